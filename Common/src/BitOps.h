@@ -0,0 +1,69 @@
+#ifndef BITOPS_H_
+#define BITOPS_H_
+
+#include "BasicTypes.h"
+#include <bit>
+
+#if defined(_MSC_VER)
+#include <cstdlib>
+#endif
+
+/*
+ * Bit manipulation shared by the VM and the compiler, so values folded at compile time match the runtime ones.
+ * The C++ library versions compile to the host's popcount, count leading zeros and rotate instructions where it has them.
+ * Bit fields are checked by the compiler: a width of 1 to 32 bits, ending at or before bit 32.
+ */
+namespace BitOps
+{
+    inline u32 Mask(const u32 width)
+    {
+        return width >= 32 ? 0xFFFFFFFF : (1u << width) - 1;
+    }
+
+    inline u32 Extract(const u32 value, const u32 position, const u32 width)
+    {
+        return (value >> position) & Mask(width);
+    }
+
+    /* Bits of the field past the width are ignored. */
+    inline u32 Insert(const u32 value, const u32 field, const u32 position, const u32 width)
+    {
+        const u32 mask = Mask(width) << position;
+        return (value & ~mask) | ((field << position) & mask);
+    }
+
+    inline u32 PopCount(const u32 value)
+    {
+        return (u32)std::popcount(value);
+    }
+
+    /* 32 for 0. */
+    inline u32 CountLeadingZeros(const u32 value)
+    {
+        return (u32)std::countl_zero(value);
+    }
+
+    /* Rotates by the count modulo 32. A negative count rotates the other way. */
+    inline u32 RotateLeft(const u32 value, const s32 count)
+    {
+        return std::rotl(value, count);
+    }
+
+    inline u32 RotateRight(const u32 value, const s32 count)
+    {
+        return std::rotr(value, count);
+    }
+
+    inline u32 ByteSwap(const u32 value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_bswap32(value);
+#elif defined(_MSC_VER)
+        return _byteswap_ulong(value);
+#else
+        return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+#endif
+    }
+}
+
+#endif // BITOPS_H_
@@ -0,0 +1,88 @@
+#ifndef FIXEDPOINT_H_
+#define FIXEDPOINT_H_
+
+#include "BasicTypes.h"
+#include <cmath>
+
+/* The 'fixed' type is Q16.16: a signed 32 bit int holding the value times 65536. */
+#define FIXED_FRACTION_BITS 16
+#define FIXED_ONE           (1 << FIXED_FRACTION_BITS)
+
+/*
+ * Fixed point arithmetic shared by the VM and the compiler, so values folded at compile time match the runtime ones bit for bit.
+ * Everything but float conversion is done in integers, for targets without an FPU.
+ * Saturating operations clamp to the largest or smallest value instead of wrapping around. Conversions to fixed always saturate.
+ * Dividing by zero gives the largest value with the sign of the dividend rather than stopping the script.
+ */
+namespace FixedPoint
+{
+    inline s32 Saturate(const s64 value)
+    {
+        return value > INT32_MAX ? INT32_MAX : (value < INT32_MIN ? INT32_MIN : (s32)value);
+    }
+
+    inline s32 FromInt(const s32 value)
+    {
+        return Saturate((s64)value * FIXED_ONE);
+    }
+
+    /* Rounds to the nearest. */
+    inline s32 FromFloat(const float value)
+    {
+        if (std::isnan(value)) {
+            return 0;
+        }
+
+        const float scaled = value * (float)FIXED_ONE;
+        if (scaled >= 2147483647.0f) {
+            return INT32_MAX;
+        }
+        if (scaled <= -2147483648.0f) {
+            return INT32_MIN;
+        }
+        return (s32)std::lround(scaled);
+    }
+
+    /* Rounds towards zero, the same as a float. */
+    inline s32 ToInt(const s32 value)
+    {
+        return value / FIXED_ONE;
+    }
+
+    inline float ToFloat(const s32 value)
+    {
+        return (float)value / (float)FIXED_ONE;
+    }
+
+    inline s32 Add(const s32 lhs, const s32 rhs, const bool saturate)
+    {
+        const s64 result = (s64)lhs + rhs;
+        return saturate ? Saturate(result) : (s32)(u32)result;
+    }
+
+    inline s32 Subtract(const s32 lhs, const s32 rhs, const bool saturate)
+    {
+        const s64 result = (s64)lhs - rhs;
+        return saturate ? Saturate(result) : (s32)(u32)result;
+    }
+
+    /* Rounds down. */
+    inline s32 Multiply(const s32 lhs, const s32 rhs, const bool saturate)
+    {
+        const s64 result = ((s64)lhs * rhs) >> FIXED_FRACTION_BITS;
+        return saturate ? Saturate(result) : (s32)(u32)result;
+    }
+
+    /* Rounds towards zero. */
+    inline s32 Divide(const s32 lhs, const s32 rhs, const bool saturate)
+    {
+        if (rhs == 0) {
+            return lhs < 0 ? INT32_MIN : INT32_MAX;
+        }
+
+        const s64 result = ((s64)lhs * FIXED_ONE) / rhs;
+        return saturate ? Saturate(result) : (s32)(u32)result;
+    }
+}
+
+#endif // FIXEDPOINT_H_
@@ -26,6 +26,9 @@ enum OpCode : opCode_t {
     OP_NIL,
     OP_FALSE,
     OP_TRUE,
+    OP_INT_8,
+    OP_INT_16,
+    OP_FLOAT_ONE,
     OP_CONSTANT,
     OP_CONSTANT_16,
     OP_CONSTANT_24,
@@ -41,6 +44,7 @@ enum OpCode : opCode_t {
 
     // Array Indexes
     OP_ARRAY,
+    OP_BOUNDS_CHECK,
     OP_GET_INDEXED_S8,
     OP_GET_INDEXED_U8,
     OP_GET_INDEXED_S16,
@@ -61,6 +65,14 @@ enum OpCode : opCode_t {
     OP_CAST_PREV_INT_TO_FLOAT,
     OP_CAST_FLOAT_TO_INT,
     OP_CAST_PREV_FLOAT_TO_INT,
+    OP_CAST_INT_TO_FIXED,
+    OP_CAST_PREV_INT_TO_FIXED,
+    OP_CAST_FIXED_TO_INT,
+    OP_CAST_PREV_FIXED_TO_INT,
+    OP_CAST_FLOAT_TO_FIXED,
+    OP_CAST_PREV_FLOAT_TO_FIXED,
+    OP_CAST_FIXED_TO_FLOAT,
+    OP_CAST_PREV_FIXED_TO_FLOAT,
 
     // Math
     OP_MODULUS, // Always int
@@ -78,6 +90,12 @@ enum OpCode : opCode_t {
     OP_DIV_S,
     OP_DIV_U,
     OP_DIV_F,
+    OP_ADD_SAT_FIXED, // Fixed adds and subtracts that wrap are the same as ints
+    OP_SUB_SAT_FIXED,
+    OP_MULT_FIXED,
+    OP_MULT_SAT_FIXED,
+    OP_DIV_FIXED,
+    OP_DIV_SAT_FIXED,
 
     // Inc / Dec
     OP_PREFIX_DECREASE,
@@ -117,6 +135,41 @@ enum OpCode : opCode_t {
     OP_BIT_SHIFT_L,
     OP_BIT_SHIFT_R,
 
+    // Vectors. Operands are pointers to the first component, the count of components follows the op.
+    OP_VEC_COPY,
+    OP_VEC_ADD,
+    OP_VEC_SUB,
+    OP_VEC_MULT,
+    OP_VEC_SCALE,
+    OP_VEC_DOT,
+    OP_VEC_LENGTH_SQ,
+
+    // Math Intrinsics
+    OP_ABS_I,
+    OP_ABS_F,
+    OP_MIN_S,
+    OP_MIN_U,
+    OP_MIN_F,
+    OP_MAX_S,
+    OP_MAX_U,
+    OP_MAX_F,
+    OP_CLAMP_S, // Value, min, max
+    OP_CLAMP_U,
+    OP_CLAMP_F,
+    OP_SQRT, // Always float
+    OP_SIN,
+    OP_COS,
+    OP_FLOOR,
+
+    // Bit Intrinsics
+    OP_BIT_EXTRACT, // [position][width]
+    OP_BIT_INSERT,  // [position][width]
+    OP_POPCOUNT,
+    OP_CLZ,
+    OP_ROTATE_L,
+    OP_ROTATE_R,
+    OP_BYTE_SWAP,
+
     // Functions
     OP_JUMP,
     OP_JUMP_IF_FALSE,
@@ -124,13 +177,21 @@ enum OpCode : opCode_t {
     OP_JUMP_IF_EQUAL,
     OP_LOOP,
     OP_SWITCH,
+    OP_SWITCH_SPARSE,
+    OP_SWITCH_HASH,
     OP_BREAK,
     OP_CONTINUE,
     OP_FRAME,
     OP_CALL,
     OP_CALL_NATIVE,
+    OP_TAIL_CALL,
     OP_RETURN,
 
+    // Channels
+    OP_CHANNEL_SEND,
+    OP_CHANNEL_RECEIVE,
+    OP_CHANNEL_COUNT,
+
     // Reserved
     OP_FUNCTION_START = 254,
     OP_END            = 255
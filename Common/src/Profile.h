@@ -0,0 +1,31 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "BasicTypes.h"
+
+#define PROFILE_MAGIC 0x464F5250 // "PROF"
+
+/* Edges from the host, eg. exported functions and periodic tasks, are recorded from here. */
+#define PROFILE_FROM_HOST 0xFFFFFFFF
+
+/*
+ * Execution profile written by the VM and read back by the compiler to guide its optimisations.
+ * The file is a header followed by its entries.
+ */
+struct ProfileHeader {
+    u32 Magic;
+    u32 CodeChecksum; // Checksum of the code section the profile was taken from
+    u32 EntryCount;
+};
+
+/*
+ * Times control went from one instruction to another. Offsets are from the start of the code.
+ * Branches record where they went, including falling through. Calls record the first instruction of the function.
+ */
+struct ProfileEntry {
+    u32 From;
+    u32 To;
+    u32 Count; // 0 for an unused slot
+};
+
+#endif // PROFILE_H
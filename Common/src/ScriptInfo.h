@@ -8,15 +8,28 @@
 #include "Instructions.h"
 #include "Value.h"
 
+// Opcodes and data types are numbered per version. Images from another version are rejected.
 #define LANG_VERSION_MAJOR 0
-#define LANG_VERSION_MINOR 1
+#define LANG_VERSION_MINOR 2
 
 enum CompileOptions : u32 {
     coEmbeddedFileName = 0x01,
     coShortAddressing  = 0x02,
     coDecompileResult  = 0x04,
+    coSymbolTable      = 0x08,
+    coNoOptimise       = 0x10,
+    coUnrollLoops      = 0x20,
+    coOptimiseSize     = 0x40,
+    coStats            = 0x80,
+    coBoundsCheck      = 0x100,
 };
 
+/* Flags written to the binary header for the VM. The rest only affect the compiler. */
+#define HEADER_OPTIONS (coEmbeddedFileName | coShortAddressing | coSymbolTable)
+
+/* Flags set by the optimisation level. -O1 is none of them. */
+#define OPTIMISE_LEVEL (coNoOptimise | coUnrollLoops | coOptimiseSize)
+
 struct CodeData {
     opCode_t *Data;
     u32 Length;
@@ -27,13 +40,54 @@ struct ValueData {
     u32 Count;
 };
 
+struct TaskInfo {
+    u32 Function; // Byte offset of the function in the code
+    u32 Period;   // Milliseconds
+};
+
+struct TaskData {
+    const TaskInfo *Entries;
+    u32 Count;
+};
+
+struct ExportInfo {
+    u32 Function; // Byte offset of the function in the code
+    u32 Name;     // String index
+    u8 ReturnType;
+    u8 ArgCount;
+    u16 Reserved;
+};
+
+struct ExportData {
+    const ExportInfo *Entries;
+    u32 Count;
+};
+
+struct SymbolInfo {
+    u32 Name;  // String index
+    u16 Slot;  // Global address
+    u16 Size;  // Stack values
+    u8 Type;   // DataType
+    u8 Flags;  // Array = 0x01, Const = 0x20
+    u16 Reserved;
+};
+
+struct SymbolData {
+    const SymbolInfo *Entries;
+    u32 Count;
+};
+
 struct ScriptInfo {
     CodeData Code;
     ValueData Constants;
     ValueData Strings;
     ValueData Globals;
     ValueData Stack;
+    TaskData Tasks;
+    ExportData Exports;
+    SymbolData Symbols;
     const char *FileName;
+    u32 CheckSum;
 };
 
 struct ScriptBinaryHeader {
@@ -46,6 +100,9 @@ struct ScriptBinaryHeader {
     u32 CodePos;      // Bytes
     u32 ConstantsPos; // Bytes
     u32 StringsPos;   // Bytes
+    u32 TasksPos;     // Bytes
+    u32 ExportsPos;   // Bytes
+    u32 SymbolsPos;   // Bytes
     u32 GlobalsSize;  // Bytes
     u32 TotalSize;    // Bytes
     u32 CheckSum;     // XOR byte code
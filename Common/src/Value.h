@@ -51,8 +51,14 @@ enum DataType : u8 {
     dtUint16,
     dtInt32,
     dtUint32,
+    dtFixed, // Q16.16, see FixedPoint.h
     dtFloat, // Float
 
+    // Vectors, stored as consecutive floats
+    dtVec2,
+    dtVec3,
+    dtVec4,
+
     // Other
     dtPointer,
     dtFunction,
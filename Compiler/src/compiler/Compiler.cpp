@@ -4,22 +4,41 @@
 
 #include "Compiler.h"
 
+#include "BoundsCheck.h"
 #include "Checksum.h"
+#include "CodeLayout.h"
 #include "Console.h"
+#include "ConstEvaluator.h"
+#include "DeadCode.h"
+#include "Immediates.h"
+#include "Inliner.h"
 #include "Disassembler.h"
-#include "JumpTable.hpp"
+#include "LoopInvariant.h"
+#include "LoopUnroller.h"
 #include "MathUtils.h"
 #include "Options.h"
+#include "PassManager.h"
+#include "Peephole.h"
+#include "ProfileGuide.h"
 #include "ScriptInfo.h"
+#include "TailCall.h"
+#include <bit>
 #include <chrono>
+#include <cmath>
 #include <fstream>
+#include <iomanip>
 #include <map>
 
 #define CURRENT_TOKEN_POS m_CurrentPos
 #define CURRENT_CODE_POS  (int)CurrentFunction()->Code.size()
 #define CURRENT_SCOPE     m_ScopeDepth
 
-Compiler::Compiler(ErrorHandler *errorHandler, NativeFunctionParser *nativeFuncs, const std::string &script, const u8 flags, const std::string &fileName)
+/* Passes each loop is counted as making when estimating how many instructions a function runs. */
+#ifndef STATS_LOOP_PASSES
+#define STATS_LOOP_PASSES 8
+#endif // STATS_LOOP_PASSES
+
+Compiler::Compiler(ErrorHandler *errorHandler, NativeFunctionParser *nativeFuncs, const std::string &script, const u32 flags, const std::string &fileName)
     : CompilerBase(errorHandler, script),
       m_PreProcessor(errorHandler)
 {
@@ -85,7 +104,7 @@ ScriptFunction *Compiler::CurrentFunction()
 ScriptFunction *Compiler::FindFunctionById(int chunkId)
 {
     for (auto chunk : m_Functions) {
-        if (chunk->Id == chunkId) {
+        if (chunk != nullptr && chunk->Id == chunkId) {
             return chunk;
         }
     }
@@ -122,6 +141,12 @@ ScriptFunction *Compiler::FindScriptFunction(const std::string &name)
     return nullptr;
 }
 
+/* Checks if the function being compiled is constexpr, so can only use what is known at compile time. */
+bool Compiler::InConstExpr()
+{
+    return CurrentFunction()->Attributes & atConstExpr;
+}
+
 void Compiler::ConditionalBegin()
 {
     CurrentFunction()->ConditionalDepth++;
@@ -190,6 +215,15 @@ StatusCode Compiler::Compile()
         return SetResult(errSyntaxError);
     }
 
+    // Optimise the finished bytecode. Only valid code gets this far.
+    if (!(m_Flags & coNoOptimise)) {
+        OptimiseFunctions();
+    }
+
+    if (m_Flags & coStats) {
+        PrintStats();
+    }
+
     return SetResult(stsCompileDone, "Compile Done");
 }
 
@@ -207,6 +241,11 @@ bool Compiler::CheckNativeFunction(const Token &token)
     return false;
 }
 
+bool Compiler::CheckChannel(const Token &token)
+{
+    return ResolveChannel(token.Value) != nullptr;
+}
+
 bool Compiler::CheckFunction(const Token &token)
 {
     std::string name = token.Value;
@@ -245,6 +284,11 @@ StatusCode Compiler::SetResult(StatusCode result, std::string message)
     return m_Result;
 }
 
+void Compiler::UseProfile(const std::vector<u8> &profile)
+{
+    m_Profile = profile;
+}
+
 StatusCode Compiler::Result()
 {
     return m_Result;
@@ -442,6 +486,119 @@ void Compiler::EmitConstant(const ConstantInfo &constant)
     }
 }
 
+/* Emits a constant that the surrounding expression may fold at compile time. */
+void Compiler::EmitFoldableConstant(const ConstantInfo &constant)
+{
+    const size_t poolSize = m_ConstValues.size();
+
+    ConstExpression emitted;
+    emitted.FunctionId = CurrentFunction()->Id;
+    emitted.Start      = CURRENT_CODE_POS;
+    EmitConstant(constant);
+    emitted.End      = CURRENT_CODE_POS;
+    emitted.NewEntry = m_ConstValues.size() > poolSize;
+    emitted.Index    = (u32)poolSize;
+    emitted.Constant = constant;
+
+    m_LastConstant = emitted;
+}
+
+/* Checks if the value on top of the stack is a constant emitted by EmitFoldableConstant(). */
+bool Compiler::TopConstant(ConstExpression &outConstant)
+{
+    if (m_LastConstant.FunctionId != CurrentFunction()->Id || m_LastConstant.End != CURRENT_CODE_POS) {
+        return false;
+    }
+
+    outConstant = m_LastConstant;
+    return true;
+}
+
+/* Removes a folded constant's instruction, and its pool entry if nothing else uses it. */
+void Compiler::DiscardConstant(const ConstExpression &constant)
+{
+    CurrentFunction()->Code.resize(constant.Start);
+
+    if (constant.NewEntry && m_ConstValues.size() == constant.Index + 1) {
+        m_ConstValues.pop_back();
+    }
+
+    m_LastConstant = ConstExpression();
+}
+
+/* Checks if the value on top of the stack was just read from a byte or ushort array, so is zero extended and never negative. */
+bool Compiler::TopUnsignedLoad()
+{
+    return m_UnsignedLoadFunction == CurrentFunction()->Id && m_UnsignedLoadEnd == CURRENT_CODE_POS;
+}
+
+/*
+ * Replaces a multiply, divide or modulus by a constant with a cheaper instruction that gives the same result for the left hand side.
+ * Integer division and modulus by a power of two only become a shift and a mask when the left hand side can't be negative.
+ * Scalar variables carry no sign or width at runtime, a byte can hold -1, and the fix up that rounds a shifted negative value
+ * towards zero costs more than the divide.
+ */
+bool Compiler::ReduceStrength(TokenType operatorType, DataType binaryType, DataType lhsType, DataType rhsType, const ConstExpression &rhsConstant,
+                              bool lhsUnsigned)
+{
+    const bool multiply = operatorType == tknStar || operatorType == tknTimesEquals;
+    const bool divide   = operatorType == tknSlash || operatorType == tknDivideEquals;
+    const bool modulus  = operatorType == tknPercent;
+
+    ConstantInfo rhs{};
+    if ((!multiply && !divide && !modulus) || binaryType == dtFixed ||
+        !Folding::Cast(TypeInfo::CheckCompatibility(binaryType, rhsType), rhsConstant.Constant, rhs)) {
+        return false;
+    }
+
+    const bool isFloat    = binaryType == dtFloat;
+    const float value     = isFloat ? rhs.ConstValue.Float : (float)rhs.ConstValue.Int;
+    const bool powerOfTwo = !isFloat && rhs.ConstValue.Int > 0 && std::has_single_bit((u32)rhs.ConstValue.Int);
+
+    ConstantInfo operand{};
+    opCode_t op = OP_NOP;
+
+    if (modulus) {
+        // x % 8 -> x & 7
+        if (!lhsUnsigned || !powerOfTwo) {
+            return false;
+        }
+        operand = { dtInt32, INT32_VAL(rhs.ConstValue.Int - 1) };
+        op      = OP_BIT_AND;
+    } else if (value == 1.0f) {
+        // x * 1, x / 1 -> x
+    } else if (value == -1.0f) {
+        op = isFloat ? OP_NEGATE_F : OP_NEGATE_I;
+    } else if (powerOfTwo && (multiply || lhsUnsigned)) {
+        operand = { dtInt32, INT32_VAL(std::countr_zero((u32)rhs.ConstValue.Int)) };
+        op      = multiply ? OP_BIT_SHIFT_L : OP_BIT_SHIFT_R;
+    } else if (isFloat && divide) {
+        // The reciprocal of a power of two is exact, so multiplying by it rounds the same as dividing.
+        int exponent;
+        const float reciprocal = 1.0f / value;
+        if (std::fabs(std::frexp(value, &exponent)) != 0.5f || !std::isnormal(value) || !std::isnormal(reciprocal)) {
+            return false;
+        }
+        operand = { dtFloat, FLOAT_VAL(reciprocal) };
+        op      = OP_MULT_F;
+    } else {
+        return false;
+    }
+
+    // The left hand side is back on top of the stack.
+    DiscardConstant(rhsConstant);
+    EmitCast(TypeInfo::CheckCompatibility(binaryType, lhsType));
+
+    if (operand.Type != dtNone) {
+        EmitConstant(operand);
+    }
+    if (op != OP_NOP) {
+        EmitByte(op);
+    }
+
+    return true;
+}
+
 u32 Compiler::AddString(const std::string &str)
 {
     // Check if it already exists
@@ -499,6 +656,10 @@ void Compiler::Declaration()
     DataType varType;
     u32 varFlags;
 
+    if (Check(tknLeftSquareBracket)) {
+        AttributeList();
+    }
+
     if (Match(tknClass)) {
         ClassDeclaration();
     } else if (MatchTypeDeclaration(varType, varFlags)) {
@@ -511,11 +672,89 @@ void Compiler::Declaration()
         Statement();
     }
 
+    // Any attributes not taken by the declaration were used in the wrong place.
+    if (m_Attributes.Flags != atNone) {
+        AddError("Attributes can only be applied to function declarations and loops.", m_Attributes.Token);
+        m_Attributes = {};
+    }
+
     if (m_PanicMode || m_Status == errPanicSync) {
         Synchronize();
     }
 }
 
+/*
+ * Parses one or more attribute lists before a declaration.
+ * Eg: [periodic 10] or [a, b] or [a][b]
+ */
+void Compiler::AttributeList()
+{
+    m_Attributes       = {};
+    m_Attributes.Token = CurrentToken();
+
+    while (Match(tknLeftSquareBracket)) {
+        do {
+            Attribute();
+        } while (Match(tknComma));
+
+        ConsumeToken(tknRightSquareBracket, -2, "Expected ']' after attributes.");
+    }
+}
+
+void Compiler::Attribute()
+{
+    Token token = ConsumeToken(tknIdentifier, -2, "Expected attribute name.");
+
+    if (token.Value == "periodic") {
+        if (!Check(tknIntegerLiteral)) {
+            AddError("Expected period in milliseconds after 'periodic'.", token);
+            return;
+        }
+        Token periodToken = ConsumeToken(tknIntegerLiteral);
+        int period        = 0;
+        if (!ScriptUtils::StringToInt(periodToken.Value, period) || period <= 0) {
+            AddError("Invalid period '" + periodToken.Value + "'.", periodToken);
+            return;
+        }
+        m_Attributes.Flags |= atPeriodic;
+        m_Attributes.Period = (u32)period;
+    } else if (token.Value == "export") {
+        m_Attributes.Flags |= atExport;
+    } else if (token.Value == "inline") {
+        m_Attributes.Flags |= atInline;
+    } else if (token.Value == "constexpr") {
+        m_Attributes.Flags |= atConstExpr;
+    } else if (token.Value == "saturate") {
+        m_Attributes.Flags |= atSaturate;
+    } else if (token.Value == "unroll") {
+        // Unrolled fully unless a count is given.
+        int times = 0;
+        if (Check(tknIntegerLiteral)) {
+            Token timesToken = ConsumeToken(tknIntegerLiteral);
+            if (!ScriptUtils::StringToInt(timesToken.Value, times) || times < 2) {
+                AddError("Invalid unroll count '" + timesToken.Value + "'. Must be at least 2.", timesToken);
+                return;
+            }
+        }
+        m_Attributes.Flags |= atUnroll;
+        m_Attributes.Unroll = (u32)times;
+    } else if (token.Value == "nounroll") {
+        m_Attributes.Flags |= atNoUnroll;
+    } else {
+        AddError("Unknown attribute '" + token.Value + "'.", token);
+    }
+}
+
+/*
+ * Gets the attributes for the current declaration and clears them so they aren't applied again.
+ */
+AttributeInfo Compiler::TakeAttributes()
+{
+    AttributeInfo attributes = m_Attributes;
+    m_Attributes             = {};
+    return attributes;
+}
+
 void Compiler::TypeDeclaration(DataType dataType, u32 flags)
 {
     if (dataType == dtClass) {
@@ -526,6 +765,8 @@ void Compiler::TypeDeclaration(DataType dataType, u32 flags)
         } else {
             FunctionDeclaration(dataType);
         }
+    } else if (TypeInfo::IsVector(dataType)) {
+        VectorDeclaration(dataType, flags);
     } else if (CheckAhead(tknLeftSquareBracket)) {
         ArrayDeclaration(dataType, flags);
     } else {
@@ -606,7 +847,8 @@ DataType Compiler::TypeSetCurrent(const DataType type, bool force)
     if (m_CurrentType->IgnoreExpectingOnSet) {
         m_CurrentType->Type = type;
     } else {
-        m_CurrentType->Type = m_CurrentType->Expecting() == dtFloat ? dtFloat : type;
+        const DataType expecting = m_CurrentType->Expecting();
+        m_CurrentType->Type      = (expecting == dtFloat || expecting == dtFixed) ? expecting : type;
     }
     return m_CurrentType->Type;
 }
@@ -652,6 +894,40 @@ DataType Compiler::Expression()
     return TypeEnd();
 }
 
+/* Compiles an expression that must give the type and casts it if it doesn't. */
+void Compiler::TypedExpression(DataType type)
+{
+    TypeInfo expectedType(type);
+    TypeBegin(&expectedType);
+
+    DataType exprType = Expression();
+    auto compat       = expectedType.CheckCompatibleWith(exprType);
+    if (compat == tcIncompatible) {
+        AddError("Value of type '" + DataTypeToString(type) + "' expected.", LookBack());
+    }
+    EmitCast(compat);
+
+    TypeEnd();
+}
+
+bool Compiler::ParseIntegerLiteral(const std::string &text, int &outValue)
+{
+    std::string str;
+    int base;
+    if (text.starts_with("0b")) { // Binary
+        str  = text.substr(2);
+        base = 2;
+    } else if (text.starts_with("0o")) { // Octal
+        str  = text.substr(2);
+        base = 8;
+    } else { // Decimal or Hex
+        str  = text;
+        base = 0; // Determined from string
+    }
+
+    return ScriptUtils::StringToInt(str, outValue, base);
+}
+
 ConstantInfo Compiler::ParseNumericLiteral()
 {
     // Get the token that got us here
@@ -691,20 +967,7 @@ ConstantInfo Compiler::ParseNumericLiteral()
     else if (token.TokenType == tknIntegerLiteral) {
         constant.Type = dtInt32;
         int iVal;
-        std::string str;
-        int base;
-        if (token.Value.starts_with("0b")) { // Binary
-            str  = token.Value.substr(2);
-            base = 2;
-        } else if (token.Value.starts_with("0o")) { // Octal
-            str  = token.Value.substr(2);
-            base = 8;
-        } else { // Decimal or Hex
-            str  = token.Value;
-            base = 0; // Determined from string
-        }
-
-        if (ScriptUtils::StringToInt(str, iVal, base)) {
+        if (ParseIntegerLiteral(token.Value, iVal)) {
             constant.ConstValue = INT32_VAL(iVal);
             return constant;
         } else {
@@ -728,7 +991,7 @@ void Compiler::NumericLiteral()
 {
     const ConstantInfo literal = ParseNumericLiteral();
 
-    EmitConstant(literal);
+    EmitFoldableConstant(literal);
 
     TypeSetCurrent(literal.Type);
 
@@ -742,6 +1005,11 @@ void Compiler::NumericLiteral()
         std::string msg = "Floating point literal will be implicitly cast to surrounding integer type.\n";
         msg += "Remove decimal place(s) to specify a integer literal.";
         AddWarning(msg, LookBack());
+    } else if (compat == tcCastSignedToFixed || compat == tcCastFloatToFixed) {
+        const float value = literal.Type == dtFloat ? literal.ConstValue.Float : (float)literal.ConstValue.Int;
+        if (value >= 32768.0f || value < -32768.0f) {
+            AddWarning("Literal is out of the range of 'fixed' and will be saturated.", LookBack());
+        }
     }
 
     EmitCast(compat);
@@ -760,8 +1028,14 @@ void Compiler::Variable(bool canAssign)
 
     if (CheckNativeFunction(token)) {
         NativeFunction(token);
+    } else if (CheckChannel(token)) {
+        Channel(token);
     } else if (CheckFunction(token)) {
         NamedFunction(token);
+    } else if (CheckVectorFunction(token)) {
+        VectorFunction(token);
+    } else if (CheckIntrinsic(token)) {
+        Intrinsic(token);
     } else {
         NamedVariable(token, canAssign);
     }
@@ -800,6 +1074,16 @@ void Compiler::VariablePrefix()
         return;
     }
 
+    if (variable->IsFolded()) {
+        AddError("Cannot write to const variable after initialisation.", LookBack());
+        return;
+    }
+
+    if (TypeInfo::IsVector(variable->Type())) {
+        AddError("Vectors can't be incremented or decremented.", LookBack());
+        return;
+    }
+
     Token opToken = LookBack();
 
     EmitPointer(variable);
@@ -837,6 +1121,16 @@ void Compiler::VariablePostfix(bool canAssign)
         return;
     }
 
+    if (variable->IsFolded()) {
+        AddError("Cannot write to const variable after initialisation.", LookBack(2));
+        return;
+    }
+
+    if (TypeInfo::IsVector(variable->Type())) {
+        AddError("Vectors can't be incremented or decremented.", LookBack(2));
+        return;
+    }
+
     Token opToken = LookBack();
 
     EmitPointer(variable);
@@ -864,6 +1158,16 @@ void Compiler::Unary()
     // Compile the operand
     ParsePrecedence(precUnary);
 
+    ConstExpression operand;
+    ConstantInfo folded{};
+    if (TopConstant(operand) && Folding::Unary(operatorType, unaryType.Type, operand.Constant, folded)) {
+        DiscardConstant(operand);
+        EmitFoldableConstant(folded);
+        EmitCast(TypeInfo::CheckCompatibility(unaryType.Expecting(), unaryType.Type));
+        TypeEnd();
+        return;
+    }
+
     switch (operatorType) {
         case tknMinus:
             EmitByte(unaryType.Type == dtFloat ? OP_NEGATE_F : OP_NEGATE_I);
@@ -891,22 +1195,33 @@ void Compiler::Binary()
     TypeInfo binType;
     TypeBegin(&binType);
 
+    ConstExpression lhsConstant;
+    const bool lhsIsConstant = TopConstant(lhsConstant);
+    const bool lhsUnsigned   = TopUnsignedLoad();
+
     TokenType operatorType = LookBack().TokenType;
     ParseRule rule         = Rules::Get(operatorType);
     ParsePrecedence((Precedence)(rule.Prec + 1));
 
     DataType rhsType = CurrentType();
 
-    DataType binaryType = (lhsType == dtFloat || rhsType == dtFloat) ? dtFloat : dtInt32;
+    DataType binaryType = dtInt32;
+    if (lhsType == dtFloat || rhsType == dtFloat) {
+        binaryType = dtFloat;
+    } else if (lhsType == dtFixed || rhsType == dtFixed) {
+        binaryType = dtFixed;
+    }
 
     // Override binary type to int for certain ops
     if (operatorType == tknBitwiseAnd || operatorType == tknBitwiseAndEquals || operatorType == tknBitwiseOr || operatorType == tknBitwiseOrEquals ||
         operatorType == tknBitwiseXor || operatorType == tknBitwiseXorEquals || operatorType == tknShiftLeft || operatorType == tknShiftRight) {
         if (binaryType == dtFloat) {
             AddError("Cannot use floating point numbers in binary operations.", LookBack(lhsType == dtFloat ? 3 : 1));
+        } else if (binaryType == dtFixed) {
+            AddError("Cannot use fixed point numbers in binary operations.", LookBack(lhsType == dtFixed ? 3 : 1));
         }
         binaryType = dtInt32;
-    } else if (operatorType == tknPercent) {
+    } else if (operatorType == tknPercent && binaryType != dtFixed) {
         if (binaryType == dtFloat) {
             AddWarning("'%' operator with floating point values will be implicitly cast to integer type. "
                        "Data may be lost.",
@@ -915,6 +1230,34 @@ void Compiler::Binary()
         binaryType = dtInt32;
     }
 
+    // Comparisons leave a bool whatever they compare.
+    const bool comparison     = operatorType == tknEquals || operatorType == tknNotEqual || operatorType == tknLessThan ||
+                                operatorType == tknLessEqual || operatorType == tknGreaterThan || operatorType == tknGreaterEqual;
+    const DataType resultType = comparison ? dtBool : binaryType;
+
+    // Both operands are constants, evaluate it now.
+    ConstExpression rhsConstant;
+    if (lhsIsConstant && TopConstant(rhsConstant) && rhsConstant.Start == lhsConstant.End) {
+        ConstantInfo lhs{}, rhs{}, folded{};
+        if (Folding::Cast(TypeInfo::CheckCompatibility(binaryType, lhsType), lhsConstant.Constant, lhs) &&
+            Folding::Cast(TypeInfo::CheckCompatibility(binaryType, rhsType), rhsConstant.Constant, rhs) &&
+            Folding::Binary(operatorType, binaryType, lhs, rhs, folded)) {
+            DiscardConstant(rhsConstant);
+            DiscardConstant(lhsConstant);
+            EmitFoldableConstant(folded);
+            TypeEnd();
+            EmitCast(TypeCheck(resultType));
+            return;
+        }
+    }
+
+    // Only the right hand side is constant. Eg: x * 8 -> x << 3
+    if (!lhsIsConstant && TopConstant(rhsConstant) && ReduceStrength(operatorType, binaryType, lhsType, rhsType, rhsConstant, lhsUnsigned)) {
+        TypeEnd();
+        EmitCast(TypeCheck(binaryType));
+        return;
+    }
+
     EmitCast(TypeInfo::CheckCompatibility(binaryType, lhsType), true);
     EmitCast(TypeInfo::CheckCompatibility(binaryType, rhsType));
 
@@ -989,13 +1332,21 @@ void Compiler::Binary()
     TypeEnd();
 
     // If the resulting type does not match the required type, cast it.
-    EmitCast(TypeCheck(binaryType));
+    EmitCast(TypeCheck(resultType));
+}
+
+/* Fixed point arithmetic in functions marked [saturate] clamps instead of wrapping around. */
+bool Compiler::Saturating()
+{
+    return CurrentFunction()->Attributes & atSaturate;
 }
 
 void Compiler::EmitAdd(DataType type)
 {
     if (type == dtFloat) {
         EmitByte(OP_ADD_F);
+    } else if (type == dtFixed && Saturating()) {
+        EmitByte(OP_ADD_SAT_FIXED);
     } else if (type == dtUint32) {
         EmitByte(OP_ADD_U);
     } else {
@@ -1007,6 +1358,8 @@ void Compiler::EmitSubtract(DataType type)
 {
     if (type == dtFloat) {
         EmitByte(OP_SUB_F);
+    } else if (type == dtFixed && Saturating()) {
+        EmitByte(OP_SUB_SAT_FIXED);
     } else if (type == dtUint32) {
         EmitByte(OP_SUB_U);
     } else {
@@ -1018,6 +1371,8 @@ void Compiler::EmitMultiply(DataType type)
 {
     if (type == dtFloat) {
         EmitByte(OP_MULT_F);
+    } else if (type == dtFixed) {
+        EmitByte(Saturating() ? OP_MULT_SAT_FIXED : OP_MULT_FIXED);
     } else if (type == dtUint32) {
         EmitByte(OP_MULT_U);
     } else {
@@ -1029,6 +1384,8 @@ void Compiler::EmitDivide(DataType type)
 {
     if (type == dtFloat) {
         EmitByte(OP_DIV_F);
+    } else if (type == dtFixed) {
+        EmitByte(Saturating() ? OP_DIV_SAT_FIXED : OP_DIV_FIXED);
     } else if (type == dtUint32) {
         EmitByte(OP_DIV_U);
     } else {
@@ -1294,26 +1651,34 @@ void Compiler::LoopEnd()
         EmitByte(OP_POP);
     }
 
-    // Find any break placeholder instructions (which will be OP_BREAK in the
-    // bytecode) and replace them with real jumps.
-    int i = m_CurrentLoop->Body;
-    while (i < CURRENT_CODE_POS) {
-        if (CurrentFunction()->Code[i] == OP_BREAK) {
-            // m_CodeBytes[i] = OP_JUMP;
-            PatchJump(i + 1);
-            i += 3;
-        } else {
-            // Skip this instruction and its arguments.
-            // i += 1 + getByteCountForArguments(compiler->fn->code.data, compiler->fn->constants.data, i);
-            ++i;
-        }
+    // Point the break placeholder instructions at the end of the loop.
+    for (const int jump : m_CurrentLoop->Breaks) {
+        PatchJump(jump);
     }
 
     m_CurrentLoop = m_CurrentLoop->Enclosing;
 }
 
+/* Starts recording the extent of a loop statement, along with the attributes written before it. */
+LoopRange Compiler::LoopStatement()
+{
+    AttributeInfo attributes = TakeAttributes();
+    if (attributes.Flags & ~LOOP_ATTRIBUTES) {
+        AddError("Only 'unroll' and 'nounroll' can be applied to loops.", attributes.Token);
+    }
+
+    LoopRange range;
+    range.Start      = CURRENT_CODE_POS;
+    range.Attributes = attributes.Flags & LOOP_ATTRIBUTES;
+    range.Unroll     = attributes.Unroll;
+    range.Token      = attributes.Flags != atNone ? attributes.Token : LookBack();
+    return range;
+}
+
 void Compiler::WhileStatement()
 {
+    LoopRange range = LoopStatement();
+
     LoopInfo loop;
     LoopBegin(&loop);
 
@@ -1328,10 +1693,15 @@ void Compiler::WhileStatement()
     LoopBody();
 
     LoopEnd();
+
+    range.End = CURRENT_CODE_POS;
+    CurrentFunction()->Loops.push_back(range);
 }
 
 void Compiler::ForStatement()
 {
+    LoopRange range = LoopStatement();
+
     ScopeBegin();
     ConsumeToken(tknLeftParen, -1, "Expected '(' after 'for' statement.");
 
@@ -1380,6 +1750,9 @@ void Compiler::ForStatement()
     LoopEnd();
 
     ScopeEnd();
+
+    range.End = CURRENT_CODE_POS;
+    CurrentFunction()->Loops.push_back(range);
 }
 
 // Marks the beginning of a switch
@@ -1401,19 +1774,9 @@ void Compiler::SwitchBody()
 // we know where the end of the loop is.
 void Compiler::SwitchEnd()
 {
-    // Find any break placeholder instructions (which will be OP_BREAK in the
-    // bytecode) and replace them with real jumps.
-    int i = m_CurrentSwitch->Body;
-    while (i < CURRENT_CODE_POS) {
-        if (CurrentFunction()->Code[i] == OP_BREAK) {
-            // m_CodeBytes[i] = OP_JUMP;
-            PatchJump(i + 1);
-            i += 3;
-        } else {
-            // Skip this instruction and its arguments.
-            // i += 1 + getByteCountForArguments(compiler->fn->code.data, compiler->fn->constants.data, i);
-            ++i;
-        }
+    // Point the break placeholder instructions at the end of the switch.
+    for (const int jump : m_CurrentSwitch->Breaks) {
+        PatchJump(jump);
     }
 
     m_CurrentSwitch = m_CurrentSwitch->Enclosing;
@@ -1428,13 +1791,11 @@ void Compiler::SwitchStatement()
     // Input expression
     ConsumeToken(tknLeftParen, -1, "Expected '(' after 'switch' statement.");
 
-    Token switchToken = CurrentToken();
-
     // Parse the input expression and remember its type.
     DataType switchType = Expression();
 
-    if (switchType == dtFloat) {
-        AddError("Switch statement requires expression of integer type ('float' invalid).", LookBack());
+    if (switchType == dtFloat || switchType == dtFixed) {
+        AddError("Switch statement requires expression of integer type ('" + DataTypeToString(switchType) + "' invalid).", LookBack());
     }
 
     ConsumeToken(tknRightParen, -1, "Expected ')' after 'switch' expression.");
@@ -1442,39 +1803,61 @@ void Compiler::SwitchStatement()
     // Body
     ConsumeToken(tknLeftCurly, -1, "Expected '{' to start 'switch' body.");
 
+    // The switch instruction comes before the body, so look ahead at the case labels to decide how to reach them.
+    SwitchTable labels;
+    ScanCaseLabels(labels);
+    const SwitchLowering lowering = labels.Choose();
+
+    if (lowering == slIfElse) {
+        SwitchAsIfElse(switchType);
+        return;
+    }
+
     /* The input value will now be on the top of the stack.
      * Stack = [switchValue]
-     * OpCode = [OP_SWITCH][JumpTableOffset][MinValue][MaxValue]
+     * Dense  = [OP_SWITCH][JumpTableOffset][MinValue][MaxValue]
+     * Sparse = [OP_SWITCH_SPARSE][JumpTableOffset][CaseCount]
+     * Hashed = [OP_SWITCH_HASH][JumpTableOffset][Multiplier][Bits]
+     * The jump table offset is from the end of the offset itself.
      */
-
-    int switchJumpPos = EmitJump(OP_SWITCH);
-    int minValuePos   = EmitInt(0);
-    int maxValuePos   = EmitInt(0);
+    int switchJumpPos;
+    int minValuePos  = NOT_SET;
+    int maxValuePos  = NOT_SET;
+    int caseCountPos = NOT_SET;
+    u32 multiplier   = 0;
+    u8 bits          = 0;
+
+    if (lowering == slSparse) {
+        switchJumpPos = EmitJump(OP_SWITCH_SPARSE);
+        caseCountPos  = EmitShort(0);
+    } else if (lowering == slHashed) {
+        labels.FindHash(multiplier, bits);
+        switchJumpPos = EmitJump(OP_SWITCH_HASH);
+        EmitInt((int)multiplier);
+        EmitByte(bits);
+    } else {
+        switchJumpPos = EmitJump(OP_SWITCH);
+        minValuePos   = EmitInt(0);
+        maxValuePos   = EmitInt(0);
+    }
 
     SwitchBody();
 
     // Parse the case labels. There can be more than one before a case body.
-    JumpTable<int, int> jumpTable;
+    SwitchTable cases;
 
     while (Match(tknCase)) {
         // Parse fall through case labels
         do {
-            if (!Match(tknIntegerLiteral) && !Match(tknFloatLiteral)) {
-                AddError("Expected numerical literal in case label.", LookBack());
-            }
-
-            const Token &caseToken = LookBack();
-            ConstantInfo value     = ParseNumericLiteral();
-
-            // Check the type of the case label. Input values must be integers
-            TypeCompatibility caseCompat = TypeInfo::CheckCompatibility(switchType, value.Type);
-            if (caseCompat != tcMatch) {
-                AddError("Case label type not compatible.", LookBack());
-            }
+            const Token caseToken = CurrentToken();
+            s32 low;
+            s32 high;
+            const bool valid = CaseLabel(switchType, low, high);
 
             // Make sure it doesn't already exist
-            if (!jumpTable.Add(value.ConstValue.Int, CURRENT_CODE_POS)) {
-                AddError("case label '" + caseToken.Value + "' already exists.", caseToken);
+            if (valid && !cases.Add(low, high, CURRENT_CODE_POS)) {
+                const std::string label = (low == high) ? std::to_string(low) : std::to_string(low) + " ... " + std::to_string(high);
+                AddError("case label '" + label + "' already exists.", caseToken);
             }
 
             ConsumeToken(tknColon, -1, "Expected ':' after case label.");
@@ -1498,138 +1881,290 @@ void Compiler::SwitchStatement()
 
     ConsumeToken(tknRightCurly, -1, "Expected '}' to end 'switch' body.");
 
-    if (jumpTable.Count() > 0) {
-        int caseMin   = jumpTable.LowestValue();
-        int caseMax   = jumpTable.HighestValue();
-        int caseRange = caseMax - caseMin;
+    // Build the jump table
+    // If there's no break statement or default case provided, we need to jump over the table body.
+    int jumpTableStart = EmitJump(OP_JUMP);
 
-        // Warn about big jump table
-        if ((jumpTable.Count() * 2) <= caseRange) {
-            AddWarning("Switch statement contains a large range and a small number of case labels. "
-                       "Consider using multiple condensed switch statements or if/else statements instead.",
-                       switchToken);
-        }
+    if (lowering == slSparse) {
+        PatchShort(caseCountPos, cases.Count());
+        EmitSparseTable(cases, defaultCase);
+    } else if (lowering == slHashed) {
+        EmitHashedTable(cases, defaultCase, multiplier, bits);
+    } else {
+        PatchInt(minValuePos, cases.LowestValue());
+        PatchInt(maxValuePos, cases.HighestValue());
+        EmitDenseTable(cases, defaultCase);
+    }
 
-        PatchInt(minValuePos, caseMin);
-        PatchInt(maxValuePos, caseMax);
+    // Patch the jump over the table body.
+    PatchJump(jumpTableStart);
 
-        // Build the jump table
-        // If there's no break statement or default case provided, we need to jump over the table body.
-        int jumpTableStart = EmitJump(OP_JUMP);
+    PatchJump(switchJumpPos);
 
-        // Put the default jump at the start so that it's always available to out-of-range values.
-        int defaultJump = CURRENT_CODE_POS - defaultCase;
-        EmitShort(defaultJump);
+    SwitchEnd(); // Takes care of break statements.
 
-        // Build table containing the entire range. Empty cases get the default jump address.
-        for (int i = caseMin; i <= caseMax; ++i) {
-            int addr;
-            // If a case exists the addr will be updated.
-            if (!jumpTable.Find(i, addr)) {
-                addr = defaultCase;
-            }
-            // Convert the address to an offset. The jump is backwards.
-            int jumpBack = CURRENT_CODE_POS - addr;
+    ScopeEnd();
+}
 
-            EmitShort(jumpBack);
+/*
+ * Table = [default][case min]...[case max]
+ * Every value from the lowest case to the highest gets an entry. Values without a case get the default jump.
+ */
+void Compiler::EmitDenseTable(const SwitchTable &cases, int defaultCase)
+{
+    // Put the default jump at the start so that it's always available to out-of-range values.
+    int defaultJump = CURRENT_CODE_POS - defaultCase;
+    EmitShort(defaultJump);
+
+    for (s32 i = cases.LowestValue(); i <= cases.HighestValue(); ++i) {
+        int addr;
+        // If a case exists the addr will be updated.
+        if (!cases.Find(i, addr)) {
+            addr = defaultCase;
         }
+        // Convert the address to an offset. The jump is backwards.
+        int jumpBack = CURRENT_CODE_POS - addr;
 
-        // Patch the jump over the table body.
-        PatchJump(jumpTableStart);
+        EmitShort(jumpBack);
+
+        // Don't wrap around if the highest case is the largest int.
+        if (i == cases.HighestValue()) {
+            break;
+        }
     }
+}
 
-    PatchJump(switchJumpPos);
+/*
+ * Table = [low 0][high 0]...[low n][high n][default][case 0]...[case n]
+ * The ranges are sorted, so the VM can binary search them.
+ */
+void Compiler::EmitSparseTable(const SwitchTable &cases, int defaultCase)
+{
+    for (const auto &c : cases.Cases()) {
+        EmitInt(c.Low);
+        EmitInt(c.High);
+    }
 
-    SwitchEnd(); // Takes care of break statements.
+    EmitShort(CURRENT_CODE_POS - defaultCase);
 
-    ScopeEnd();
+    for (const auto &c : cases.Cases()) {
+        EmitShort(CURRENT_CODE_POS - c.Address);
+    }
 }
 
-void Compiler::SwitchAsIfElse()
+/*
+ * Table = [key 0]...[key n][default][slot 0]...[slot n]
+ * Each case sits in the slot its value hashes to. Empty slots, and values that don't match the key of their slot, take the default jump.
+ */
+void Compiler::EmitHashedTable(const SwitchTable &cases, int defaultCase, u32 multiplier, u8 bits)
 {
-    ScopeBegin();
-    SwitchInfo switchInfo;
-    SwitchBegin(&switchInfo);
+    const u32 slotCount = 1u << bits;
+    std::vector<s32> keys(slotCount, 0);
+    std::vector<int> addresses(slotCount, NOT_SET);
 
-    // Input expression
-    ConsumeToken(tknLeftParen, -1, "Expected '(' after 'switch' statement.");
-    // Parse the input expression and remember its type.
-    DataType switchType = Expression();
+    for (const auto &c : cases.Cases()) {
+        const u32 slot = SwitchTable::HashSlot(c.Low, multiplier, bits);
+        if (addresses[slot] != NOT_SET || c.Low != c.High) {
+            AddError("Switch case labels can't be hashed.", LookBack());
+            return;
+        }
+        keys[slot]      = c.Low;
+        addresses[slot] = c.Address;
+    }
 
-    // The input value will now be on the top of the stack.
-    // Create a local variable from it, so it's easy to access later.
-    VmPointer inputPtr = VmPointer(CurrentFunction()->Locals.size(), switchType, scopeLocal);
-    VariableInfo *swVar;
-    swVar          = new VariableInfo();
-    swVar->Name    = "<switch>";
-    swVar->Depth   = m_ScopeDepth;
-    swVar->Pointer = inputPtr;
-    CurrentFunction()->Locals.push_back(swVar);
-    EmitSetVariable(OP_ASSIGN, swVar, switchType);
+    for (const s32 key : keys) {
+        EmitInt(key);
+    }
 
-    ConsumeToken(tknRightParen, -1, "Expected ')' after 'switch' expression.");
+    EmitShort(CURRENT_CODE_POS - defaultCase);
 
-    // Body
-    ConsumeToken(tknLeftCurly, -1, "Expected '{' to start 'switch' body.");
+    for (const int address : addresses) {
+        EmitShort(CURRENT_CODE_POS - (address != NOT_SET ? address : defaultCase));
+    }
+}
 
-    SwitchBody();
+/*
+ * Reads the case labels of the switch body ahead of the current token, without parsing them.
+ * Labels that don't parse are left out. They're reported when the body is parsed.
+ */
+void Compiler::ScanCaseLabels(SwitchTable &outTable)
+{
+    // Next token that isn't a comment or line end.
+    auto next = [&](size_t &pos) {
+        Token token;
+        do {
+            token = TokenAt(pos++);
+        } while (IsSkippable(token) && token.TokenType != tknEndOfFile);
+        return token;
+    };
 
-    // Parse the case labels. There can be more than one before a case body.
-    std::vector<ConstantInfo> cases;
+    // Reads [-]literal
+    auto value = [&](size_t &pos, s32 &outValue) {
+        Token token         = next(pos);
+        const bool negative = token.TokenType == tknMinus;
+        if (negative) {
+            token = next(pos);
+        }
 
-    while (Match(tknCase)) {
-        std::vector<int> jumps;
-        do {
-            // Parse fall through case labels
-            // Push the input expression onto the stack
-            EmitGetVariable(swVar, switchType);
+        int parsed;
+        if (token.TokenType != tknIntegerLiteral || !ParseIntegerLiteral(token.Value, parsed)) {
+            return false;
+        }
+        outValue = negative ? -parsed : parsed;
+        return true;
+    };
 
-            if (!Match(tknIntegerLiteral) && !Match(tknFloatLiteral)) {
-                AddError("Expected numerical literal in case label.", LookBack());
-            }
+    size_t pos = m_CurrentPos;
+    int depth  = 0;
+    while (true) {
+        const Token token = next(pos);
+        if (token.TokenType == tknEndOfFile) {
+            return;
+        }
 
-            const Token &caseToken = LookBack();
-            ConstantInfo value     = ParseNumericLiteral();
-
-            // Check the type of the case label
-            TypeCompatibility caseCompat = TypeInfo::CheckCompatibility(switchType, value.Type);
-            if (caseCompat == tcCastFloatToSigned) {
-                value.ConstValue.Int = (int)value.ConstValue.Float;
-                value.Type           = dtInt32;
-            } else if (caseCompat == tcCastSignedToFloat) {
-                value.ConstValue.Float = (float)value.ConstValue.Int;
-                value.Type             = dtFloat;
+        if (token.TokenType == tknLeftCurly) {
+            ++depth;
+        } else if (token.TokenType == tknRightCurly) {
+            if (--depth < 0) {
+                return;
+            }
+        } else if (token.TokenType == tknCase && depth == 0) {
+            s32 low;
+            if (!value(pos, low)) {
+                continue;
             }
 
-            // Make sure it doesn't already exist
-            for (auto c : cases) {
-                if (value.Type == c.Type && AS_INT32(value.ConstValue) == AS_INT32(c.ConstValue)) {
-                    AddError("case label '" + caseToken.Value + "' already exists.", caseToken);
+            s32 high        = low;
+            size_t ellipsis = pos;
+            if (next(ellipsis).TokenType == tknEllipsis) {
+                pos = ellipsis;
+                if (!value(pos, high)) {
+                    continue;
                 }
             }
-            cases.push_back(value);
-
-            EmitConstant(value);
 
-            ConsumeToken(tknColon, -1, "Expected ':' after case label.");
+            if (low <= high) {
+                outTable.Add(low, high);
+            }
+        }
+    }
+}
 
-            // Jump to the case statement if true.
-            jumps.push_back(EmitJump(OP_JUMP_IF_EQUAL));
-        } while (Match(tknCase));
+/* Parses a case label value or range. Eg: case 4: or case 1 ... 9: */
+bool Compiler::CaseLabel(DataType switchType, s32 &outLow, s32 &outHigh)
+{
+    if (!CaseValue(switchType, outLow)) {
+        outHigh = outLow;
+        return false;
+    }
 
-        // If we made it here, no labels matched, so we jump the case body.
-        int skipJump = EmitJump(OP_JUMP);
+    outHigh = outLow;
+    if (!Match(tknEllipsis)) {
+        return true;
+    }
 
-        // Patch the case match jumps
-        for (auto jump : jumps) {
-            PatchJump(jump);
-        }
+    if (!CaseValue(switchType, outHigh)) {
+        return false;
+    }
+
+    if (outHigh < outLow) {
+        AddError("Case range must go from the lower value to the higher one.", LookBack());
+        outHigh = outLow;
+        return false;
+    }
+
+    return true;
+}
+
+bool Compiler::CaseValue(DataType switchType, s32 &outValue)
+{
+    const bool negative = Match(tknMinus);
+
+    if (!Match(tknIntegerLiteral) && !Match(tknFloatLiteral)) {
+        AddError("Expected numerical literal in case label.", LookBack());
+        outValue = 0;
+        return false;
+    }
+
+    ConstantInfo value = ParseNumericLiteral();
+
+    // Check the type of the case label. Input values must be integers
+    TypeCompatibility caseCompat = TypeInfo::CheckCompatibility(switchType, value.Type);
+    if (caseCompat != tcMatch) {
+        AddError("Case label type not compatible.", LookBack());
+    }
+
+    outValue = negative ? -AS_INT32(value.ConstValue) : AS_INT32(value.ConstValue);
+    return caseCompat == tcMatch;
+}
+
+/*
+ * Compiles a switch with very few cases as a compare and jump for each one.
+ * The input value is on top of the stack, and is kept there in a hidden local for the cases to compare with.
+ */
+void Compiler::SwitchAsIfElse(DataType switchType)
+{
+    VmPointer inputPtr = VmPointer(CurrentFunction()->Locals.size(), switchType, scopeLocal);
+    VariableInfo *swVar;
+    swVar          = new VariableInfo();
+    swVar->Name    = "<switch>";
+    swVar->Depth   = m_ScopeDepth;
+    swVar->Pointer = inputPtr;
+    CurrentFunction()->Locals.push_back(swVar);
+    EmitSetVariable(OP_ASSIGN, swVar, switchType);
+
+    SwitchBody();
+
+    // Parse the case labels. There can be more than one before a case body.
+    SwitchTable cases;
+    int fallThrough = NOT_SET;
+
+    while (Match(tknCase)) {
+        std::vector<int> jumps;
+        do {
+            // Parse fall through case labels
+            // Push the input expression onto the stack
+            EmitGetVariable(swVar, switchType);
+
+            const Token caseToken = CurrentToken();
+            s32 low;
+            s32 high;
+            const bool valid = CaseLabel(switchType, low, high);
+
+            // Make sure it doesn't already exist
+            if (valid && !cases.Add(low, high)) {
+                AddError("case label '" + std::to_string(low) + "' already exists.", caseToken);
+            }
+
+            ConstantInfo value(dtInt32, INT32_VAL(low));
+            EmitConstant(value);
+
+            ConsumeToken(tknColon, -1, "Expected ':' after case label.");
+
+            // Jump to the case statement if true.
+            jumps.push_back(EmitJump(OP_JUMP_IF_EQUAL));
+        } while (Match(tknCase));
+
+        // If we made it here, no labels matched, so we jump the case body.
+        int skipJump = EmitJump(OP_JUMP);
+
+        // Patch the case match jumps
+        for (auto jump : jumps) {
+            PatchJump(jump);
+        }
+
+        // The case above falls through into this one, past its labels.
+        if (fallThrough != NOT_SET) {
+            PatchJump(fallThrough);
+        }
 
         // Parse the case body, which can be multiple statements, not necessarily in a block.
         while (!Check(tknCase) && !Check(tknDefault) && !Check(tknRightCurly) && !IsAtEnd()) {
             Statement();
         }
 
+        fallThrough = Check(tknCase) ? EmitJump(OP_JUMP) : NOT_SET;
+
         // Patch the jump over the statement
         PatchJump(skipJump);
     }
@@ -1644,8 +2179,7 @@ void Compiler::SwitchAsIfElse()
 
     ConsumeToken(tknRightCurly, -1, "Expected '}' to end 'switch' body.");
     SwitchEnd(); // Takes care of break statements.
-    EmitPop();
-    ScopeEnd();
+    ScopeEnd();  // Pops the input value.
 }
 
 // Generates code to discard local variables at [depth] or greater. Does *not*
@@ -1688,7 +2222,8 @@ void Compiler::BreakStatement()
     }
 
     // Since we will be jumping out of the scope, make sure any locals in it are discarded first.
-    if ((m_CurrentLoop == nullptr) || (m_CurrentSwitch != nullptr && m_CurrentSwitch->ScopeDepth > m_CurrentLoop->ScopeDepth)) {
+    const bool fromSwitch = (m_CurrentLoop == nullptr) || (m_CurrentSwitch != nullptr && m_CurrentSwitch->ScopeDepth > m_CurrentLoop->ScopeDepth);
+    if (fromSwitch) {
         DiscardLocals(m_CurrentSwitch->ScopeDepth + 1);
     } else {
         DiscardLocals(m_CurrentLoop->ScopeDepth + 1);
@@ -1697,7 +2232,12 @@ void Compiler::BreakStatement()
     // Emit a placeholder instruction for the jump to the end of the body. When
     // we're done compiling the loop body and know where the end is, we'll
     // replace the address with appropriate offsets.
-    EmitJump(OP_BREAK);
+    const int jump = EmitJump(OP_BREAK);
+    if (fromSwitch) {
+        m_CurrentSwitch->Breaks.push_back(jump);
+    } else {
+        m_CurrentLoop->Breaks.push_back(jump);
+    }
 }
 
 void Compiler::ContinueStatement()
@@ -1719,6 +2259,10 @@ void Compiler::ContinueStatement()
 
 void Compiler::ExpressionStatement()
 {
+    if (VectorAssignment()) {
+        return;
+    }
+
     Expression();
     ConsumeToken(tknSemiColon, -2, "Expected ';' after expression.");
     EmitByte(OP_POP);
@@ -1742,6 +2286,17 @@ void Compiler::ScopeEnd(bool pop)
         ++popCount;
     }
 
+    // Compile time constants have no storage to pop
+    while (!m_FoldedConstants.empty() && m_FoldedConstants.back()->Depth > m_ScopeDepth) {
+        VariableInfo *constant = m_FoldedConstants.back();
+        if (constant->Reads < 1) {
+            AddWarning("Variable '" + constant->Name + "' is never used.", constant->Token);
+        }
+
+        delete (constant);
+        m_FoldedConstants.pop_back();
+    }
+
     if (pop) { // We don't need to pop the stack when returning from a function
         EmitPop(popCount);
     }
@@ -1935,7 +2490,8 @@ void Compiler::ClassInstanceDeclaration()
     /* Initializer */
     ScriptFunction *initFunc = FindScriptFunction("__" + klass->Name + "__Init");
     if (initFunc) {
-        // Push the init function and call it
+        // Store the call frame, then push the init function and call it
+        EmitByte(OP_FRAME);
         ConstantInfo funcId(dtFunction, FUNCTION_VAL(initFunc->Id));
         EmitConstant(funcId);
 
@@ -1996,7 +2552,10 @@ void Compiler::ArrayDeclaration(DataType dataType, u32 flags)
     ConsumeToken(tknRightSquareBracket, -2, "Expected ']' after array size");
 
     // Initializer. The first value is already on the stack.
-    if (Match(tknAssign) && Match(tknLeftCurly)) {
+    const bool assigned = Match(tknAssign);
+    if (assigned && Check(tknIdentifier)) {
+        ArrayFromFunction(name, dataType, count);
+    } else if (assigned && Match(tknLeftCurly)) {
         initCount = 0;
         TypeInfo arrayType(dataType);
         TypeBegin(&arrayType);
@@ -2056,13 +2615,17 @@ void Compiler::ArrayDeclaration(DataType dataType, u32 flags)
             // Push the pointer to the start of the array onto the stack
             EmitAbsolutePointer(arrayVar);
 
+            // Push the offset of the stack value onto the stack. Packed elements are zeroed a whole stack value at a time.
+            ConstantInfo index(dtInt32, INT32_VAL(i / packedValueCount));
+            EmitConstant(index);
+
             VariableInfo *aVal = CreateVariable("__" + name + "__" + std::to_string(i), CurrentScope(), dataType, vfNormal);
             if (aVal == nullptr) { // Check the return value of the CreateVariable function
                 AddError("Failed to create array value", LookBack());
             }
 
             EmitByte(OP_NIL);
-            EmitSetAtOffset(arrayVar->Type(), dtInt32);
+            EmitSetAtOffset(dtInt32, dtInt32);
             EmitPop();
         }
     }
@@ -2079,8 +2642,9 @@ void Compiler::ArrayDeclaration(DataType dataType, u32 flags)
         return;
 
     // Calculate the size in terms of stack values
-    int size       = (TypeInfo::GetByteSize(dataType) * count) / (int)sizeof(Value);
-    arrayVar->Size = size;
+    int size         = (TypeInfo::GetByteSize(dataType) * count) / (int)sizeof(Value);
+    arrayVar->Size   = size;
+    arrayVar->Length = count;
 
     // Local Only: Patch the array size.
     if (arrayCodePos >= 0) {
@@ -2090,6 +2654,500 @@ void Compiler::ArrayDeclaration(DataType dataType, u32 flags)
     ConsumeToken(tknSemiColon, -2, "Expected ';' after array declaration.");
 }
 
+/*
+ * Fills an array with the values a constexpr function returns for each index, worked out at compile time.
+ * Eg: byte crcTable[256] = CrcEntry; stores CrcEntry(0) to CrcEntry(255).
+ */
+void Compiler::ArrayFromFunction(const std::string &name, DataType dataType, int count)
+{
+    const Token token    = ConsumeToken(tknIdentifier);
+    ScriptFunction *func = FindScriptFunction(token.Value);
+
+    if (func == nullptr || !(func->Attributes & atConstExpr) || func->ArgCount() != 1 || func->Args[0] < dtInt8 || func->Args[0] > dtUint32) {
+        AddError("Arrays can only be initialised by a constexpr function that takes the index.", token);
+        return;
+    }
+    if (count <= 0) {
+        AddError("Array initialised by a function must have a size.", token);
+        return;
+    }
+
+    auto compat = TypeInfo::CheckCompatibility(dataType, func->ReturnType);
+    if (compat == tcIncompatible) {
+        AddError("Value of type '" + DataTypeToString(dataType) + "' expected.", token);
+        return;
+    } else if (compat != tcMatch) {
+        AddWarning("Value will be implicitly cast to type '" + DataTypeToString(dataType) + "'. Data may be lost.", token);
+    }
+
+    if (m_Status >= errError) {
+        return;
+    }
+
+    int packedValueCount = TypeInfo::GetPackedCount(dataType);
+    ConstEvaluator evaluator(m_Functions, m_ConstValues, m_StringData);
+
+    for (int i = 0; i < count; ++i) {
+        if ((i > 0) && (i % packedValueCount == 0)) {
+            // Add a variable to the stack if we're past a pack size boundary
+            CreateVariable("__" + name + "__" + std::to_string(i), CurrentScope(), dataType, vfNormal);
+        }
+
+        Value result = INT32_VAL(0);
+        if (!evaluator.Evaluate(func, { INT32_VAL(i) }, CurrentFunction(), result)) {
+            AddError("Constexpr function '" + func->Name + "' failed for index " + std::to_string(i) + ": " + evaluator.Error() + ".", token);
+            return;
+        }
+
+        // Find the array pointer again in case the vector has reallocated.
+        VariableInfo *arrayVar = ResolveVariable(name);
+        EmitAbsolutePointer(arrayVar);
+
+        ConstantInfo index(dtInt32, INT32_VAL(i));
+        EmitConstant(index);
+
+        ConstantInfo value(func->ReturnType, result);
+        EmitConstant(value);
+
+        EmitSetAtOffset(arrayVar->Type(), func->ReturnType);
+        EmitPop(); // No need to leave a value on the stack when initialising an array.
+    }
+
+    func->Evaluated += count;
+}
+
+/*
+ * Declares a vector. The components are consecutive floats, like the elements of an array, so the vector instructions can work on all of them at once.
+ * Eg: vec3 p; vec3 v = { 1, 2, 3 }; vec3 w = p + v;
+ */
+void Compiler::VectorDeclaration(DataType dataType, u32 flags)
+{
+    if (InClassInitialiser()) {
+        AddError("Vectors can't be class fields.", LookBack());
+        return;
+    }
+
+    VariableInfo *vector = ParseVariable(dataType, flags);
+    if (vector == nullptr) {
+        return;
+    }
+
+    if (Check(tknLeftSquareBracket)) {
+        AddError("Arrays of vectors aren't supported.", CurrentToken());
+        return;
+    }
+
+    const bool global = CurrentScope() == scopeGlobal;
+    const int count   = TypeInfo::ComponentCount(dataType);
+    vector->Size      = count;
+    vector->Length    = count;
+
+    // The head holds the first component and the rest follow it.
+    std::vector<VariableInfo *> components = { vector };
+    for (int i = 1; i < count; ++i) {
+        VariableInfo *component = CreateVariable("__" + vector->Name + "__" + std::to_string(i), CurrentScope(), dtFloat, vfNormal);
+        component->Reads        = 1; // Only read through the vector.
+        components.push_back(component);
+    }
+    if (!global && CurrentFunction()->Locals.size() > CurrentFunction()->LocalsMaxHeight) {
+        CurrentFunction()->LocalsMaxHeight = CurrentFunction()->Locals.size();
+    }
+
+    const bool assigned    = Match(tknAssign);
+    const bool initialiser = assigned && Match(tknLeftCurly);
+    if (assigned && !initialiser) {
+        if (!global) {
+            EmitPush(count); // Overwritten by the expression.
+        }
+        VectorExpression(vector);
+    } else {
+        // Locals are initialised in place as they're pushed.
+        for (int i = 0; i < count; ++i) {
+            if (initialiser && i > 0) {
+                ConsumeToken(tknComma, -2, "Expected " + std::to_string(count) + " values to initialise '" + DataTypeToString(dataType) + "'.");
+            }
+            if (initialiser) {
+                TypedExpression(dtFloat);
+            } else {
+                EmitByte(OP_NIL);
+            }
+            if (global) {
+                EmitComponentPointer(vector, i);
+                EmitByte(OP_SET_VARIABLE);
+            }
+        }
+        if (initialiser) {
+            ConsumeToken(tknRightCurly, -2, "Expected '}' after vector initialisation.");
+        }
+        vector->Writes++;
+    }
+
+    ConsumeToken(tknSemiColon, -2, "Expected ';' after vector declaration.");
+
+    for (VariableInfo *component : components) {
+        component->Depth = global ? 0 : m_ScopeDepth;
+    }
+}
+
+/* Pushes a pointer to one component of a vector. */
+void Compiler::EmitComponentPointer(const VariableInfo *vector, int index)
+{
+    Value pointer;
+    pointer.Pointer = VmPointer(vector->Pointer.Address + index, dtFloat, vector->Pointer.Scope);
+    EmitConstant({ dtPointer, pointer });
+}
+
+/* True if the current token names a vector variable. Its components don't count. Eg: v but not v.x */
+bool Compiler::CheckVector()
+{
+    if (!Check(tknIdentifier) || CheckAhead(tknDot)) {
+        return false;
+    }
+
+    const std::string name = CurrentToken().Value;
+    VariableInfo *variable = ResolveLocal(name);
+    if (variable == nullptr) {
+        variable = ResolveGlobal(name);
+    }
+
+    return variable != nullptr && TypeInfo::IsVector(variable->Type());
+}
+
+/* Pushes a pointer to a vector named by the next token. It must be of the given type, or any vector if that's dtNone. */
+VariableInfo *Compiler::VectorOperand(DataType type)
+{
+    const std::string expected = type == dtNone ? "vector" : "'" + DataTypeToString(type) + "'";
+    if (!Match(tknIdentifier)) {
+        AddError("Expected a " + expected + ".", CurrentToken());
+        return nullptr;
+    }
+
+    VariableInfo *operand = ResolveVariable(LookBack().Value);
+    if (operand == nullptr) {
+        return nullptr;
+    }
+    if (!TypeInfo::IsVector(operand->Type()) || (type != dtNone && operand->Type() != type)) {
+        AddError("Expected a " + expected + ".", LookBack());
+        return nullptr;
+    }
+
+    operand->Reads++;
+    EmitAbsolutePointer(operand);
+    return operand;
+}
+
+/*
+ * Compiles a vector expression straight into a vector, as a vector can't be left on the stack.
+ * Only one operator is allowed. Eg: a, a + b, a - b, a * b (each component), a * 2.0
+ */
+void Compiler::VectorExpression(VariableInfo *dest)
+{
+    EmitAbsolutePointer(dest);
+    if (VectorOperand(dest->Type()) == nullptr) {
+        return;
+    }
+
+    const TokenType operatorType = CurrentToken().TokenType;
+    if (operatorType == tknPlus || operatorType == tknMinus || operatorType == tknStar || operatorType == tknSlash) {
+        AdvanceToken();
+        VectorOperation(dest, operatorType);
+    } else {
+        EmitBytes(OP_VEC_COPY, (opCode_t)TypeInfo::ComponentCount(dest->Type()));
+        dest->Writes++;
+    }
+
+    const TokenType next = CurrentToken().TokenType;
+    if (next == tknPlus || next == tknMinus || next == tknStar || next == tknSlash) {
+        AddError("Vector expressions can only have one operator.", CurrentToken());
+    }
+}
+
+/*
+ * Compiles the right hand side of a vector operation and the operation itself.
+ * Stack Before = ...[dest][lhs]
+ */
+void Compiler::VectorOperation(VariableInfo *dest, TokenType operatorType)
+{
+    opCode_t op;
+    switch (operatorType) {
+        case tknPlus:
+        case tknPlusEquals:
+            op = OP_VEC_ADD;
+            break;
+        case tknMinus:
+        case tknMinusEquals:
+            op = OP_VEC_SUB;
+            break;
+        case tknStar:
+        case tknTimesEquals:
+            op = CheckVector() ? OP_VEC_MULT : OP_VEC_SCALE;
+            break;
+        default:
+            AddError("Vectors can only be added, subtracted, multiplied or scaled.", LookBack());
+            return;
+    }
+
+    if (op == OP_VEC_SCALE) {
+        TypedExpression(dtFloat);
+    } else if (VectorOperand(dest->Type()) == nullptr) {
+        return;
+    }
+
+    EmitBytes(op, (opCode_t)TypeInfo::ComponentCount(dest->Type()));
+    dest->Writes++;
+}
+
+/*
+ * Vector assignments don't leave a value on the stack, so they're only allowed as statements.
+ * Eg: a = b + c; a += b; a *= 2.0; a = { 1, 2, 3 };
+ */
+bool Compiler::VectorAssignment()
+{
+    if (!CheckVector() || !(CheckAhead(tknAssign) || CheckAhead(tknPlusEquals) || CheckAhead(tknMinusEquals) || CheckAhead(tknTimesEquals) ||
+                            CheckAhead(tknDivideEquals) || CheckAhead(tknBitwiseAndEquals) || CheckAhead(tknBitwiseOrEquals))) {
+        return false;
+    }
+
+    AdvanceToken();
+    VariableInfo *vector = ResolveVariable(LookBack().Value);
+    TokenType assignToken;
+    MatchAssignment(assignToken);
+
+    if (vector->IsConst() && vector->Writes > 0) {
+        AddError("Cannot write to const variable after initialisation.", LookBack());
+        return true;
+    }
+
+    const int count = TypeInfo::ComponentCount(vector->Type());
+    if (assignToken == tknAssign && Match(tknLeftCurly)) {
+        for (int i = 0; i < count; ++i) {
+            if (i > 0) {
+                ConsumeToken(tknComma, -2, "Expected " + std::to_string(count) + " values to assign to '" + DataTypeToString(vector->Type()) + "'.");
+            }
+            TypedExpression(dtFloat);
+            EmitComponentPointer(vector, i);
+            EmitByte(OP_SET_VARIABLE);
+        }
+        ConsumeToken(tknRightCurly, -2, "Expected '}' after vector values.");
+        vector->Writes++;
+    } else if (assignToken == tknAssign) {
+        VectorExpression(vector);
+    } else {
+        // a += b -> a = a + b
+        EmitAbsolutePointer(vector);
+        EmitAbsolutePointer(vector);
+        vector->Reads++;
+        VectorOperation(vector, assignToken);
+    }
+
+    ConsumeToken(tknSemiColon, -2, "Expected ';' after expression.");
+    return true;
+}
+
+/* Reads or writes one component of a vector as a float. Eg: v.x, v.y = 2 */
+void Compiler::VectorComponent(VariableInfo *vector, bool canAssign)
+{
+    if (!Match(tknDot)) {
+        AddError("Vectors can only be used through their components, dot(), lengthSq() or vector assignments.", LookBack());
+        return;
+    }
+
+    const Token component  = ConsumeToken(tknIdentifier, -2, "Expected component after '.'.");
+    const std::string xyzw = "xyzw";
+    const size_t index     = component.Value.size() == 1 ? xyzw.find(component.Value[0]) : std::string::npos;
+    if (index == std::string::npos || (int)index >= TypeInfo::ComponentCount(vector->Type())) {
+        AddError("'" + component.Value + "' is not a component of '" + DataTypeToString(vector->Type()) + "'.", component);
+        return;
+    }
+
+    // A component is the same as a float variable, at an offset from the vector.
+    VariableInfo variable = *vector;
+    variable.Pointer      = VmPointer(vector->Pointer.Address + index, dtFloat, vector->Pointer.Scope);
+
+    TypeSetCurrent(dtFloat);
+
+    TypeInfo componentType(dtFloat);
+    TypeBegin(&componentType);
+
+    TokenType assignToken;
+    if (canAssign && MatchAssignment(assignToken)) {
+        AssignVariable(&variable, assignToken);
+    } else {
+        EmitGetVariable(&variable, componentType.Expecting());
+    }
+
+    TypeEnd();
+
+    vector->Reads  = variable.Reads;
+    vector->Writes = variable.Writes;
+}
+
+bool Compiler::CheckVectorFunction(const Token &token)
+{
+    return (token.Value == "dot" || token.Value == "lengthSq") && Check(tknLeftParen);
+}
+
+/* Built in functions of vectors that give a float. Eg: dot(a, b), lengthSq(a) */
+void Compiler::VectorFunction(const Token &token)
+{
+    ConsumeToken(tknLeftParen, -2, "Expected '(' after function name");
+
+    VariableInfo *vector = VectorOperand(dtNone);
+    if (vector == nullptr) {
+        return;
+    }
+
+    opCode_t op = OP_VEC_LENGTH_SQ;
+    if (token.Value == "dot") {
+        ConsumeToken(tknComma, -2, "'dot' expects 2 arguments.");
+        if (VectorOperand(vector->Type()) == nullptr) {
+            return;
+        }
+        op = OP_VEC_DOT;
+    }
+    ConsumeToken(tknRightParen, -2, "Expected ')' after arguments.");
+
+    EmitBytes(op, (opCode_t)TypeInfo::ComponentCount(vector->Type()));
+
+    TypeSetCurrent(dtFloat);
+    EmitCast(TypeInfo::CheckCompatibility(CurrentType(), dtFloat));
+}
+
+const IntrinsicInfo *Compiler::FindIntrinsic(const std::string &name)
+{
+    static const IntrinsicInfo intrinsics[] = {
+        {      "abs", 1, 0,       OP_ABS_I,         OP_NOP,   OP_ABS_F,  iaNumber },
+        {      "min", 2, 0,       OP_MIN_S,       OP_MIN_U,   OP_MIN_F,  iaNumber },
+        {      "max", 2, 0,       OP_MAX_S,       OP_MAX_U,   OP_MAX_F,  iaNumber },
+        {    "clamp", 3, 0,     OP_CLAMP_S,     OP_CLAMP_U, OP_CLAMP_F,  iaNumber },
+        {     "sqrt", 1, 0,        OP_SQRT,        OP_SQRT,    OP_SQRT,   iaFloat },
+        {      "sin", 1, 0,         OP_SIN,         OP_SIN,     OP_SIN,   iaFloat },
+        {      "cos", 1, 0,         OP_COS,         OP_COS,     OP_COS,   iaFloat },
+        {    "floor", 1, 0,       OP_FLOOR,       OP_FLOOR,   OP_FLOOR,   iaFloat },
+        {  "extract", 3, 2, OP_BIT_EXTRACT, OP_BIT_EXTRACT,     OP_NOP, iaInteger },
+        {   "insert", 4, 2,  OP_BIT_INSERT,  OP_BIT_INSERT,     OP_NOP, iaInteger },
+        { "popcount", 1, 0,    OP_POPCOUNT,    OP_POPCOUNT,     OP_NOP, iaInteger },
+        {      "clz", 1, 0,         OP_CLZ,         OP_CLZ,     OP_NOP, iaInteger },
+        {     "rotl", 2, 0,    OP_ROTATE_L,    OP_ROTATE_L,     OP_NOP, iaInteger },
+        {     "rotr", 2, 0,    OP_ROTATE_R,    OP_ROTATE_R,     OP_NOP, iaInteger },
+        {    "bswap", 1, 0,   OP_BYTE_SWAP,   OP_BYTE_SWAP,     OP_NOP, iaInteger },
+    };
+
+    for (const auto &intrinsic : intrinsics) {
+        if (name == intrinsic.Name) {
+            return &intrinsic;
+        }
+    }
+
+    return nullptr;
+}
+
+/* Script and native functions with the same name take priority. */
+bool Compiler::CheckIntrinsic(const Token &token)
+{
+    return FindIntrinsic(token.Value) != nullptr && Check(tknLeftParen);
+}
+
+/*
+ * Built in functions. Eg: abs(x), clamp(x, 0, 10), sqrt(x), extract(reg, 4, 8), insert(reg, field, 4, 8), rotl(x, 3)
+ * The first argument sets the type the rest are cast to, the same as an assignment. sqrt, sin, cos and floor always take a float.
+ * The position and width of a bit field must be constants.
+ * Calls with constant arguments are folded, except the ones whose result depends on how the VM was built.
+ */
+void Compiler::Intrinsic(const Token &token)
+{
+    const IntrinsicInfo *intrinsic = FindIntrinsic(token.Value);
+    ConsumeToken(tknLeftParen, -2, "Expected '(' after function name");
+
+    const int start = CURRENT_CODE_POS;
+    DataType type   = intrinsic->Args == iaFloat ? dtFloat : dtNone;
+    std::vector<ConstExpression> constants;
+    std::vector<ConstantInfo> immediates;
+
+    for (int i = 0; i < intrinsic->ArgCount; ++i) {
+        if (i > 0) {
+            ConsumeToken(tknComma, -2, "'" + token.Value + "' expects " + std::to_string(intrinsic->ArgCount) + " arguments.");
+        }
+
+        const int argStart = CURRENT_CODE_POS;
+        if (i >= intrinsic->ArgCount - intrinsic->Immediates) {
+            TypedExpression(dtInt32);
+
+            ConstExpression immediate;
+            if (TopConstant(immediate) && immediate.Start == argStart) {
+                immediates.push_back(immediate.Constant);
+                DiscardConstant(immediate);
+            } else {
+                AddError("Argument " + std::to_string(i + 1) + " of '" + token.Value + "' must be a constant.", LookBack());
+            }
+            continue;
+        }
+
+        if (type == dtNone) {
+            type = Expression();
+            if (intrinsic->Args == iaInteger && (type < dtInt8 || type > dtUint32)) {
+                AddError("'" + token.Value + "' expects an integer.", LookBack());
+                type = dtInt32;
+            } else if (type < dtInt8 || type > dtFloat) {
+                AddError("'" + token.Value + "' expects a number.", LookBack());
+                type = dtInt32;
+            }
+        } else {
+            TypedExpression(type);
+        }
+
+        // Only a run of constants with nothing between them can be folded.
+        ConstExpression constant;
+        if (constants.size() == (size_t)i && TopConstant(constant) && constant.Start == argStart &&
+            (constants.empty() ? argStart == start : constants.back().End == argStart)) {
+            constants.push_back(constant);
+        }
+    }
+    ConsumeToken(tknRightParen, -2, "Expected ')' after arguments.");
+
+    // Bit fields. Eg: extract(reg, position, width)
+    bool valid = immediates.size() == (size_t)intrinsic->Immediates;
+    if (valid && intrinsic->Immediates == 2) {
+        const s32 position = immediates[0].ConstValue.Int;
+        const s32 width    = immediates[1].ConstValue.Int;
+        if (position < 0 || width < 1 || width > 32 || position + width > 32) {
+            AddError("Bit field must be 1 to 32 bits wide and end at or before bit 32.", LookBack());
+            valid = false;
+        }
+    }
+
+    opCode_t op = intrinsic->SignedOp;
+    if (type == dtFloat) {
+        op = intrinsic->FloatOp;
+    } else if (type == dtUint32) {
+        op = intrinsic->UnsignedOp;
+    }
+
+    std::vector<ConstantInfo> args;
+    for (const auto &constant : constants) {
+        args.push_back(constant.Constant);
+    }
+    args.insert(args.end(), immediates.begin(), immediates.end());
+
+    ConstantInfo folded{};
+    if (op == OP_NOP) {
+        // The value is already the result. Eg: abs() of an unsigned int
+    } else if (valid && args.size() == (size_t)intrinsic->ArgCount && Folding::Intrinsic(op, type, args, folded)) {
+        for (auto it = constants.rbegin(); it != constants.rend(); ++it) {
+            DiscardConstant(*it);
+        }
+        EmitFoldableConstant(folded);
+    } else {
+        EmitByte(op);
+        for (const auto &immediate : immediates) {
+            EmitByte((opCode_t)immediate.ConstValue.Int);
+        }
+    }
+
+    TypeSetCurrent(type);
+    EmitCast(TypeInfo::CheckCompatibility(CurrentType(), type));
+}
+
 void Compiler::FunctionDeclaration(DataType dataType)
 {
     Token token          = ConsumeToken(tknIdentifier, -2, "Expected method name.");
@@ -2128,7 +3186,14 @@ void Compiler::DestructorDeclaration()
 
 ScriptFunction *Compiler::Function(const std::string &name, FunctionType chunkType, DataType returnType)
 {
+    AttributeInfo attributes = TakeAttributes();
+    if (attributes.Flags & LOOP_ATTRIBUTES) {
+        AddError("'unroll' and 'nounroll' can only be applied to loops.", attributes.Token);
+    }
+
     ScriptFunction *func = CreateFunction(name, chunkType, returnType);
+    func->Attributes     = attributes.Flags;
+    func->Period         = attributes.Period;
 
     ScopeBegin();
 
@@ -2153,6 +3218,9 @@ ScriptFunction *Compiler::Function(const std::string &name, FunctionType chunkTy
             if (MatchTypeDeclaration(dt, flags)) {
                 ClassInfo *classInfo = nullptr;
 
+                if (TypeInfo::IsVector(dt)) {
+                    AddError("Vectors can't be passed to functions. Pass their components instead.", LookBack());
+                }
                 if (dt == dtClass) {
                     flags |= vfClass;
                     classInfo = ResolveClass(LookBack().Value);
@@ -2175,6 +3243,31 @@ ScriptFunction *Compiler::Function(const std::string &name, FunctionType chunkTy
     }
     ConsumeToken(tknRightParen, -2, "Expected ')' after parameters.");
 
+    if (func->Attributes & atPeriodic) {
+        // Periodic tasks are called by the host, so they can't take or return anything.
+        if (chunkType != ftFunction || returnType != dtVoid || func->ArgCount() > 0) {
+            AddError("Periodic task '" + name + "' must be a void function with no parameters.", func->Token);
+        }
+    }
+
+    if (TypeInfo::IsVector(returnType)) {
+        AddError("Functions can't return vectors.", func->Token);
+    }
+
+    if ((func->Attributes & atExport) && chunkType != ftFunction) {
+        AddError("Only functions can be exported.", func->Token);
+    }
+
+    if (func->Attributes & atConstExpr) {
+        // The result replaces the call, so it has to be a single value.
+        if (chunkType != ftFunction || returnType < dtBool || returnType > dtFloat) {
+            AddError("Constexpr function '" + name + "' must be a function that returns a number.", func->Token);
+        }
+        if (func->Attributes & (atPeriodic | atExport)) {
+            AddError("Constexpr function '" + name + "' can't be called by the host.", func->Token);
+        }
+    }
+
     ConsumeToken(tknLeftCurly, -2, "Expected '{' before function body.");
     Block();
 
@@ -2211,6 +3304,10 @@ void Compiler::NativeFunction(const Token &token)
         return;
     }
 
+    if (InConstExpr()) {
+        AddError("Constexpr function can't call native function '" + name + "'.", token);
+    }
+
     ConstantInfo native{};
     native.Type                   = dtNativeFunc;
     native.ConstValue.FuncPointer = nativeFunc->Id;
@@ -2323,6 +3420,9 @@ void Compiler::PointerIndex(bool canAssign)
         return;
     }
 
+    // The length is only known when an array is indexed by name, not through a pointer.
+    const VariableInfo *array = (m_CurrentArray != nullptr && m_CurrentArrayEnd == CURRENT_CODE_POS) ? m_CurrentArray : nullptr;
+
     // Index expression
     TypeInfo indexTypeInfo(dtInt32);
     TypeBegin(&indexTypeInfo);
@@ -2335,6 +3435,18 @@ void Compiler::PointerIndex(bool canAssign)
     TypeCompatibility cast = TypeInfo::CheckCompatibility(dtInt32, indexType);
     EmitCast(cast);
 
+    // A constant index is checked now. Anything else is checked as the script runs if asked for, unless the optimiser can show it's in range.
+    ConstExpression index;
+    if (array != nullptr && array->Length > 0) {
+        if (TopConstant(index)) {
+            if (index.Constant.ConstValue.Int < 0 || index.Constant.ConstValue.Int >= array->Length) {
+                AddWarning("Index is out of bounds. Array '" + array->Name + "' has " + std::to_string(array->Length) + " elements.", LookBack());
+            }
+        } else if ((m_Flags & coBoundsCheck) && array->Length <= UINT16_MAX) {
+            EmitShortArg(OP_BOUNDS_CHECK, array->Length);
+        }
+    }
+
     // Get or Set
     TokenType assignToken;
     if (canAssign && MatchAssignment(assignToken)) {
@@ -2359,6 +3471,76 @@ NativeFuncInfo *Compiler::ResolveNativeFunction(const std::string &name)
     return nullptr;
 }
 
+ChannelInfo *Compiler::ResolveChannel(const std::string &name)
+{
+    if (m_NativeFuncs == nullptr) {
+        return nullptr;
+    }
+
+    auto &channelMap   = m_NativeFuncs->Channels();
+    const auto channel = channelMap.find(name);
+    if (channel != channelMap.end()) {
+        return &channel->second;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Channels are declared in the natives file and are used like an object with three operations:
+ *   bool send(value)  - Sends a value. Returns false if the channel is full.
+ *   type receive()    - Receives a value. Suspends the script until a value is available.
+ *   uint count()      - Number of values waiting to be received.
+ */
+void Compiler::Channel(const Token &token)
+{
+    ChannelInfo *channel = ResolveChannel(token.Value);
+    if (channel == nullptr) {
+        AddError("Failed to resolve channel '" + token.Value + "'.", token);
+        return;
+    }
+
+    if (InConstExpr()) {
+        AddError("Constexpr function can't use channel '" + token.Value + "'.", token);
+    }
+
+    ConsumeToken(tknDot, -2, "Expected '.' after channel name.");
+    const Token operationToken = ConsumeToken(tknIdentifier, -2, "Expected channel operation after '.'.");
+    ConsumeToken(tknLeftParen, -2, "Expected '(' after channel operation.");
+
+    const std::string &operation = operationToken.Value;
+    if (operation == "send") {
+        TypeInfo elementType(channel->Type);
+        TypeBegin(&elementType);
+
+        DataType exprType = Expression();
+        auto compat       = TypeInfo::CheckCompatibility(channel->Type, exprType);
+        if (compat == tcIncompatible) {
+            AddError("Channel '" + channel->Name + "' expects type '" + DataTypeToString(channel->Type) + "'.", LookBack());
+        }
+
+        // If required, cast the value to match the channel element type.
+        EmitCast(compat);
+
+        TypeEnd();
+
+        ConsumeToken(tknRightParen, -2, "Expected ')' after value.");
+        EmitBytes(OP_CHANNEL_SEND, (u8)channel->Id);
+        TypeSetCurrent(dtBool);
+    } else if (operation == "receive") {
+        ConsumeToken(tknRightParen, -2, "Expected ')' after '" + operation + "'.");
+        EmitBytes(OP_CHANNEL_RECEIVE, (u8)channel->Id);
+        TypeSetCurrent(channel->Type);
+        EmitCast(TypeInfo::CheckCompatibility(CurrentType(), channel->Type));
+    } else if (operation == "count") {
+        ConsumeToken(tknRightParen, -2, "Expected ')' after '" + operation + "'.");
+        EmitBytes(OP_CHANNEL_COUNT, (u8)channel->Id);
+        TypeSetCurrent(dtUint32);
+    } else {
+        AddError("Unknown channel operation '" + operation + "'. Expected 'send', 'receive' or 'count'.", operationToken);
+    }
+}
+
 ScriptFunction *Compiler::ResolveMethod(const std::string &name, VariableInfo *parentVar)
 {
     if (parentVar == nullptr)
@@ -2384,11 +3566,17 @@ void Compiler::VariableDeclaration(const DataType dataType, u32 flags)
 
     DataType inputType = dtNone;
     if (Match(tknAssign)) {
-        Token exprToken = CurrentToken();
-        inputType       = Expression();
+        Token exprToken           = CurrentToken();
+        const int expressionStart = CURRENT_CODE_POS;
+        inputType                 = Expression();
         if (inputType != var->Type()) {
             AddWarning("Expression will be implicitly cast to assignee type: " + DataTypeToString(var->Type()), exprToken);
         }
+        if (FoldConstantVariable(var, expressionStart, inputType)) {
+            ConsumeToken(tknSemiColon, -2, "Expected ';' after variable declaration.");
+            TypeEnd();
+            return;
+        }
     } else {
         EmitByte(OP_NIL);
         inputType = dtInt32;
@@ -2399,6 +3587,46 @@ void Compiler::VariableDeclaration(const DataType dataType, u32 flags)
     TypeEnd();
 }
 
+/*
+ * A const scalar initialised with a constant expression becomes a compile time constant with no storage.
+ * Reads of it are replaced by the constant itself.
+ */
+bool Compiler::FoldConstantVariable(VariableInfo *variable, int expressionStart, DataType inputType)
+{
+    if (!variable->IsConst() || variable->IsArray() || variable->IsPointer() || variable->IsField() || variable->Type() == dtClass ||
+        variable->Type() > dtFloat || InClassInitialiser()) {
+        return false;
+    }
+
+    ConstExpression initialiser;
+    if (!TopConstant(initialiser) || initialiser.Start != expressionStart) {
+        return false;
+    }
+
+    // Apply the same cast the assignment would.
+    ConstantInfo value{};
+    if (!Folding::Cast(TypeInfo::CheckCompatibility(variable->Type(), inputType), initialiser.Constant, value)) {
+        return false;
+    }
+
+    // The variable was the last one declared, take it back out of storage.
+    std::vector<VariableInfo *> &storage = (CurrentScope() == scopeGlobal) ? m_Globals : CurrentFunction()->Locals;
+    if (storage.empty() || storage.back() != variable) {
+        return false;
+    }
+    storage.pop_back();
+
+    DiscardConstant(initialiser);
+
+    variable->Flags |= vfFolded;
+    variable->Constant = value;
+    variable->Depth    = m_ScopeDepth;
+    variable->Writes   = 1;
+    m_FoldedConstants.push_back(variable);
+
+    return true;
+}
+
 VariableInfo *Compiler::ParseVariable(const DataType dataType, u32 flags, const std::string &errorMessage)
 {
     Token token       = ConsumeToken(tknIdentifier, -2, errorMessage);
@@ -2417,7 +3645,12 @@ VariableInfo *Compiler::AddGlobal(const Token &token, const DataType dataType, u
         return nullptr;
     }
 
-    if (ResolveGlobal(name) != nullptr) {
+    if (ResolveChannel(name) != nullptr) {
+        AddError("Channel with name '" + name + "' already exists.", token);
+        return nullptr;
+    }
+
+    if ((ResolveGlobal(name) != nullptr) || (ResolveFoldedConstant(name) != nullptr)) {
         AddError("Variable '" + name + "' already exists.", token);
         return nullptr;
     }
@@ -2442,7 +3675,12 @@ VariableInfo *Compiler::AddLocal(const Token &token, const DataType dataType, u3
         return nullptr;
     }
 
-    if ((ResolveGlobal(name) != nullptr) || (ResolveLocal(name) != nullptr)) {
+    if (ResolveChannel(name) != nullptr) {
+        AddError("Channel with name '" + name + "' already exists.", token);
+        return nullptr;
+    }
+
+    if ((ResolveGlobal(name) != nullptr) || (ResolveLocal(name) != nullptr) || (ResolveFoldedConstant(name) != nullptr)) {
         AddError("Variable '" + name + "' already exists.", token);
         return nullptr;
     }
@@ -2477,6 +3715,11 @@ VariableInfo *Compiler::AddMember(const Token &token, DataType dataType, u32 fla
         return nullptr;
     }
 
+    if (ResolveChannel(name) != nullptr) {
+        AddError("Channel with name '" + name + "' already exists.", token);
+        return nullptr;
+    }
+
     if ((ResolveGlobal(name) != nullptr) || (ResolveLocal(name) != nullptr)) {
         AddError("Field '" + name + "' already exists.", token);
         return nullptr;
@@ -2610,6 +3853,17 @@ VariableInfo *Compiler::ResolveLocal(const std::string &name, const std::string
     return nullptr;
 }
 
+VariableInfo *Compiler::ResolveFoldedConstant(const std::string &name)
+{
+    for (int i = (int)(m_FoldedConstants.size() - 1); i >= 0; --i) {
+        if (m_FoldedConstants[i]->Name == name) {
+            return m_FoldedConstants[i];
+        }
+    }
+
+    return nullptr;
+}
+
 VariableInfo *Compiler::ResolveMember(ClassInfo *parentClass, const std::string &name)
 {
     if (parentClass == nullptr) {
@@ -2643,6 +3897,11 @@ VariableInfo *Compiler::ResolveVariable(const std::string &name, const std::stri
         var = ResolveLocal(name, parentInstance);
     }
 
+    // Compile time constants
+    if (var == nullptr && parentInstance.empty()) {
+        var = ResolveFoldedConstant(name);
+    }
+
     // Globals
     if (var == nullptr) {
         var = ResolveGlobal(name, parentInstance);
@@ -2797,14 +4056,37 @@ void Compiler::NamedVariable(const Token &token, bool canAssign)
         return;
     }
 
+    // Globals aren't set until the script runs. Folded constants are known now.
+    if (InConstExpr() && variable->Scope() == scopeGlobal && !variable->IsFolded()) {
+        AddError("Constexpr function can't use global variable '" + variable->Name + "'.", token);
+    }
+
+    if (TypeInfo::IsVector(variable->Type())) {
+        VectorComponent(variable, canAssign);
+        return;
+    }
+
     TypeSetCurrent(variable->Type());
 
     TypeInfo varType(variable->Type());
 
+    if (variable->IsFolded()) {
+        TokenType assignToken;
+        if (canAssign && MatchAssignment(assignToken)) {
+            AddError("Cannot write to const variable after initialisation.", LookBack());
+            return;
+        }
+        variable->Reads++;
+        EmitFoldableConstant(variable->Constant);
+        EmitCast(TypeInfo::CheckCompatibility(CurrentType(), variable->Type()));
+        return;
+    }
+
     // Check if the variable is an array
     if (variable->IsArray()) {
         EmitAbsolutePointer(variable);
-        m_CurrentArray = variable;
+        m_CurrentArray    = variable;
+        m_CurrentArrayEnd = CURRENT_CODE_POS;
         if (!Check(tknLeftSquareBracket)) {
             // Raw Pointer
         }
@@ -2830,7 +4112,62 @@ void Compiler::NamedFunction(const Token &token)
 
     ScriptFunction *func = FindScriptFunction(token.Value);
 
+    const int callStart = CURRENT_CODE_POS;
     EmitCallDirect(func, nullptr);
+
+    if (func != nullptr && (func->Attributes & atConstExpr)) {
+        EvaluateCall(func, callStart, token);
+    }
+
+    EmitReturnCast(func);
+}
+
+/*
+ * Replaces a call to a constexpr function with the value it returns, if every argument is a constant.
+ * Calls to functions that are still being compiled are left as they are. Eg: A function that calls itself.
+ */
+void Compiler::EvaluateCall(ScriptFunction *function, int callStart, const Token &token)
+{
+    // Code with errors in it can't be run.
+    if (m_Status >= errError) {
+        return;
+    }
+
+    const std::vector<opCode_t> call(CurrentFunction()->Code.begin() + callStart, CurrentFunction()->Code.end());
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(call, instructions)) {
+        return;
+    }
+
+    // OP_FRAME, the function, the arguments, OP_CALL.
+    const int argCount = function->TotalArgCount();
+    if ((int)instructions.size() != argCount + 3 || instructions.front().Op != OP_FRAME || instructions.back().Op != OP_CALL) {
+        return;
+    }
+
+    std::vector<Value> args;
+    for (int i = 0; i < argCount; ++i) {
+        const Instruction &arg = instructions[i + 2];
+        if (!Bytecode::IsConstant(arg.Op) || Bytecode::ConstantIndex(arg) >= m_ConstValues.size()) {
+            return;
+        }
+        args.push_back(m_ConstValues[Bytecode::ConstantIndex(arg)].ConstValue);
+    }
+
+    ConstEvaluator evaluator(m_Functions, m_ConstValues, m_StringData);
+    Value result = INT32_VAL(0);
+    if (!evaluator.Evaluate(function, args, CurrentFunction(), result)) {
+        if (!evaluator.Error().empty()) {
+            AddError("Constexpr function '" + function->Name + "' failed: " + evaluator.Error() + ".", token);
+        }
+        return;
+    }
+
+    CurrentFunction()->Code.resize(callStart);
+    function->Evaluated++;
+
+    ConstantInfo constant(function->ReturnType, result);
+    EmitFoldableConstant(constant);
 }
 
 void Compiler::NamedMethod(const Token &token, VariableInfo *parentVar)
@@ -2851,6 +4188,18 @@ void Compiler::NamedMethod(const Token &token, VariableInfo *parentVar)
     }
 
     EmitCallDirect(method, parentVar);
+    EmitReturnCast(method);
+}
+
+/* Casts the value a call returns to the type the expression wants, the same as reading a variable of that type. */
+void Compiler::EmitReturnCast(const ScriptFunction *function)
+{
+    if (function == nullptr || function->ReturnType <= dtVoid) {
+        return;
+    }
+
+    TypeSetCurrent(function->ReturnType);
+    EmitCast(TypeInfo::CheckCompatibility(CurrentType(), function->ReturnType));
 }
 
 /*
@@ -2963,7 +4312,14 @@ void Compiler::EmitGetFromOffset(DataType dataType, DataType outputType)
         m_CurrentArray->Reads++;
     }
 
+    const int loadEnd = CURRENT_CODE_POS;
     EmitCast(cast);
+
+    // Only while the value is still the element, not cast to something else.
+    if ((dataType == dtUint8 || dataType == dtUint16) && CURRENT_CODE_POS == loadEnd) {
+        m_UnsignedLoadFunction = CurrentFunction()->Id;
+        m_UnsignedLoadEnd      = loadEnd;
+    }
 }
 
 /*
@@ -3006,6 +4362,16 @@ void Compiler::EmitSetAtOffset(DataType dataType, DataType inputType)
  * */
 void Compiler::EmitCast(TypeCompatibility castMode, bool previous)
 {
+    ConstExpression operand;
+    ConstantInfo folded{};
+    if (!previous && TopConstant(operand) && Folding::Cast(castMode, operand.Constant, folded)) {
+        if (folded.Type != operand.Constant.Type || folded.ConstValue.UInt != operand.Constant.ConstValue.UInt) {
+            DiscardConstant(operand);
+            EmitFoldableConstant(folded);
+        }
+        return;
+    }
+
     switch (castMode) {
         case tcCastSignedToFloat:
             EmitByte(previous ? OP_CAST_PREV_INT_TO_FLOAT : OP_CAST_INT_TO_FLOAT);
@@ -3013,6 +4379,18 @@ void Compiler::EmitCast(TypeCompatibility castMode, bool previous)
         case tcCastFloatToSigned:
             EmitByte(previous ? OP_CAST_PREV_FLOAT_TO_INT : OP_CAST_FLOAT_TO_INT);
             break;
+        case tcCastSignedToFixed:
+            EmitByte(previous ? OP_CAST_PREV_INT_TO_FIXED : OP_CAST_INT_TO_FIXED);
+            break;
+        case tcCastFixedToSigned:
+            EmitByte(previous ? OP_CAST_PREV_FIXED_TO_INT : OP_CAST_FIXED_TO_INT);
+            break;
+        case tcCastFloatToFixed:
+            EmitByte(previous ? OP_CAST_PREV_FLOAT_TO_FIXED : OP_CAST_FLOAT_TO_FIXED);
+            break;
+        case tcCastFixedToFloat:
+            EmitByte(previous ? OP_CAST_PREV_FIXED_TO_FLOAT : OP_CAST_FIXED_TO_FLOAT);
+            break;
         default:
             break;
     }
@@ -3040,6 +4418,11 @@ int Compiler::EmitJump(opCode_t jumpOp)
 
 void Compiler::PatchJump(int offset)
 {
+    // Code can now be reached from elsewhere, so nothing before here can be folded.
+    m_LastConstant    = ConstExpression();
+    m_UnsignedLoadEnd = NOT_SET;
+
+
     if (CurrentFunction()->Code[offset] != 0xFF && CurrentFunction()->Code[offset + 1] != 0xFF) {
         // Jump has already been patched
         return;
@@ -3076,6 +4459,10 @@ void Compiler::EmitCall(opCode_t callOp, int argsCount)
 
 void Compiler::EmitCallDirect(ScriptFunction *function, VariableInfo *parentVar)
 {
+    if (InConstExpr() && function != nullptr && !(function->Attributes & atConstExpr)) {
+        AddError("Constexpr function can't call '" + function->Name + "', which isn't constexpr.", LookBack());
+    }
+
     // Store the stack frame
     EmitByte(OP_FRAME);
 
@@ -3121,6 +4508,12 @@ void Compiler::SanityCheck()
             AddWarning("Variable '" + var->Name + "' is never used.", var->Token);
         }
     }
+
+    for (auto &constant : m_FoldedConstants) {
+        if (constant->Reads < 1) {
+            AddWarning("Variable '" + constant->Name + "' is never used.", constant->Token);
+        }
+    }
 }
 
 u32 Compiler::CodeSizeInBytes()
@@ -3204,6 +4597,423 @@ bool Compiler::PatchFunctionOffset(const std::string &name, funcPtr_t functionId
     return false;
 }
 
+/* Runs the bytecode optimisations over every finished function before they are laid out. */
+void Compiler::OptimiseFunctions()
+{
+    DeadCode deadCode(m_ConstValues);
+    Peephole peephole;
+    Inliner inliner(m_ConstValues);
+    TailCall tailCall(m_ConstValues);
+    LoopInvariant loopInvariant(m_ConstValues);
+    LoopUnroller unroller(m_ConstValues);
+    BoundsCheck boundsCheck(m_ConstValues);
+    ProfileGuide guide;
+    CodeLayout layout(m_ConstValues);
+    Immediates immediates(m_ConstValues);
+    u32 functionBytes = 0;
+    u32 constantBytes = 0;
+
+    // Optimising for size leaves out anything that trades bytes for speed.
+    const bool small = m_Flags & coOptimiseSize;
+
+    std::map<const ScriptFunction *, u32> profileStarts;
+    const bool profiled = !m_Profile.empty() && LoadProfile(guide, profileStarts);
+
+    std::set<ScriptFunction *> failed;
+    auto check = [&](ScriptFunction &func, bool ok) {
+        if (!ok && failed.insert(&func).second) {
+            AddWarning("Function '" + func.Name + "' could not be optimised.", func.Token);
+        }
+    };
+
+    PassManager passes;
+
+    // The profile is keyed by where the code was when it was profiled, so it's used before anything else changes it.
+    if (profiled) {
+        passes.AddFunctionPass("profile", [&](ScriptFunction &func) { guide.Run(func.Code, profileStarts[&func], func.Loops, func.Calls); });
+    }
+
+    // Loops are found by where they were parsed, so these have to run before anything else moves the code. The profile moves them along.
+    passes.AddFunctionPass("unroll", [&](ScriptFunction &func) {
+        if (small) {
+            for (auto &loop : func.Loops) {
+                loop.Hot = false;
+            }
+        }
+        unroller.Run(func.Code, func.TotalArgCount(), func.Loops, m_Flags & coUnrollLoops);
+        for (auto &loop : unroller.Refused()) {
+            AddWarning("Loop can't be unrolled. Only innermost for loops that count an int between constants can be.", loop.Token);
+        }
+    });
+
+    // Unrolled loops read their counters as constants, which is all the checks in them need to go.
+    if (m_Flags & coBoundsCheck) {
+        passes.AddFunctionPass("bounds-check", [&](ScriptFunction &func) { boundsCheck.Run(func.Code, func.Loops); });
+    }
+    passes.AddFunctionPass("loop-invariant", [&](ScriptFunction &func) {
+        loopInvariant.Run(func.Code, func.TotalArgCount(), func.Loops);
+        func.Loops.clear();
+    });
+
+    // Dead code is stripped again afterwards as threaded jumps can leave code behind them unreachable.
+    passes.AddFunctionPass("dead-code", [&](ScriptFunction &func) { check(func, deadCode.Run(func.Code)); });
+    passes.AddFunctionPass("peephole", [&](ScriptFunction &func) { check(func, peephole.Run(func.Code)); });
+    passes.AddFunctionPass("dead-code", [&](ScriptFunction &func) { check(func, deadCode.Run(func.Code)); });
+
+    passes.AddProgramPass("unused-warnings", [&](std::vector<ScriptFunction *> &) { CheckUnusedFunctions(); });
+
+    // Inline small functions into their callers, then tidy up the joins.
+    passes.AddProgramPass("inline", [&](std::vector<ScriptFunction *> &functions) {
+        // Optimising for size, functions are only inlined where the copies cost less than stripping the function saves.
+        std::map<funcPtr_t, u32> callSites;
+        for (auto func : functions) {
+            std::vector<Instruction> instructions;
+            if (!small || func == nullptr || !Bytecode::Decode(func->Code, instructions))
+                continue;
+
+            for (auto &instr : instructions) {
+                if (instr.IsTable || !Bytecode::IsConstant(instr.Op))
+                    continue;
+
+                const u32 index = Bytecode::ConstantIndex(instr);
+                if (index < m_ConstValues.size() && m_ConstValues[index].Type == dtFunction) {
+                    callSites[m_ConstValues[index].ConstValue.FuncPointer]++;
+                }
+            }
+        }
+
+        for (auto func : functions) {
+            if (func == nullptr || func->Name.empty())
+                continue;
+
+            // Functions the profile never saw called aren't worth growing their callers for. Hot ones are inlined whatever their size.
+            const bool asked = func->Attributes & atInline;
+            if (profiled && !asked && func->Calls == 0)
+                continue;
+
+            const bool forced = asked || (profiled && !small && guide.IsHot(func->Calls));
+            const u32 limit   = small ? Inliner::SizeLimitForSize(callSites[func->Id], func->Attributes & (atExport | atPeriodic)) : INLINE_SIZE_LIMIT;
+            if (!inliner.AddFunction(func->Id, func->Code, func->TotalArgCount(), func->Type == ftClassMethod, func->ReturnType, forced, limit) &&
+                asked) {
+                AddWarning("Function '" + func->Name + "' can't be inlined. Only functions without branches or loops can be.", func->Token);
+            }
+        }
+        for (auto func : functions) {
+            if (func != nullptr && inliner.Run(func->Code, func->TotalArgCount(), func->Id)) {
+                peephole.Run(func->Code);
+                deadCode.Run(func->Code);
+            }
+        }
+    });
+
+    // Calls left in tail position reuse the caller's frame. The returns behind them become unreachable.
+    passes.AddFunctionPass("tail-call", [&](ScriptFunction &func) {
+        if (tailCall.Run(func.Code)) {
+            deadCode.Run(func.Code);
+        }
+    });
+
+    // Cold arms of if statements are moved out of the way of the hot path once nothing else needs the code in order.
+    // Each one moved can cost a jump back.
+    if (!small) {
+        passes.AddFunctionPass("layout", [&](ScriptFunction &func) { layout.Run(func.Code, profiled); });
+    }
+
+    // Other passes find numbers through the constant pool, so they're only moved into the code at the end.
+    passes.AddProgramPass("immediates", [&](std::vector<ScriptFunction *> &functions) { immediates.Run(functions, small); });
+
+    passes.AddProgramPass("strip-functions", [&](std::vector<ScriptFunction *> &) { functionBytes = RemoveUnusedFunctions(); });
+    passes.AddProgramPass("compact-constants", [&](std::vector<ScriptFunction *> &) { constantBytes = CompactConstants(); });
+    passes.AddProgramPass("function-order", [&](std::vector<ScriptFunction *> &functions) { layout.OrderFunctions(functions, profiled); });
+
+    passes.Run(m_Functions);
+    m_PassStats = passes.Stats();
+
+    for (auto &stats : passes.Stats()) {
+        MSG_V("Pass " << stats.Name << ": " << stats.Changed << " function(s) changed in " << stats.Time.count() << " us");
+    }
+
+    for (auto &stats : peephole.Stats()) {
+        if (stats.Applied > 0) {
+            MSG_V("Peephole " << stats.Name << ": " << stats.Applied << " applied, " << stats.BytesSaved << " bytes saved");
+        }
+    }
+    MSG_V("Peephole total: " << peephole.TotalBytesSaved() << " bytes saved");
+
+    if (profiled) {
+        MSG_V("Profile: " << guide.BranchesSwapped() << " branches swapped, " << guide.LoopsHot() << " hot loops, " << guide.SwitchesWidened()
+                          << " switches widened");
+    }
+
+    MSG_V("Layout: " << layout.BlocksMoved() << " cold blocks moved");
+    MSG_V("Inlined " << inliner.CallsInlined() << " calls, " << inliner.BytesAdded() << " bytes added");
+    MSG_V("Immediates: " << immediates.LoadsReplaced() << " constant loads replaced");
+    MSG_V("Tail calls: " << tailCall.CallsReplaced());
+    MSG_V("Unrolled " << unroller.LoopsUnrolled() << " loops fully and " << unroller.LoopsPartlyUnrolled() << " partly, " << unroller.BytesAdded()
+                      << " bytes added");
+    if (m_Flags & coBoundsCheck) {
+        MSG_V("Bounds checks: " << boundsCheck.ChecksRemoved() << " removed, " << boundsCheck.ChecksKept() << " kept");
+    }
+    MSG_V("Loop invariants: " << loopInvariant.ExpressionsHoisted() << " expressions hoisted out of " << loopInvariant.LoopsChanged() << " loops");
+
+    MSG_V("Dead code: " << deadCode.BranchesFolded() << " constant branches, " << deadCode.BytesRemoved() << " unreachable bytes, " << functionBytes
+                        << " bytes of unused functions, " << constantBytes << " bytes of unused constants removed");
+}
+
+/*
+ * Reports where the code size goes and what each optimiser pass did, for trading size against speed and tracking changes between
+ * compiler versions. Dispatches is an estimate of the instructions one call runs, counting each loop as STATS_LOOP_PASSES passes.
+ */
+void Compiler::PrintStats()
+{
+    std::map<DataType, u32> constantTypes;
+    for (auto &constant : m_ConstValues) {
+        constantTypes[constant.Type]++;
+    }
+
+    MSG("");
+    MSG(std::left << std::setw(32) << "Function" << std::right << std::setw(8) << "Bytes" << std::setw(8) << "Consts" << std::setw(12)
+                  << "Dispatches");
+
+    u32 totalBytes      = 0;
+    u64 totalDispatches = 0;
+    for (auto func : m_Functions) {
+        if (func == nullptr)
+            continue;
+
+        const u32 bytes = func->Code.size() + (func->Name.empty() ? 0 : 1 + Bytecode::OperandSize(OP_FUNCTION_START));
+        totalBytes += bytes;
+
+        std::vector<Instruction> instructions;
+        if (!Bytecode::Decode(func->Code, instructions)) {
+            MSG(std::left << std::setw(32) << (func->Name.empty() ? "<Script>" : func->Name) << std::right << std::setw(8) << bytes);
+            continue;
+        }
+
+        std::set<u32> constants;
+        u64 dispatches               = 0;
+        const std::vector<int> depth = Bytecode::LoopDepths(instructions);
+        for (size_t i = 0; i < instructions.size(); ++i) {
+            if (instructions[i].IsTable)
+                continue;
+
+            if (Bytecode::IsConstant(instructions[i].Op)) {
+                constants.insert(Bytecode::ConstantIndex(instructions[i]));
+            }
+
+            u64 runs = 1;
+            for (int d = 0; d < depth[i]; ++d) {
+                runs *= STATS_LOOP_PASSES;
+            }
+            dispatches += runs;
+        }
+        totalDispatches += dispatches;
+
+        MSG(std::left << std::setw(32) << (func->Name.empty() ? "<Script>" : func->Name) << std::right << std::setw(8) << bytes << std::setw(8)
+                      << constants.size() << std::setw(12) << dispatches);
+    }
+    MSG(std::left << std::setw(32) << "Total" << std::right << std::setw(8) << totalBytes << std::setw(8) << m_ConstValues.size() << std::setw(12)
+                  << totalDispatches);
+
+    MSG("");
+    MSG("Constants: " << m_ConstValues.size() << " (" << ConstantsSizeInBytes() << " bytes)");
+    for (auto &[type, count] : constantTypes) {
+        MSG("  " << std::left << std::setw(30) << DataTypeToString(type) << std::right << std::setw(8) << count);
+    }
+    MSG("Strings: " << m_ConstStrings.size() << " (" << m_StringData.size() << " bytes)");
+
+    if (m_PassStats.empty()) {
+        return;
+    }
+
+    MSG("");
+    MSG(std::left << std::setw(32) << "Pass" << std::right << std::setw(8) << "Runs" << std::setw(8) << "Changed" << std::setw(12) << "Removed"
+                  << std::setw(12) << "Time (us)");
+    for (auto &stats : m_PassStats) {
+        MSG(std::left << std::setw(32) << stats.Name << std::right << std::setw(8) << stats.Runs << std::setw(8) << stats.Changed << std::setw(12)
+                      << stats.Removed << std::setw(12) << stats.Time.count());
+    }
+}
+
+/* Finds every function that can be called from the top level, an export or a task. Returns false if the calls can't be followed. */
+bool Compiler::FindUsedFunctions(std::set<ScriptFunction *> &outUsed)
+{
+    std::map<funcPtr_t, ScriptFunction *> functions;
+    std::vector<ScriptFunction *> pending;
+    for (auto func : m_Functions) {
+        if (func == nullptr)
+            continue;
+
+        functions.emplace(func->Id, func);
+        if (func->Name.empty() || (func->Attributes & (atExport | atPeriodic))) {
+            pending.push_back(func);
+        }
+    }
+
+    // Calls are made through function constants, so follow every constant a function loads.
+    outUsed = std::set<ScriptFunction *>(pending.begin(), pending.end());
+    while (!pending.empty()) {
+        ScriptFunction *func = pending.back();
+        pending.pop_back();
+
+        std::vector<Instruction> instructions;
+        if (!Bytecode::Decode(func->Code, instructions)) {
+            return false;
+        }
+
+        for (auto &instr : instructions) {
+            if (instr.IsTable || !Bytecode::IsConstant(instr.Op))
+                continue;
+
+            const u32 index = Bytecode::ConstantIndex(instr);
+            if (index >= m_ConstValues.size() || m_ConstValues[index].Type != dtFunction)
+                continue;
+
+            auto callee = functions.find(m_ConstValues[index].ConstValue.FuncPointer);
+            if (callee != functions.end() && outUsed.insert(callee->second).second) {
+                pending.push_back(callee->second);
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Reads the execution profile and finds where each function was in the code it was taken from. Returns false if it doesn't match. */
+bool Compiler::LoadProfile(ProfileGuide &guide, std::map<const ScriptFunction *, u32> &outStarts)
+{
+    if (!guide.Load(m_Profile)) {
+        AddWarning("Execution profile can't be read. It has been ignored.", 0, 0);
+        return false;
+    }
+
+    // Lay the code out the same way WriteBinaryFile() does. Nothing has been optimised yet.
+    std::vector<u8> code;
+    for (auto func : m_Functions) {
+        if (func == nullptr)
+            continue;
+
+        if (!func->Name.empty()) {
+            code.push_back(OP_FUNCTION_START);
+            code.push_back((u8)func->ReturnType);
+            code.push_back((u8)func->TotalArgCount());
+        }
+        outStarts[func] = code.size();
+        code.insert(code.end(), func->Code.begin(), func->Code.end());
+    }
+    while (code.size() % 4 > 0) {
+        code.push_back(0x00);
+    }
+
+    if (Checksum::Calculate(code.data(), code.size()) != guide.CodeChecksum()) {
+        AddWarning("Execution profile doesn't match the script. It has to be taken from a build with -O0. It has been ignored.", 0, 0);
+        return false;
+    }
+
+    return true;
+}
+
+/* Warns about functions that are never called. */
+void Compiler::CheckUnusedFunctions()
+{
+    std::set<ScriptFunction *> used;
+    if (!FindUsedFunctions(used))
+        return;
+
+    for (auto func : m_Functions) {
+        // Hidden functions, eg. class initialisers, are only unused when their class is.
+        if (func != nullptr && !used.contains(func) && !func->Name.starts_with("__") && func->Evaluated == 0) {
+            AddWarning("Function '" + func->Name + "' is never used", func->Token);
+        }
+    }
+}
+
+/* Removes functions that are no longer called, eg. because every call was inlined. Returns the bytes saved. */
+u32 Compiler::RemoveUnusedFunctions()
+{
+    std::set<ScriptFunction *> used;
+    if (!FindUsedFunctions(used)) {
+        // Can't see what it calls. Keep everything.
+        return 0;
+    }
+
+    u32 saved = 0;
+    for (auto &func : m_Functions) {
+        if (func == nullptr || used.contains(func))
+            continue;
+
+        saved += func->Code.size() + 1 + Bytecode::OperandSize(OP_FUNCTION_START);
+        delete func;
+        func = nullptr;
+    }
+
+    return saved;
+}
+
+/* Drops constants that no remaining code loads and renumbers the rest. Returns the bytes saved. */
+u32 Compiler::CompactConstants()
+{
+    std::vector<std::vector<Instruction>> decoded;
+    std::vector<bool> used(m_ConstValues.size(), false);
+    for (auto func : m_Functions) {
+        if (func == nullptr)
+            continue;
+
+        decoded.emplace_back();
+        if (!Bytecode::Decode(func->Code, decoded.back())) {
+            // Can't see which constants it loads. Keep everything.
+            return 0;
+        }
+
+        for (auto &instr : decoded.back()) {
+            if (!instr.IsTable && Bytecode::IsConstant(instr.Op) && Bytecode::ConstantIndex(instr) < used.size()) {
+                used[Bytecode::ConstantIndex(instr)] = true;
+            }
+        }
+    }
+
+    std::vector<ConstantInfo> constants;
+    std::vector<u32> remap(m_ConstValues.size(), 0);
+    for (size_t i = 0; i < m_ConstValues.size(); ++i) {
+        if (used[i]) {
+            remap[i] = constants.size();
+            constants.push_back(m_ConstValues[i]);
+        }
+    }
+
+    if (constants.size() == m_ConstValues.size()) {
+        return 0;
+    }
+
+    // Encode everything first so nothing changes if a function no longer fits.
+    std::vector<std::vector<opCode_t>> encoded;
+    for (auto &instructions : decoded) {
+        for (auto &instr : instructions) {
+            if (!instr.IsTable && Bytecode::IsConstant(instr.Op)) {
+                Bytecode::SetConstantIndex(instr, remap[Bytecode::ConstantIndex(instr)]);
+            }
+        }
+
+        encoded.emplace_back();
+        if (!Bytecode::Encode(instructions, encoded.back())) {
+            return 0;
+        }
+    }
+
+    u32 saved = (m_ConstValues.size() - constants.size()) * sizeof(Value);
+    size_t f  = 0;
+    for (auto func : m_Functions) {
+        if (func == nullptr)
+            continue;
+
+        saved += func->Code.size() - encoded[f].size();
+        func->Code = encoded[f++];
+    }
+
+    m_ConstValues = constants;
+    return saved;
+}
+
 StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
 {
 #define WRITE_BYTE(data) fileBytes.push_back(data)
@@ -3220,7 +5030,7 @@ StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
     // Write Header
     ScriptBinaryHeader header{
         .HeaderSize       = sizeof(ScriptBinaryHeader),
-        .Flags            = m_Flags,
+        .Flags            = (u8)(m_Flags & HEADER_OPTIONS),
         .LangVersionMajor = LANG_VERSION_MAJOR,
         .LangVersionMinor = LANG_VERSION_MINOR,
         .BuildDay         = buildDay,
@@ -3228,6 +5038,9 @@ StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
         .CodePos          = 0,
         .ConstantsPos     = 0,
         .StringsPos       = 0,
+        .TasksPos         = 0,
+        .ExportsPos       = 0,
+        .SymbolsPos       = 0,
         .GlobalsSize      = GlobalsSizeInBytes(),
         .TotalSize        = 0,
         .CheckSum         = 0 // Gets patched at the end
@@ -3245,20 +5058,32 @@ StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
     PADD_BYTES
     u32 codeStart = FILE_POS;
     std::map<funcPtr_t, std::string> functionsMap;
+    std::vector<TaskInfo> tasks;
+    std::vector<ExportInfo> exports;
     for (auto func : m_Functions) {
         if (func == nullptr)
             continue;
 
         u32 funcPos = FILE_POS - codeStart;
-        // Patch function pointers
-        if (!PatchFunctionOffset(func->Name, func->Id, funcPos)) {
-            AddWarning("Function '" + func->Name + "' is never used", func->Token);
-            continue;
-        }
+        // Patch function pointers. Unused functions have already been removed.
+        PatchFunctionOffset(func->Name, func->Id, funcPos);
 
         // Output the function to the function map for debugging
         functionsMap.emplace(funcPos, func->Name.empty() ? "<Script>" : func->Name);
 
+        if (func->Attributes & atPeriodic) {
+            tasks.push_back({ .Function = funcPos, .Period = func->Period });
+        }
+
+        if (func->Attributes & atExport) {
+            // The name is added to the strings so the host can look the function up.
+            exports.push_back({ .Function   = funcPos,
+                                .Name       = AddString(func->Name),
+                                .ReturnType = (u8)func->ReturnType,
+                                .ArgCount   = (u8)func->TotalArgCount(),
+                                .Reserved   = 0 });
+        }
+
         // Function header (skipped for top level)
         if (!func->Name.empty()) {
             WRITE_BYTE(OP_FUNCTION_START);
@@ -3272,6 +5097,27 @@ StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
         }
     }
 
+    // Global symbols for the host. Names must be added before the strings are written.
+    std::vector<SymbolInfo> symbols;
+    if (m_Flags & CompileOptions::coSymbolTable) {
+        for (auto global : m_Globals) {
+            // Skip hidden variables. Eg: Array slots.
+            if (global == nullptr || global->Name.starts_with("__"))
+                continue;
+
+            if (global->Type() < dtBool || global->Type() > dtFloat)
+                continue;
+
+            std::string name = global->ParentInstance.empty() ? global->Name : global->ParentInstance + "." + global->Name;
+            symbols.push_back({ .Name     = AddString(name),
+                                .Slot     = (u16)global->Address(),
+                                .Size     = (u16)global->Size,
+                                .Type     = (u8)global->Type(),
+                                .Flags    = (u8)(global->Flags & (vfArray | vfConst)),
+                                .Reserved = 0 });
+        }
+    }
+
     // Write Constants Code
     PADD_BYTES
     u32 codeSize       = FILE_POS - codeStart;
@@ -3290,7 +5136,38 @@ StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
     for (auto &c : m_StringData) {
         WRITE_BYTE((uint8_t)c);
     }
+
+    // Write Periodic Tasks
+    PADD_BYTES
     u32 stringsSize = FILE_POS - stringsStart;
+    u32 tasksStart  = FILE_POS;
+    for (auto &task : tasks) {
+        auto *bytes = (uint8_t *)&task;
+        for (size_t b = 0; b < sizeof(TaskInfo); b++) {
+            WRITE_BYTE(bytes[b]);
+        }
+    }
+    u32 tasksSize = FILE_POS - tasksStart;
+
+    // Write Exports
+    u32 exportsStart = FILE_POS;
+    for (auto &exportInfo : exports) {
+        auto *bytes = (uint8_t *)&exportInfo;
+        for (size_t b = 0; b < sizeof(ExportInfo); b++) {
+            WRITE_BYTE(bytes[b]);
+        }
+    }
+    u32 exportsSize = FILE_POS - exportsStart;
+
+    // Write Symbols
+    u32 symbolsStart = FILE_POS;
+    for (auto &symbol : symbols) {
+        auto *bytes = (uint8_t *)&symbol;
+        for (size_t b = 0; b < sizeof(SymbolInfo); b++) {
+            WRITE_BYTE(bytes[b]);
+        }
+    }
+    u32 symbolsSize = FILE_POS - symbolsStart;
 
     /* Globals do not need to be in the code */
 
@@ -3304,6 +5181,9 @@ StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
     fileHeader->CodePos      = codeStart;
     fileHeader->ConstantsPos = constantsStart;
     fileHeader->StringsPos   = stringsStart;
+    fileHeader->TasksPos     = tasksStart;
+    fileHeader->ExportsPos   = exportsStart;
+    fileHeader->SymbolsPos   = symbolsStart;
     fileHeader->TotalSize    = totalSize;
 
     // Write the final binary file output
@@ -3328,7 +5208,9 @@ StatusCode Compiler::WriteBinaryFile(const std::string &filePath)
     return SetResult(stsBinaryFileDone,
                      "Binary file written: " + filePath + "\n" + "Header:         " + std::to_string(header.HeaderSize) + " bytes\n" +
                          "Code:           " + std::to_string(codeSize) + " bytes\n" + "Constants:      " + std::to_string(constantsSize) + " bytes\n" +
-                         "Strings:        " + std::to_string(stringsSize) + " bytes\n" + "Globals:        " + std::to_string(header.GlobalsSize) + " bytes\n" +
+                         "Strings:        " + std::to_string(stringsSize) + " bytes\n" + "Tasks:          " + std::to_string(tasksSize) + " bytes\n" +
+                         "Exports:        " + std::to_string(exportsSize) + " bytes\n" + "Symbols:        " + std::to_string(symbolsSize) + " bytes\n" +
+                         "Globals:        " + std::to_string(header.GlobalsSize) + " bytes\n" +
                          "Total:          " + std::to_string(totalSize) + " bytes\n" + "Min Slots Size: " + std::to_string((m_LocalsMax * sizeof(Value))) +
                          " bytes\n\r");
 
@@ -3358,6 +5240,10 @@ void Compiler::Cleanup()
     for (const auto shared : m_SharedGlobals) {
         delete (shared);
     }
+    for (const auto constant : m_FoldedConstants) {
+        delete (constant);
+    }
+    m_FoldedConstants.clear();
 
     m_ConstValues.clear();
     m_ConstStrings.clear();
@@ -3374,8 +5260,16 @@ std::string Compiler::DataTypeToString(const DataType dataType)
             return "int";
         case dtUint32:
             return "uint";
+        case dtFixed:
+            return "fixed";
         case dtFloat:
             return "float";
+        case dtVec2:
+            return "vec2";
+        case dtVec3:
+            return "vec3";
+        case dtVec4:
+            return "vec4";
         case dtBool:
             return "bool";
         case dtInt8:
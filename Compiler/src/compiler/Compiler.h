@@ -10,12 +10,19 @@
 #include "CompilerBase.h"
 #include "CompilerData.h"
 #include "ErrorHandler.h"
+#include "Folding.h"
 #include "Function.h"
 #include "Lexer.h"
 #include "Native.h"
+#include "PassManager.h"
 #include "Rules.h"
+#include "SwitchTable.h"
 #include "TypeSystem.h"
 #include "Variable.h"
+#include <map>
+#include <set>
+
+class ProfileGuide;
 
 class Compiler : public CompilerBase
 {
@@ -23,7 +30,7 @@ class Compiler : public CompilerBase
     explicit Compiler(ErrorHandler *errorHandler,
                       NativeFunctionParser *nativeFuncs,
                       const std::string &script,
-                      const u8 flags              = 0,
+                      const u32 flags             = 0,
                       const std::string &fileName = "");
     ~Compiler();
 
@@ -36,6 +43,9 @@ class Compiler : public CompilerBase
 
     StatusCode WriteBinaryFile(const std::string &filePath);
 
+    /* Execution profile written by the VM. Must be taken from the same script compiled with the optimiser off. */
+    void UseProfile(const std::vector<u8> &profile);
+
     StatusCode Result();
     std::string Message();
 
@@ -44,16 +54,19 @@ class Compiler : public CompilerBase
   private:
     static Compiler *m_Compiler;
     NativeFunctionParser *m_NativeFuncs;
-    u8 m_Flags;
+    u32 m_Flags; // CompileOptions
     std::string m_TopLevelFileName;
     PreProcessor m_PreProcessor;
     StatusCode m_Result = stsOk;
 
     std::vector<ConstantInfo> m_ConstValues;
+    std::vector<u8> m_Profile;
+    std::vector<PassStats> m_PassStats;
 
     bool CheckFunction(const Token &token);
     bool CheckMethod(const Token &token, VariableInfo *parentVar);
     bool CheckNativeFunction(const Token &token);
+    bool CheckChannel(const Token &token);
 
     /* Classes */
     ClassInfo *m_CurrentClass = nullptr;
@@ -77,6 +90,7 @@ class Compiler : public CompilerBase
     ScriptFunction *FindScriptFunction(const std::string &name);
     ScriptFunction *ResolveMethod(const std::string &name, VariableInfo *parentVar);
     int EndFunction();
+    bool InConstExpr();
     void ConditionalBegin();
     void ConditionalEnd();
 
@@ -90,6 +104,7 @@ class Compiler : public CompilerBase
     int m_ScopeDepth             = 0;
     u32 m_LocalsMax              = 0;
     VariableInfo *m_CurrentArray = nullptr;
+    int m_CurrentArrayEnd        = NOT_SET; // Code position just after the pointer to m_CurrentArray
     VarScopeType CurrentScope() const;
 
     VariableInfo *CreateVariable(const std::string &name, VarScopeType scope, DataType dataType, u32 flags);
@@ -110,6 +125,7 @@ class Compiler : public CompilerBase
     VariableInfo *ResolveLocal(const std::string &name, const std::string &parent = "");
     VariableInfo *ResolveMember(ClassInfo *parentClass, const std::string &name);
     VariableInfo *ResolveVariable(const std::string &name, const std::string &parentInstance = "");
+    VariableInfo *ResolveFoldedConstant(const std::string &name);
     void Destroy(VariableInfo *variable);
     u32 AddConstant(const ConstantInfo &constant);
     u32 AddString(const std::string &str);
@@ -117,7 +133,9 @@ class Compiler : public CompilerBase
     VariableInfo *ParseVariable(DataType dataType, u32 flags, const std::string &errorMessage = "");
     void NamedVariable(const Token &token, bool canAssign);
     void NamedFunction(const Token &token);
+    void EvaluateCall(ScriptFunction *function, int callStart, const Token &token);
     void NamedMethod(const Token &token, VariableInfo *parentVar);
+    void EmitReturnCast(const ScriptFunction *function);
     VariableInfo *DeclareVariable(DataType dataType, u32 flags);
     void DefineVariable(VariableInfo *variable, DataType inputType);
     void MarkInitialised(VarScopeType scope);
@@ -125,16 +143,55 @@ class Compiler : public CompilerBase
     void AssignVariable(VariableInfo *variable, TokenType assignToken);
     void AssignArrayIndex(DataType arrayType, TokenType assignToken);
 
+    /* Vectors */
+    void EmitComponentPointer(const VariableInfo *vector, int index);
+    bool CheckVector();
+    VariableInfo *VectorOperand(DataType type);
+    void VectorExpression(VariableInfo *dest);
+    void VectorOperation(VariableInfo *dest, TokenType operatorType);
+    bool VectorAssignment();
+    void VectorComponent(VariableInfo *vector, bool canAssign);
+    bool CheckVectorFunction(const Token &token);
+    void VectorFunction(const Token &token);
+
+    /* Intrinsics */
+    static const IntrinsicInfo *FindIntrinsic(const std::string &name);
+    bool CheckIntrinsic(const Token &token);
+    void Intrinsic(const Token &token);
+
+    /* Constant Folding */
+    ConstExpression m_LastConstant;
+    std::vector<VariableInfo *> m_FoldedConstants;
+    void EmitFoldableConstant(const ConstantInfo &constant);
+    bool TopConstant(ConstExpression &outConstant);
+    void DiscardConstant(const ConstExpression &constant);
+    bool FoldConstantVariable(VariableInfo *variable, int expressionStart, DataType inputType);
+
+    /* Strength Reduction */
+    int m_UnsignedLoadFunction = NOT_SET;
+    int m_UnsignedLoadEnd      = NOT_SET;
+    bool TopUnsignedLoad();
+    bool ReduceStrength(TokenType operatorType, DataType binaryType, DataType lhsType, DataType rhsType, const ConstExpression &rhsConstant,
+                        bool lhsUnsigned);
+
     /* Scope */
     void ScopeBegin();
     int DiscardLocals(int depth);
     void ScopeEnd(bool pop = true);
 
+    /* Attributes */
+    AttributeInfo m_Attributes;
+    void AttributeList();
+    void Attribute();
+    AttributeInfo TakeAttributes();
+
     /* Parser Functions */
     void Declaration();
     void Statement();
     DataType Expression();
+    void TypedExpression(DataType type);
     ConstantInfo ParseNumericLiteral();
+    static bool ParseIntegerLiteral(const std::string &text, int &outValue);
     void NumericLiteral();
     void String();
     void Variable(bool canAssign);
@@ -158,6 +215,8 @@ class Compiler : public CompilerBase
     void ClassDeclaration();
     void TypeDeclaration(DataType dataType, u32 flags);
     void ArrayDeclaration(DataType dataType, u32 flags);
+    void ArrayFromFunction(const std::string &name, DataType dataType, int count);
+    void VectorDeclaration(DataType dataType, u32 flags);
     void ClassInstanceDeclaration();
     void FunctionDeclaration(DataType dataType);
     void MethodDeclaration(DataType dataType);
@@ -166,6 +225,7 @@ class Compiler : public CompilerBase
     void DestructorDeclaration();
     void IfStatement();
     void ReturnStatement();
+    LoopRange LoopStatement();
     void WhileStatement();
     void ForStatement();
     void SwitchStatement();
@@ -174,7 +234,13 @@ class Compiler : public CompilerBase
     void ExpressionStatement();
 
     SwitchInfo *m_CurrentSwitch = nullptr;
-    void SwitchAsIfElse();
+    void SwitchAsIfElse(DataType switchType);
+    void ScanCaseLabels(SwitchTable &outTable);
+    bool CaseLabel(DataType switchType, s32 &outLow, s32 &outHigh);
+    bool CaseValue(DataType switchType, s32 &outValue);
+    void EmitDenseTable(const SwitchTable &cases, int defaultCase);
+    void EmitSparseTable(const SwitchTable &cases, int defaultCase);
+    void EmitHashedTable(const SwitchTable &cases, int defaultCase, u32 multiplier, u8 bits);
     void SwitchBegin(SwitchInfo *switchInfo);
     void SwitchBody();
     void SwitchEnd();
@@ -192,6 +258,10 @@ class Compiler : public CompilerBase
     bool PatchFunctionOffset(const std::string &name, funcPtr_t functionId, u32 offset);
     void NativeFunction(const Token &token);
 
+    /* Channels */
+    ChannelInfo *ResolveChannel(const std::string &name);
+    void Channel(const Token &token);
+
     /* Byte Code Output */
     void EmitByte(opCode_t byte);
     void EmitBytes(opCode_t byte0, opCode_t byte1);
@@ -209,6 +279,7 @@ class Compiler : public CompilerBase
     void EmitGetFromOffset(DataType dataType, DataType outputType);
     void EmitSetAtOffset(DataType dataType, DataType inputType);
     void EmitCast(TypeCompatibility castMode, bool previous = false);
+    bool Saturating();
     void EmitAdd(DataType type);
     void EmitSubtract(DataType type);
     void EmitMultiply(DataType type);
@@ -234,6 +305,13 @@ class Compiler : public CompilerBase
     void EmitReturn();
 
     void EndCompile();
+    void OptimiseFunctions();
+    void PrintStats();
+    bool LoadProfile(ProfileGuide &guide, std::map<const ScriptFunction *, u32> &outStarts);
+    bool FindUsedFunctions(std::set<ScriptFunction *> &outUsed);
+    void CheckUnusedFunctions();
+    u32 RemoveUnusedFunctions();
+    u32 CompactConstants();
     void SanityCheck();
     u32 GetCodeSize();
     u32 CalculateChecksum(const u8 *data, u32 length);
@@ -193,7 +193,11 @@ void CompilerBase::Synchronize()
             case tknUShort:
             case tknInt:
             case tknUInt:
+            case tknFixed:
             case tknFloat:
+            case tknVec2:
+            case tknVec3:
+            case tknVec4:
             case tknFor:
             case tknIf:
             case tknWhile:
@@ -237,8 +241,16 @@ bool CompilerBase::MatchTypeDeclaration(DataType &outDataType, u32 &outFlags)
         outDataType = dtInt32;
     } else if (Match(tknUInt)) {
         outDataType = dtUint32;
+    } else if (Match(tknFixed)) {
+        outDataType = dtFixed;
     } else if (Match(tknFloat)) {
         outDataType = dtFloat;
+    } else if (Match(tknVec2)) {
+        outDataType = dtVec2;
+    } else if (Match(tknVec3)) {
+        outDataType = dtVec3;
+    } else if (Match(tknVec4)) {
+        outDataType = dtVec4;
     } else if (Match(tknString)) {
         outDataType = dtString;
     } else {
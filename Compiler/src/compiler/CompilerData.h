@@ -6,7 +6,9 @@
 #define COMPILERDATA_H_
 
 #include "Instructions.h"
+#include "Tokens.h"
 #include "Value.h"
+#include "Variable.h"
 #include <string>
 #include <vector>
 
@@ -16,6 +18,33 @@ struct StringData {
     std::string String;
 };
 
+enum AttributeFlags : u32 {
+    atNone      = 0x00,
+    atPeriodic  = 0x01,
+    atExport    = 0x02,
+    atInline    = 0x04,
+    atUnroll    = 0x08,
+    atNoUnroll  = 0x10,
+    atConstExpr = 0x20,
+    atSaturate  = 0x40,
+};
+
+#define LOOP_ATTRIBUTES (atUnroll | atNoUnroll)
+
+/* Attributes written in square brackets before a declaration. Eg: [periodic 10] void Update() {...} */
+struct AttributeInfo {
+    u32 Flags = atNone; // AttributeFlags
+
+    // Period of a periodic task in milliseconds.
+    u32 Period = 0;
+
+    // Times to unroll a loop by. 0 to unroll it fully.
+    u32 Unroll = 0;
+
+    // First token of the attribute list, for error reporting.
+    Token Token;
+};
+
 struct SwitchInfo {
     // Data type of the input expression
     DataType Type;
@@ -30,6 +59,9 @@ struct SwitchInfo {
     // Depth of the scope(s) that need to be exited if a break is hit inside the loop.
     int ScopeDepth = NOT_SET;
 
+    // Jump arguments of the break statements to patch once the end is known.
+    std::vector<int> Breaks;
+
     // The loop enclosing this one, or NULL if this is the outermost loop.
     SwitchInfo *Enclosing = nullptr;
 };
@@ -48,8 +80,49 @@ struct LoopInfo {
     // Depth of the scope(s) that need to be exited if a break is hit inside the loop.
     int ScopeDepth = NOT_SET;
 
+    // Jump arguments of the break statements to patch once the end is known.
+    std::vector<int> Breaks;
+
     // The loop enclosing this one, or NULL if this is the outermost loop.
     LoopInfo *Enclosing = nullptr;
 };
 
+/* The most recently emitted constant that could still be folded into the expression around it. */
+struct ConstExpression {
+    // Function the constant was emitted into.
+    int FunctionId = NOT_SET;
+
+    // Code positions of the constant instruction.
+    int Start = NOT_SET;
+    int End   = NOT_SET;
+
+    // Index in the constant pool, and if the pool grew to hold it.
+    u32 Index     = 0;
+    bool NewEntry = false;
+
+    ConstantInfo Constant = { dtNone, INT32_VAL(0) };
+};
+
+enum IntrinsicArgs : u8 {
+    iaNumber,  // Any number. The first argument sets the type.
+    iaFloat,   // Always cast to float.
+    iaInteger, // Any integer. The first argument sets the type.
+};
+
+/* A function built into the language. It compiles to a single instruction instead of a native call. Eg: abs(x), extract(reg, 4, 8) */
+struct IntrinsicInfo {
+    const char *Name;
+    int ArgCount;
+
+    // Trailing arguments that must be constants. They follow the instruction as bytes instead of being pushed.
+    int Immediates;
+
+    // Instruction for each type of argument. Fixed point values use the signed one. OP_NOP if nothing needs doing.
+    opCode_t SignedOp;
+    opCode_t UnsignedOp;
+    opCode_t FloatOp;
+
+    IntrinsicArgs Args;
+};
+
 #endif // COMPILERDATA_H_
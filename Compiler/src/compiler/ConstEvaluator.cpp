@@ -0,0 +1,213 @@
+#include "ConstEvaluator.h"
+#include "Bytecode.h"
+#include "Checksum.h"
+#include "MecVm.h"
+#include "ScriptInfo.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// The called function is laid out straight after the top level code, which is a single OP_END.
+#define EVAL_FUNCTION_OFFSET 1
+
+static std::string StatusToString(const VmStatus status)
+{
+    switch (status) {
+        case vmStop:
+            return "took longer than " + std::to_string(CONSTEXPR_TIME_LIMIT) + " ms";
+        case vmStackUnderflow:
+            return "stack underflow";
+        case vmStackOverflow:
+        case vmCallFrameOverflow:
+            return "ran out of stack";
+        case vmCallArgCountError:
+        case vmCallNotAFunction:
+        case vmCalledNonCallable:
+            return "bad function call";
+        case vmNativeFunctionNotResolved:
+            return "called a native function";
+        case vmChannelNotResolved:
+        case vmWaiting:
+            return "used a channel";
+        case vmIndexOutOfBounds:
+            return "indexed an array out of bounds";
+        case vmDivideByZero:
+            return "divided by zero";
+        case vmDivideOverflow:
+            return "divided INT32_MIN by -1";
+        default:
+            return "error " + std::to_string((int)status);
+    }
+}
+
+ConstEvaluator::ConstEvaluator(const std::vector<ScriptFunction *> &functions, const std::vector<ConstantInfo> &constants,
+                               const std::vector<char> &strings)
+    : m_Functions(functions), m_Constants(constants), m_Strings(strings)
+{
+}
+
+const std::string &ConstEvaluator::Error() const
+{
+    return m_Error;
+}
+
+/* Finds the function and everything it can call, the function first. Returns false if any of them are still being compiled. */
+bool ConstEvaluator::FindCallees(const ScriptFunction *function, const ScriptFunction *compiling, std::vector<const ScriptFunction *> &outCallees) const
+{
+    std::map<funcPtr_t, const ScriptFunction *> functions;
+    for (auto func : m_Functions) {
+        if (func != nullptr) {
+            functions.emplace(func->Id, func);
+        }
+    }
+
+    outCallees = { function };
+    for (size_t i = 0; i < outCallees.size(); ++i) {
+        for (const ScriptFunction *open = compiling; open != nullptr; open = open->Enclosing) {
+            if (open == outCallees[i]) {
+                return false;
+            }
+        }
+
+        std::vector<Instruction> instructions;
+        if (!Bytecode::Decode(outCallees[i]->Code, instructions)) {
+            return false;
+        }
+
+        // Calls are made through function constants.
+        for (auto &instr : instructions) {
+            if (instr.IsTable || !Bytecode::IsConstant(instr.Op))
+                continue;
+
+            const u32 index = Bytecode::ConstantIndex(instr);
+            if (index >= m_Constants.size() || m_Constants[index].Type != dtFunction)
+                continue;
+
+            auto callee = functions.find(m_Constants[index].ConstValue.FuncPointer);
+            if (callee != functions.end() && std::find(outCallees.begin(), outCallees.end(), callee->second) == outCallees.end()) {
+                outCallees.push_back(callee->second);
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Lays out a script image the same way Compiler::WriteBinaryFile() does, with no globals, tasks, exports or symbols. */
+void ConstEvaluator::BuildImage(const std::vector<const ScriptFunction *> &callees, std::vector<u8> &outImage) const
+{
+    auto padd = [&outImage]() {
+        while (outImage.size() % 4 > 0) {
+            outImage.push_back(0x00);
+        }
+    };
+
+    outImage.assign(sizeof(ScriptBinaryHeader), 0x00);
+    padd();
+
+    const u32 codeStart = outImage.size();
+    outImage.push_back(OP_END);
+
+    std::vector<ConstantInfo> constants = m_Constants;
+    for (auto func : callees) {
+        const u32 funcPos = outImage.size() - codeStart;
+        for (auto &constant : constants) {
+            if (constant.Type == dtFunction && constant.ConstValue.FuncPointer == (funcPtr_t)func->Id) {
+                constant.ConstValue.FuncPointer = funcPos;
+                break;
+            }
+        }
+
+        outImage.push_back(OP_FUNCTION_START);
+        outImage.push_back((u8)func->ReturnType);
+        outImage.push_back((u8)func->TotalArgCount());
+        outImage.insert(outImage.end(), func->Code.begin(), func->Code.end());
+    }
+
+    padd();
+    const u32 constantsStart = outImage.size();
+    for (auto &constant : constants) {
+        auto *bytes = (const u8 *)&constant.ConstValue;
+        outImage.insert(outImage.end(), bytes, bytes + sizeof(Value));
+    }
+
+    padd();
+    const u32 stringsStart = outImage.size();
+    outImage.insert(outImage.end(), m_Strings.begin(), m_Strings.end());
+
+    padd();
+    const u32 totalSize = outImage.size();
+
+    ScriptBinaryHeader header{};
+    header.HeaderSize       = sizeof(ScriptBinaryHeader);
+    header.LangVersionMajor = LANG_VERSION_MAJOR;
+    header.LangVersionMinor = LANG_VERSION_MINOR;
+    header.CodePos          = codeStart;
+    header.ConstantsPos     = constantsStart;
+    header.StringsPos       = stringsStart;
+    header.TasksPos         = totalSize;
+    header.ExportsPos       = totalSize;
+    header.SymbolsPos       = totalSize;
+    header.TotalSize        = totalSize;
+    header.CheckSum         = Checksum::Calculate(outImage.data() + codeStart, totalSize - codeStart);
+    memcpy(outImage.data(), &header, sizeof(ScriptBinaryHeader));
+}
+
+bool ConstEvaluator::Evaluate(const ScriptFunction *function, const std::vector<Value> &args, const ScriptFunction *compiling, Value &outResult)
+{
+    m_Error.clear();
+
+    std::vector<const ScriptFunction *> callees;
+    if (function == nullptr || !FindCallees(function, compiling, callees)) {
+        return false;
+    }
+
+    std::vector<u8> image;
+    BuildImage(callees, image);
+
+    std::vector<Value> stack(CONSTEXPR_STACK_SIZE, INT32_VAL(0));
+    ScriptInfo script{};
+    if (MecVm::DecodeScript(image.data(), image.size(), (u8 *)stack.data(), stack.size() * sizeof(Value), &script) == 0) {
+        m_Error = "bad script image";
+        return false;
+    }
+
+    // Runs the top level code, which just ends, so the function can be invoked.
+    MecVm vm;
+    vm.Run(&script);
+
+    ExportInfo entry{};
+    entry.Function   = EVAL_FUNCTION_OFFSET;
+    entry.ReturnType = (u8)function->ReturnType;
+    entry.ArgCount   = (u8)args.size();
+
+    // Stops functions that never return. The VM checks its status before every instruction.
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::thread watchdog([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!finished.wait_for(lock, std::chrono::milliseconds(CONSTEXPR_TIME_LIMIT), [&done]() { return done; })) {
+            vm.Stop();
+        }
+    });
+
+    const bool ok = vm.Invoke(&entry, args.data(), (int)args.size(), &outResult);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    finished.notify_one();
+    watchdog.join();
+
+    if (!ok) {
+        m_Error = StatusToString(vm.GetStatus());
+    }
+
+    return ok;
+}
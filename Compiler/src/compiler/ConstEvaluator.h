@@ -0,0 +1,49 @@
+#ifndef CONSTEVALUATOR_H_
+#define CONSTEVALUATOR_H_
+
+#include "Function.h"
+#include "Value.h"
+#include "Variable.h"
+#include <string>
+#include <vector>
+
+/* Stack values given to a constexpr function while it runs in the compiler. */
+#ifndef CONSTEXPR_STACK_SIZE
+#define CONSTEXPR_STACK_SIZE 1024
+#endif // CONSTEXPR_STACK_SIZE
+
+/* Longest a constexpr function may run in the compiler before it is stopped, in milliseconds. */
+#ifndef CONSTEXPR_TIME_LIMIT
+#define CONSTEXPR_TIME_LIMIT 1000
+#endif // CONSTEXPR_TIME_LIMIT
+
+/*
+ * Runs constexpr functions at compile time on the same virtual machine used by the host.
+ * A script image holding only the called function and the functions it calls is built from the code compiled so far,
+ * then the function is invoked with constant arguments and its return value is read back.
+ * Constexpr functions can't use globals, natives or channels, so the result only depends on the arguments.
+ */
+class ConstEvaluator
+{
+  public:
+    ConstEvaluator(const std::vector<ScriptFunction *> &functions, const std::vector<ConstantInfo> &constants, const std::vector<char> &strings);
+
+    /*
+     * Runs a function and gets the value it returns. Functions still being compiled can't be run, which is not an error.
+     * Returns false if it couldn't be run. The reason is in Error() if the function failed.
+     */
+    bool Evaluate(const ScriptFunction *function, const std::vector<Value> &args, const ScriptFunction *compiling, Value &outResult);
+
+    const std::string &Error() const;
+
+  private:
+    const std::vector<ScriptFunction *> &m_Functions;
+    const std::vector<ConstantInfo> &m_Constants;
+    const std::vector<char> &m_Strings;
+    std::string m_Error;
+
+    bool FindCallees(const ScriptFunction *function, const ScriptFunction *compiling, std::vector<const ScriptFunction *> &outCallees) const;
+    void BuildImage(const std::vector<const ScriptFunction *> &callees, std::vector<u8> &outImage) const;
+};
+
+#endif // CONSTEVALUATOR_H_
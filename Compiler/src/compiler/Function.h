@@ -62,6 +62,16 @@ class FunctionInfo
     }
 };
 
+/* Byte range of a while or for statement, from its condition or initialiser to after the locals it declared are popped. */
+struct LoopRange {
+    u32 Start      = 0;
+    u32 End        = 0;
+    u32 Attributes = 0; // AttributeFlags
+    u32 Unroll     = 0; // Times to unroll by, from [unroll n]. 0 to unroll fully.
+    bool Hot       = false; // Run often in the execution profile. Unrolled as if optimising for speed.
+    Token Token;
+};
+
 class ScriptFunction : public FunctionInfo
 {
   public:
@@ -73,6 +83,11 @@ class ScriptFunction : public FunctionInfo
     u32 LocalsMaxHeight  = 0;
     int ConditionalDepth = 0;
     bool ReturnSupplied  = false;
+    u32 Attributes       = 0; // AttributeFlags
+    u32 Period           = 0; // Milliseconds, for periodic tasks
+    u32 Evaluated        = 0; // Calls to a constexpr function replaced by their result
+    u32 Calls            = 0; // Times called in the execution profile
+    std::vector<LoopRange> Loops; // Innermost first. Only valid until the code is first changed by the optimiser.
 
     ScriptFunction(FunctionType type, int id);
     ~ScriptFunction();
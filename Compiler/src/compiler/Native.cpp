@@ -29,6 +29,7 @@ StatusCode NativeFunctionParser::Parse()
     MSG_V("Starting Native Function Parser...");
 
     m_FunctionMap.clear();
+    m_ChannelMap.clear();
 
     // Tokenize and parse the script.
     if (m_Lexer.Tokenize() != stsLexEndOfFile) {
@@ -43,10 +44,11 @@ StatusCode NativeFunctionParser::Parse()
 
     // Churn through the script
     while (!IsAtEnd()) {
-        ParseNativeFunction();
+        ParseDeclaration();
     }
 
     MSG_V("Parsed " << m_FunctionMap.size() << " native functions");
+    MSG_V("Parsed " << m_ChannelMap.size() << " channels");
 
     m_Status = stsOk;
 
@@ -58,15 +60,31 @@ std::map<std::string, NativeFuncInfo> &NativeFunctionParser::Functions()
     return m_FunctionMap;
 }
 
-void NativeFunctionParser::ParseNativeFunction()
+std::map<std::string, ChannelInfo> &NativeFunctionParser::Channels()
 {
-    // Expect the native function declaration to start with "[native]"
-    (void)ConsumeToken(tknLeftSquareBracket, -1, "Expected \"[native]\" annotation.");
-    Token tknNative = ConsumeToken(tknIdentifier, -1, "Expected \"[native]\" annotation.");
-    if (tknNative.Value != "native") {
-        AddError("Expected \"[native]\" annotation.", tknNative);
-        return;
+    return m_ChannelMap;
+}
+
+void NativeFunctionParser::ParseDeclaration()
+{
+    // Expect each declaration to start with a "[native]" or "[channel]" annotation
+    (void)ConsumeToken(tknLeftSquareBracket, -1, "Expected \"[native]\" or \"[channel]\" annotation.");
+    Token tknAnnotation = ConsumeToken(tknIdentifier, -1, "Expected \"[native]\" or \"[channel]\" annotation.");
+    if (tknAnnotation.Value == "native") {
+        ParseNativeFunction();
+    } else if (tknAnnotation.Value == "channel") {
+        ParseChannel();
+    } else {
+        AddError("Expected \"[native]\" or \"[channel]\" annotation.", tknAnnotation);
+        // Skip to the next declaration
+        while (!IsAtEnd() && !Match(tknSemiColon)) {
+            AdvanceToken();
+        }
     }
+}
+
+void NativeFunctionParser::ParseNativeFunction()
+{
     // Expect a function ID
     if (!Check(tknIntegerLiteral)) {
         AddError("Expected function ID after \"[native]\" annotation.", LookBack());
@@ -129,4 +147,56 @@ void NativeFunctionParser::ParseNativeFunction()
     nativeFunc.Name                  = tknFunction.Value;
     m_FunctionMap[tknFunction.Value] = nativeFunc;
     MSG_V("Parsed native function \"" + nativeFunc.Name + "\"");
+}
+
+void NativeFunctionParser::ParseChannel()
+{
+    // Expect a channel ID
+    if (!Check(tknIntegerLiteral)) {
+        AddError("Expected channel ID after \"[channel]\" annotation.", LookBack());
+        return;
+    }
+    Token tknChannelId = ConsumeToken(tknIntegerLiteral, -1, "Expected channel ID after \"[channel]\" annotation.");
+    int channelId      = -1;
+    if (!ScriptUtils::StringToInt(tknChannelId.Value, channelId) || channelId < 0 || channelId >= MAX_CHANNELS) {
+        AddError("Invalid channel ID after \"[channel]\" annotation. Expected 0 to " + std::to_string(MAX_CHANNELS - 1) + ".", tknChannelId);
+        return;
+    }
+    (void)ConsumeToken(tknRightSquareBracket, -1, "Expected \"]\" after \"[channel]\" annotation.");
+
+    // Expect the element type to appear next
+    DataType elementType = dtVoid;
+    u32 flags            = vfNormal;
+    if (!MatchTypeDeclaration(elementType, flags) || elementType == dtVoid || flags != vfNormal) {
+        AddError("Expected element type for channel.", LookBack());
+        return;
+    }
+
+    // Expect the channel name to appear next
+    Token tknChannel = ConsumeToken(tknIdentifier, -1, "Expected channel name.");
+
+    // Expect the semicolon to end the declaration
+    if (!Match(tknSemiColon)) {
+        AddError("Expected \";\" to end channel declaration.", LookBack());
+        return;
+    }
+
+    for (auto &channel : m_ChannelMap) {
+        if (channel.second.Id == channelId) {
+            AddError("Channel ID " + std::to_string(channelId) + " is already used by \"" + channel.first + "\".", tknChannelId);
+            return;
+        }
+    }
+
+    if (m_FunctionMap.find(tknChannel.Value) != m_FunctionMap.end()) {
+        AddError("Native function with name \"" + tknChannel.Value + "\" already exists.", tknChannel);
+        return;
+    }
+
+    ChannelInfo channel;
+    channel.Name                   = tknChannel.Value;
+    channel.Id                     = channelId;
+    channel.Type                   = elementType;
+    m_ChannelMap[tknChannel.Value] = channel;
+    MSG_V("Parsed channel \"" + channel.Name + "\"");
 }
\ No newline at end of file
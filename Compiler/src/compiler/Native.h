@@ -10,6 +10,14 @@
 #include <map>
 #include <string>
 
+#define MAX_CHANNELS 256
+
+struct ChannelInfo {
+    std::string Name;
+    int Id        = -1;
+    DataType Type = dtNone;
+};
+
 class NativeFunctionParser : public CompilerBase
 {
   public:
@@ -18,13 +26,17 @@ class NativeFunctionParser : public CompilerBase
     StatusCode Parse();
 
     std::map<std::string, NativeFuncInfo> &Functions();
+    std::map<std::string, ChannelInfo> &Channels();
 
   private:
     std::map<std::string, NativeFuncInfo> m_FunctionMap;
+    std::map<std::string, ChannelInfo> m_ChannelMap;
 
     bool m_ScriptOk;
 
+    void ParseDeclaration();
     void ParseNativeFunction();
+    void ParseChannel();
 };
 
 #endif // NATIVE_H
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "SwitchTable.h"
+#include <algorithm>
+
+bool SwitchTable::Add(s32 low, s32 high, int address)
+{
+    // First case that starts after the new one.
+    auto it = std::upper_bound(m_Cases.begin(), m_Cases.end(), low, [](s32 value, const Case &c) { return value < c.Low; });
+
+    if (it != m_Cases.end() && it->Low <= high) {
+        return false;
+    }
+    if (it != m_Cases.begin() && std::prev(it)->High >= low) {
+        return false;
+    }
+
+    Case added;
+    added.Low     = low;
+    added.High    = high;
+    added.Address = address;
+    m_Cases.insert(it, added);
+    return true;
+}
+
+const std::vector<SwitchTable::Case> &SwitchTable::Cases() const
+{
+    return m_Cases;
+}
+
+int SwitchTable::Count() const
+{
+    return (int)m_Cases.size();
+}
+
+bool SwitchTable::HasRanges() const
+{
+    return std::any_of(m_Cases.begin(), m_Cases.end(), [](const Case &c) { return c.Low != c.High; });
+}
+
+s32 SwitchTable::LowestValue() const
+{
+    return m_Cases.empty() ? 0 : m_Cases.front().Low;
+}
+
+s32 SwitchTable::HighestValue() const
+{
+    return m_Cases.empty() ? 0 : m_Cases.back().High;
+}
+
+bool SwitchTable::Find(s32 value, int &outAddress) const
+{
+    auto it = std::upper_bound(m_Cases.begin(), m_Cases.end(), value, [](s32 v, const Case &c) { return v < c.Low; });
+    if (it == m_Cases.begin() || std::prev(it)->High < value) {
+        return false;
+    }
+
+    outAddress = std::prev(it)->Address;
+    return true;
+}
+
+SwitchLowering SwitchTable::Choose() const
+{
+    if (m_Cases.empty()) {
+        return slDense;
+    }
+
+    // Table sizes in bytes, leaving out the switch instruction and the jump over the table.
+    const s64 span   = (s64)HighestValue() - LowestValue() + 1;
+    const s64 dense  = (span + 1) * 2;      // Default + an offset for every value
+    const s64 sparse = 2 + Count() * 10;    // Default + a low, high and offset for every case
+
+    // A dense table is the quickest to search, so it is used whenever it is no bigger than a sparse one.
+    if (dense <= sparse) {
+        return slDense;
+    }
+
+    if (HasRanges()) {
+        return slSparse;
+    }
+
+    if (Count() <= SWITCH_IF_ELSE_LIMIT) {
+        return slIfElse;
+    }
+
+    u32 multiplier;
+    u8 bits;
+    if (Count() >= SWITCH_HASH_MIN_CASES && FindHash(multiplier, bits)) {
+        return slHashed;
+    }
+
+    return slSparse;
+}
+
+bool SwitchTable::FindHash(u32 &outMultiplier, u8 &outBits) const
+{
+    if (m_Cases.empty() || HasRanges()) {
+        return false;
+    }
+
+    // Fewest bits that give every case a slot.
+    int fewest = 1;
+    while ((1 << fewest) < Count()) {
+        ++fewest;
+    }
+
+    // Allow up to four slots per case. Any more and the table is much bigger than a sparse one.
+    for (int bits = fewest; bits <= fewest + 1 && bits <= 16; ++bits) {
+        std::vector<bool> taken(1 << bits);
+
+        for (u32 attempt = 1; attempt <= SWITCH_HASH_TRIES; ++attempt) {
+            const u32 multiplier = (attempt * 0x9E3779B9u) | 1u;
+
+            std::fill(taken.begin(), taken.end(), false);
+            bool perfect = true;
+            for (const Case &c : m_Cases) {
+                const u32 slot = HashSlot(c.Low, multiplier, (u8)bits);
+                if (taken[slot]) {
+                    perfect = false;
+                    break;
+                }
+                taken[slot] = true;
+            }
+
+            if (perfect) {
+                outMultiplier = multiplier;
+                outBits       = (u8)bits;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+u32 SwitchTable::HashSlot(s32 value, u32 multiplier, u8 bits)
+{
+    return ((u32)value * multiplier) >> (32 - bits);
+}
@@ -0,0 +1,70 @@
+#ifndef SWITCHTABLE_H_
+#define SWITCHTABLE_H_
+
+#include "Value.h"
+#include <vector>
+
+/* Most case labels a switch can have and still be lowered to a compare for each one. */
+#ifndef SWITCH_IF_ELSE_LIMIT
+#define SWITCH_IF_ELSE_LIMIT 2
+#endif // SWITCH_IF_ELSE_LIMIT
+
+/* Fewest case labels worth searching for a perfect hash, rather than a binary search. */
+#ifndef SWITCH_HASH_MIN_CASES
+#define SWITCH_HASH_MIN_CASES 8
+#endif // SWITCH_HASH_MIN_CASES
+
+/* Multipliers tried for each table size when searching for a perfect hash. */
+#define SWITCH_HASH_TRIES 1024
+
+/* Ways a switch statement can jump to its cases. */
+enum SwitchLowering {
+    slDense,  // OP_SWITCH. A jump for every value from the lowest case to the highest.
+    slSparse, // OP_SWITCH_SPARSE. A binary search over the case ranges, sorted.
+    slHashed, // OP_SWITCH_HASH. A slot for each case, found by a perfect hash of the value.
+    slIfElse, // A compare and jump for each case.
+};
+
+/*
+ * The case labels of a switch statement and where each one jumps to.
+ * A label covers a range of values. Eg: case 1 ... 5: Single values have Low == High.
+ */
+class SwitchTable
+{
+  public:
+    struct Case {
+        s32 Low     = 0;
+        s32 High    = 0;
+        int Address = NOT_SET;
+    };
+
+    /* Adds a case covering low to high. Returns false if any of the values already have a case. */
+    bool Add(s32 low, s32 high, int address = NOT_SET);
+
+    /* Cases sorted by value. */
+    const std::vector<Case> &Cases() const;
+    int Count() const;
+    bool HasRanges() const;
+    s32 LowestValue() const;
+    s32 HighestValue() const;
+
+    /* Gets the address of the case covering a value. */
+    bool Find(s32 value, int &outAddress) const;
+
+    /* Picks the smallest table that can be searched quickly, or an if/else chain for very few cases. */
+    SwitchLowering Choose() const;
+
+    /*
+     * Searches for a multiplier that gives each case its own slot in a table 2^bits long.
+     * Only single value cases can be hashed. Returns false if no multiplier was found.
+     */
+    bool FindHash(u32 &outMultiplier, u8 &outBits) const;
+
+    /* Slot of a value in a hashed table. Must match OP_SWITCH_HASH in the VM. */
+    static u32 HashSlot(s32 value, u32 multiplier, u8 bits);
+
+  private:
+    std::vector<Case> m_Cases;
+};
+
+#endif // SWITCHTABLE_H_
@@ -12,6 +12,10 @@ TypeCompatibility TypeInfo::CheckCompatibility(DataType expecting, DataType inpu
     if ((expecting == dtNone) || (input == dtNone))
         return tcNotApplicable;
 
+    // Vectors aren't values on the stack, so they can't be cast to or from anything.
+    if (IsVector(expecting) || IsVector(input))
+        return tcIncompatible;
+
     if (expecting >= dtBool && expecting <= dtInt32) {
         if (input >= dtBool && input <= dtInt32)
             return tcMatch;
@@ -19,18 +23,32 @@ TypeCompatibility TypeInfo::CheckCompatibility(DataType expecting, DataType inpu
             return tcCastUnsignedToSigned;
         if (input == dtFloat)
             return tcCastFloatToSigned;
+        if (input == dtFixed)
+            return tcCastFixedToSigned;
     }
 
     if (expecting == dtUint32) {
         if (input == dtFloat)
             return tcCastFloatToUnsigned;
+        else if (input == dtFixed)
+            return tcCastFixedToSigned;
         else
             return tcCastSignedToUnsigned;
     }
 
+    // Unsigned values are converted as signed ones, the same as for floats.
+    if (expecting == dtFixed) {
+        if (input >= dtBool && input <= dtUint32)
+            return tcCastSignedToFixed;
+        if (input == dtFloat)
+            return tcCastFloatToFixed;
+    }
+
     if (expecting == dtFloat) {
         if (input >= dtBool && input <= dtInt32)
             return tcCastSignedToFloat;
+        if (input == dtFixed)
+            return tcCastFixedToFloat;
         return tcCastUnsignedToFloat;
     }
 
@@ -83,3 +101,13 @@ int TypeInfo::GetPackedCount(DataType dataType)
 {
     return (int)sizeof(Value) / GetByteSize(dataType);
 }
+
+bool TypeInfo::IsVector(DataType dataType)
+{
+    return dataType >= dtVec2 && dataType <= dtVec4;
+}
+
+int TypeInfo::ComponentCount(DataType dataType)
+{
+    return IsVector(dataType) ? 2 + (dataType - dtVec2) : 1;
+}
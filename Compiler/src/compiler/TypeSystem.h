@@ -17,6 +17,10 @@ enum TypeCompatibility {
     tcCastUnsignedToFloat,
     tcCastFloatToUnsigned,
     tcCastFloatToSigned,
+    tcCastSignedToFixed,
+    tcCastFixedToSigned,
+    tcCastFloatToFixed,
+    tcCastFixedToFloat,
     tcMatch,
     tcNotApplicable,
 };
@@ -47,6 +51,8 @@ class TypeInfo
     static TypeCompatibility CheckCompatibility(DataType expecting, DataType input);
     static int GetByteSize(DataType dataType);
     static int GetPackedCount(DataType dataType);
+    static bool IsVector(DataType dataType);
+    static int ComponentCount(DataType dataType);
 };
 
 #endif // TYPESYSTEM_H_
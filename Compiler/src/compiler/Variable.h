@@ -17,6 +17,7 @@ enum VariableFlags : u32 {
     vfField    = 0x08,
     vfPointer  = 0x10,
     vfConst    = 0x20,
+    vfFolded   = 0x40,
 };
 
 struct ConstantInfo {
@@ -118,7 +119,11 @@ struct VariableInfo {
     int Depth         = NOT_SET;
     int Reads         = 0;
     int Writes        = 0;
-    int Size          = 1;
+    int Size          = 1; // Stack values
+    int Length        = 0; // Elements, for arrays
+
+    // Value of a const variable that was folded at compile time and has no storage.
+    ConstantInfo Constant = { dtNone, INT32_VAL(0) };
 
     DataType Type() const
     {
@@ -145,6 +150,11 @@ struct VariableInfo {
         return Flags & vfConst;
     }
 
+    bool IsFolded() const
+    {
+        return Flags & vfFolded;
+    }
+
     bool IsField() const
     {
         return !ParentClass.empty() || (Flags & vfField);
@@ -21,6 +21,7 @@ static std::map<std::string, TokenType> TokenMap = {
     // Punctuation
     {        ",",              tknComma },
     {        ".",                tknDot },
+    {      "...",           tknEllipsis },
     {        ";",          tknSemiColon },
     {        ":",              tknColon },
     {        "?",       tknQuestionMark },
@@ -68,7 +69,11 @@ static std::map<std::string, TokenType> TokenMap = {
     {   "ushort",             tknUShort },
     {      "int",                tknInt },
     {     "uint",               tknUInt },
+    {    "fixed",              tknFixed },
     {    "float",              tknFloat },
+    {     "vec2",               tknVec2 },
+    {     "vec3",               tknVec3 },
+    {     "vec4",               tknVec4 },
     {   "string",             tknString },
 
     // Keywords
@@ -41,7 +41,11 @@ enum TokenType {
     tknUShort,
     tknInt,
     tknUInt,
+    tknFixed,
     tknFloat,
+    tknVec2,
+    tknVec3,
+    tknVec4,
 
     // Operators
     tknOperator,
@@ -111,6 +115,7 @@ enum TokenType {
     // Punctuation
     tknColonColon,
     tknDot,
+    tknEllipsis,
     tknComma,
     tknSemiColon,
     tknEndLine,
@@ -19,6 +19,7 @@ int main(int argc, char *argv[])
     std::filesystem::path inputFilePath;
     std::filesystem::path outputFilePath;
     std::filesystem::path nativeFuncFilePath;
+    std::filesystem::path profileFilePath;
     u32 flags = 0;
 
     { // Read args
@@ -38,6 +39,32 @@ int main(int argc, char *argv[])
                     exit(ERROR_INVALID_FUNCTION);
                 }
                 nativeFuncFilePath = argv[i++];
+            } else if (arg == "-p") { // Execution profile from the VM
+                if (i >= argc) {
+                    ERR("Expected execution profile file path!");
+                    exit(ERROR_INVALID_FUNCTION);
+                }
+                profileFilePath = argv[i++];
+            } else if (arg == "-s") { // Global symbol table for host access
+                MSG("Symbol table = On");
+                flags |= CompileOptions::coSymbolTable;
+            } else if (arg == "-O0") { // Emit the bytecode as parsed
+                MSG("Optimisation = Off");
+                flags = (flags & ~OPTIMISE_LEVEL) | CompileOptions::coNoOptimise;
+            } else if (arg == "-O1") { // Optimise without growing the code much. The default
+                MSG("Optimisation = Balanced");
+                flags &= ~OPTIMISE_LEVEL;
+            } else if (arg == "-O2") { // Optimise for speed over size
+                MSG("Optimisation = Speed");
+                flags = (flags & ~OPTIMISE_LEVEL) | CompileOptions::coUnrollLoops;
+            } else if (arg == "-Os") { // Optimise for size over speed
+                MSG("Optimisation = Size");
+                flags = (flags & ~OPTIMISE_LEVEL) | CompileOptions::coOptimiseSize;
+            } else if (arg == "-b") { // Check array indexes are in bounds as the script runs
+                MSG("Bounds checking = On");
+                flags |= CompileOptions::coBoundsCheck;
+            } else if (arg == "--stats") { // Report where the code size goes and what each pass did
+                flags |= CompileOptions::coStats;
             } else if (arg == "-d") { // Decompiler resulting binary
                 MSG("Decompile output binary = On");
                 flags |= CompileOptions::coDecompileResult;
@@ -123,6 +150,19 @@ int main(int argc, char *argv[])
     ErrorHandler errorHandler(script);
     Compiler compiler(&errorHandler, &nativeFuncs, script, flags, outputFileName);
 
+    // If an execution profile is provided, use it to guide the optimiser
+    if (!profileFilePath.empty()) {
+        std::ifstream profileInput(profileFilePath, std::fstream::binary);
+
+        if (!profileInput.good()) {
+            ERR("File does not exist or cannot be opened: " << profileFilePath);
+            exit(ERROR_FILE_NOT_FOUND);
+        }
+
+        MSG_V("Reading execution profile: " << profileFilePath);
+        compiler.UseProfile(std::vector<u8>(std::istreambuf_iterator<char>(profileInput), {}));
+    }
+
     StatusCode compile = compiler.Compile();
 
     if (compile == stsCompileDone) {
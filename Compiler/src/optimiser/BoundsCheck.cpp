@@ -0,0 +1,359 @@
+#include "BoundsCheck.h"
+#include "CompilerData.h"
+#include <algorithm>
+
+static bool IsOp(const std::vector<Instruction> &code, int index, opCode_t op)
+{
+    return index >= 0 && index < (int)code.size() && !code[index].IsTable && code[index].Op == op;
+}
+
+BoundsCheck::BoundsCheck(const std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+u32 BoundsCheck::ChecksRemoved() const
+{
+    return m_ChecksRemoved;
+}
+
+u32 BoundsCheck::ChecksKept() const
+{
+    return m_ChecksKept;
+}
+
+bool BoundsCheck::Run(std::vector<opCode_t> &code, std::vector<LoopRange> &loops)
+{
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(code, instructions)) {
+        return false;
+    }
+
+    std::vector<CountedLoop> counted;
+    for (int i = 0; i < (int)instructions.size(); ++i) {
+        CountedLoop loop;
+        if (Match(instructions, i, loop)) {
+            counted.push_back(loop);
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < (int)instructions.size(); ++i) {
+        Instruction &instr = instructions[i];
+        if (instr.IsTable || instr.Op != OP_BOUNDS_CHECK) {
+            continue;
+        }
+
+        // Anything jumping to the check could bring a different index.
+        const s64 length = instr.Operands[0] | (instr.Operands[1] << 8);
+        Range index;
+        int start;
+        if (!instr.IsLabel && RangeOf(instructions, counted, i, index, start) && index.Min >= 0 && index.Max < length) {
+            instr.Removed = true;
+            m_ChecksRemoved++;
+            changed = true;
+        } else {
+            m_ChecksKept++;
+        }
+    }
+
+    if (!changed) {
+        return false;
+    }
+
+    std::vector<opCode_t> encoded;
+    if (!Bytecode::Encode(instructions, encoded)) {
+        return false;
+    }
+
+    // Loops are found by their byte range, which moves down by the checks removed in front of it.
+    std::vector<u32> removedAt;
+    u32 pos = 0;
+    for (auto &instr : instructions) {
+        if (instr.Removed) {
+            removedAt.push_back(pos);
+        }
+        pos += instr.Size();
+    }
+    for (auto &loop : loops) {
+        const u32 size  = 1 + Bytecode::OperandSize(OP_BOUNDS_CHECK);
+        const auto less = [&removedAt](u32 offset) { return (u32)(std::lower_bound(removedAt.begin(), removedAt.end(), offset) - removedAt.begin()); };
+        loop.Start -= less(loop.Start) * size;
+        loop.End -= less(loop.End) * size;
+    }
+
+    code = encoded;
+    return true;
+}
+
+const ConstantInfo *BoundsCheck::ConstantAt(const Instruction &instr) const
+{
+    if (instr.IsTable || !Bytecode::IsConstant(instr.Op)) {
+        return nullptr;
+    }
+
+    const u32 index = Bytecode::ConstantIndex(instr);
+    return index < m_Constants.size() ? &m_Constants[index] : nullptr;
+}
+
+bool BoundsCheck::IntAt(const std::vector<Instruction> &code, int index, s32 &outValue) const
+{
+    if (index < 0 || index >= (int)code.size()) {
+        return false;
+    }
+
+    if (IsOp(code, index, OP_NIL)) {
+        outValue = 0;
+        return true;
+    }
+
+    const ConstantInfo *constant = ConstantAt(code[index]);
+    if (constant == nullptr || constant->Type != dtInt32) {
+        return false;
+    }
+
+    outValue = constant->ConstValue.Int;
+    return true;
+}
+
+bool BoundsCheck::IsCounter(const std::vector<Instruction> &code, int index, const VmPointer &counter) const
+{
+    if (index < 0 || index >= (int)code.size()) {
+        return false;
+    }
+
+    const ConstantInfo *constant = ConstantAt(code[index]);
+    return constant != nullptr && constant->Type == dtPointer && constant->ConstValue.Pointer == counter;
+}
+
+/*
+ * Matches the code ForStatement() emits for a counted loop starting at start, the same as LoopUnroller does:
+ * declaration: CONSTANT first, CONSTANT i, ASSIGN
+ * condition:   CONSTANT i, GET_VARIABLE, CONSTANT limit, compare, JUMP_IF_FALSE exit, POP, JUMP body
+ * increment:   i++ or i += step, POP, LOOP condition
+ * body:        ..., LOOP increment
+ * exit:        POP
+ * The body may hold other loops, but may only read the counter.
+ */
+bool BoundsCheck::Match(const std::vector<Instruction> &code, int start, CountedLoop &outLoop) const
+{
+    CountedLoop loop;
+
+    s32 first;
+    const ConstantInfo *counter = start + 1 < (int)code.size() ? ConstantAt(code[start + 1]) : nullptr;
+    if (!IntAt(code, start, first) || counter == nullptr || counter->Type != dtPointer || !IsOp(code, start + 2, OP_ASSIGN)) {
+        return false;
+    }
+    loop.Counter = counter->ConstValue.Pointer;
+    if (loop.Counter.Scope != scopeLocal || loop.Counter.Type != dtInt32) {
+        return false;
+    }
+
+    const int condition = start + 3;
+    s32 limit;
+    if (!IsCounter(code, condition, loop.Counter) || !IsOp(code, condition + 1, OP_GET_VARIABLE) || !IntAt(code, condition + 2, limit) ||
+        condition + 3 >= (int)code.size() || !IsOp(code, condition + 4, OP_JUMP_IF_FALSE) || !IsOp(code, condition + 5, OP_POP) ||
+        !IsOp(code, condition + 6, OP_JUMP)) {
+        return false;
+    }
+
+    const int exit      = code[condition + 4].Target;
+    const int increment = condition + 7;
+    loop.Body           = code[condition + 6].Target;
+    loop.Back           = exit - 1;
+
+    s32 step;
+    int incrementEnd;
+    if (!MatchStep(code, increment, loop.Counter, step, incrementEnd) || code[incrementEnd].Target != condition || loop.Body != incrementEnd + 1 ||
+        loop.Back < loop.Body || !IsOp(code, loop.Back, OP_LOOP) || code[loop.Back].Target != increment || !IsOp(code, exit, OP_POP)) {
+        return false;
+    }
+
+    if (!CounterValues(first, step, code[condition + 3].Op, limit, loop.Values)) {
+        return false;
+    }
+
+    // The body can only read the counter.
+    for (int i = loop.Body; i < loop.Back; ++i) {
+        if (IsCounter(code, i, loop.Counter) && (!IsOp(code, i + 1, OP_GET_VARIABLE) || code[i + 1].IsLabel)) {
+            return false;
+        }
+    }
+
+    // It can't be written through a pointer either, or skipped to without passing the condition.
+    for (int i = 0; i < (int)code.size(); ++i) {
+        const Instruction &instr = code[i];
+        if (IsCounter(code, i, loop.Counter) && IsOp(code, i + 1, OP_ABSOLUTE_POINTER)) {
+            return false;
+        }
+
+        if (i >= condition && i <= loop.Back) {
+            continue;
+        }
+        std::vector<int> targets = instr.IsTable ? instr.Table : std::vector<int>{ instr.Target };
+        for (const int target : targets) {
+            if (Bytecode::IsJump(instr.Op) || instr.IsTable) {
+                if (target >= loop.Body && target <= loop.Back) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    outLoop = loop;
+    return true;
+}
+
+/* Matches i++, ++i, i--, --i, i += step or i -= step, each followed by POP and the LOOP back to the condition. */
+bool BoundsCheck::MatchStep(const std::vector<Instruction> &code, int increment, const VmPointer &counter, s32 &outStep, int &outEnd) const
+{
+    const int i = increment;
+    if (!IsCounter(code, i, counter)) {
+        return false;
+    }
+
+    if (IsOp(code, i + 1, OP_GET_VARIABLE) && IsCounter(code, i + 2, counter) && (IsOp(code, i + 3, OP_PLUS_PLUS) || IsOp(code, i + 3, OP_MINUS_MINUS)) &&
+        IsOp(code, i + 4, OP_POP) && IsOp(code, i + 5, OP_LOOP)) {
+        outStep = code[i + 3].Op == OP_PLUS_PLUS ? 1 : -1;
+        outEnd  = i + 5;
+        return true;
+    }
+
+    if ((IsOp(code, i + 1, OP_PREFIX_INCREASE) || IsOp(code, i + 1, OP_PREFIX_DECREASE)) && IsOp(code, i + 2, OP_POP) && IsOp(code, i + 3, OP_LOOP)) {
+        outStep = code[i + 1].Op == OP_PREFIX_INCREASE ? 1 : -1;
+        outEnd  = i + 3;
+        return true;
+    }
+
+    s32 step;
+    if (IsOp(code, i + 1, OP_GET_VARIABLE) && IntAt(code, i + 2, step) && (IsOp(code, i + 3, OP_ADD_S) || IsOp(code, i + 3, OP_SUB_S)) &&
+        IsCounter(code, i + 4, counter) && IsOp(code, i + 5, OP_ASSIGN) && IsOp(code, i + 6, OP_POP) && IsOp(code, i + 7, OP_LOOP)) {
+        if (step == INT32_MIN) {
+            return false;
+        }
+        outStep = code[i + 3].Op == OP_ADD_S ? step : -step;
+        outEnd  = i + 7;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Values the counter takes in the body of the loop. It's empty, with Min above Max, if the body never runs.
+ * Returns false if the counter could wrap around before the condition stops it.
+ */
+bool BoundsCheck::CounterValues(s32 first, s32 step, opCode_t compare, s32 limit, Range &outValues)
+{
+    if (step > 0) {
+        if ((s64)limit + step > INT32_MAX) {
+            return false;
+        }
+
+        outValues.Min = first;
+        if (compare == OP_LESS_S || (compare == OP_NOT_EQUAL_S && step == 1 && first <= limit)) {
+            outValues.Max = (s64)limit - 1;
+        } else if (compare == OP_LESS_OR_EQUAL_S) {
+            outValues.Max = limit;
+        } else {
+            return false;
+        }
+    } else if (step < 0) {
+        if ((s64)limit + step < INT32_MIN) {
+            return false;
+        }
+
+        outValues.Max = first;
+        if (compare == OP_GREATER_S || (compare == OP_NOT_EQUAL_S && step == -1 && first >= limit)) {
+            outValues.Min = (s64)limit + 1;
+        } else if (compare == OP_GREATER_OR_EQUAL_S) {
+            outValues.Min = limit;
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Range of the value left on the stack by the instructions just before end. Gets the first of those instructions,
+ * or NOT_SET if it isn't known because the value doesn't depend on all of them.
+ * Returns false if the range can't be worked out.
+ */
+bool BoundsCheck::RangeOf(const std::vector<Instruction> &code, const std::vector<CountedLoop> &loops, int end, Range &outRange, int &outStart) const
+{
+    const int last = end - 1;
+    if (last < 0 || code[last].IsTable) {
+        return false;
+    }
+
+    s32 value;
+    if (IntAt(code, last, value)) {
+        outRange = { value, value };
+        outStart = last;
+        return true;
+    }
+
+    if (code[last].IsLabel) {
+        return false;
+    }
+
+    if (code[last].Op == OP_GET_VARIABLE) {
+        const ConstantInfo *variable = last > 0 ? ConstantAt(code[last - 1]) : nullptr;
+        if (variable == nullptr || variable->Type != dtPointer) {
+            return false;
+        }
+
+        for (const auto &loop : loops) {
+            if (loop.Counter == variable->ConstValue.Pointer && last > loop.Body && last < loop.Back) {
+                outRange = loop.Values;
+                outStart = last - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (code[last].Op != OP_ADD_S && code[last].Op != OP_SUB_S && code[last].Op != OP_BIT_AND) {
+        return false;
+    }
+
+    Range right;
+    int rightStart;
+    if (!RangeOf(code, loops, last, right, rightStart) || rightStart == NOT_SET || code[rightStart].IsLabel) {
+        return false;
+    }
+
+    Range left;
+    int leftStart;
+    const bool leftKnown = RangeOf(code, loops, rightStart, left, leftStart);
+
+    if (code[last].Op == OP_BIT_AND) {
+        // Masking with something that can't be negative can't give more than it.
+        if (leftKnown && left.Min >= 0 && (right.Min < 0 || left.Max < right.Max)) {
+            outRange = { 0, left.Max };
+        } else if (right.Min >= 0) {
+            outRange = { 0, right.Max };
+        } else {
+            return false;
+        }
+        outStart = NOT_SET;
+        return true;
+    }
+
+    if (!leftKnown) {
+        return false;
+    }
+
+    if (code[last].Op == OP_ADD_S) {
+        outRange = { left.Min + right.Min, left.Max + right.Max };
+    } else {
+        outRange = { left.Min - right.Max, left.Max - right.Min };
+    }
+    outStart = leftStart;
+
+    // The VM wraps around instead.
+    return outRange.Min >= INT32_MIN && outRange.Max <= INT32_MAX;
+}
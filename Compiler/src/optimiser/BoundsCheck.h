@@ -0,0 +1,57 @@
+#ifndef BOUNDSCHECK_H_
+#define BOUNDSCHECK_H_
+
+#include "Bytecode.h"
+#include "Function.h"
+#include "Variable.h"
+#include <vector>
+
+/*
+ * Removes array bounds checks that can never fail, found by the range of values the index can take:
+ *  - Constants, eg. a loop counter after the loop has been unrolled.
+ *  - The counter of a for loop that counts an int between constants, if the body doesn't write it. Eg: for (int i = 0; i < 8; i++) a[i]
+ *  - Sums and differences of those, and anything masked with one that can't be negative. Eg: a[i + 1], a[x & 7]
+ * Runs before anything else changes the shape of the loops.
+ */
+class BoundsCheck
+{
+  public:
+    explicit BoundsCheck(const std::vector<ConstantInfo> &constants);
+
+    /* Optimises a function in place. The loops are moved to where they now start and end. Returns true if the code was changed. */
+    bool Run(std::vector<opCode_t> &code, std::vector<LoopRange> &loops);
+
+    /* Totals for every function run so far. */
+    u32 ChecksRemoved() const;
+    u32 ChecksKept() const;
+
+  private:
+    struct Range {
+        s64 Min = 0;
+        s64 Max = 0;
+    };
+
+    /* Instruction indices of the body of a counted for loop, and the values its counter takes in there. */
+    struct CountedLoop {
+        VmPointer Counter;
+        int Body = NOT_SET;
+        int Back = NOT_SET; // Loop back to the increment at the end of the body
+        Range Values;
+    };
+
+    const std::vector<ConstantInfo> &m_Constants;
+    u32 m_ChecksRemoved = 0;
+    u32 m_ChecksKept    = 0;
+
+    const ConstantInfo *ConstantAt(const Instruction &instr) const;
+    bool IntAt(const std::vector<Instruction> &code, int index, s32 &outValue) const;
+    bool IsCounter(const std::vector<Instruction> &code, int index, const VmPointer &counter) const;
+
+    bool Match(const std::vector<Instruction> &code, int start, CountedLoop &outLoop) const;
+    bool MatchStep(const std::vector<Instruction> &code, int increment, const VmPointer &counter, s32 &outStep, int &outEnd) const;
+    static bool CounterValues(s32 first, s32 step, opCode_t compare, s32 limit, Range &outValues);
+
+    bool RangeOf(const std::vector<Instruction> &code, const std::vector<CountedLoop> &loops, int end, Range &outRange, int &outStart) const;
+};
+
+#endif // BOUNDSCHECK_H_
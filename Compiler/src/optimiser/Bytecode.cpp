@@ -0,0 +1,664 @@
+#include "Bytecode.h"
+#include "MathUtils.h"
+#include <algorithm>
+#include <map>
+
+#define UINT16_AT(code, pos) (u16)((code)[pos] | ((code)[(pos) + 1] << 8))
+#define INT32_AT(code, pos)  (s32)((code)[pos] | ((code)[(pos) + 1] << 8) | ((code)[(pos) + 2] << 16) | ((code)[(pos) + 3] << 24))
+
+int Bytecode::OperandSize(opCode_t op)
+{
+    switch (op) {
+        case OP_PUSH_N:
+        case OP_POP_N:
+        case OP_INT_8:
+        case OP_CONSTANT:
+        case OP_STRING:
+        case OP_CALL:
+        case OP_CALL_NATIVE:
+        case OP_TAIL_CALL:
+        case OP_CHANNEL_SEND:
+        case OP_CHANNEL_RECEIVE:
+        case OP_CHANNEL_COUNT:
+        case OP_VEC_COPY:
+        case OP_VEC_ADD:
+        case OP_VEC_SUB:
+        case OP_VEC_MULT:
+        case OP_VEC_SCALE:
+        case OP_VEC_DOT:
+        case OP_VEC_LENGTH_SQ:
+            return 1;
+
+        case OP_INT_16:
+        case OP_CONSTANT_16:
+        case OP_STRING_16:
+        case OP_ARRAY:
+        case OP_BOUNDS_CHECK:
+        case OP_BIT_EXTRACT:
+        case OP_BIT_INSERT:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_EQUAL:
+        case OP_LOOP:
+        case OP_BREAK:
+        case OP_CONTINUE:
+            return 2;
+
+        case OP_CONSTANT_24:
+        case OP_STRING_24:
+            return 3;
+
+        case OP_SWITCH:
+            return 10; // [table end][min][max]
+
+        case OP_SWITCH_SPARSE:
+            return 4; // [table end][count]
+
+        case OP_SWITCH_HASH:
+            return 7; // [table end][multiplier][bits]
+
+        case OP_FUNCTION_START:
+            return 2;
+
+        default:
+            return (op <= OP_CHANNEL_COUNT || op == OP_END) ? 0 : -1;
+    }
+}
+
+bool Bytecode::IsForwardJump(opCode_t op)
+{
+    return op == OP_JUMP || op == OP_BREAK || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_JUMP_IF_EQUAL || IsSwitch(op);
+}
+
+bool Bytecode::IsBackwardJump(opCode_t op)
+{
+    return op == OP_LOOP || op == OP_CONTINUE;
+}
+
+bool Bytecode::IsJump(opCode_t op)
+{
+    return IsForwardJump(op) || IsBackwardJump(op);
+}
+
+bool Bytecode::IsSwitch(opCode_t op)
+{
+    return op == OP_SWITCH || op == OP_SWITCH_SPARSE || op == OP_SWITCH_HASH;
+}
+
+bool Bytecode::IsTerminator(opCode_t op)
+{
+    switch (op) {
+        case OP_JUMP:
+        case OP_BREAK:
+        case OP_LOOP:
+        case OP_CONTINUE:
+        case OP_SWITCH:
+        case OP_SWITCH_SPARSE:
+        case OP_SWITCH_HASH:
+        case OP_TAIL_CALL:
+        case OP_RETURN:
+        case OP_END:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Bytecode::StackEffect(const Instruction &instr, int &outEffect)
+{
+    if (instr.IsTable) {
+        return false;
+    }
+
+    switch (instr.Op) {
+        case OP_NOP:
+        case OP_GET_VARIABLE:
+        case OP_ABSOLUTE_POINTER:
+        case OP_BOUNDS_CHECK:
+        case OP_CAST_INT_TO_FLOAT:
+        case OP_CAST_PREV_INT_TO_FLOAT:
+        case OP_CAST_FLOAT_TO_INT:
+        case OP_CAST_PREV_FLOAT_TO_INT:
+        case OP_CAST_INT_TO_FIXED:
+        case OP_CAST_PREV_INT_TO_FIXED:
+        case OP_CAST_FIXED_TO_INT:
+        case OP_CAST_PREV_FIXED_TO_INT:
+        case OP_CAST_FLOAT_TO_FIXED:
+        case OP_CAST_PREV_FLOAT_TO_FIXED:
+        case OP_CAST_FIXED_TO_FLOAT:
+        case OP_CAST_PREV_FIXED_TO_FLOAT:
+        case OP_NEGATE_I:
+        case OP_NEGATE_F:
+        case OP_BIT_NOT:
+        case OP_ABS_I:
+        case OP_ABS_F:
+        case OP_SQRT:
+        case OP_SIN:
+        case OP_COS:
+        case OP_FLOOR:
+        case OP_BIT_EXTRACT:
+        case OP_POPCOUNT:
+        case OP_CLZ:
+        case OP_BYTE_SWAP:
+        case OP_NOT:
+        case OP_PREFIX_DECREASE:
+        case OP_PREFIX_INCREASE:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_BREAK:
+        case OP_CONTINUE:
+        case OP_FRAME:
+        case OP_CHANNEL_SEND:
+        case OP_VEC_LENGTH_SQ:
+            outEffect = 0;
+            return true;
+
+        case OP_PUSH:
+        case OP_DUPLICATE:
+        case OP_NIL:
+        case OP_FALSE:
+        case OP_TRUE:
+        case OP_INT_8:
+        case OP_INT_16:
+        case OP_FLOAT_ONE:
+        case OP_CONSTANT:
+        case OP_CONSTANT_16:
+        case OP_CONSTANT_24:
+        case OP_STRING:
+        case OP_STRING_16:
+        case OP_STRING_24:
+        case OP_CHANNEL_RECEIVE:
+        case OP_CHANNEL_COUNT:
+            outEffect = 1;
+            return true;
+
+        case OP_DUPLICATE_2:
+            outEffect = 2;
+            return true;
+
+        case OP_PUSH_N:
+            outEffect = instr.Operands[0];
+            return true;
+
+        case OP_ARRAY:
+            outEffect = UINT16_AT(instr.Operands, 0);
+            return true;
+
+        case OP_POP_N:
+            outEffect = -instr.Operands[0];
+            return true;
+
+        case OP_SET_VARIABLE:
+        case OP_JUMP_IF_EQUAL:
+        case OP_VEC_COPY:
+        case OP_CLAMP_S:
+        case OP_CLAMP_U:
+        case OP_CLAMP_F:
+            outEffect = -2;
+            return true;
+
+        case OP_VEC_ADD:
+        case OP_VEC_SUB:
+        case OP_VEC_MULT:
+        case OP_VEC_SCALE:
+            outEffect = -3;
+            return true;
+
+        case OP_SET_INDEXED_S8:
+        case OP_SET_INDEXED_U8:
+        case OP_SET_INDEXED_S16:
+        case OP_SET_INDEXED_U16:
+        case OP_SET_INDEXED_S32:
+        case OP_SET_INDEXED_U32:
+        case OP_SET_INDEXED_FLOAT:
+            outEffect = -2;
+            return true;
+
+        case OP_CALL:
+        case OP_CALL_NATIVE:
+            // The function and its arguments are replaced by the result.
+            outEffect = -instr.Operands[0];
+            return true;
+
+        case OP_POP:
+        case OP_SWITCH:
+        case OP_SWITCH_SPARSE:
+        case OP_SWITCH_HASH:
+        case OP_ASSIGN:
+        case OP_PLUS_PLUS:
+        case OP_MINUS_MINUS:
+        case OP_GET_INDEXED_S8:
+        case OP_GET_INDEXED_U8:
+        case OP_GET_INDEXED_S16:
+        case OP_GET_INDEXED_U16:
+        case OP_GET_INDEXED_S32:
+        case OP_GET_INDEXED_U32:
+        case OP_GET_INDEXED_FLOAT:
+        case OP_VEC_DOT:
+        case OP_MIN_S:
+        case OP_MIN_U:
+        case OP_MIN_F:
+        case OP_MAX_S:
+        case OP_MAX_U:
+        case OP_MAX_F:
+        case OP_BIT_INSERT:
+        case OP_ROTATE_L:
+        case OP_ROTATE_R:
+            outEffect = -1;
+            return true;
+
+        default:
+            // Binary operators pop both operands and push the result.
+            if ((instr.Op >= OP_MODULUS && instr.Op <= OP_GREATER_OR_EQUAL_F) || (instr.Op >= OP_BIT_AND && instr.Op <= OP_BIT_SHIFT_R)) {
+                outEffect = -1;
+                return true;
+            }
+            return false;
+    }
+}
+
+bool Bytecode::IsConstant(opCode_t op)
+{
+    return op == OP_CONSTANT || op == OP_CONSTANT_16 || op == OP_CONSTANT_24;
+}
+
+u32 Bytecode::ConstantIndex(const Instruction &instr)
+{
+    u32 index = 0;
+    for (int i = instr.OperandCount - 1; i >= 0; --i) {
+        index = (index << 8) | instr.Operands[i];
+    }
+    return index;
+}
+
+void Bytecode::SetConstantIndex(Instruction &instr, u32 index)
+{
+    if (index <= 0xFF) {
+        instr.Op           = OP_CONSTANT;
+        instr.OperandCount = 1;
+    } else if (index <= 0xFFFF) {
+        instr.Op           = OP_CONSTANT_16;
+        instr.OperandCount = 2;
+    } else {
+        instr.Op           = OP_CONSTANT_24;
+        instr.OperandCount = 3;
+    }
+
+    instr.Operands[0] = mByte0(index);
+    instr.Operands[1] = mByte1(index);
+    instr.Operands[2] = mByte2(index);
+}
+
+bool Bytecode::Decode(const std::vector<opCode_t> &code, std::vector<Instruction> &outInstructions)
+{
+    outInstructions.clear();
+
+    const int length = (int)code.size();
+
+    // Byte position -> instruction index
+    std::vector<int> indexAt(length + 1, NOT_SET);
+    // Instruction index -> byte positions of its jump targets
+    std::vector<std::vector<int>> targetPositions;
+    // Switch table start -> end, and the number of keys in front of its jumps
+    std::map<int, std::pair<int, int>> tables;
+
+    int pos = 0;
+    while (pos < length) {
+        Instruction instr;
+        std::vector<int> targets;
+        indexAt[pos] = (int)outInstructions.size();
+
+        // A switch table is only emitted with a jump over it.
+        auto table = tables.find(pos);
+        if (table != tables.end() && !outInstructions.empty() && outInstructions.back().Op == OP_JUMP &&
+            targetPositions.back().front() == table->second.first) {
+            const int end  = table->second.first;
+            const int keys = table->second.second;
+            instr.IsTable  = true;
+            for (int key = 0; key < keys; ++key) {
+                instr.Keys.push_back(INT32_AT(code, pos + key * 4));
+            }
+            for (int entry = pos + keys * 4; entry < end; entry += 2) {
+                targets.push_back(entry - UINT16_AT(code, entry));
+                instr.Table.push_back(NOT_SET);
+            }
+            pos = end;
+        } else {
+            instr.Op           = code[pos];
+            const int operands = OperandSize(instr.Op);
+            if (operands < 0 || pos + 1 + operands > length) {
+                return false;
+            }
+
+            instr.OperandCount = (u8)operands;
+            for (int i = 0; i < operands; ++i) {
+                instr.Operands[i] = code[pos + 1 + i];
+            }
+
+            // Forward jump offsets are from the end of the offset, which is only the end of the instruction for plain jumps.
+            const int next = pos + 1 + operands;
+            if (IsForwardJump(instr.Op)) {
+                targets.push_back(pos + 3 + UINT16_AT(instr.Operands, 0));
+            } else if (IsBackwardJump(instr.Op)) {
+                targets.push_back(next - UINT16_AT(instr.Operands, 0));
+            }
+
+            if (IsSwitch(instr.Op)) {
+                int jumps;
+                int keys;
+                if (instr.Op == OP_SWITCH) {
+                    const s32 min = INT32_AT(instr.Operands, 2);
+                    const s32 max = INT32_AT(instr.Operands, 6);
+                    jumps         = (max - min) + 2; // Default + cases
+                    keys          = 0;
+                } else if (instr.Op == OP_SWITCH_SPARSE) {
+                    const int count = UINT16_AT(instr.Operands, 2);
+                    jumps           = count + 1;
+                    keys            = count * 2; // Low and high of each case
+                } else {
+                    const int slots = 1 << instr.Operands[6];
+                    jumps           = slots + 1;
+                    keys            = slots;
+                }
+                tables.emplace(targets.front() - (jumps * 2) - (keys * 4), std::make_pair(targets.front(), keys));
+            }
+
+            pos = next;
+        }
+
+        outInstructions.push_back(instr);
+        targetPositions.push_back(targets);
+    }
+    indexAt[length] = (int)outInstructions.size();
+
+    // Convert the byte positions to instruction indexes.
+    for (size_t i = 0; i < outInstructions.size(); ++i) {
+        Instruction &instr = outInstructions[i];
+        for (size_t t = 0; t < targetPositions[i].size(); ++t) {
+            const int target = targetPositions[i][t];
+            if (target < 0 || target > length || indexAt[target] == NOT_SET) {
+                return false;
+            }
+            if (instr.IsTable) {
+                instr.Table[t] = indexAt[target];
+            } else {
+                instr.Target = indexAt[target];
+            }
+        }
+    }
+
+    MarkLabels(outInstructions);
+
+    return true;
+}
+
+bool Bytecode::Encode(const std::vector<Instruction> &instructions, std::vector<opCode_t> &outCode)
+{
+    const int count = (int)instructions.size();
+
+    // Byte position of every instruction. Removed ones share the position of the next one that remains.
+    std::vector<int> positions(count + 1, 0);
+    int pos = 0;
+    for (int i = 0; i < count; ++i) {
+        positions[i] = pos;
+        if (!instructions[i].Removed) {
+            pos += (int)instructions[i].Size();
+        }
+    }
+    positions[count] = pos;
+
+    std::vector<opCode_t> code;
+    code.reserve(pos);
+
+    for (int i = 0; i < count; ++i) {
+        const Instruction &instr = instructions[i];
+        if (instr.Removed) {
+            continue;
+        }
+
+        if (instr.IsTable) {
+            for (const s32 key : instr.Keys) {
+                code.push_back(mByte0(key));
+                code.push_back(mByte1(key));
+                code.push_back(mByte2(key));
+                code.push_back(mByte3(key));
+            }
+            const int jumps = positions[i] + (int)instr.Keys.size() * 4;
+            for (size_t entry = 0; entry < instr.Table.size(); ++entry) {
+                const int offset = (jumps + (int)entry * 2) - positions[instr.Table[entry]];
+                if (offset < 0 || offset > UINT16_MAX) {
+                    return false;
+                }
+                code.push_back(mByte0(offset));
+                code.push_back(mByte1(offset));
+            }
+            continue;
+        }
+
+        u8 operands[MAX_OPERAND_BYTES];
+        for (int o = 0; o < instr.OperandCount; ++o) {
+            operands[o] = instr.Operands[o];
+        }
+
+        if (IsJump(instr.Op)) {
+            const int next = positions[i] + (int)instr.Size();
+            int offset;
+            if (IsBackwardJump(instr.Op)) {
+                offset = next - positions[instr.Target];
+            } else {
+                offset = positions[instr.Target] - (positions[i] + 3);
+            }
+            if (offset < 0 || offset > UINT16_MAX) {
+                return false;
+            }
+            operands[0] = mByte0(offset);
+            operands[1] = mByte1(offset);
+        }
+
+        code.push_back(instr.Op);
+        for (int o = 0; o < instr.OperandCount; ++o) {
+            code.push_back(operands[o]);
+        }
+    }
+
+    outCode = code;
+    return true;
+}
+
+int Bytecode::Resolve(const std::vector<Instruction> &instructions, int index)
+{
+    while (index < (int)instructions.size() && instructions[index].Removed) {
+        ++index;
+    }
+    return index;
+}
+
+int Bytecode::Next(const std::vector<Instruction> &instructions, int index)
+{
+    return Resolve(instructions, index + 1);
+}
+
+void Bytecode::MarkLabels(std::vector<Instruction> &instructions)
+{
+    const int count = (int)instructions.size();
+
+    for (auto &instr : instructions) {
+        instr.IsLabel = false;
+    }
+
+    for (auto &instr : instructions) {
+        if (instr.Removed) {
+            continue;
+        }
+
+        if (instr.IsTable) {
+            for (const int target : instr.Table) {
+                const int label = Resolve(instructions, target);
+                if (label < count) {
+                    instructions[label].IsLabel = true;
+                }
+            }
+        } else if (IsJump(instr.Op)) {
+            const int label = Resolve(instructions, instr.Target);
+            if (label < count) {
+                instructions[label].IsLabel = true;
+            }
+        }
+    }
+}
+
+u32 Bytecode::SizeOf(const std::vector<Instruction> &instructions)
+{
+    u32 size = 0;
+    for (auto &instr : instructions) {
+        if (!instr.Removed) {
+            size += instr.Size();
+        }
+    }
+    return size;
+}
+
+std::vector<int> Bytecode::LoopDepths(const std::vector<Instruction> &instructions)
+{
+    const int count = (int)instructions.size();
+    std::vector<int> depths(count, 0);
+
+    // Where control can go from each instruction.
+    std::vector<std::vector<int>> successors(count);
+    std::vector<std::vector<int>> predecessors(count);
+    for (int i = 0; i < count; ++i) {
+        const Instruction &instr = instructions[i];
+        if (instr.IsTable)
+            continue;
+
+        std::vector<int> targets;
+        if (IsSwitch(instr.Op)) {
+            if (instr.Target > 0 && instr.Target <= count && instructions[instr.Target - 1].IsTable) {
+                targets = instructions[instr.Target - 1].Table;
+            }
+        } else if (IsJump(instr.Op)) {
+            targets.push_back(instr.Target);
+        }
+        if (!IsTerminator(instr.Op)) {
+            targets.push_back(i + 1);
+        }
+
+        for (const int target : targets) {
+            if (target >= 0 && target < count && !instructions[target].IsTable) {
+                successors[i].push_back(target);
+                predecessors[target].push_back(i);
+            }
+        }
+    }
+
+    // Reverse post order from the first instruction.
+    std::vector<int> order;
+    std::vector<int> rank(count, NOT_SET);
+    {
+        std::vector<bool> seen(count, false);
+        std::vector<std::pair<int, size_t>> stack;
+        if (count > 0) {
+            stack.emplace_back(0, 0);
+            seen[0] = true;
+        }
+        while (!stack.empty()) {
+            auto &[at, next] = stack.back();
+            if (next < successors[at].size()) {
+                const int successor = successors[at][next++];
+                if (!seen[successor]) {
+                    seen[successor] = true;
+                    stack.emplace_back(successor, 0);
+                }
+            } else {
+                order.push_back(at);
+                stack.pop_back();
+            }
+        }
+        std::reverse(order.begin(), order.end());
+        for (int i = 0; i < (int)order.size(); ++i) {
+            rank[order[i]] = i;
+        }
+    }
+
+    // Immediate dominators, by Cooper, Harvey and Kennedy's iterative method.
+    std::vector<int> dominator(count, NOT_SET);
+    if (!order.empty()) {
+        dominator[order[0]] = order[0];
+    }
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (rank[a] > rank[b])
+                a = dominator[a];
+            while (rank[b] > rank[a])
+                b = dominator[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); ++i) {
+            int idom = NOT_SET;
+            for (const int pred : predecessors[order[i]]) {
+                if (dominator[pred] != NOT_SET) {
+                    idom = (idom == NOT_SET) ? pred : intersect(pred, idom);
+                }
+            }
+            if (idom != dominator[order[i]]) {
+                dominator[order[i]] = idom;
+                changed             = true;
+            }
+        }
+    }
+    auto dominates = [&](int a, int b) {
+        while (b != a && dominator[b] != b && dominator[b] != NOT_SET) {
+            b = dominator[b];
+        }
+        return b == a;
+    };
+
+    /*
+     * A jump back to an instruction that every path to the jump passes through closes a loop. Everything that gets to the jump without
+     * passing that instruction is in the loop. Jumps back that don't, eg. from a block moved out of line, aren't loops.
+     */
+    std::vector<std::vector<bool>> loops(count);
+    for (const int from : order) {
+        for (const int header : successors[from]) {
+            if (rank[header] > rank[from] || !dominates(header, from))
+                continue;
+
+            std::vector<bool> &body = loops[header];
+            if (body.empty()) {
+                body.assign(count, false);
+                body[header] = true;
+            }
+
+            std::vector<int> pending = { from };
+            while (!pending.empty()) {
+                const int at = pending.back();
+                pending.pop_back();
+                if (body[at] || rank[at] == NOT_SET)
+                    continue;
+
+                body[at] = true;
+                pending.insert(pending.end(), predecessors[at].begin(), predecessors[at].end());
+            }
+        }
+    }
+
+    for (auto &body : loops) {
+        for (int i = 0; i < (int)body.size(); ++i) {
+            depths[i] += body[i] ? 1 : 0;
+        }
+    }
+
+    // Switch tables take the depth of the switch they belong to.
+    for (int i = 1; i < count; ++i) {
+        if (instructions[i].IsTable) {
+            depths[i] = depths[i - 1];
+        }
+    }
+    return depths;
+}
@@ -0,0 +1,94 @@
+#ifndef BYTECODE_H_
+#define BYTECODE_H_
+
+#include "Instructions.h"
+#include "Value.h"
+#include <vector>
+
+#define MAX_OPERAND_BYTES 10
+
+/*
+ * A decoded instruction. Jumps refer to the instruction they land on rather than a byte offset,
+ * so instructions can be removed or rewritten and the offsets rebuilt afterwards by Bytecode::Encode().
+ */
+struct Instruction {
+    opCode_t Op = OP_NOP;
+
+    // Raw operand bytes. Jump offsets are rebuilt from Target when encoded.
+    u8 Operands[MAX_OPERAND_BYTES] = {};
+    u8 OperandCount                = 0;
+
+    // Index of the instruction a jump lands on. Can be one past the end of the function.
+    int Target = NOT_SET;
+
+    // Switch jump table data, placed after the code that jumps over it. Not executed.
+    bool IsTable = false;
+    std::vector<int> Table;
+
+    // Values a sparse or hashed switch table is searched by, written in front of its jumps.
+    std::vector<s32> Keys;
+
+    // Something jumps here.
+    bool IsLabel = false;
+
+    // Dropped by an optimisation. Jumps to it land on the next instruction that remains.
+    bool Removed = false;
+
+    u32 Size() const
+    {
+        return IsTable ? (u32)(Keys.size() * 4 + Table.size() * 2) : 1 + OperandCount;
+    }
+};
+
+class Bytecode
+{
+  public:
+    /* Number of operand bytes following an opcode, or -1 if the opcode is unknown. */
+    static int OperandSize(opCode_t op);
+
+    static bool IsForwardJump(opCode_t op);
+    static bool IsBackwardJump(opCode_t op);
+    static bool IsJump(opCode_t op);
+
+    /* Jumps through a table. The table sits just before where the switch instruction itself jumps to. */
+    static bool IsSwitch(opCode_t op);
+
+    /* Control never falls through to the next instruction. */
+    static bool IsTerminator(opCode_t op);
+
+    /*
+     * Change in stack height after the instruction runs. Returns false if it isn't known.
+     * A call frame is counted against its OP_CALL, so OP_FRAME adds nothing and OP_CALL only removes its arguments.
+     */
+    static bool StackEffect(const Instruction &instr, int &outEffect);
+
+    /* Constant pool loads. The index is re-encoded at the smallest width when changed. */
+    static bool IsConstant(opCode_t op);
+    static u32 ConstantIndex(const Instruction &instr);
+    static void SetConstantIndex(Instruction &instr, u32 index);
+
+    /* Splits a function into instructions. Returns false if the code can't be decoded reliably. */
+    static bool Decode(const std::vector<opCode_t> &code, std::vector<Instruction> &outInstructions);
+
+    /* Writes instructions back to code, skipping removed ones. Returns false if a jump no longer fits. */
+    static bool Encode(const std::vector<Instruction> &instructions, std::vector<opCode_t> &outCode);
+
+    /* First instruction at or after index that hasn't been removed. */
+    static int Resolve(const std::vector<Instruction> &instructions, int index);
+
+    /* Next instruction after index that hasn't been removed. */
+    static int Next(const std::vector<Instruction> &instructions, int index);
+
+    /* Marks every instruction that a jump or switch table lands on. */
+    static void MarkLabels(std::vector<Instruction> &instructions);
+
+    static u32 SizeOf(const std::vector<Instruction> &instructions);
+
+    /*
+     * Number of loops each instruction is inside. A loop is found by a jump back to an instruction that every way into it passes through,
+     * so a block moved out of line that jumps back isn't one.
+     */
+    static std::vector<int> LoopDepths(const std::vector<Instruction> &instructions);
+};
+
+#endif // BYTECODE_H_
@@ -0,0 +1,306 @@
+#include "CodeLayout.h"
+#include "CompilerData.h"
+#include <algorithm>
+#include <map>
+
+CodeLayout::CodeLayout(const std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+u32 CodeLayout::BlocksMoved() const
+{
+    return m_BlocksMoved;
+}
+
+bool CodeLayout::Run(std::vector<opCode_t> &code, bool profiled)
+{
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(code, instructions) || instructions.empty() || instructions.back().IsTable ||
+        !Bytecode::IsTerminator(instructions.back().Op)) {
+        return false;
+    }
+
+    // Instructions from here on have been moved already.
+    int limit    = (int)instructions.size();
+    bool changed = false;
+
+    for (int i = 0; i < limit; ++i) {
+        /*
+         * cond, JUMP_IF_FALSE second, POP, first..., JUMP end, second: POP, second..., end:
+         * A first arm that returns has no jump at its end, and where the second arm ends isn't known.
+         */
+        const Instruction &branch = instructions[i];
+        if (branch.IsTable || (branch.Op != OP_JUMP_IF_FALSE && branch.Op != OP_JUMP_IF_TRUE)) {
+            continue;
+        }
+
+        const int second = branch.Target;
+        const int jump   = second - 1;
+        if (second <= i + 2 || second >= limit || instructions[i + 1].Op != OP_POP || instructions[second].Op != OP_POP ||
+            instructions[i + 1].IsTable || instructions[second].IsTable || instructions[jump].IsTable) {
+            continue;
+        }
+
+        int end;
+        if (instructions[jump].Op == OP_JUMP) {
+            end = instructions[jump].Target;
+            if (end <= second || end >= limit) {
+                continue;
+            }
+        } else if (instructions[jump].Op == OP_RETURN || instructions[jump].Op == OP_TAIL_CALL) {
+            end = NOT_SET;
+        } else {
+            continue;
+        }
+
+        const Arm cold = ColdArm(instructions, i, jump, end);
+
+        std::vector<Instruction> attempt = instructions;
+        int moved                        = 0;
+        if (cold == armFirst && jump > i + 2) {
+            // The branch now jumps to the first arm and falls through to the second. The jump after the first arm goes back.
+            attempt[i].Op     = (branch.Op == OP_JUMP_IF_FALSE) ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+            attempt[i].Target = i + 1;
+            if (MoveToEnd(attempt, i + 1, second, end, i, NOT_SET)) {
+                moved = second - (i + 1);
+            }
+        } else if (cold == armSecond && end != NOT_SET && !profiled) {
+            // The first arm no longer needs to jump over the second.
+            if (MoveToEnd(attempt, second, end, end, i, jump)) {
+                moved = end - second + 1;
+            }
+        }
+
+        if (moved > 0) {
+            instructions = attempt;
+            limit -= moved;
+            ++m_BlocksMoved;
+            changed = true;
+        }
+    }
+
+    if (!changed) {
+        return false;
+    }
+
+    std::vector<opCode_t> encoded;
+    if (!Bytecode::Encode(instructions, encoded)) {
+        return false;
+    }
+
+    code = encoded;
+    return true;
+}
+
+/* Guesses which arm of an if is rarely run. Arms with loops in them aren't cold. End is NOT_SET if the first arm returns. */
+CodeLayout::Arm CodeLayout::ColdArm(const std::vector<Instruction> &code, int branch, int jump, int end) const
+{
+    auto callsNative = [&code](int from, int to) {
+        bool native = false;
+        for (int i = from; i < to; ++i) {
+            if (code[i].IsTable)
+                continue;
+            if (Bytecode::IsBackwardJump(code[i].Op)) {
+                return false;
+            }
+            native |= code[i].Op == OP_CALL_NATIVE;
+        }
+        return native;
+    };
+
+    // Natives are how a script reports something, which is mostly an error.
+    const bool firstNative  = callsNative(branch + 2, jump);
+    const bool secondNative = end != NOT_SET && callsNative(jump + 2, end);
+    if (firstNative != secondNative) {
+        return firstNative ? armFirst : armSecond;
+    }
+
+    // A value is rarely equal to one particular constant. Only when the compare is the whole condition.
+    if (branch < 2 || code[branch].IsLabel || code[branch - 1].IsTable || code[branch - 2].IsTable || !Bytecode::IsConstant(code[branch - 2].Op)) {
+        return armNone;
+    }
+
+    const opCode_t compare = code[branch - 1].Op;
+    bool whenEqual;
+    if (compare == OP_EQUAL_S || compare == OP_EQUAL_U) {
+        whenEqual = true;
+    } else if (compare == OP_NOT_EQUAL_S || compare == OP_NOT_EQUAL_U) {
+        whenEqual = false;
+    } else {
+        return armNone;
+    }
+
+    // The first arm runs when the condition is true for JUMP_IF_FALSE.
+    const bool firstWhenTrue = code[branch].Op == OP_JUMP_IF_FALSE;
+    return (firstWhenTrue == whenEqual) ? armFirst : armSecond;
+}
+
+/*
+ * Moves the instructions from start up to end to the end of the function. Only entry can jump in, to start.
+ * They carry on at continuation, with a jump back there unless they already end with one, or NOT_SET if they return.
+ * Drop is an instruction to leave out.
+ * Returns false if they can't be moved, eg. a break jumps out of them.
+ */
+bool CodeLayout::MoveToEnd(std::vector<Instruction> &code, int start, int end, int continuation, int entry, int drop)
+{
+    const int count = (int)code.size();
+    auto inside     = [start, end](int index) { return index >= start && index < end; };
+
+    if (!Bytecode::IsTerminator(code[end - 1].Op) && end != continuation) {
+        return false;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const Instruction &instr = code[i];
+        if (i == drop) {
+            continue;
+        }
+
+        // The table of a switch has to stay just before where the switch jumps to.
+        if (!inside(i) && !instr.IsTable && Bytecode::IsSwitch(instr.Op) && inside(instr.Target - 1)) {
+            return false;
+        }
+
+        std::vector<int> targets = instr.IsTable ? instr.Table : std::vector<int>{ instr.Target };
+        for (const int target : targets) {
+            if (target == NOT_SET) {
+                continue;
+            }
+            if (target >= count) {
+                return false;
+            }
+            if (!inside(i) && inside(target) && !(i == entry && target == start)) {
+                return false;
+            }
+            if (inside(i) && (target == drop || (!inside(target) && target > i && target != continuation))) {
+                return false;
+            }
+        }
+    }
+
+    // The moved instructions go back with the jump at their end if there is one. Otherwise one is added, if anything needs it.
+    const Instruction &last = code[end - 1];
+    const bool reuse        = !last.IsTable && last.Op == OP_JUMP && last.Target == continuation;
+    const int dropNext      = (drop + 1 == start) ? end : drop + 1;
+
+    bool exits = !last.IsTable && !Bytecode::IsTerminator(last.Op);
+    for (int i = start; i < end; ++i) {
+        if (!code[i].IsTable && Bytecode::IsForwardJump(code[i].Op) && code[i].Target == continuation) {
+            exits = true;
+        }
+    }
+    exits |= last.IsTable;
+
+    std::vector<int> order;
+    for (int i = 0; i < count; ++i) {
+        if (!inside(i) && i != drop) {
+            order.push_back(i);
+        }
+    }
+    for (int i = start; i < end; ++i) {
+        order.push_back(i);
+    }
+
+    std::vector<int> moved(count, NOT_SET);
+    for (int i = 0; i < (int)order.size(); ++i) {
+        moved[order[i]] = i;
+    }
+    const int back = reuse ? moved[end - 1] : (int)order.size();
+
+    std::vector<Instruction> laidOut;
+    for (const int from : order) {
+        Instruction instr = code[from];
+        auto remap        = [&](int target) {
+            if (target == NOT_SET) {
+                return target;
+            }
+            if (target == drop) {
+                target = dropNext;
+            }
+            // Jumps out of the moved instructions go through the jump back.
+            if (inside(from) && !inside(target) && target > from && !(reuse && from == end - 1)) {
+                return back;
+            }
+            return moved[target];
+        };
+
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = remap(target);
+            }
+        } else {
+            instr.Target = remap(instr.Target);
+        }
+        laidOut.push_back(instr);
+    }
+
+    if (reuse) {
+        laidOut[back].Op = OP_LOOP;
+    } else if (exits && continuation != NOT_SET) {
+        Instruction loop;
+        loop.Op           = OP_LOOP;
+        loop.OperandCount = 2;
+        loop.Target       = moved[continuation];
+        laidOut.push_back(loop);
+    }
+
+    Bytecode::MarkLabels(laidOut);
+    code = laidOut;
+    return true;
+}
+
+void CodeLayout::OrderFunctions(std::vector<ScriptFunction *> &functions, bool profiled) const
+{
+    if (functions.size() < 3) {
+        return;
+    }
+
+    std::map<const ScriptFunction *, u64> weights;
+    std::map<funcPtr_t, const ScriptFunction *> byId;
+    for (auto func : functions) {
+        if (func == nullptr)
+            continue;
+
+        byId.emplace(func->Id, func);
+        if (profiled) {
+            weights[func] = func->Calls;
+        } else if (func->Attributes & atPeriodic) {
+            // The host calls these over and over.
+            weights[func] += LAYOUT_LOOP_WEIGHT;
+        }
+    }
+
+    // Without a profile, each call counts for more the deeper in loops it is.
+    for (auto func : functions) {
+        std::vector<Instruction> code;
+        if (profiled || func == nullptr || !Bytecode::Decode(func->Code, code))
+            continue;
+
+        const std::vector<int> depth = Bytecode::LoopDepths(code);
+        for (int i = 0; i < (int)code.size(); ++i) {
+            if (code[i].IsTable || !Bytecode::IsConstant(code[i].Op))
+                continue;
+
+            const u32 index = Bytecode::ConstantIndex(code[i]);
+            if (index >= m_Constants.size() || m_Constants[index].Type != dtFunction)
+                continue;
+
+            auto callee = byId.find(m_Constants[index].ConstValue.FuncPointer);
+            if (callee != byId.end()) {
+                u64 weight = 1;
+                for (int d = 0; d < std::min(depth[i], LAYOUT_MAX_DEPTH); ++d) {
+                    weight *= LAYOUT_LOOP_WEIGHT;
+                }
+                weights[callee->second] += weight;
+            }
+        }
+    }
+
+    // The top level code is run first, from the start of the code.
+    std::stable_sort(functions.begin() + 1, functions.end(), [&weights](const ScriptFunction *a, const ScriptFunction *b) {
+        if (a == nullptr || b == nullptr) {
+            return a != nullptr && b == nullptr;
+        }
+        return weights[a] > weights[b];
+    });
+}
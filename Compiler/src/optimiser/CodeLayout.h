@@ -0,0 +1,55 @@
+#ifndef CODELAYOUT_H_
+#define CODELAYOUT_H_
+
+#include "Bytecode.h"
+#include "Function.h"
+#include "Variable.h"
+#include <vector>
+
+/* Weight of a call made from inside a loop, per loop it's nested in, when there's no profile. */
+#ifndef LAYOUT_LOOP_WEIGHT
+#define LAYOUT_LOOP_WEIGHT 8
+#endif // LAYOUT_LOOP_WEIGHT
+
+/* Deepest loop nesting counted towards a call's weight. */
+#define LAYOUT_MAX_DEPTH 3
+
+/*
+ * Lays out the code so that what runs most often sits together.
+ * Functions are ordered hottest first, by how often the profile saw them called or by how deep in loops they're called from.
+ * Cold arms of an if are moved to the end of their function, which jumps back when they're done, so the hot path runs straight through.
+ * An arm is cold if it calls a native function and the other doesn't, eg. to report an error, or if it's only run when a value equals a constant.
+ * Runs after the other passes, which expect the code of each statement to be in one piece.
+ */
+class CodeLayout
+{
+  public:
+    explicit CodeLayout(const std::vector<ConstantInfo> &constants);
+
+    /*
+     * Moves the cold arms of a function's if statements to the end of it. Returns true if the code was changed.
+     * With a profile the arms have already been ordered by it, so only a cold first arm is moved.
+     */
+    bool Run(std::vector<opCode_t> &code, bool profiled);
+
+    /* Sorts the functions hottest first. The top level code stays at the start. */
+    void OrderFunctions(std::vector<ScriptFunction *> &functions, bool profiled) const;
+
+    /* Total for every function run so far. */
+    u32 BlocksMoved() const;
+
+  private:
+    const std::vector<ConstantInfo> &m_Constants;
+    u32 m_BlocksMoved = 0;
+
+    enum Arm {
+        armNone,
+        armFirst,  // Run when the branch falls through
+        armSecond, // Run when the branch jumps
+    };
+
+    Arm ColdArm(const std::vector<Instruction> &code, int branch, int jump, int end) const;
+    static bool MoveToEnd(std::vector<Instruction> &code, int start, int end, int continuation, int entry, int drop);
+};
+
+#endif // CODELAYOUT_H_
@@ -0,0 +1,175 @@
+#include "DeadCode.h"
+
+DeadCode::DeadCode(const std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+bool DeadCode::Run(std::vector<opCode_t> &code)
+{
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(code, instructions)) {
+        return false;
+    }
+
+    const u32 originalSize = Bytecode::SizeOf(instructions);
+    const int folded       = FoldBranches(instructions);
+
+    if (!RemoveUnreachable(instructions)) {
+        return false;
+    }
+
+    std::vector<opCode_t> optimised;
+    if (!Bytecode::Encode(instructions, optimised)) {
+        return false;
+    }
+
+    m_BranchesFolded += folded;
+    m_BytesRemoved += originalSize - (u32)optimised.size();
+    code = optimised;
+    return true;
+}
+
+u32 DeadCode::BranchesFolded() const
+{
+    return m_BranchesFolded;
+}
+
+u32 DeadCode::BytesRemoved() const
+{
+    return m_BytesRemoved;
+}
+
+/* Gets the truthiness of a value pushed by the instruction, if it is known at compile time. */
+bool DeadCode::ConstantCondition(const Instruction &instr, bool &outCondition) const
+{
+    if (instr.IsTable) {
+        return false;
+    }
+
+    switch (instr.Op) {
+        case OP_NIL:
+        case OP_FALSE:
+            outCondition = false;
+            return true;
+
+        case OP_TRUE:
+        case OP_FLOAT_ONE:
+            outCondition = true;
+            return true;
+
+        case OP_INT_8:
+        case OP_INT_16:
+            outCondition = instr.Operands[0] != 0 || (instr.OperandCount > 1 && instr.Operands[1] != 0);
+            return true;
+
+        case OP_CONSTANT:
+        case OP_CONSTANT_16:
+        case OP_CONSTANT_24: {
+            const u32 index = Bytecode::ConstantIndex(instr);
+            if (index >= m_Constants.size()) {
+                return false;
+            }
+            // Same test as the VM. Only the bits matter.
+            outCondition = AS_INT32(m_Constants[index].ConstValue) != 0;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+/* CONSTANT, JUMP_IF_FALSE L -> CONSTANT, JUMP L or CONSTANT */
+int DeadCode::FoldBranches(std::vector<Instruction> &code) const
+{
+    int folded   = 0;
+    int previous = NOT_SET;
+
+    for (int i = 0; i < (int)code.size(); ++i) {
+        Instruction &instr = code[i];
+        if (instr.Removed) {
+            continue;
+        }
+
+        const int pushed = previous;
+        previous         = i;
+
+        // Something else jumps here, so the condition isn't always the constant.
+        if ((instr.Op != OP_JUMP_IF_FALSE && instr.Op != OP_JUMP_IF_TRUE) || instr.IsTable || instr.IsLabel || pushed == NOT_SET) {
+            continue;
+        }
+
+        bool condition;
+        if (!ConstantCondition(code[pushed], condition)) {
+            continue;
+        }
+
+        // The condition is only peeked, so the stack is the same whichever way it goes.
+        if (condition == (instr.Op == OP_JUMP_IF_TRUE)) {
+            instr.Op = OP_JUMP;
+        } else {
+            instr.Removed = true;
+        }
+        folded++;
+    }
+
+    return folded;
+}
+
+/* Walks every path from the start of the function and removes whatever isn't visited. */
+bool DeadCode::RemoveUnreachable(std::vector<Instruction> &code)
+{
+    const int count = (int)code.size();
+    std::vector<bool> reached(count, false);
+    std::vector<int> pending;
+
+    auto visit = [&](int index) {
+        index = Bytecode::Resolve(code, index);
+        if (index < count && !reached[index]) {
+            reached[index] = true;
+            pending.push_back(index);
+        }
+    };
+
+    visit(0);
+    while (!pending.empty()) {
+        const int index          = pending.back();
+        const Instruction &instr = code[index];
+        pending.pop_back();
+
+        if (instr.IsTable) {
+            for (const int target : instr.Table) {
+                visit(target);
+            }
+            // The jump over the table is kept so the table can still be found when decoded again.
+            if (index > 0) {
+                visit(index - 1);
+            }
+            continue;
+        }
+
+        if (Bytecode::IsSwitch(instr.Op)) {
+            // The table sits just before where the switch jumps to.
+            const int table = instr.Target - 1;
+            if (table < 0 || !code[table].IsTable) {
+                return false;
+            }
+            visit(table);
+        } else if (Bytecode::IsJump(instr.Op)) {
+            visit(instr.Target);
+        }
+
+        if (!Bytecode::IsTerminator(instr.Op)) {
+            visit(Bytecode::Next(code, index));
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (!reached[i]) {
+            code[i].Removed = true;
+        }
+    }
+
+    Bytecode::MarkLabels(code);
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef DEADCODE_H_
+#define DEADCODE_H_
+
+#include "Bytecode.h"
+#include "Variable.h"
+#include <vector>
+
+/*
+ * Removes code that can never run from a finished function.
+ * Conditional jumps on a constant are replaced with a plain jump or dropped, then anything
+ * not reachable from the start of the function is stripped. Eg: code after a return or break.
+ */
+class DeadCode
+{
+  public:
+    explicit DeadCode(const std::vector<ConstantInfo> &constants);
+
+    /* Optimises a function in place. The code is left untouched if it can't be decoded. */
+    bool Run(std::vector<opCode_t> &code);
+
+    /* Totals for every function run so far. */
+    u32 BranchesFolded() const;
+    u32 BytesRemoved() const;
+
+  private:
+    const std::vector<ConstantInfo> &m_Constants;
+    u32 m_BranchesFolded = 0;
+    u32 m_BytesRemoved   = 0;
+
+    bool ConstantCondition(const Instruction &instr, bool &outCondition) const;
+    int FoldBranches(std::vector<Instruction> &code) const;
+    static bool RemoveUnreachable(std::vector<Instruction> &code);
+};
+
+#endif // DEADCODE_H_
@@ -0,0 +1,353 @@
+#include "Folding.h"
+#include "BitOps.h"
+#include "FixedPoint.h"
+#include <algorithm>
+#include <cmath>
+
+static ConstantInfo IntConstant(DataType type, s32 value)
+{
+    return ConstantInfo{ type, INT32_VAL(value) };
+}
+
+static ConstantInfo FloatConstant(DataType type, float value)
+{
+    return ConstantInfo{ type, FLOAT_VAL(value) };
+}
+
+static bool IsComparison(TokenType operatorType)
+{
+    switch (operatorType) {
+        case tknEquals:
+        case tknNotEqual:
+        case tknLessThan:
+        case tknLessEqual:
+        case tknGreaterThan:
+        case tknGreaterEqual:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Folding::Cast(TypeCompatibility castMode, const ConstantInfo &input, ConstantInfo &outResult)
+{
+    switch (castMode) {
+        case tcCastSignedToFloat:
+            outResult = FloatConstant(dtFloat, (float)input.ConstValue.Int);
+            return true;
+
+        case tcCastFloatToSigned: {
+            // Out of range conversions are undefined, leave them to the target.
+            const float value = input.ConstValue.Float;
+            if (!std::isfinite(value) || value >= 2147483648.0f || value < -2147483648.0f) {
+                return false;
+            }
+            outResult = IntConstant(dtInt32, (s32)value);
+            return true;
+        }
+
+        case tcCastSignedToFixed:
+            outResult = IntConstant(dtFixed, FixedPoint::FromInt(input.ConstValue.Int));
+            return true;
+        case tcCastFixedToSigned:
+            outResult = IntConstant(dtInt32, FixedPoint::ToInt(input.ConstValue.Int));
+            return true;
+        case tcCastFloatToFixed:
+            outResult = IntConstant(dtFixed, FixedPoint::FromFloat(input.ConstValue.Float));
+            return true;
+        case tcCastFixedToFloat:
+            outResult = FloatConstant(dtFloat, FixedPoint::ToFloat(input.ConstValue.Int));
+            return true;
+
+        default:
+            // All other casts don't emit an instruction.
+            outResult = input;
+            return true;
+    }
+}
+
+bool Folding::Unary(TokenType operatorType, DataType type, const ConstantInfo &operand, ConstantInfo &outResult)
+{
+    const Value value = operand.ConstValue;
+
+    switch (operatorType) {
+        case tknMinus:
+            if (type == dtFloat) {
+                outResult = FloatConstant(type, -value.Float);
+            } else {
+                outResult = IntConstant(type, (s32)(0u - value.UInt));
+            }
+            return true;
+
+        case tknExclamation:
+            outResult = IntConstant(type, value.Int == 0 ? 1 : 0);
+            return true;
+
+        case tknBitwiseNot:
+            outResult = IntConstant(type, ~value.Int);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool BinaryInt(TokenType operatorType, const s32 lhs, const s32 rhs, s32 &outResult)
+{
+    // Wrapping arithmetic is done unsigned to avoid undefined behaviour on overflow.
+    const u32 uLhs = (u32)lhs;
+    const u32 uRhs = (u32)rhs;
+
+    switch (operatorType) {
+        case tknPlus:
+        case tknPlusEquals:
+            outResult = (s32)(uLhs + uRhs);
+            return true;
+        case tknMinus:
+        case tknMinusEquals:
+            outResult = (s32)(uLhs - uRhs);
+            return true;
+        case tknStar:
+        case tknTimesEquals:
+            outResult = (s32)(uLhs * uRhs);
+            return true;
+        case tknSlash:
+        case tknDivideEquals:
+        case tknPercent:
+            if (rhs == 0 || (lhs == INT32_MIN && rhs == -1)) {
+                return false;
+            }
+            outResult = (operatorType == tknPercent) ? lhs % rhs : lhs / rhs;
+            return true;
+
+        case tknEquals:
+            outResult = lhs == rhs;
+            return true;
+        case tknNotEqual:
+            outResult = lhs != rhs;
+            return true;
+        case tknLessThan:
+            outResult = lhs < rhs;
+            return true;
+        case tknLessEqual:
+            outResult = lhs <= rhs;
+            return true;
+        case tknGreaterThan:
+            outResult = lhs > rhs;
+            return true;
+        case tknGreaterEqual:
+            outResult = lhs >= rhs;
+            return true;
+
+        case tknBitwiseAnd:
+        case tknBitwiseAndEquals:
+            outResult = lhs & rhs;
+            return true;
+        case tknBitwiseOr:
+        case tknBitwiseOrEquals:
+            outResult = lhs | rhs;
+            return true;
+        case tknBitwiseXor:
+        case tknBitwiseXorEquals:
+            outResult = lhs ^ rhs;
+            return true;
+        case tknShiftLeft:
+        case tknShiftRight:
+            if (rhs < 0 || rhs > 31) {
+                return false;
+            }
+            outResult = (operatorType == tknShiftLeft) ? (s32)(uLhs << rhs) : (lhs >> rhs);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool BinaryFloat(TokenType operatorType, const float lhs, const float rhs, Value &outResult)
+{
+    switch (operatorType) {
+        case tknPlus:
+        case tknPlusEquals:
+            outResult = FLOAT_VAL(lhs + rhs);
+            return true;
+        case tknMinus:
+        case tknMinusEquals:
+            outResult = FLOAT_VAL(lhs - rhs);
+            return true;
+        case tknStar:
+        case tknTimesEquals:
+            outResult = FLOAT_VAL(lhs * rhs);
+            return true;
+        case tknSlash:
+        case tknDivideEquals:
+            outResult = FLOAT_VAL(lhs / rhs);
+            return true;
+
+        // Comparisons leave a bool on the stack.
+        case tknEquals:
+            outResult = INT32_VAL(lhs == rhs);
+            return true;
+        case tknNotEqual:
+            outResult = INT32_VAL(lhs != rhs);
+            return true;
+        case tknLessThan:
+            outResult = INT32_VAL(lhs < rhs);
+            return true;
+        case tknLessEqual:
+            outResult = INT32_VAL(lhs <= rhs);
+            return true;
+        case tknGreaterThan:
+            outResult = INT32_VAL(lhs > rhs);
+            return true;
+        case tknGreaterEqual:
+            outResult = INT32_VAL(lhs >= rhs);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* Only folded if the result is in range, as it isn't known here whether the VM would wrap it around or saturate it. */
+static bool BinaryFixed(TokenType operatorType, const s32 lhs, const s32 rhs, s32 &outResult)
+{
+    s32 wrapped;
+    switch (operatorType) {
+        case tknPlus:
+        case tknPlusEquals:
+            wrapped   = FixedPoint::Add(lhs, rhs, false);
+            outResult = FixedPoint::Add(lhs, rhs, true);
+            break;
+        case tknMinus:
+        case tknMinusEquals:
+            wrapped   = FixedPoint::Subtract(lhs, rhs, false);
+            outResult = FixedPoint::Subtract(lhs, rhs, true);
+            break;
+        case tknStar:
+        case tknTimesEquals:
+            wrapped   = FixedPoint::Multiply(lhs, rhs, false);
+            outResult = FixedPoint::Multiply(lhs, rhs, true);
+            break;
+        case tknSlash:
+        case tknDivideEquals:
+            if (rhs == 0) {
+                return false;
+            }
+            wrapped   = FixedPoint::Divide(lhs, rhs, false);
+            outResult = FixedPoint::Divide(lhs, rhs, true);
+            break;
+
+        default:
+            // Everything else is the same as for ints.
+            return BinaryInt(operatorType, lhs, rhs, outResult);
+    }
+
+    return wrapped == outResult;
+}
+
+bool Folding::Binary(TokenType operatorType, DataType binaryType, const ConstantInfo &lhs, const ConstantInfo &rhs, ConstantInfo &outResult)
+{
+    if (binaryType == dtFloat) {
+        Value result = INT32_VAL(0);
+        if (!BinaryFloat(operatorType, lhs.ConstValue.Float, rhs.ConstValue.Float, result)) {
+            return false;
+        }
+        outResult = ConstantInfo{ IsComparison(operatorType) ? dtBool : binaryType, result };
+        return true;
+    }
+
+    if (binaryType == dtFixed) {
+        s32 result = 0;
+        if (!BinaryFixed(operatorType, lhs.ConstValue.Int, rhs.ConstValue.Int, result)) {
+            return false;
+        }
+        outResult = IntConstant(IsComparison(operatorType) ? dtBool : binaryType, result);
+        return true;
+    }
+
+    if (binaryType == dtInt32) {
+        s32 result = 0;
+        if (!BinaryInt(operatorType, lhs.ConstValue.Int, rhs.ConstValue.Int, result)) {
+            return false;
+        }
+        outResult = IntConstant(binaryType, result);
+        return true;
+    }
+
+    return false;
+}
+
+/* Only the intrinsics with an exact answer. sqrt, sin and cos depend on how the VM was built. */
+bool Folding::Intrinsic(opCode_t op, DataType type, const std::vector<ConstantInfo> &args, ConstantInfo &outResult)
+{
+    const Value value = args[0].ConstValue;
+
+    switch (op) {
+        case OP_ABS_I:
+            outResult = IntConstant(type, (s32)(value.Int < 0 ? 0u - value.UInt : value.UInt));
+            return true;
+        case OP_ABS_F:
+            outResult = FloatConstant(type, std::fabs(value.Float));
+            return true;
+        case OP_FLOOR:
+            outResult = FloatConstant(type, std::floor(value.Float));
+            return true;
+
+        case OP_MIN_S:
+            outResult = IntConstant(type, std::min(value.Int, args[1].ConstValue.Int));
+            return true;
+        case OP_MIN_U:
+            outResult = IntConstant(type, (s32)std::min(value.UInt, args[1].ConstValue.UInt));
+            return true;
+        case OP_MIN_F:
+            outResult = FloatConstant(type, std::min(value.Float, args[1].ConstValue.Float));
+            return true;
+        case OP_MAX_S:
+            outResult = IntConstant(type, std::max(value.Int, args[1].ConstValue.Int));
+            return true;
+        case OP_MAX_U:
+            outResult = IntConstant(type, (s32)std::max(value.UInt, args[1].ConstValue.UInt));
+            return true;
+        case OP_MAX_F:
+            outResult = FloatConstant(type, std::max(value.Float, args[1].ConstValue.Float));
+            return true;
+
+        // The max wins if the limits are the wrong way round.
+        case OP_CLAMP_S:
+            outResult = IntConstant(type, std::min(std::max(value.Int, args[1].ConstValue.Int), args[2].ConstValue.Int));
+            return true;
+        case OP_CLAMP_U:
+            outResult = IntConstant(type, (s32)std::min(std::max(value.UInt, args[1].ConstValue.UInt), args[2].ConstValue.UInt));
+            return true;
+        case OP_CLAMP_F:
+            outResult = FloatConstant(type, std::min(std::max(value.Float, args[1].ConstValue.Float), args[2].ConstValue.Float));
+            return true;
+
+        // The compiler has already checked the bit field fits.
+        case OP_BIT_EXTRACT:
+            outResult = IntConstant(type, (s32)BitOps::Extract(value.UInt, args[1].ConstValue.UInt, args[2].ConstValue.UInt));
+            return true;
+        case OP_BIT_INSERT:
+            outResult = IntConstant(type, (s32)BitOps::Insert(value.UInt, args[1].ConstValue.UInt, args[2].ConstValue.UInt, args[3].ConstValue.UInt));
+            return true;
+        case OP_POPCOUNT:
+            outResult = IntConstant(type, (s32)BitOps::PopCount(value.UInt));
+            return true;
+        case OP_CLZ:
+            outResult = IntConstant(type, (s32)BitOps::CountLeadingZeros(value.UInt));
+            return true;
+        case OP_ROTATE_L:
+            outResult = IntConstant(type, (s32)BitOps::RotateLeft(value.UInt, args[1].ConstValue.Int));
+            return true;
+        case OP_ROTATE_R:
+            outResult = IntConstant(type, (s32)BitOps::RotateRight(value.UInt, args[1].ConstValue.Int));
+            return true;
+        case OP_BYTE_SWAP:
+            outResult = IntConstant(type, (s32)BitOps::ByteSwap(value.UInt));
+            return true;
+
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef FOLDING_H_
+#define FOLDING_H_
+
+#include "Instructions.h"
+#include "Tokens.h"
+#include "TypeSystem.h"
+#include "Variable.h"
+#include <vector>
+
+/*
+ * Compile time evaluation of constant expressions.
+ * Each function mirrors what the VM would do with the instructions the compiler would otherwise emit,
+ * so a folded result is bit for bit the same as the runtime result.
+ * Returns false if the operation can't be folded safely, eg. integer division by zero, in which case it is left to the VM.
+ */
+namespace Folding
+{
+    bool Cast(TypeCompatibility castMode, const ConstantInfo &input, ConstantInfo &outResult);
+    bool Unary(TokenType operatorType, DataType type, const ConstantInfo &operand, ConstantInfo &outResult);
+    bool Binary(TokenType operatorType, DataType binaryType, const ConstantInfo &lhs, const ConstantInfo &rhs, ConstantInfo &outResult);
+    bool Intrinsic(opCode_t op, DataType type, const std::vector<ConstantInfo> &args, ConstantInfo &outResult);
+}
+
+#endif // FOLDING_H_
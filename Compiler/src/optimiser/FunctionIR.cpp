@@ -0,0 +1,214 @@
+#include "FunctionIR.h"
+#include <algorithm>
+
+bool FunctionIR::Lift(const std::vector<opCode_t> &code, int argCount)
+{
+    m_ArgCount = argCount;
+
+    if (!Bytecode::Decode(code, Instructions)) {
+        return false;
+    }
+
+    Analyse();
+    return true;
+}
+
+bool FunctionIR::Lower(std::vector<opCode_t> &outCode) const
+{
+    return Bytecode::Encode(Instructions, outCode);
+}
+
+void FunctionIR::Analyse()
+{
+    Compact();
+    Bytecode::MarkLabels(Instructions);
+
+    if (!StackHeights(Instructions, m_ArgCount, Heights)) {
+        Heights.clear();
+    }
+
+    BuildBlocks();
+}
+
+int FunctionIR::BlockOf(int instruction) const
+{
+    return (instruction >= 0 && instruction < (int)m_BlockOf.size()) ? m_BlockOf[instruction] : NOT_SET;
+}
+
+std::vector<u32> FunctionIR::Offsets() const
+{
+    std::vector<u32> offsets;
+    u32 offset = 0;
+    for (const auto &instr : Instructions) {
+        offsets.push_back(offset);
+        offset += instr.Removed ? 0 : instr.Size();
+    }
+    offsets.push_back(offset);
+    return offsets;
+}
+
+bool FunctionIR::StackHeights(const std::vector<Instruction> &code, int argCount, std::vector<int> &outHeights)
+{
+    const int count = (int)code.size();
+    outHeights.assign(count, NOT_SET);
+    std::vector<int> pending;
+
+    auto reach = [&](int index, int height) {
+        if (index >= count) {
+            return true;
+        }
+        if (height < 0) {
+            return false;
+        }
+        if (outHeights[index] == NOT_SET) {
+            outHeights[index] = height;
+            pending.push_back(index);
+            return true;
+        }
+        // Every path must agree.
+        return outHeights[index] == height;
+    };
+
+    if (!reach(0, argCount)) {
+        return false;
+    }
+
+    while (!pending.empty()) {
+        const int index          = pending.back();
+        const Instruction &instr = code[index];
+        pending.pop_back();
+
+        // Tables are followed from their switch. Returns leave the function.
+        if (instr.IsTable || instr.Op == OP_RETURN || instr.Op == OP_TAIL_CALL || instr.Op == OP_END) {
+            continue;
+        }
+
+        int effect;
+        if (!Bytecode::StackEffect(instr, effect)) {
+            return false;
+        }
+        const int height = outHeights[index] + effect;
+
+        if (Bytecode::IsSwitch(instr.Op)) {
+            const int table = instr.Target - 1;
+            if (table < 0 || !code[table].IsTable) {
+                return false;
+            }
+            for (const int target : code[table].Table) {
+                if (!reach(target, height)) {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        if (Bytecode::IsJump(instr.Op) && !reach(instr.Target, height)) {
+            return false;
+        }
+
+        if (!Bytecode::IsTerminator(instr.Op) && !reach(index + 1, height)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Removes dropped instructions for good. Jumps to them land on the next one that remains, as they do when encoded. */
+void FunctionIR::Compact()
+{
+    const int count = (int)Instructions.size();
+
+    std::vector<int> moved(count + 1, 0);
+    std::vector<Instruction> kept;
+    for (int i = 0; i < count; ++i) {
+        moved[i] = (int)kept.size();
+        if (!Instructions[i].Removed) {
+            kept.push_back(Instructions[i]);
+        }
+    }
+    moved[count] = (int)kept.size();
+
+    if ((int)kept.size() == count) {
+        return;
+    }
+
+    for (auto &instr : kept) {
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = moved[target];
+            }
+        } else if (Bytecode::IsJump(instr.Op)) {
+            instr.Target = moved[instr.Target];
+        }
+    }
+
+    Instructions = kept;
+}
+
+void FunctionIR::BuildBlocks()
+{
+    const int count = (int)Instructions.size();
+
+    // A block starts at the function entry, anything jumped to, and after anything that doesn't fall through.
+    std::vector<bool> leader(count + 1, false);
+    leader[0] = true;
+    for (int i = 0; i < count; ++i) {
+        const Instruction &instr = Instructions[i];
+        if (instr.IsLabel || instr.IsTable) {
+            leader[i] = true;
+        }
+        if (instr.IsTable || Bytecode::IsJump(instr.Op) || Bytecode::IsTerminator(instr.Op)) {
+            leader[i + 1] = true;
+        }
+    }
+
+    Blocks.clear();
+    m_BlockOf.assign(count, NOT_SET);
+    for (int i = 0; i < count; ++i) {
+        if (leader[i]) {
+            BasicBlock block;
+            block.Start   = i;
+            block.IsTable = Instructions[i].IsTable;
+            block.StackIn = Heights.empty() ? NOT_SET : Heights[i];
+            Blocks.push_back(block);
+        }
+        Blocks.back().End = i + 1;
+        m_BlockOf[i]      = (int)Blocks.size() - 1;
+    }
+
+    auto link = [&](int from, int to) {
+        const int target = BlockOf(to);
+        if (target == NOT_SET) {
+            return; // Falls off the end of the function
+        }
+        auto &successors = Blocks[from].Successors;
+        if (std::find(successors.begin(), successors.end(), target) == successors.end()) {
+            successors.push_back(target);
+            Blocks[target].Predecessors.push_back(from);
+        }
+    };
+
+    for (int b = 0; b < (int)Blocks.size(); ++b) {
+        const BasicBlock &block  = Blocks[b];
+        const Instruction &last = Instructions[block.End - 1];
+        if (block.IsTable) {
+            continue;
+        }
+
+        if (Bytecode::IsSwitch(last.Op)) {
+            const int table = last.Target - 1;
+            if (table >= 0 && Instructions[table].IsTable) {
+                for (const int target : Instructions[table].Table) {
+                    link(b, target);
+                }
+            }
+        } else if (Bytecode::IsJump(last.Op)) {
+            link(b, last.Target);
+        }
+
+        if (!Bytecode::IsTerminator(last.Op)) {
+            link(b, block.End);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef FUNCTIONIR_H_
+#define FUNCTIONIR_H_
+
+#include "Bytecode.h"
+#include <vector>
+
+/* A run of instructions that is only entered at the top and only left from the bottom. */
+struct BasicBlock {
+    int Start    = 0;       // First instruction
+    int End      = 0;       // One past the last instruction
+    int StackIn  = NOT_SET; // Stack height on entry. NOT_SET if unreachable or unknown.
+    bool IsTable = false;   // Switch jump table data, never executed
+    std::vector<int> Successors;
+    std::vector<int> Predecessors;
+};
+
+/*
+ * Intermediate representation of a function for the optimiser.
+ * The bytecode the parser emitted is lifted into instructions split into basic blocks, with the height of the virtual stack
+ * worked out before every instruction. Passes edit the instructions and call Analyse() to bring the blocks up to date again.
+ * Lowering a function that hasn't been changed gives back the bytes it was lifted from.
+ * Only the loop passes use it. The others decode the bytecode with Bytecode::Decode() and work on the instructions alone.
+ */
+class FunctionIR
+{
+  public:
+    std::vector<Instruction> Instructions;
+    std::vector<BasicBlock> Blocks;
+    std::vector<int> Heights; // Stack height before each instruction, relative to the frame's slots. Empty if unknown.
+
+    /* Returns false if the code can't be decoded reliably. */
+    bool Lift(const std::vector<opCode_t> &code, int argCount);
+    bool Lower(std::vector<opCode_t> &outCode) const;
+
+    /* Drops removed instructions, then rebuilds the labels, blocks and stack heights. */
+    void Analyse();
+
+    int BlockOf(int instruction) const;
+
+    /* Byte offset of each instruction as lowered, followed by the size of the function. */
+    std::vector<u32> Offsets() const;
+
+    /* Works out the stack height before every instruction. Unreachable ones are NOT_SET. Returns false if any aren't known. */
+    static bool StackHeights(const std::vector<Instruction> &code, int argCount, std::vector<int> &outHeights);
+
+  private:
+    int m_ArgCount = 0;
+    std::vector<int> m_BlockOf;
+
+    void Compact();
+    void BuildBlocks();
+};
+
+#endif // FUNCTIONIR_H_
@@ -0,0 +1,113 @@
+#include "Immediates.h"
+#include "MathUtils.h"
+
+Immediates::Immediates(const std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+u32 Immediates::LoadsReplaced() const
+{
+    return m_LoadsReplaced;
+}
+
+bool Immediates::Run(std::vector<ScriptFunction *> &functions, bool small)
+{
+    std::vector<std::vector<Instruction>> decoded(functions.size());
+    std::vector<s32> growth(m_Constants.size(), 0); // Bytes of code added by replacing every load of each constant
+
+    for (size_t f = 0; f < functions.size(); ++f) {
+        if (functions[f] == nullptr || !Bytecode::Decode(functions[f]->Code, decoded[f]))
+            continue;
+
+        for (auto &instr : decoded[f]) {
+            if (instr.IsTable || !Bytecode::IsConstant(instr.Op))
+                continue;
+
+            Instruction replacement;
+            const u32 index = Bytecode::ConstantIndex(instr);
+            if (index < m_Constants.size() && Immediate(m_Constants[index], replacement)) {
+                growth[index] += (s32)replacement.Size() - (s32)instr.Size();
+            }
+        }
+    }
+
+    bool changed = false;
+    for (size_t f = 0; f < functions.size(); ++f) {
+        bool replaced = false;
+        for (auto &instr : decoded[f]) {
+            if (instr.IsTable || !Bytecode::IsConstant(instr.Op))
+                continue;
+
+            Instruction replacement;
+            const u32 index = Bytecode::ConstantIndex(instr);
+            if (index >= m_Constants.size() || !Immediate(m_Constants[index], replacement))
+                continue;
+
+            // The pool entry is only freed if every load of it is replaced.
+            if (small && growth[index] >= (s32)sizeof(Value))
+                continue;
+
+            instr.Op           = replacement.Op;
+            instr.OperandCount = replacement.OperandCount;
+            instr.Operands[0]  = replacement.Operands[0];
+            instr.Operands[1]  = replacement.Operands[1];
+            ++m_LoadsReplaced;
+            replaced = true;
+        }
+
+        std::vector<opCode_t> encoded;
+        if (replaced && Bytecode::Encode(decoded[f], encoded)) {
+            functions[f]->Code = encoded;
+            changed            = true;
+        }
+    }
+
+    return changed;
+}
+
+/* Gets the instruction that pushes the constant without reading the pool, if there is one. */
+bool Immediates::Immediate(const ConstantInfo &constant, Instruction &outInstr) const
+{
+    const s32 value = AS_INT32(constant.ConstValue);
+
+    outInstr.OperandCount = 0;
+
+    if (constant.Type == dtBool) {
+        outInstr.Op = AS_BOOL(constant.ConstValue) ? OP_TRUE : OP_FALSE;
+        return true;
+    }
+
+    if (constant.Type == dtFloat) {
+        // 0.0 has the same bits as 0. -0.0 doesn't.
+        if (value == 0) {
+            outInstr.Op = OP_NIL;
+        } else if (AS_FLOAT(constant.ConstValue) == 1.0f) {
+            outInstr.Op = OP_FLOAT_ONE;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    if (constant.Type < dtInt8 || constant.Type > dtFixed) {
+        return false;
+    }
+
+    // Only the bits matter, so an unsigned or fixed point value sign extended from fewer bits is the same.
+    if (value == 0) {
+        outInstr.Op = OP_NIL;
+    } else if (value >= INT8_MIN && value <= INT8_MAX) {
+        outInstr.Op           = OP_INT_8;
+        outInstr.OperandCount = 1;
+        outInstr.Operands[0]  = mByte0(value);
+    } else if (value >= INT16_MIN && value <= INT16_MAX) {
+        outInstr.Op           = OP_INT_16;
+        outInstr.OperandCount = 2;
+        outInstr.Operands[0]  = mByte0(value);
+        outInstr.Operands[1]  = mByte1(value);
+    } else {
+        return false;
+    }
+
+    return true;
+}
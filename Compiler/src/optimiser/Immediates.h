@@ -0,0 +1,35 @@
+#ifndef IMMEDIATES_H_
+#define IMMEDIATES_H_
+
+#include "Bytecode.h"
+#include "Function.h"
+#include "Variable.h"
+#include <vector>
+
+/*
+ * Replaces loads of small numbers from the constant pool with instructions that carry the value, so the VM doesn't read the pool:
+ *  - 0 and 0.0 -> NIL, false and true -> FALSE and TRUE, 1.0 -> FLOAT_ONE
+ *  - Other integers that fit in 8 or 16 bits -> INT_8 or INT_16, sign extended
+ * Runs after the other passes, which find constants through the pool. Pool entries nothing loads any more are stripped afterwards.
+ * INT_16 takes a byte more than loading one of the first 256 constants, so optimising for size it's only used where the pool entry
+ * it frees makes up for it.
+ */
+class Immediates
+{
+  public:
+    explicit Immediates(const std::vector<ConstantInfo> &constants);
+
+    /* Optimises every function in place. Returns true if any code was changed. */
+    bool Run(std::vector<ScriptFunction *> &functions, bool small);
+
+    /* Total for every run so far. */
+    u32 LoadsReplaced() const;
+
+  private:
+    const std::vector<ConstantInfo> &m_Constants;
+    u32 m_LoadsReplaced = 0;
+
+    bool Immediate(const ConstantInfo &constant, Instruction &outInstr) const;
+};
+
+#endif // IMMEDIATES_H_
@@ -0,0 +1,355 @@
+#include "Inliner.h"
+#include <algorithm>
+
+Inliner::Inliner(std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+bool Inliner::AddFunction(funcPtr_t id, const std::vector<opCode_t> &code, int argCount, bool isMethod, DataType returnType, bool forced, u32 sizeLimit)
+{
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(code, instructions) || instructions.empty() || instructions.back().Op != OP_RETURN) {
+        return false;
+    }
+    instructions.pop_back();
+
+    InlineFunction function;
+    function.IsMethod   = isMethod;
+    function.ReturnType = returnType;
+    function.Height     = argCount;
+
+    int frames = 0;
+    for (auto &instr : instructions) {
+        // Straight line code only, so the body can't leave early.
+        if (instr.IsTable || Bytecode::IsJump(instr.Op) || Bytecode::IsTerminator(instr.Op)) {
+            return false;
+        }
+
+        int effect;
+        if (!Bytecode::StackEffect(instr, effect)) {
+            return false;
+        }
+        function.Height += effect;
+
+        // Every call must have a frame stored for it, or the stack heights can't be worked out.
+        if (instr.Op == OP_FRAME) {
+            frames++;
+        } else if (instr.Op == OP_CALL && --frames < 0) {
+            return false;
+        }
+
+        const ConstantInfo *constant = ConstantAt(instr);
+        if (constant != nullptr && constant->Type == dtPointer && constant->ConstValue.Pointer.Scope == scopeField) {
+            function.UsesFields = true;
+        }
+    }
+
+    if (frames != 0 || function.Height < 1) {
+        return false;
+    }
+
+    if (!forced && Bytecode::SizeOf(instructions) > sizeLimit) {
+        return false;
+    }
+
+    function.Body   = instructions;
+    m_Functions[id] = function;
+    return true;
+}
+
+bool Inliner::Run(std::vector<opCode_t> &code, int argCount, funcPtr_t self)
+{
+    if (m_Functions.empty()) {
+        return false;
+    }
+
+    std::vector<Instruction> instructions;
+    std::vector<int> heights;
+    if (!Bytecode::Decode(code, instructions) || !FunctionIR::StackHeights(instructions, argCount, heights)) {
+        return false;
+    }
+
+    const int count = (int)instructions.size();
+
+    // Pair each call with the frame stored for it. Calls made in the arguments are nested inside.
+    std::vector<CallSite> calls;
+    std::vector<CallSite> sites;
+    std::vector<int> frames;
+    for (int i = 0; i < count; ++i) {
+        const Instruction &instr = instructions[i];
+        if (instr.IsTable) {
+            continue;
+        }
+
+        if (instr.Op == OP_FRAME) {
+            frames.push_back(i);
+        } else if (instr.Op == OP_CALL) {
+            if (frames.empty()) {
+                return false;
+            }
+
+            CallSite site;
+            site.Frame = frames.back();
+            site.Call  = i;
+            frames.pop_back();
+
+            calls.push_back(site);
+            if (FindCallSite(instructions, site, self)) {
+                sites.push_back(site);
+            }
+        }
+    }
+
+    if (!frames.empty() || sites.empty()) {
+        return false;
+    }
+
+    // Outer calls first, so calls nested in their arguments know where they end up.
+    std::sort(sites.begin(), sites.end(), [](const CallSite &a, const CallSite &b) {
+        return a.Frame < b.Frame;
+    });
+
+    std::vector<int> shift(count, 0);
+    std::map<int, std::vector<Instruction>> expansions; // Call index -> inlined code
+    std::map<int, int> skipped;                         // Frame, function and popped result -> call index
+    int bytesAdded = 0;
+
+    for (auto &site : sites) {
+        // Unreachable
+        if (heights[site.Frame] == NOT_SET) {
+            continue;
+        }
+
+        // A frame stored by an enclosing call that stays takes up slots the heights don't count.
+        const bool nested = std::any_of(calls.begin(), calls.end(), [&](const CallSite &call) {
+            return call.Frame < site.Frame && call.Call > site.Call && !expansions.contains(call.Call);
+        });
+        if (nested) {
+            continue;
+        }
+
+        // Calls outside this one that are inlined no longer push their function constant under it.
+        const int base = heights[site.Frame] + shift[site.Frame];
+
+        std::vector<Instruction> expansion;
+        if (!Expand(site, base, expansion)) {
+            continue;
+        }
+
+        int removed = (int)(instructions[site.Frame].Size() + instructions[site.Frame + 1].Size() + instructions[site.Call].Size());
+        if (site.Discarded) {
+            removed += (int)instructions[site.Call + 1].Size();
+        }
+
+        const int growth = (int)Bytecode::SizeOf(expansion) - removed;
+        if (m_BytesAdded + bytesAdded + growth > INLINE_CODE_BUDGET) {
+            continue;
+        }
+        bytesAdded += growth;
+
+        for (int i = site.Frame + 1; i < site.Call; ++i) {
+            shift[i]--;
+        }
+
+        expansions[site.Call]   = expansion;
+        skipped[site.Frame]     = site.Call;
+        skipped[site.Frame + 1] = site.Call;
+        if (site.Discarded) {
+            skipped[site.Call + 1] = site.Call;
+        }
+    }
+
+    if (expansions.empty()) {
+        return false;
+    }
+
+    // Rebuild the function with the calls replaced. Old instruction index -> new index.
+    std::vector<Instruction> output;
+    std::vector<int> moved(count + 1, 0);
+    for (int i = 0; i < count; ++i) {
+        moved[i] = (int)output.size();
+
+        if (skipped.contains(i)) {
+            continue;
+        }
+
+        auto expansion = expansions.find(i);
+        if (expansion != expansions.end()) {
+            output.insert(output.end(), expansion->second.begin(), expansion->second.end());
+        } else {
+            output.push_back(instructions[i]);
+        }
+    }
+    moved[count] = (int)output.size();
+
+    // Only the caller's own code has jumps. The inlined bodies are straight line.
+    for (auto &instr : output) {
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = moved[target];
+            }
+        } else if (Bytecode::IsJump(instr.Op)) {
+            instr.Target = moved[instr.Target];
+        }
+    }
+
+    std::vector<opCode_t> inlined;
+    if (!Bytecode::Encode(output, inlined)) {
+        return false;
+    }
+
+    m_CallsInlined += expansions.size();
+    m_BytesAdded += (int)inlined.size() - (int)code.size();
+    code = inlined;
+    return true;
+}
+
+u32 Inliner::CallsInlined() const
+{
+    return m_CallsInlined;
+}
+
+/*
+ * Each copy costs the body less the call it replaces. Once every call is inlined the function is stripped,
+ * saving its body, its OP_RETURN, its header and its constant.
+ */
+u32 Inliner::SizeLimitForSize(u32 callSites, bool kept)
+{
+    if (kept) {
+        return INLINE_CALL_BYTES;
+    }
+    if (callSites <= 1) {
+        return UINT32_MAX;
+    }
+
+    const u32 stripped = 1 + 1 + Bytecode::OperandSize(OP_FUNCTION_START) + sizeof(Value);
+    return (callSites * INLINE_CALL_BYTES + stripped) / (callSites - 1);
+}
+
+int Inliner::BytesAdded() const
+{
+    return m_BytesAdded;
+}
+
+/* Same as Compiler::AddConstant(). Reuses an existing entry if there is one. */
+u32 Inliner::AddConstant(const ConstantInfo &constant)
+{
+    for (size_t i = 0; i < m_Constants.size(); ++i) {
+        if (constant.Type == m_Constants[i].Type && constant.ConstValue.Int == m_Constants[i].ConstValue.Int) {
+            return i;
+        }
+    }
+
+    m_Constants.push_back(constant);
+    return (m_Constants.size() - 1);
+}
+
+const ConstantInfo *Inliner::ConstantAt(const Instruction &instr) const
+{
+    if (instr.IsTable || !Bytecode::IsConstant(instr.Op)) {
+        return nullptr;
+    }
+
+    const u32 index = Bytecode::ConstantIndex(instr);
+    return index < m_Constants.size() ? &m_Constants[index] : nullptr;
+}
+
+/* Checks a call can be inlined and fills in what's needed to do it. */
+bool Inliner::FindCallSite(const std::vector<Instruction> &code, CallSite &site, funcPtr_t self) const
+{
+    const int count = (int)code.size();
+
+    // Jumps into the middle of the call would skip the function constant.
+    const ConstantInfo *callee = ConstantAt(code[site.Frame + 1]);
+    if (callee == nullptr || callee->Type != dtFunction || code[site.Frame].IsLabel || code[site.Frame + 1].IsLabel || code[site.Call].IsLabel) {
+        return false;
+    }
+
+    // Recursive calls are left alone.
+    const funcPtr_t id = callee->ConstValue.FuncPointer;
+    auto function      = m_Functions.find(id);
+    if (id == self || function == m_Functions.end()) {
+        return false;
+    }
+    site.Function = &function->second;
+
+    // Fields are found through 'this', so it must be known here. Eg: instance.Method()
+    if (site.Function->UsesFields) {
+        const ConstantInfo *instance = (site.Frame + 3 < count) ? ConstantAt(code[site.Frame + 2]) : nullptr;
+        if (instance == nullptr || instance->Type != dtPointer || code[site.Frame + 3].Op != OP_ABSOLUTE_POINTER) {
+            return false;
+        }
+
+        site.This = instance->ConstValue.Pointer;
+        if (site.This.Scope != scopeGlobal && site.This.Scope != scopeLocal) {
+            return false;
+        }
+    }
+
+    const int next = site.Call + 1;
+    site.Discarded = next < count && !code[next].IsTable && !code[next].IsLabel && code[next].Op == OP_POP;
+    return true;
+}
+
+/* Copies the function body for a call with its arguments starting at slot base. */
+bool Inliner::Expand(const CallSite &site, int base, std::vector<Instruction> &output)
+{
+    const InlineFunction &function = *site.Function;
+
+    for (auto instr : function.Body) {
+        const ConstantInfo *constant = ConstantAt(instr);
+        if (constant != nullptr && constant->Type == dtPointer) {
+            VmPointer pointer = constant->ConstValue.Pointer;
+            if (pointer.Scope == scopeLocal) {
+                pointer.Address += base;
+            } else if (pointer.Scope == scopeField) {
+                pointer.Scope = site.This.Scope;
+                pointer.Address += site.This.Address;
+            }
+
+            if (pointer.Address < constant->ConstValue.Pointer.Address) {
+                return false; // Wrapped
+            }
+
+            ConstantInfo moved{};
+            moved.Type               = dtPointer;
+            moved.ConstValue.Pointer = pointer;
+            Bytecode::SetConstantIndex(instr, AddConstant(moved));
+        }
+        output.push_back(instr);
+    }
+
+    // Leave just the result where the function constant was, as the return would.
+    int pops = function.Height;
+    if (!site.Discarded && function.Height > 1) {
+        ConstantInfo result{};
+        result.Type               = dtPointer;
+        result.ConstValue.Pointer = VmPointer((u16)base, function.ReturnType, scopeLocal);
+
+        Instruction pointer;
+        Bytecode::SetConstantIndex(pointer, AddConstant(result));
+        output.push_back(pointer);
+
+        Instruction store;
+        store.Op = OP_SET_VARIABLE;
+        output.push_back(store);
+
+        pops = function.Height - 2;
+    } else if (!site.Discarded) {
+        pops = 0;
+    }
+
+    if (pops > 0xFF) {
+        return false;
+    }
+
+    if (pops > 0) {
+        Instruction pop;
+        pop.Op           = pops == 1 ? OP_POP : OP_POP_N;
+        pop.OperandCount = pops == 1 ? 0 : 1;
+        pop.Operands[0]  = (u8)pops;
+        output.push_back(pop);
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef INLINER_H_
+#define INLINER_H_
+
+#include "Bytecode.h"
+#include "FunctionIR.h"
+#include "Variable.h"
+#include <map>
+#include <vector>
+
+/* Largest function body, in bytes, that is inlined without the [inline] attribute. */
+#ifndef INLINE_SIZE_LIMIT
+#define INLINE_SIZE_LIMIT 16
+#endif // INLINE_SIZE_LIMIT
+
+/* Bytes a call takes: OP_FRAME, the function constant and OP_CALL. */
+#define INLINE_CALL_BYTES 5
+
+/* Most bytes inlining may add to the whole program. */
+#ifndef INLINE_CODE_BUDGET
+#define INLINE_CODE_BUDGET 1024
+#endif // INLINE_CODE_BUDGET
+
+/*
+ * Replaces calls to small functions with a copy of the function body.
+ * Only straight line functions with a single return at the end are inlined. The arguments stay where the
+ * caller pushed them and become locals of the caller, so the body's local slots are moved up to meet them.
+ */
+class Inliner
+{
+  public:
+    explicit Inliner(std::vector<ConstantInfo> &constants);
+
+    /*
+     * Registers a function that calls can be replaced with. Returns false if it can't be inlined.
+     * Bodies bigger than sizeLimit bytes are only inlined if forced.
+     */
+    bool AddFunction(funcPtr_t id, const std::vector<opCode_t> &code, int argCount, bool isMethod, DataType returnType, bool forced, u32 sizeLimit);
+
+    /*
+     * Largest body worth inlining when optimising for size, for a function called from this many places.
+     * Kept is true if the function can't be stripped afterwards, eg. it's exported.
+     */
+    static u32 SizeLimitForSize(u32 callSites, bool kept);
+
+    /* Inlines calls made by a function. Returns true if the code was changed. */
+    bool Run(std::vector<opCode_t> &code, int argCount, funcPtr_t self);
+
+    /* Totals for every function run so far. */
+    u32 CallsInlined() const;
+    int BytesAdded() const;
+
+  private:
+    struct InlineFunction {
+        std::vector<Instruction> Body; // Without the return
+        int Height          = 0;       // Stack height at the return, including the result
+        bool IsMethod       = false;
+        bool UsesFields     = false;
+        DataType ReturnType = dtVoid;
+    };
+
+    struct CallSite {
+        int Frame                      = NOT_SET;
+        int Call                       = NOT_SET;
+        const InlineFunction *Function = nullptr;
+        VmPointer This;          // Instance the method is called on
+        bool Discarded = false; // The result is popped straight away
+    };
+
+    std::vector<ConstantInfo> &m_Constants;
+    std::map<funcPtr_t, InlineFunction> m_Functions;
+    u32 m_CallsInlined = 0;
+    int m_BytesAdded   = 0;
+
+    u32 AddConstant(const ConstantInfo &constant);
+    const ConstantInfo *ConstantAt(const Instruction &instr) const;
+    bool FindCallSite(const std::vector<Instruction> &code, CallSite &site, funcPtr_t self) const;
+    bool Expand(const CallSite &site, int base, std::vector<Instruction> &output);
+};
+
+#endif // INLINER_H_
@@ -0,0 +1,676 @@
+#include "LoopInvariant.h"
+#include <algorithm>
+
+#define SCOPE_COUNT   4
+#define NOT_TAKEN     0x10000
+#define IS_SCOPE(ptr) ((ptr).Scope < SCOPE_COUNT)
+
+static bool IsPureUnary(opCode_t op)
+{
+    switch (op) {
+        case OP_NEGATE_I:
+        case OP_NEGATE_F:
+        case OP_NOT:
+        case OP_BIT_NOT:
+        case OP_CAST_INT_TO_FLOAT:
+        case OP_CAST_FLOAT_TO_INT:
+        case OP_CAST_INT_TO_FIXED:
+        case OP_CAST_FIXED_TO_INT:
+        case OP_CAST_FLOAT_TO_FIXED:
+        case OP_CAST_FIXED_TO_FLOAT:
+        case OP_ABS_I:
+        case OP_ABS_F:
+        case OP_SQRT:
+        case OP_SIN:
+        case OP_COS:
+        case OP_FLOOR:
+        case OP_BIT_EXTRACT:
+        case OP_POPCOUNT:
+        case OP_CLZ:
+        case OP_BYTE_SWAP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Binary operators that can't fail. Divides are checked separately as they can. Fixed point divides by zero saturate. */
+static bool IsPureBinary(opCode_t op)
+{
+    return (op >= OP_ADD_S && op <= OP_MULT_F) || op == OP_DIV_F || (op >= OP_ADD_SAT_FIXED && op <= OP_DIV_SAT_FIXED) ||
+           (op >= OP_EQUAL_S && op <= OP_GREATER_OR_EQUAL_F) || (op >= OP_BIT_AND && op <= OP_BIT_SHIFT_R) || (op >= OP_MIN_S && op <= OP_MAX_F) ||
+           op == OP_BIT_INSERT || op == OP_ROTATE_L || op == OP_ROTATE_R;
+}
+
+static bool IsIntDivide(opCode_t op)
+{
+    return op == OP_DIV_S || op == OP_DIV_U || op == OP_MODULUS;
+}
+
+static bool IsGetIndexed(opCode_t op)
+{
+    return op >= OP_GET_INDEXED_S8 && op <= OP_GET_INDEXED_FLOAT;
+}
+
+static bool IsVariableWrite(opCode_t op)
+{
+    switch (op) {
+        case OP_ASSIGN:
+        case OP_SET_VARIABLE:
+        case OP_PREFIX_DECREASE:
+        case OP_PREFIX_INCREASE:
+        case OP_PLUS_PLUS:
+        case OP_MINUS_MINUS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Type of the value an operator leaves on the stack. Only used to label the hidden locals. */
+static DataType ResultType(opCode_t op, DataType operand)
+{
+    if (op >= OP_EQUAL_S && op <= OP_GREATER_OR_EQUAL_F) {
+        return dtBool;
+    }
+
+    switch (op) {
+        case OP_NOT:
+            return dtBool;
+        case OP_NEGATE_F:
+        case OP_ADD_F:
+        case OP_SUB_F:
+        case OP_MULT_F:
+        case OP_DIV_F:
+        case OP_CAST_INT_TO_FLOAT:
+        case OP_CAST_FIXED_TO_FLOAT:
+        case OP_GET_INDEXED_FLOAT:
+        case OP_ABS_F:
+        case OP_MIN_F:
+        case OP_MAX_F:
+        case OP_SQRT:
+        case OP_SIN:
+        case OP_COS:
+        case OP_FLOOR:
+            return dtFloat;
+        case OP_CAST_FLOAT_TO_INT:
+        case OP_CAST_FIXED_TO_INT:
+            return dtInt32;
+        case OP_ADD_SAT_FIXED:
+        case OP_SUB_SAT_FIXED:
+        case OP_MULT_FIXED:
+        case OP_MULT_SAT_FIXED:
+        case OP_DIV_FIXED:
+        case OP_DIV_SAT_FIXED:
+        case OP_CAST_INT_TO_FIXED:
+        case OP_CAST_FLOAT_TO_FIXED:
+            return dtFixed;
+        default:
+            return IsGetIndexed(op) ? dtInt32 : operand;
+    }
+}
+
+LoopInvariant::LoopInvariant(std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+bool LoopInvariant::Run(std::vector<opCode_t> &code, int argCount, const std::vector<LoopRange> &loops)
+{
+    if (loops.empty()) {
+        return false;
+    }
+
+    FunctionIR ir;
+    if (!ir.Lift(code, argCount) || ir.Heights.empty()) {
+        return false;
+    }
+
+    // The loops were recorded as byte offsets, so find the instructions they start and end at.
+    std::map<u32, int> indexAt;
+    const std::vector<u32> offsets = ir.Offsets();
+    for (int i = 0; i < (int)offsets.size(); ++i) {
+        indexAt[offsets[i]] = i;
+    }
+
+    std::vector<Region> regions;
+    for (const auto &range : loops) {
+        const auto start = indexAt.find(range.Start);
+        const auto end   = indexAt.find(range.End);
+        if (start != indexAt.end() && end != indexAt.end() && start->second < end->second) {
+            Region region;
+            region.Start = start->second;
+            region.End   = end->second;
+            regions.push_back(region);
+        }
+    }
+
+    bool changed = false;
+    for (size_t r = 0; r < regions.size(); ++r) {
+        const Region loop = regions[r];
+        const int count   = (int)ir.Instructions.size();
+        const int height  = ir.Heights[loop.Start];
+
+        // The hidden locals are pushed at the start and popped at the end, so the stack must be the same height at both.
+        if (height == NOT_SET || (loop.End < count && ir.Heights[loop.End] != NOT_SET && ir.Heights[loop.End] != height)) {
+            continue;
+        }
+
+        FindTaken(ir.Instructions);
+
+        Writes writes;
+        if (!IsSingleEntry(ir.Instructions, loop) || !FindWrites(ir.Instructions, loop, writes)) {
+            continue;
+        }
+
+        std::vector<Expression> expressions;
+        FindExpressions(ir, loop, writes, expressions);
+
+        std::vector<int> moved;
+        if (expressions.empty() || !Hoist(ir, loop, expressions, moved)) {
+            continue;
+        }
+
+        // Loops that enclose this one start in front of the hoisted code.
+        for (size_t other = r + 1; other < regions.size(); ++other) {
+            regions[other].Start = moved[regions[other].Start];
+            regions[other].End   = moved[regions[other].End];
+        }
+
+        ir.Analyse();
+        if (ir.Heights.empty()) {
+            return false;
+        }
+        changed = true;
+    }
+
+    if (!changed) {
+        return false;
+    }
+
+    std::vector<opCode_t> optimised;
+    if (!ir.Lower(optimised)) {
+        return false;
+    }
+
+    code = optimised;
+    return true;
+}
+
+u32 LoopInvariant::ExpressionsHoisted() const
+{
+    return m_ExpressionsHoisted;
+}
+
+u32 LoopInvariant::LoopsChanged() const
+{
+    return m_LoopsChanged;
+}
+
+/* Same as Compiler::AddConstant(). Reuses an existing entry if there is one. */
+u32 LoopInvariant::AddConstant(const ConstantInfo &constant)
+{
+    for (size_t i = 0; i < m_Constants.size(); ++i) {
+        if (constant.Type == m_Constants[i].Type && constant.ConstValue.Int == m_Constants[i].ConstValue.Int) {
+            return i;
+        }
+    }
+
+    m_Constants.push_back(constant);
+    return (m_Constants.size() - 1);
+}
+
+const ConstantInfo *LoopInvariant::ConstantAt(const Instruction &instr) const
+{
+    if (instr.IsTable || !Bytecode::IsConstant(instr.Op)) {
+        return nullptr;
+    }
+
+    const u32 index = Bytecode::ConstantIndex(instr);
+    return index < m_Constants.size() ? &m_Constants[index] : nullptr;
+}
+
+bool LoopInvariant::PointerAt(const std::vector<Instruction> &code, int index, VmPointer &outPointer) const
+{
+    if (index < 0 || index >= (int)code.size()) {
+        return false;
+    }
+
+    const ConstantInfo *constant = ConstantAt(code[index]);
+    if (constant == nullptr || constant->Type != dtPointer) {
+        return false;
+    }
+
+    outPointer = constant->ConstValue.Pointer;
+    return true;
+}
+
+void LoopInvariant::FindTaken(const std::vector<Instruction> &code)
+{
+    std::fill(m_Taken, m_Taken + SCOPE_COUNT, NOT_TAKEN);
+
+    for (int i = 0; i < (int)code.size(); ++i) {
+        if (code[i].IsTable || code[i].Op != OP_ABSOLUTE_POINTER) {
+            continue;
+        }
+
+        VmPointer pointer;
+        if (code[i].IsLabel || !PointerAt(code, i - 1, pointer) || !IS_SCOPE(pointer)) {
+            // Could be to anything.
+            std::fill(m_Taken, m_Taken + SCOPE_COUNT, 0);
+            return;
+        }
+        m_Taken[pointer.Scope] = std::min(m_Taken[pointer.Scope], (int)pointer.Address);
+    }
+}
+
+/* Only the start of the loop may be jumped to from outside it, and only its end from inside. */
+bool LoopInvariant::IsSingleEntry(const std::vector<Instruction> &code, const Region &loop) const
+{
+    for (int i = 0; i < (int)code.size(); ++i) {
+        const Instruction &instr = code[i];
+        std::vector<int> targets;
+        if (instr.IsTable) {
+            targets = instr.Table;
+        } else if (Bytecode::IsJump(instr.Op)) {
+            targets.push_back(instr.Target);
+        }
+
+        const bool inside = i >= loop.Start && i < loop.End;
+        for (const int target : targets) {
+            if (inside ? (target < loop.Start || target > loop.End) : (target > loop.Start && target < loop.End)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Returns false if the loop assigns through a pointer that isn't a constant, as then anything could change. */
+bool LoopInvariant::FindWrites(const std::vector<Instruction> &code, const Region &loop, Writes &outWrites) const
+{
+    for (int i = loop.Start; i < loop.End; ++i) {
+        const Instruction &instr = code[i];
+        if (instr.IsTable) {
+            continue;
+        }
+
+        if (IsVariableWrite(instr.Op)) {
+            VmPointer pointer;
+            if (instr.IsLabel || i == loop.Start || !PointerAt(code, i - 1, pointer)) {
+                return false;
+            }
+            outWrites.Variables.insert({ pointer.Scope, pointer.Address });
+            outWrites.Globals |= pointer.Scope == scopeGlobal;
+            outWrites.Fields |= pointer.Scope == scopeField;
+            continue;
+        }
+
+        switch (instr.Op) {
+            case OP_CALL:
+            case OP_CALL_NATIVE:
+            case OP_TAIL_CALL:
+            case OP_CHANNEL_RECEIVE:
+                outWrites.Calls    = true;
+                outWrites.Indirect = true;
+                break;
+            case OP_SET_INDEXED_S8:
+            case OP_SET_INDEXED_U8:
+            case OP_SET_INDEXED_S16:
+            case OP_SET_INDEXED_U16:
+            case OP_SET_INDEXED_S32:
+            case OP_SET_INDEXED_U32:
+            case OP_SET_INDEXED_FLOAT:
+            case OP_VEC_COPY:
+            case OP_VEC_ADD:
+            case OP_VEC_SUB:
+            case OP_VEC_MULT:
+            case OP_VEC_SCALE:
+                outWrites.Indirect = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+/* True if a variable has the same value on every pass of a loop that starts with the stack at height. */
+bool LoopInvariant::IsInvariantRead(const VmPointer &pointer, int height, const Writes &writes) const
+{
+    if (!IS_SCOPE(pointer) || writes.Variables.count({ pointer.Scope, pointer.Address }) > 0) {
+        return false;
+    }
+
+    const bool taken = pointer.Address >= m_Taken[pointer.Scope];
+    switch (pointer.Scope) {
+        case scopeLocal:
+            // The loop's own locals are pushed again on every pass.
+            return pointer.Address < height && !(writes.Indirect && taken);
+        case scopeGlobal:
+            // Fields live in the same memory as the globals, so could be the same variable.
+            return !writes.Calls && !writes.Fields && !(writes.Indirect && taken);
+        case scopeField:
+            return !writes.Calls && !writes.Globals && !writes.Indirect;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Follows each block of the loop with a stack of the values it works out, to find the largest expressions
+ * made only of constants, variables the loop doesn't write and operators that can't fail.
+ */
+void LoopInvariant::FindExpressions(const FunctionIR &ir, const Region &loop, const Writes &writes, std::vector<Expression> &outExpressions) const
+{
+    const std::vector<Instruction> &code = ir.Instructions;
+    const int height                     = ir.Heights[loop.Start];
+    std::vector<Operand> stack;
+
+    auto record = [&](const Operand &operand) {
+        if (operand.Invariant && operand.Cost >= LOOP_INVARIANT_MIN_COST) {
+            Expression expression;
+            expression.Start = operand.Start;
+            expression.End   = operand.Start + operand.Cost;
+            expression.Type  = operand.Type;
+            outExpressions.push_back(expression);
+        }
+    };
+
+    auto flush = [&]() {
+        for (const auto &operand : stack) {
+            record(operand);
+        }
+        stack.clear();
+    };
+
+    // Values from before the block aren't known.
+    auto pop = [&]() {
+        Operand operand;
+        if (!stack.empty()) {
+            operand = stack.back();
+            stack.pop_back();
+        }
+        return operand;
+    };
+
+    auto push = [&](int start, int cost) -> Operand & {
+        Operand operand;
+        operand.Start = start;
+        operand.Cost  = cost;
+        stack.push_back(operand);
+        return stack.back();
+    };
+
+    bool reachable = false;
+    for (int i = loop.Start; i < loop.End; ++i) {
+        const Instruction &instr = code[i];
+        const int block          = ir.BlockOf(i);
+        if (i == loop.Start || (block != NOT_SET && ir.Blocks[block].Start == i)) {
+            flush();
+            reachable = !instr.IsTable && ir.Heights[i] != NOT_SET;
+        }
+        if (!reachable) {
+            continue;
+        }
+
+        if (Bytecode::IsConstant(instr.Op)) {
+            const ConstantInfo *constant = ConstantAt(instr);
+            Operand &operand             = push(i, 1);
+            if (constant == nullptr) {
+                continue;
+            }
+            if (constant->Type == dtPointer) {
+                operand.IsPointer = true;
+                operand.Pointer   = constant->ConstValue.Pointer;
+            } else if (constant->Type >= dtBool && constant->Type <= dtFloat) {
+                operand.Invariant  = true;
+                operand.IsConstant = true;
+                operand.Constant   = constant->ConstValue;
+                operand.Type       = constant->Type;
+            }
+            continue;
+        }
+
+        switch (instr.Op) {
+            case OP_NIL:
+            case OP_FALSE:
+            case OP_TRUE: {
+                Operand &operand  = push(i, 1);
+                operand.Invariant = true;
+                operand.Type      = instr.Op == OP_NIL ? dtInt32 : dtBool;
+                continue;
+            }
+
+            case OP_GET_VARIABLE:
+            case OP_ABSOLUTE_POINTER: {
+                const Operand pointer = pop();
+                Operand &operand      = push(i, 1);
+                if (!pointer.IsPointer || pointer.Start != i - 1) {
+                    continue;
+                }
+
+                // The address of a variable never changes while the function runs, only the value in it.
+                if (instr.Op == OP_ABSOLUTE_POINTER) {
+                    operand.Invariant = pointer.Pointer.Scope != scopeLocal || pointer.Pointer.Address < height;
+                    operand.Type      = dtPointer;
+                } else {
+                    operand.Invariant = IsInvariantRead(pointer.Pointer, height, writes);
+                    operand.Type      = pointer.Pointer.Type;
+                }
+                operand.Start   = pointer.Start;
+                operand.Cost    = 2;
+                operand.Pointer = pointer.Pointer;
+                continue;
+            }
+
+            default:
+                break;
+        }
+
+        if (IsPureUnary(instr.Op)) {
+            const Operand value = pop();
+            Operand &operand    = push(i, 1);
+            if (value.Invariant && value.Type != dtPointer && value.Start + value.Cost == i) {
+                operand.Invariant = true;
+                operand.Start     = value.Start;
+                operand.Cost      = value.Cost + 1;
+                operand.Type      = ResultType(instr.Op, value.Type);
+            } else {
+                record(value);
+            }
+            continue;
+        }
+
+        if (IsPureBinary(instr.Op) || IsIntDivide(instr.Op) || IsGetIndexed(instr.Op)) {
+            const Operand rhs = pop();
+            const Operand lhs = pop();
+            Operand &operand  = push(i, 1);
+
+            bool invariant = lhs.Invariant && rhs.Invariant && lhs.Start + lhs.Cost == rhs.Start && rhs.Start + rhs.Cost == i;
+            if (IsIntDivide(instr.Op)) {
+                // Hoisting a divide by zero could fail a loop that would never have run it.
+                invariant = invariant && rhs.IsConstant && rhs.Constant.Int != 0 && rhs.Constant.Int != -1;
+            } else if (IsGetIndexed(instr.Op)) {
+                // Only the elements of arrays the loop can't write, at a constant index.
+                invariant = invariant && lhs.Type == dtPointer && lhs.Cost == 2 && rhs.IsConstant && !writes.Indirect &&
+                            IsInvariantRead(lhs.Pointer, height, writes);
+                for (const auto &written : writes.Variables) {
+                    invariant = invariant && !(written.first == lhs.Pointer.Scope && written.second >= lhs.Pointer.Address);
+                }
+            } else {
+                invariant = invariant && lhs.Type != dtPointer && rhs.Type != dtPointer;
+            }
+
+            if (invariant) {
+                operand.Invariant = true;
+                operand.Start     = lhs.Start;
+                operand.Cost      = lhs.Cost + rhs.Cost + 1;
+                operand.Type      = ResultType(instr.Op, lhs.Type);
+            } else {
+                record(lhs);
+                record(rhs);
+            }
+            continue;
+        }
+
+        if (instr.Op == OP_POP) {
+            record(pop());
+            continue;
+        }
+
+        // Anything else may use any of the values, so take them as they are.
+        flush();
+    }
+    flush();
+}
+
+bool LoopInvariant::Hoist(FunctionIR &ir, const Region &loop, const std::vector<Expression> &expressions, std::vector<int> &outMoved)
+{
+    const std::vector<Instruction> &code = ir.Instructions;
+    const int count                      = (int)code.size();
+    const int height                     = ir.Heights[loop.Start];
+
+    // Number the expressions by their code, so identical ones share a local.
+    std::map<std::vector<u8>, int> numbers;
+    std::vector<Expression> hoisted;
+    std::vector<int> localAt(count, NOT_SET);
+    std::vector<int> endAt(count, NOT_SET);
+    for (const auto &expression : expressions) {
+        std::vector<u8> key;
+        for (int i = expression.Start; i < expression.End; ++i) {
+            key.push_back(code[i].Op);
+            key.insert(key.end(), code[i].Operands, code[i].Operands + code[i].OperandCount);
+        }
+
+        auto number = numbers.find(key);
+        if (number == numbers.end()) {
+            if (hoisted.size() >= LOOP_INVARIANT_LIMIT) {
+                continue;
+            }
+            number = numbers.emplace(key, (int)hoisted.size()).first;
+            hoisted.push_back(expression);
+        }
+        localAt[expression.Start] = number->second;
+        endAt[expression.Start]   = expression.End;
+    }
+
+    const int added = (int)hoisted.size();
+    if (added == 0 || height + added > UINT16_MAX) {
+        return false;
+    }
+
+    std::vector<Instruction> output;
+    std::vector<int> origin; // Instruction each one was copied from. NOT_SET for new ones.
+    std::vector<int> at(count + 1, NOT_SET);
+
+    auto emit = [&](const Instruction &instr, int from) {
+        output.push_back(instr);
+        origin.push_back(from);
+    };
+
+    auto emitLoad = [&](int local) {
+        ConstantInfo constant{};
+        constant.Type               = dtPointer;
+        constant.ConstValue.Pointer = VmPointer((u16)(height + local), hoisted[local].Type, scopeLocal);
+
+        Instruction load;
+        load.Op = OP_CONSTANT;
+        Bytecode::SetConstantIndex(load, AddConstant(constant));
+        emit(load, NOT_SET);
+
+        Instruction get;
+        get.Op = OP_GET_VARIABLE;
+        emit(get, NOT_SET);
+    };
+
+    for (int i = 0; i < loop.Start; ++i) {
+        at[i] = (int)output.size();
+        emit(code[i], i);
+    }
+
+    // Work out each expression in front of the loop, leaving it in its local.
+    const int preheader = (int)output.size();
+    for (const auto &expression : hoisted) {
+        for (int i = expression.Start; i < expression.End; ++i) {
+            emit(code[i], NOT_SET);
+        }
+    }
+
+    for (int i = loop.Start; i < loop.End; ++i) {
+        at[i] = (int)output.size();
+
+        if (localAt[i] != NOT_SET) {
+            emitLoad(localAt[i]);
+            for (int j = i + 1; j < endAt[i]; ++j) {
+                at[j] = at[i];
+            }
+            i = endAt[i] - 1;
+            continue;
+        }
+
+        // The loop's own locals move up past the hidden ones.
+        Instruction instr = code[i];
+        VmPointer pointer;
+        if (PointerAt(code, i, pointer) && pointer.Scope == scopeLocal && pointer.Address >= height) {
+            ConstantInfo moved{};
+            moved.Type               = dtPointer;
+            moved.ConstValue.Pointer = VmPointer((u16)(pointer.Address + added), pointer.Type, scopeLocal);
+            Bytecode::SetConstantIndex(instr, AddConstant(moved));
+        }
+        emit(instr, i);
+    }
+
+    const int exit = (int)output.size();
+    Instruction pop;
+    if (added == 1) {
+        pop.Op = OP_POP;
+    } else {
+        pop.Op           = OP_POP_N;
+        pop.Operands[0]  = (u8)added;
+        pop.OperandCount = 1;
+    }
+    emit(pop, NOT_SET);
+
+    for (int i = loop.End; i < count; ++i) {
+        at[i] = (int)output.size();
+        emit(code[i], i);
+    }
+    at[count] = (int)output.size();
+
+    // Entering the loop from outside runs the hoisted code first. Leaving it from inside pops the hidden locals.
+    auto retarget = [&](int from, int target) {
+        const bool inside = from >= loop.Start && from < loop.End;
+        if (!inside && target == loop.Start) {
+            return preheader;
+        }
+        if (inside && target == loop.End) {
+            return exit;
+        }
+        return at[target];
+    };
+
+    for (size_t i = 0; i < output.size(); ++i) {
+        Instruction &instr = output[i];
+        if (origin[i] == NOT_SET) {
+            continue;
+        }
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = retarget(origin[i], target);
+            }
+        } else if (Bytecode::IsJump(instr.Op)) {
+            instr.Target = retarget(origin[i], instr.Target);
+        }
+    }
+
+    ir.Instructions = output;
+
+    outMoved             = at;
+    outMoved[loop.Start] = preheader;
+
+    m_ExpressionsHoisted += added;
+    m_LoopsChanged++;
+    return true;
+}
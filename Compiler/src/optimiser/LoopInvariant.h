@@ -0,0 +1,91 @@
+#ifndef LOOPINVARIANT_H_
+#define LOOPINVARIANT_H_
+
+#include "Bytecode.h"
+#include "Function.h"
+#include "FunctionIR.h"
+#include "Variable.h"
+#include <map>
+#include <set>
+#include <vector>
+
+/* Most expressions hoisted out of a single loop. Each one takes a hidden local for as long as the loop runs. */
+#ifndef LOOP_INVARIANT_LIMIT
+#define LOOP_INVARIANT_LIMIT 8
+#endif // LOOP_INVARIANT_LIMIT
+
+/* Fewest instructions an expression must take before it is worth a hidden local. Loading it back takes two. */
+#define LOOP_INVARIANT_MIN_COST 3
+
+/*
+ * Hoists expressions that give the same result on every pass of a loop out in front of it.
+ * Each one is worked out once before the loop and kept in a hidden local pushed below the loop's own locals,
+ * which are moved up to make room. Everywhere the expression appeared in the loop it is read back from the local,
+ * and identical expressions share the same one. The hidden locals are popped again where the loop ends.
+ * Eg: for (...) { total += data[i] * (k * scale + 1); } only reads k * scale + 1 back on each pass.
+ */
+class LoopInvariant
+{
+  public:
+    explicit LoopInvariant(std::vector<ConstantInfo> &constants);
+
+    /* Hoists out of the loops recorded while parsing the function. Returns true if the code was changed. */
+    bool Run(std::vector<opCode_t> &code, int argCount, const std::vector<LoopRange> &loops);
+
+    /* Totals for every function run so far. */
+    u32 ExpressionsHoisted() const;
+    u32 LoopsChanged() const;
+
+  private:
+    struct Region {
+        int Start = NOT_SET; // First instruction
+        int End   = NOT_SET; // One past the last instruction
+    };
+
+    struct Expression {
+        int Start     = NOT_SET;
+        int End       = NOT_SET;
+        DataType Type = dtVoid;
+    };
+
+    /* A value on the stack while a block is followed through. */
+    struct Operand {
+        bool Invariant  = false;
+        bool IsPointer  = false; // A pointer constant. Not a value to hoist by itself.
+        bool IsConstant = false;
+        int Start       = NOT_SET; // First instruction that works it out
+        int Cost        = 0;       // Instructions that work it out
+        DataType Type   = dtVoid;
+        Value Constant  = {};
+        VmPointer Pointer;
+    };
+
+    /* What a loop writes to, other than its own locals. */
+    struct Writes {
+        std::set<std::pair<int, int>> Variables; // Scope and address of every variable assigned directly
+        bool Globals  = false;
+        bool Fields   = false;
+        bool Calls    = false; // Other code may run, eg. a call or waiting on a channel
+        bool Indirect = false; // Writes through pointers worked out at run time, eg. to arrays
+    };
+
+    std::vector<ConstantInfo> &m_Constants;
+    u32 m_ExpressionsHoisted = 0;
+    u32 m_LoopsChanged       = 0;
+
+    // Lowest address of each scope that an absolute pointer is taken to. Anything at or above it may be written through one.
+    int m_Taken[4] = {};
+
+    u32 AddConstant(const ConstantInfo &constant);
+    const ConstantInfo *ConstantAt(const Instruction &instr) const;
+    bool PointerAt(const std::vector<Instruction> &code, int index, VmPointer &outPointer) const;
+
+    void FindTaken(const std::vector<Instruction> &code);
+    bool IsSingleEntry(const std::vector<Instruction> &code, const Region &loop) const;
+    bool FindWrites(const std::vector<Instruction> &code, const Region &loop, Writes &outWrites) const;
+    bool IsInvariantRead(const VmPointer &pointer, int height, const Writes &writes) const;
+    void FindExpressions(const FunctionIR &ir, const Region &loop, const Writes &writes, std::vector<Expression> &outExpressions) const;
+    bool Hoist(FunctionIR &ir, const Region &loop, const std::vector<Expression> &expressions, std::vector<int> &outMoved);
+};
+
+#endif // LOOPINVARIANT_H_
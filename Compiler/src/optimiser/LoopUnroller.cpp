@@ -0,0 +1,566 @@
+#include "LoopUnroller.h"
+#include "CompilerData.h"
+#include <map>
+
+/* Most passes counted before a loop is taken as too long to be worth unrolling at all. */
+#define MAX_COUNTED_TRIPS 0x10000
+
+static bool IsOp(const std::vector<Instruction> &code, int index, opCode_t op)
+{
+    return index >= 0 && index < (int)code.size() && !code[index].IsTable && code[index].Op == op;
+}
+
+LoopUnroller::LoopUnroller(std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+bool LoopUnroller::Run(std::vector<opCode_t> &code, int argCount, std::vector<LoopRange> &loops, bool automatic)
+{
+    m_Refused.clear();
+    if (loops.empty()) {
+        return false;
+    }
+
+    FunctionIR ir;
+    if (!ir.Lift(code, argCount) || ir.Heights.empty()) {
+        return false;
+    }
+
+    // The loops were recorded as byte offsets, so find the instructions they start and end at.
+    std::map<u32, int> indexAt;
+    std::vector<u32> offsets = ir.Offsets();
+    for (int i = 0; i < (int)offsets.size(); ++i) {
+        indexAt[offsets[i]] = i;
+    }
+
+    std::vector<int> starts;
+    std::vector<int> ends;
+    for (const auto &range : loops) {
+        const auto start = indexAt.find(range.Start);
+        const auto end   = indexAt.find(range.End);
+        if (start == indexAt.end() || end == indexAt.end()) {
+            return false;
+        }
+        starts.push_back(start->second);
+        ends.push_back(end->second);
+    }
+
+    std::vector<bool> dropped(loops.size(), false);
+    bool changed = false;
+    for (size_t r = 0; r < loops.size(); ++r) {
+        const LoopRange &range = loops[r];
+        const bool asked       = range.Attributes & atUnroll;
+        if ((range.Attributes & atNoUnroll) || (!asked && !automatic && !range.Hot)) {
+            continue;
+        }
+
+        CountedLoop loop;
+        if (!Match(ir.Instructions, starts[r], ends[r], loop)) {
+            if (asked) {
+                m_Refused.push_back(range);
+            }
+            continue;
+        }
+
+        // 0 to unroll fully.
+        int times           = NOT_SET;
+        const u32 bodyBytes = offsets[loop.Back] - offsets[loop.Body];
+        if (asked && range.Unroll == 0) {
+            times = loop.Trips <= UNROLL_MAX_TRIPS ? 0 : NOT_SET;
+        } else if (asked) {
+            times = loop.Trips <= (int)range.Unroll ? 0 : (int)range.Unroll;
+        } else if (loop.Trips <= UNROLL_MAX_TRIPS && loop.Trips * bodyBytes <= UNROLL_SIZE_LIMIT) {
+            times = 0;
+        } else if (loop.Trips >= UNROLL_FACTOR * 2 && UNROLL_FACTOR * bodyBytes <= UNROLL_SIZE_LIMIT) {
+            times = UNROLL_FACTOR;
+        }
+
+        if (times == NOT_SET) {
+            if (asked) {
+                m_Refused.push_back(range);
+            }
+            continue;
+        }
+
+        const int before = (int)Bytecode::SizeOf(ir.Instructions);
+        std::vector<int> moved;
+        if (times == 0) {
+            Unroll(ir.Instructions, loop, moved);
+            dropped[r] = true;
+            m_LoopsUnrolled++;
+        } else {
+            UnrollBy(ir.Instructions, loop, times, moved);
+            m_LoopsPartlyUnrolled++;
+        }
+
+        // Only innermost loops are unrolled, so the loops still to come are after or around this one.
+        for (size_t other = r; other < loops.size(); ++other) {
+            starts[other] = moved[starts[other]];
+            ends[other]   = moved[ends[other]];
+        }
+
+        ir.Analyse();
+        if (ir.Heights.empty()) {
+            return false;
+        }
+        offsets = ir.Offsets();
+        m_BytesAdded += (int)Bytecode::SizeOf(ir.Instructions) - before;
+        changed = true;
+    }
+
+    if (!changed) {
+        return false;
+    }
+
+    std::vector<opCode_t> optimised;
+    if (!ir.Lower(optimised)) {
+        return false;
+    }
+    code = optimised;
+
+    std::vector<LoopRange> kept;
+    for (size_t r = 0; r < loops.size(); ++r) {
+        if (!dropped[r]) {
+            LoopRange range = loops[r];
+            range.Start     = offsets[starts[r]];
+            range.End       = offsets[ends[r]];
+            kept.push_back(range);
+        }
+    }
+    loops = kept;
+    return true;
+}
+
+const std::vector<LoopRange> &LoopUnroller::Refused() const
+{
+    return m_Refused;
+}
+
+u32 LoopUnroller::LoopsUnrolled() const
+{
+    return m_LoopsUnrolled;
+}
+
+u32 LoopUnroller::LoopsPartlyUnrolled() const
+{
+    return m_LoopsPartlyUnrolled;
+}
+
+int LoopUnroller::BytesAdded() const
+{
+    return m_BytesAdded;
+}
+
+/* Same as Compiler::AddConstant(). Reuses an existing entry if there is one. */
+u32 LoopUnroller::AddConstant(const ConstantInfo &constant)
+{
+    for (size_t i = 0; i < m_Constants.size(); ++i) {
+        if (constant.Type == m_Constants[i].Type && constant.ConstValue.Int == m_Constants[i].ConstValue.Int) {
+            return i;
+        }
+    }
+
+    m_Constants.push_back(constant);
+    return (m_Constants.size() - 1);
+}
+
+const ConstantInfo *LoopUnroller::ConstantAt(const Instruction &instr) const
+{
+    if (instr.IsTable || !Bytecode::IsConstant(instr.Op)) {
+        return nullptr;
+    }
+
+    const u32 index = Bytecode::ConstantIndex(instr);
+    return index < m_Constants.size() ? &m_Constants[index] : nullptr;
+}
+
+bool LoopUnroller::IntAt(const std::vector<Instruction> &code, int index, s32 &outValue) const
+{
+    if (index < 0 || index >= (int)code.size()) {
+        return false;
+    }
+
+    const ConstantInfo *constant = ConstantAt(code[index]);
+    if (constant == nullptr || constant->Type != dtInt32) {
+        return false;
+    }
+
+    outValue = constant->ConstValue.Int;
+    return true;
+}
+
+bool LoopUnroller::IsCounter(const std::vector<Instruction> &code, int index, const VmPointer &counter) const
+{
+    if (index < 0 || index >= (int)code.size()) {
+        return false;
+    }
+
+    const ConstantInfo *constant = ConstantAt(code[index]);
+    return constant != nullptr && constant->Type == dtPointer && constant->ConstValue.Pointer == counter;
+}
+
+/*
+ * Matches the code ForStatement() emits for a counted loop between start and end:
+ * declaration: CONSTANT first, CONSTANT i, ASSIGN
+ * condition:   CONSTANT i, GET_VARIABLE, CONSTANT limit, compare, JUMP_IF_FALSE exit, POP, JUMP body
+ * increment:   i++ or i += step, POP, LOOP condition
+ * body:        ..., LOOP increment
+ * exit:        POP
+ */
+bool LoopUnroller::Match(const std::vector<Instruction> &code, int start, int end, CountedLoop &outLoop) const
+{
+    CountedLoop loop;
+    loop.Start = start;
+
+    if (IsOp(code, start, OP_NIL)) {
+        loop.First = 0;
+    } else if (!IntAt(code, start, loop.First)) {
+        return false;
+    }
+
+    const ConstantInfo *counter = start + 1 < end ? ConstantAt(code[start + 1]) : nullptr;
+    if (counter == nullptr || counter->Type != dtPointer || !IsOp(code, start + 2, OP_ASSIGN)) {
+        return false;
+    }
+    loop.Counter = counter->ConstValue.Pointer;
+    if (loop.Counter.Scope != scopeLocal || loop.Counter.Type != dtInt32) {
+        return false;
+    }
+
+    const int condition = start + 3;
+    s32 limit;
+    if (!IsCounter(code, condition, loop.Counter) || !IsOp(code, condition + 1, OP_GET_VARIABLE) || !IntAt(code, condition + 2, limit) ||
+        !IsOp(code, condition + 4, OP_JUMP_IF_FALSE) || !IsOp(code, condition + 5, OP_POP) || !IsOp(code, condition + 6, OP_JUMP)) {
+        return false;
+    }
+    loop.Condition = condition;
+    loop.Exit      = code[condition + 4].Target;
+    loop.Body      = code[condition + 6].Target;
+    loop.Increment = condition + 7;
+    loop.Back      = loop.Exit - 1;
+
+    int incrementEnd;
+    if (!MatchIncrement(code, loop, incrementEnd)) {
+        return false;
+    }
+
+    if (code[incrementEnd].Target != loop.Condition || loop.Body != incrementEnd + 1 || loop.Back < loop.Body || loop.Exit >= end) {
+        return false;
+    }
+    if (!IsOp(code, loop.Back, OP_LOOP) || code[loop.Back].Target != loop.Increment || !IsOp(code, loop.Exit, OP_POP)) {
+        return false;
+    }
+
+    if (!CountTrips(loop, code[condition + 3].Op, limit) || !CheckJumps(code, loop, end)) {
+        return false;
+    }
+
+    // The body can only read the counter, as each copy of it reads a constant in its place.
+    for (int i = loop.Body; i < loop.Back; ++i) {
+        if (IsCounter(code, i, loop.Counter) && (i + 1 >= loop.Back || !IsOp(code, i + 1, OP_GET_VARIABLE) || code[i + 1].IsLabel)) {
+            return false;
+        }
+    }
+
+    outLoop = loop;
+    return true;
+}
+
+/* Matches i++, ++i, i--, --i, i += step or i -= step, each followed by POP and the LOOP back to the condition. */
+bool LoopUnroller::MatchIncrement(const std::vector<Instruction> &code, CountedLoop &loop, int &outEnd) const
+{
+    const int i = loop.Increment;
+    if (!IsCounter(code, i, loop.Counter)) {
+        return false;
+    }
+
+    if (IsOp(code, i + 1, OP_GET_VARIABLE) && IsCounter(code, i + 2, loop.Counter) && (IsOp(code, i + 3, OP_PLUS_PLUS) || IsOp(code, i + 3, OP_MINUS_MINUS)) &&
+        IsOp(code, i + 4, OP_POP) && IsOp(code, i + 5, OP_LOOP)) {
+        loop.Step = code[i + 3].Op == OP_PLUS_PLUS ? 1 : -1;
+        outEnd    = i + 5;
+        return true;
+    }
+
+    if ((IsOp(code, i + 1, OP_PREFIX_INCREASE) || IsOp(code, i + 1, OP_PREFIX_DECREASE)) && IsOp(code, i + 2, OP_POP) && IsOp(code, i + 3, OP_LOOP)) {
+        loop.Step = code[i + 1].Op == OP_PREFIX_INCREASE ? 1 : -1;
+        outEnd    = i + 3;
+        return true;
+    }
+
+    s32 step;
+    if (IsOp(code, i + 1, OP_GET_VARIABLE) && IntAt(code, i + 2, step) && (IsOp(code, i + 3, OP_ADD_S) || IsOp(code, i + 3, OP_SUB_S)) &&
+        IsCounter(code, i + 4, loop.Counter) && IsOp(code, i + 5, OP_ASSIGN) && IsOp(code, i + 6, OP_POP) && IsOp(code, i + 7, OP_LOOP)) {
+        if (step == INT32_MIN) {
+            return false;
+        }
+        loop.Step = code[i + 3].Op == OP_ADD_S ? step : -step;
+        outEnd    = i + 7;
+        return true;
+    }
+
+    return false;
+}
+
+/* Counts the passes the loop makes. Returns false if the counter would overflow or it runs too long to be worth it. */
+bool LoopUnroller::CountTrips(CountedLoop &loop, opCode_t compare, s32 limit) const
+{
+    if (loop.Step == 0) {
+        return false;
+    }
+
+    s64 counter = loop.First;
+    int trips   = 0;
+    while (true) {
+        bool runs;
+        switch (compare) {
+            case OP_LESS_S:
+                runs = counter < limit;
+                break;
+            case OP_LESS_OR_EQUAL_S:
+                runs = counter <= limit;
+                break;
+            case OP_GREATER_S:
+                runs = counter > limit;
+                break;
+            case OP_GREATER_OR_EQUAL_S:
+                runs = counter >= limit;
+                break;
+            case OP_NOT_EQUAL_S:
+                runs = counter != limit;
+                break;
+            default:
+                return false;
+        }
+        if (!runs) {
+            break;
+        }
+
+        counter += loop.Step;
+        if (counter < INT32_MIN || counter > INT32_MAX || ++trips > MAX_COUNTED_TRIPS) {
+            return false;
+        }
+    }
+
+    loop.Trips = trips;
+    return true;
+}
+
+/*
+ * The body may only jump forwards within itself, to its end, back to the increment (continue) or past the exit (break).
+ * Nothing outside the loop may jump into it. A jump back within the body is a nested loop, which isn't unrolled.
+ */
+bool LoopUnroller::CheckJumps(const std::vector<Instruction> &code, const CountedLoop &loop, int end) const
+{
+    for (int i = 0; i < (int)code.size(); ++i) {
+        const Instruction &instr = code[i];
+        if (!instr.IsTable && !Bytecode::IsJump(instr.Op)) {
+            continue;
+        }
+
+        // The loop's own jumps were checked when it was matched.
+        if ((i >= loop.Start && i < loop.Body) || i == loop.Back) {
+            continue;
+        }
+
+        const bool inBody = i >= loop.Body && i < loop.Back;
+        if (instr.IsTable) {
+            for (const int target : instr.Table) {
+                if (inBody ? (target < loop.Body || target > loop.Back) : (target > loop.Start && target < end)) {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        const int target = instr.Target;
+        if (!inBody) {
+            if (target > loop.Start && target < end) {
+                return false;
+            }
+        } else if (instr.Op == OP_LOOP ? target != loop.Increment : (target <= i || (target > loop.Back && target != loop.Exit + 1))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Appends a copy of the loop body. Jumps to its end, or back to the increment, land after the copy.
+ * Breaks are added to the list to be pointed past the loop once it's known where that is.
+ * If counter is given, reads of the loop counter are replaced with it.
+ */
+void LoopUnroller::CopyBody(const std::vector<Instruction> &code, const CountedLoop &loop, const s32 *counter, std::vector<Instruction> &output,
+                            std::vector<int> &breaks)
+{
+    std::vector<int> at(loop.Back - loop.Body + 1, NOT_SET);
+    std::vector<int> jumps;
+
+    for (int i = loop.Body; i < loop.Back; ++i) {
+        at[i - loop.Body] = (int)output.size();
+
+        if (counter != nullptr && IsCounter(code, i, loop.Counter)) {
+            ConstantInfo value{};
+            value.Type       = dtInt32;
+            value.ConstValue = INT32_VAL(*counter);
+
+            Instruction load;
+            load.Op = OP_CONSTANT;
+            Bytecode::SetConstantIndex(load, AddConstant(value));
+            output.push_back(load);
+
+            // Skip the GET_VARIABLE.
+            at[++i - loop.Body] = (int)output.size() - 1;
+            continue;
+        }
+
+        output.push_back(code[i]);
+        if (code[i].IsTable || Bytecode::IsJump(code[i].Op)) {
+            jumps.push_back((int)output.size() - 1);
+        }
+    }
+    at.back() = (int)output.size();
+
+    for (const int index : jumps) {
+        Instruction &instr = output[index];
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = at[target - loop.Body];
+            }
+        } else if (instr.Target == loop.Exit + 1) {
+            breaks.push_back(index);
+        } else if (instr.Target == loop.Increment) {
+            // A continue now jumps forward to whatever follows the copy.
+            instr.Op     = OP_JUMP;
+            instr.Target = at.back();
+        } else {
+            instr.Target = at[instr.Target - loop.Body];
+        }
+    }
+}
+
+/* Replaces the loop with a copy of the body for each pass. */
+void LoopUnroller::Unroll(std::vector<Instruction> &code, const CountedLoop &loop, std::vector<int> &outMoved)
+{
+    const int count = (int)code.size();
+    std::vector<Instruction> output;
+    std::vector<int> at(count + 1, NOT_SET);
+    std::vector<int> kept;
+    std::vector<int> breaks;
+
+    auto keep = [&](int index) {
+        at[index] = (int)output.size();
+        kept.push_back((int)output.size());
+        output.push_back(code[index]);
+    };
+
+    // The counter is still declared so the body's locals stay where they are, but nothing reads it.
+    for (int i = 0; i < loop.Condition; ++i) {
+        keep(i);
+    }
+
+    s32 counter = loop.First;
+    for (int trip = 0; trip < loop.Trips; ++trip) {
+        CopyBody(code, loop, &counter, output, breaks);
+        counter += loop.Step;
+    }
+
+    // The condition is no longer left on the stack, so its pop goes too.
+    for (int i = loop.Exit + 1; i < count; ++i) {
+        keep(i);
+    }
+    at[count] = (int)output.size();
+
+    for (const int index : kept) {
+        Instruction &instr = output[index];
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = at[target];
+            }
+        } else if (Bytecode::IsJump(instr.Op)) {
+            instr.Target = at[instr.Target];
+        }
+    }
+    for (const int index : breaks) {
+        output[index].Target = at[loop.Exit + 1];
+    }
+
+    code     = output;
+    outMoved = at;
+}
+
+/*
+ * Repeats the body times over between tests of the condition, moving the counter on between each copy.
+ * The passes left over are run first, in front of the loop, so the condition is still tested on the last pass.
+ */
+void LoopUnroller::UnrollBy(std::vector<Instruction> &code, const CountedLoop &loop, int times, std::vector<int> &outMoved)
+{
+    const int count = (int)code.size();
+    const int left  = loop.Trips % times;
+    std::vector<Instruction> output;
+    std::vector<int> at(count + 1, NOT_SET);
+    std::vector<int> kept;
+    std::vector<int> breaks;
+
+    auto keep = [&](int index) {
+        at[index] = (int)output.size();
+        kept.push_back((int)output.size());
+        output.push_back(code[index]);
+    };
+
+    for (int i = 0; i < loop.Condition; ++i) {
+        keep(i);
+    }
+
+    s32 counter = loop.First;
+    if (left > 0) {
+        // The counter starts after the passes run in front of the loop.
+        ConstantInfo first{};
+        first.Type       = dtInt32;
+        first.ConstValue = INT32_VAL(loop.First + left * loop.Step);
+
+        Bytecode::SetConstantIndex(output[at[loop.Start]], AddConstant(first));
+
+        for (int trip = 0; trip < left; ++trip) {
+            CopyBody(code, loop, &counter, output, breaks);
+            counter += loop.Step;
+        }
+    }
+
+    // Condition, increment and the loop back to the condition.
+    for (int i = loop.Condition; i < loop.Body; ++i) {
+        keep(i);
+    }
+
+    at[loop.Body] = (int)output.size();
+    for (int copy = 0; copy < times; ++copy) {
+        CopyBody(code, loop, nullptr, output, breaks);
+        if (copy < times - 1) {
+            for (int i = loop.Increment; i < loop.Body - 1; ++i) {
+                output.push_back(code[i]);
+            }
+        }
+    }
+
+    for (int i = loop.Back; i < count; ++i) {
+        keep(i);
+    }
+    at[count] = (int)output.size();
+
+    for (const int index : kept) {
+        Instruction &instr = output[index];
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = at[target];
+            }
+        } else if (Bytecode::IsJump(instr.Op)) {
+            instr.Target = at[instr.Target];
+        }
+    }
+    for (const int index : breaks) {
+        output[index].Target = at[loop.Exit + 1];
+    }
+
+    code     = output;
+    outMoved = at;
+}
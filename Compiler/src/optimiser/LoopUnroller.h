@@ -0,0 +1,89 @@
+#ifndef LOOPUNROLLER_H_
+#define LOOPUNROLLER_H_
+
+#include "Bytecode.h"
+#include "Function.h"
+#include "FunctionIR.h"
+#include "Variable.h"
+#include <vector>
+
+/* Most bytes the copies of a loop body may add up to when a loop is unrolled without the [unroll] attribute. */
+#ifndef UNROLL_SIZE_LIMIT
+#define UNROLL_SIZE_LIMIT 256
+#endif // UNROLL_SIZE_LIMIT
+
+/* Times a loop too big to unroll fully is unrolled by, without the [unroll n] attribute. */
+#ifndef UNROLL_FACTOR
+#define UNROLL_FACTOR 4
+#endif // UNROLL_FACTOR
+
+/* Most passes a loop can make and still be unrolled fully, with or without the [unroll] attribute. */
+#ifndef UNROLL_MAX_TRIPS
+#define UNROLL_MAX_TRIPS 64
+#endif // UNROLL_MAX_TRIPS
+
+/*
+ * Unrolls for loops that count an int from one constant to another. Eg: for (int i = 0; i < 8; i++) {...}
+ * Loops that fit are unrolled fully into a copy of the body for each pass, with the counter read as a constant in each one.
+ * Bigger ones are unrolled partly. The body is repeated n times between tests of the condition, with the passes left
+ * over when the count doesn't divide by n run once in front of the loop.
+ * Only innermost loops that don't write the counter or take its address are unrolled.
+ */
+class LoopUnroller
+{
+  public:
+    explicit LoopUnroller(std::vector<ConstantInfo> &constants);
+
+    /*
+     * Unrolls the loops recorded while parsing a function. Loops unrolled fully are dropped from the list and the rest are
+     * moved to where they now start and end. If automatic is false, only loops marked [unroll] or hot in the profile are unrolled.
+     * Returns true if the code was changed.
+     */
+    bool Run(std::vector<opCode_t> &code, int argCount, std::vector<LoopRange> &loops, bool automatic);
+
+    /* Loops marked [unroll] that the last call to Run() couldn't unroll. */
+    const std::vector<LoopRange> &Refused() const;
+
+    /* Totals for every function run so far. */
+    u32 LoopsUnrolled() const;
+    u32 LoopsPartlyUnrolled() const;
+    int BytesAdded() const;
+
+  private:
+    /* Instruction indices of the parts of a counted for loop, in the order the parser emits them. */
+    struct CountedLoop {
+        int Start     = NOT_SET; // Counter declaration
+        int Condition = NOT_SET;
+        int Increment = NOT_SET;
+        int Body      = NOT_SET;
+        int Back      = NOT_SET; // Loop back to the increment at the end of the body
+        int Exit      = NOT_SET; // Pops the condition
+        VmPointer Counter;
+        s32 First = 0;
+        s32 Step  = 0;
+        int Trips = 0;
+    };
+
+    std::vector<ConstantInfo> &m_Constants;
+    std::vector<LoopRange> m_Refused;
+    u32 m_LoopsUnrolled       = 0;
+    u32 m_LoopsPartlyUnrolled = 0;
+    int m_BytesAdded          = 0;
+
+    u32 AddConstant(const ConstantInfo &constant);
+    const ConstantInfo *ConstantAt(const Instruction &instr) const;
+    bool IntAt(const std::vector<Instruction> &code, int index, s32 &outValue) const;
+    bool IsCounter(const std::vector<Instruction> &code, int index, const VmPointer &counter) const;
+
+    bool Match(const std::vector<Instruction> &code, int start, int end, CountedLoop &outLoop) const;
+    bool MatchIncrement(const std::vector<Instruction> &code, CountedLoop &loop, int &outEnd) const;
+    bool CountTrips(CountedLoop &loop, opCode_t compare, s32 limit) const;
+    bool CheckJumps(const std::vector<Instruction> &code, const CountedLoop &loop, int end) const;
+
+    void CopyBody(const std::vector<Instruction> &code, const CountedLoop &loop, const s32 *counter, std::vector<Instruction> &output,
+                  std::vector<int> &breaks);
+    void Unroll(std::vector<Instruction> &code, const CountedLoop &loop, std::vector<int> &outMoved);
+    void UnrollBy(std::vector<Instruction> &code, const CountedLoop &loop, int times, std::vector<int> &outMoved);
+};
+
+#endif // LOOPUNROLLER_H_
@@ -0,0 +1,101 @@
+#include "PassManager.h"
+#include "Bytecode.h"
+#include <map>
+
+void PassManager::AddFunctionPass(const std::string &name, const FunctionPass &pass)
+{
+    Pass added;
+    added.Stats    = StatsFor(name);
+    added.Function = pass;
+    m_Passes.push_back(added);
+}
+
+void PassManager::AddProgramPass(const std::string &name, const ProgramPass &pass)
+{
+    Pass added;
+    added.Stats   = StatsFor(name);
+    added.Program = pass;
+    m_Passes.push_back(added);
+}
+
+void PassManager::Run(std::vector<ScriptFunction *> &functions)
+{
+    for (auto &pass : m_Passes) {
+        PassStats &stats = m_Stats[pass.Stats];
+
+        // Program passes may delete or reorder functions, so keep each function's code to compare against.
+        // The pointers of deleted functions are only used as keys.
+        std::map<const ScriptFunction *, std::vector<opCode_t>> before;
+        for (auto func : functions) {
+            if (func != nullptr) {
+                before.emplace(func, func->Code);
+            }
+        }
+        const s32 sizeBefore = CodeSize(functions);
+
+        const auto start = std::chrono::steady_clock::now();
+        if (pass.Function) {
+            for (auto func : functions) {
+                if (func != nullptr) {
+                    pass.Function(*func);
+                }
+            }
+        } else {
+            pass.Program(functions);
+        }
+        stats.Time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        stats.Runs++;
+        stats.Removed += sizeBefore - CodeSize(functions);
+
+        // Functions that were removed, added or have different code.
+        size_t kept = 0;
+        for (auto func : functions) {
+            if (func == nullptr) {
+                continue;
+            }
+
+            auto old = before.find(func);
+            if (old == before.end()) {
+                stats.Changed++;
+                continue;
+            }
+
+            kept++;
+            if (func->Code != old->second) {
+                stats.Changed++;
+            }
+        }
+        stats.Changed += before.size() - kept;
+    }
+}
+
+const std::vector<PassStats> &PassManager::Stats() const
+{
+    return m_Stats;
+}
+
+/* Bytes of code in every function, including the header of each one but the top level. */
+s32 PassManager::CodeSize(const std::vector<ScriptFunction *> &functions)
+{
+    s32 size = 0;
+    for (auto func : functions) {
+        if (func != nullptr) {
+            size += (s32)func->Code.size() + (func->Name.empty() ? 0 : 1 + Bytecode::OperandSize(OP_FUNCTION_START));
+        }
+    }
+    return size;
+}
+
+size_t PassManager::StatsFor(const std::string &name)
+{
+    for (size_t i = 0; i < m_Stats.size(); ++i) {
+        if (m_Stats[i].Name == name) {
+            return i;
+        }
+    }
+
+    PassStats stats;
+    stats.Name = name;
+    m_Stats.push_back(stats);
+    return m_Stats.size() - 1;
+}
@@ -0,0 +1,50 @@
+#ifndef PASSMANAGER_H_
+#define PASSMANAGER_H_
+
+#include "Function.h"
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct PassStats {
+    std::string Name;
+    u32 Runs    = 0; // Times the pass was run over the program
+    u32 Changed = 0; // Functions whose code it changed
+    s32 Removed = 0; // Code bytes, less any it added
+    std::chrono::microseconds Time{ 0 };
+};
+
+/*
+ * Runs the optimiser passes in the order they were added and times each one.
+ * Function passes are run over every function in turn. Program passes see every function at once, eg. inlining.
+ * Passes added under the same name share their stats.
+ */
+class PassManager
+{
+  public:
+    typedef std::function<void(ScriptFunction &function)> FunctionPass;
+    typedef std::function<void(std::vector<ScriptFunction *> &functions)> ProgramPass;
+
+    void AddFunctionPass(const std::string &name, const FunctionPass &pass);
+    void AddProgramPass(const std::string &name, const ProgramPass &pass);
+
+    void Run(std::vector<ScriptFunction *> &functions);
+
+    const std::vector<PassStats> &Stats() const;
+
+  private:
+    struct Pass {
+        size_t Stats = 0;
+        FunctionPass Function;
+        ProgramPass Program;
+    };
+
+    std::vector<Pass> m_Passes;
+    std::vector<PassStats> m_Stats;
+
+    size_t StatsFor(const std::string &name);
+    static s32 CodeSize(const std::vector<ScriptFunction *> &functions);
+};
+
+#endif // PASSMANAGER_H_
@@ -0,0 +1,306 @@
+#include "Peephole.h"
+
+// Limit on how far a chain of jumps is followed
+#define MAX_JUMP_THREADING 16
+
+const Peephole::Rule Peephole::Rules[] = {
+    { "nop", RemoveNop },
+    { "push-pop", RemovePushPop },
+    { "merge-pops", MergePops },
+    { "merge-pushes", MergePushes },
+    { "assign-pop", AssignPop },
+    { "double-negate", RemoveDoubleNegate },
+    { "jump-to-next", RemoveJumpToNext },
+    { "jump-threading", ThreadJump },
+};
+
+Peephole::Peephole()
+{
+    for (auto &rule : Rules) {
+        PeepholeStats stats;
+        stats.Name = rule.Name;
+        m_Stats.push_back(stats);
+    }
+}
+
+bool Peephole::Run(std::vector<opCode_t> &code)
+{
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(code, instructions)) {
+        return false;
+    }
+
+    std::vector<PeepholeStats> stats = m_Stats;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        Bytecode::MarkLabels(instructions);
+
+        for (int i = 0; i < (int)instructions.size(); ++i) {
+            for (size_t r = 0; r < std::size(Rules); ++r) {
+                if (instructions[i].Removed || instructions[i].IsTable) {
+                    break;
+                }
+
+                const int saved = Rules[r].Apply(instructions, i);
+                if (saved >= 0) {
+                    stats[r].Applied++;
+                    stats[r].BytesSaved += saved;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<opCode_t> optimised;
+    if (!Bytecode::Encode(instructions, optimised)) {
+        return false;
+    }
+
+    code    = optimised;
+    m_Stats = stats;
+    return true;
+}
+
+const std::vector<PeepholeStats> &Peephole::Stats() const
+{
+    return m_Stats;
+}
+
+u32 Peephole::TotalBytesSaved() const
+{
+    u32 total = 0;
+    for (auto &stats : m_Stats) {
+        total += stats.BytesSaved;
+    }
+    return total;
+}
+
+void Peephole::Remove(std::vector<Instruction> &code, int index)
+{
+    code[index].Removed = true;
+
+    // Anything that jumped here now lands on the next instruction.
+    if (code[index].IsLabel) {
+        const int next = Bytecode::Resolve(code, index);
+        if (next < (int)code.size()) {
+            code[next].IsLabel = true;
+        }
+    }
+}
+
+/* The next instruction if it can be combined with the one at index, otherwise -1. */
+int Peephole::Following(std::vector<Instruction> &code, int index)
+{
+    const int next = Bytecode::Next(code, index);
+    if (next >= (int)code.size() || code[next].IsLabel || code[next].IsTable) {
+        return -1;
+    }
+    return next;
+}
+
+int Peephole::PopCount(const Instruction &instr)
+{
+    if (instr.Op == OP_POP)
+        return 1;
+    if (instr.Op == OP_POP_N)
+        return instr.Operands[0];
+    return 0;
+}
+
+int Peephole::PushCount(const Instruction &instr)
+{
+    if (instr.Op == OP_PUSH)
+        return 1;
+    if (instr.Op == OP_PUSH_N)
+        return instr.Operands[0];
+    return 0;
+}
+
+/* NOP -> */
+int Peephole::RemoveNop(std::vector<Instruction> &code, int index)
+{
+    if (code[index].Op != OP_NOP) {
+        return -1;
+    }
+
+    Remove(code, index);
+    return 1;
+}
+
+/* CONSTANT x, POP -> */
+int Peephole::RemovePushPop(std::vector<Instruction> &code, int index)
+{
+    switch (code[index].Op) {
+        case OP_PUSH:
+        case OP_DUPLICATE:
+        case OP_NIL:
+        case OP_FALSE:
+        case OP_TRUE:
+        case OP_INT_8:
+        case OP_INT_16:
+        case OP_FLOAT_ONE:
+        case OP_CONSTANT:
+        case OP_CONSTANT_16:
+        case OP_CONSTANT_24:
+        case OP_STRING:
+        case OP_STRING_16:
+        case OP_STRING_24:
+            break;
+        default:
+            return -1;
+    }
+
+    const int next = Following(code, index);
+    if (next < 0 || code[next].Op != OP_POP) {
+        return -1;
+    }
+
+    const int saved = (int)(code[index].Size() + code[next].Size());
+    Remove(code, index);
+    Remove(code, next);
+    return saved;
+}
+
+/* POP, POP -> POP_N 2 */
+int Peephole::MergePops(std::vector<Instruction> &code, int index)
+{
+    const int next = Following(code, index);
+    if (next < 0) {
+        return -1;
+    }
+
+    const int count = PopCount(code[index]) + PopCount(code[next]);
+    if (PopCount(code[index]) == 0 || PopCount(code[next]) == 0 || count > 0xFF) {
+        return -1;
+    }
+
+    const int saved = (int)(code[index].Size() + code[next].Size()) - 2;
+
+    code[index].Op           = OP_POP_N;
+    code[index].Operands[0]  = (u8)count;
+    code[index].OperandCount = 1;
+    Remove(code, next);
+    return saved;
+}
+
+/* PUSH, PUSH -> PUSH_N 2 */
+int Peephole::MergePushes(std::vector<Instruction> &code, int index)
+{
+    const int next = Following(code, index);
+    if (next < 0) {
+        return -1;
+    }
+
+    const int count = PushCount(code[index]) + PushCount(code[next]);
+    if (PushCount(code[index]) == 0 || PushCount(code[next]) == 0 || count > 0xFF) {
+        return -1;
+    }
+
+    const int saved = (int)(code[index].Size() + code[next].Size()) - 2;
+
+    code[index].Op           = OP_PUSH_N;
+    code[index].Operands[0]  = (u8)count;
+    code[index].OperandCount = 1;
+    Remove(code, next);
+    return saved;
+}
+
+/* ASSIGN, POP -> SET_VARIABLE */
+int Peephole::AssignPop(std::vector<Instruction> &code, int index)
+{
+    if (code[index].Op != OP_ASSIGN) {
+        return -1;
+    }
+
+    const int next = Following(code, index);
+    if (next < 0 || code[next].Op != OP_POP) {
+        return -1;
+    }
+
+    code[index].Op = OP_SET_VARIABLE;
+    Remove(code, next);
+    return 1;
+}
+
+/* NEGATE, NEGATE -> */
+int Peephole::RemoveDoubleNegate(std::vector<Instruction> &code, int index)
+{
+    const opCode_t op = code[index].Op;
+    if (op != OP_NEGATE_I && op != OP_NEGATE_F && op != OP_BIT_NOT) {
+        return -1;
+    }
+
+    const int next = Following(code, index);
+    if (next < 0 || code[next].Op != op) {
+        return -1;
+    }
+
+    Remove(code, index);
+    Remove(code, next);
+    return 2;
+}
+
+/* JUMP L, L: -> L: */
+int Peephole::RemoveJumpToNext(std::vector<Instruction> &code, int index)
+{
+    // Conditional jumps only peek the condition, so they can go too.
+    const opCode_t op = code[index].Op;
+    if (op != OP_JUMP && op != OP_BREAK && op != OP_JUMP_IF_FALSE && op != OP_JUMP_IF_TRUE) {
+        return -1;
+    }
+
+    if (Bytecode::Resolve(code, code[index].Target) != Bytecode::Next(code, index)) {
+        return -1;
+    }
+
+    const int saved = (int)code[index].Size();
+    Remove(code, index);
+    return saved;
+}
+
+/* JUMP L1 ... L1: JUMP L2 -> JUMP L2 */
+int Peephole::ThreadJump(std::vector<Instruction> &code, int index)
+{
+    const opCode_t op = code[index].Op;
+    if (op != OP_JUMP && op != OP_BREAK && op != OP_JUMP_IF_FALSE && op != OP_JUMP_IF_TRUE) {
+        return -1;
+    }
+
+    // The jump over a switch table must keep landing at the table end, or the table can't be decoded again.
+    const int following = Bytecode::Next(code, index);
+    if (following < (int)code.size() && code[following].IsTable) {
+        return -1;
+    }
+
+    const int original = Bytecode::Resolve(code, code[index].Target);
+    int target         = original;
+
+    for (int hops = 0; hops < MAX_JUMP_THREADING && target < (int)code.size(); ++hops) {
+        const Instruction &landing = code[target];
+        if (landing.IsTable) {
+            break;
+        }
+
+        // An unconditional jump always follows through. The same conditional jump sees the same condition.
+        const bool follows = (landing.Op == OP_JUMP || landing.Op == OP_BREAK) || (landing.Op == op && op != OP_JUMP && op != OP_BREAK);
+        if (!follows) {
+            break;
+        }
+
+        // Forward jumps can't be pointed backwards.
+        const int next = Bytecode::Resolve(code, landing.Target);
+        if (next <= index || next == target) {
+            break;
+        }
+        target = next;
+    }
+
+    if (target == original) {
+        return -1;
+    }
+
+    code[index].Target = target;
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef PEEPHOLE_H_
+#define PEEPHOLE_H_
+
+#include "Bytecode.h"
+#include <string>
+#include <vector>
+
+struct PeepholeStats {
+    std::string Name;
+    u32 Applied    = 0;
+    u32 BytesSaved = 0;
+};
+
+/*
+ * Rewrites short instruction sequences in a finished function into cheaper ones.
+ * Rules never look across a jump target, so every path into the code still sees the same stack.
+ */
+class Peephole
+{
+  public:
+    Peephole();
+
+    /* Optimises a function in place. The code is left untouched if it can't be decoded. */
+    bool Run(std::vector<opCode_t> &code);
+
+    /* Totals for every function run so far. */
+    const std::vector<PeepholeStats> &Stats() const;
+    u32 TotalBytesSaved() const;
+
+  private:
+    /* Returns the number of bytes saved, or -1 if the rule doesn't match at index. */
+    typedef int (*RuleFunction)(std::vector<Instruction> &code, int index);
+
+    struct Rule {
+        const char *Name;
+        RuleFunction Apply;
+    };
+
+    static const Rule Rules[];
+    std::vector<PeepholeStats> m_Stats;
+
+    static void Remove(std::vector<Instruction> &code, int index);
+    static int Following(std::vector<Instruction> &code, int index);
+    static int PopCount(const Instruction &instr);
+    static int PushCount(const Instruction &instr);
+
+    static int RemoveNop(std::vector<Instruction> &code, int index);
+    static int RemovePushPop(std::vector<Instruction> &code, int index);
+    static int MergePops(std::vector<Instruction> &code, int index);
+    static int MergePushes(std::vector<Instruction> &code, int index);
+    static int AssignPop(std::vector<Instruction> &code, int index);
+    static int RemoveDoubleNegate(std::vector<Instruction> &code, int index);
+    static int RemoveJumpToNext(std::vector<Instruction> &code, int index);
+    static int ThreadJump(std::vector<Instruction> &code, int index);
+};
+
+#endif // PEEPHOLE_H_
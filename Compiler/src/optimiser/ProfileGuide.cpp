@@ -0,0 +1,357 @@
+#include "ProfileGuide.h"
+#include "CompilerData.h"
+#include "MathUtils.h"
+#include "SwitchTable.h"
+#include <algorithm>
+#include <cstring>
+
+#define INT32_AT(code, pos) (s32)((code)[pos] | ((code)[(pos) + 1] << 8) | ((code)[(pos) + 2] << 16) | ((code)[(pos) + 3] << 24))
+
+bool ProfileGuide::Load(const std::vector<u8> &profile)
+{
+    m_Edges.clear();
+    m_Calls.clear();
+    m_Leaving.clear();
+    m_Hottest = 0;
+
+    ProfileHeader header{};
+    if (profile.size() < sizeof(ProfileHeader)) {
+        return false;
+    }
+    memcpy(&header, profile.data(), sizeof(ProfileHeader));
+
+    if (header.Magic != PROFILE_MAGIC || profile.size() != sizeof(ProfileHeader) + (size_t)header.EntryCount * sizeof(ProfileEntry)) {
+        return false;
+    }
+
+    for (u32 i = 0; i < header.EntryCount; ++i) {
+        ProfileEntry entry{};
+        memcpy(&entry, profile.data() + sizeof(ProfileHeader) + i * sizeof(ProfileEntry), sizeof(ProfileEntry));
+
+        m_Edges[{ entry.From, entry.To }] += entry.Count;
+        m_Calls[entry.To] += entry.Count;
+        m_Leaving[entry.From] += entry.Count;
+        m_Hottest = std::max(m_Hottest, entry.Count);
+    }
+
+    m_CodeChecksum = header.CodeChecksum;
+    return true;
+}
+
+u32 ProfileGuide::CodeChecksum() const
+{
+    return m_CodeChecksum;
+}
+
+u32 ProfileGuide::Count(u32 from, u32 to) const
+{
+    auto edge = m_Edges.find({ from, to });
+    return edge == m_Edges.end() ? 0 : edge->second;
+}
+
+u32 ProfileGuide::CallsTo(u32 start) const
+{
+    auto calls = m_Calls.find(start);
+    return calls == m_Calls.end() ? 0 : calls->second;
+}
+
+bool ProfileGuide::IsHot(u32 count) const
+{
+    return count > 0 && (u64)count * PROFILE_HOT_RATIO >= m_Hottest;
+}
+
+u32 ProfileGuide::BranchesSwapped() const
+{
+    return m_BranchesSwapped;
+}
+
+u32 ProfileGuide::LoopsHot() const
+{
+    return m_LoopsHot;
+}
+
+u32 ProfileGuide::SwitchesWidened() const
+{
+    return m_SwitchesWidened;
+}
+
+bool ProfileGuide::Run(std::vector<opCode_t> &code, u32 start, std::vector<LoopRange> &loops, u32 &outCalls)
+{
+    outCalls = CallsTo(start);
+
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(code, instructions)) {
+        return false;
+    }
+
+    // Where each instruction was in the profiled code, kept as they're moved around.
+    std::vector<u32> origins;
+    u32 pos = start;
+    for (auto &instr : instructions) {
+        origins.push_back(pos);
+        pos += instr.Size();
+    }
+
+    // A loop at the top of the function jumps back to where it was called to.
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        if (Bytecode::IsBackwardJump(instructions[i].Op)) {
+            outCalls -= std::min(outCalls, Count(origins[i], start));
+        }
+    }
+
+    MarkLoops(loops, start);
+
+    bool changed = false;
+    for (int i = 0; i < (int)instructions.size(); ++i) {
+        const Instruction &instr = instructions[i];
+        if (instr.IsTable) {
+            continue;
+        }
+
+        if (instr.Op == OP_JUMP_IF_FALSE && instr.Target > i) {
+            // Falling through runs the then arm.
+            const u32 thenCount = Count(origins[i], origins[i] + instr.Size());
+            const u32 elseCount = Count(origins[i], origins[instr.Target]);
+            if (IsHot(thenCount) && thenCount > elseCount && SwapBranch(instructions, origins, i)) {
+                ++m_BranchesSwapped;
+                changed = true;
+            }
+        } else if ((instr.Op == OP_SWITCH_SPARSE || instr.Op == OP_SWITCH_HASH) && m_Leaving.contains(origins[i])) {
+            if (IsHot(m_Leaving.at(origins[i])) && WidenSwitch(instructions, i)) {
+                ++m_SwitchesWidened;
+                changed = true;
+            }
+        }
+    }
+
+    if (!changed) {
+        return false;
+    }
+
+    std::vector<opCode_t> encoded;
+    if (!Bytecode::Encode(instructions, encoded)) {
+        return false;
+    }
+
+    // Loops are found by their byte range, which moves with them. Their instructions are still together.
+    std::vector<u32> offsets;
+    pos = 0;
+    for (auto &instr : instructions) {
+        offsets.push_back(pos);
+        pos += instr.Size();
+    }
+    for (auto &loop : loops) {
+        u32 first = UINT32_MAX;
+        u32 last  = 0;
+        for (size_t i = 0; i < instructions.size(); ++i) {
+            if (origins[i] >= start + loop.Start && origins[i] < start + loop.End) {
+                first = std::min(first, offsets[i]);
+                last  = std::max(last, offsets[i] + instructions[i].Size());
+            }
+        }
+        if (first != UINT32_MAX) {
+            loop.Start = first;
+            loop.End   = last;
+        }
+    }
+
+    code = encoded;
+    return true;
+}
+
+/* Loops that jump back often are unrolled as if optimising for speed. Loops that never ran aren't worth growing. */
+void ProfileGuide::MarkLoops(std::vector<LoopRange> &loops, u32 start)
+{
+    for (auto &loop : loops) {
+        const u32 first = start + loop.Start;
+        const u32 end   = start + loop.End;
+
+        u32 backward = 0;
+        for (auto edge = m_Edges.lower_bound({ first, 0 }); edge != m_Edges.end() && edge->first.first < end; ++edge) {
+            const u32 to = edge->first.second;
+            if (to >= first && to <= edge->first.first) {
+                backward = std::max(backward, edge->second);
+            }
+        }
+
+        const auto leaving = m_Leaving.lower_bound(first);
+        if (leaving == m_Leaving.end() || leaving->first >= end) {
+            // The condition of a loop always records an edge, so this one was never reached.
+            if (!(loop.Attributes & atUnroll)) {
+                loop.Attributes |= atNoUnroll;
+            }
+        } else if (IsHot(backward)) {
+            loop.Hot = true;
+            ++m_LoopsHot;
+        }
+    }
+}
+
+/*
+ * Swaps the arms of an if/else so the else arm pays for the jump at the end of the then arm.
+ * cond, JUMP_IF_FALSE else, POP, then..., JUMP end, else: POP, else..., end:
+ * cond, JUMP_IF_TRUE then, POP, else..., JUMP end, then: POP, then..., end:
+ * Only arms that are entered from the top and left by falling out the bottom, or by jumping out of the if entirely, are moved.
+ */
+bool ProfileGuide::SwapBranch(std::vector<Instruction> &code, std::vector<u32> &origins, int branch) const
+{
+    const int count   = (int)code.size();
+    const int elsePop = code[branch].Target;
+    const int jump    = elsePop - 1;
+    if (branch + 2 > jump || elsePop >= count || code[branch + 1].Op != OP_POP || code[branch + 1].IsTable || code[elsePop].Op != OP_POP ||
+        code[elsePop].IsTable || code[jump].Op != OP_JUMP || code[jump].IsTable) {
+        return false;
+    }
+
+    const int end = code[jump].Target;
+    if (end <= elsePop) {
+        return false;
+    }
+
+    // Which part of the if each instruction is in. Anything landing in an arm has to come from inside it.
+    enum Part { Outside, Head, Then, Else };
+    auto partOf = [&](int index) {
+        if (index <= branch || index >= end) {
+            return Outside;
+        }
+        if (index == branch + 1 || index == jump || index == elsePop) {
+            return Head;
+        }
+        return index < jump ? Then : Else;
+    };
+
+    for (int i = 0; i < count; ++i) {
+        std::vector<int> targets = code[i].IsTable ? code[i].Table : std::vector<int>{ code[i].Target };
+        for (const int target : targets) {
+            if (target == NOT_SET || partOf(target) == Outside || (i == branch && target == elsePop)) {
+                continue;
+            }
+            // The end of the then arm is now the end of the if.
+            if (target == jump && partOf(i) == Then) {
+                continue;
+            }
+            if (partOf(target) == Head || partOf(target) != partOf(i)) {
+                return false;
+            }
+        }
+    }
+
+    std::vector<int> order;
+    for (int i = 0; i <= branch + 1; ++i) {
+        order.push_back(i);
+    }
+    for (int i = elsePop + 1; i < end; ++i) {
+        order.push_back(i);
+    }
+    order.push_back(jump);
+    order.push_back(elsePop);
+    for (int i = branch + 2; i < jump; ++i) {
+        order.push_back(i);
+    }
+    for (int i = end; i < count; ++i) {
+        order.push_back(i);
+    }
+
+    std::vector<int> moved(count + 1);
+    for (int i = 0; i < count; ++i) {
+        moved[order[i]] = i;
+    }
+    moved[count] = count;
+
+    std::vector<Instruction> swapped;
+    std::vector<u32> swappedOrigins;
+    for (const int from : order) {
+        Instruction instr = code[from];
+        const bool inThen = partOf(from) == Then;
+        auto remap        = [&](int target) {
+            if (target == NOT_SET) {
+                return target;
+            }
+            return moved[(inThen && target == jump) ? end : target];
+        };
+
+        if (instr.IsTable) {
+            for (auto &target : instr.Table) {
+                target = remap(target);
+            }
+        } else {
+            instr.Target = remap(instr.Target);
+        }
+        swapped.push_back(instr);
+        swappedOrigins.push_back(origins[from]);
+    }
+
+    swapped[branch].Op = OP_JUMP_IF_TRUE;
+
+    Bytecode::MarkLabels(swapped);
+    code    = swapped;
+    origins = swappedOrigins;
+    return true;
+}
+
+/* Turns a sparse or hashed switch into a dense table, if the range of its cases isn't too wide. */
+bool ProfileGuide::WidenSwitch(std::vector<Instruction> &code, int index) const
+{
+    Instruction &instr = code[index];
+    const int table    = instr.Target - 1;
+    if (table <= index || !code[table].IsTable || code[table].Table.empty()) {
+        return false;
+    }
+
+    const std::vector<s32> &keys  = code[table].Keys;
+    const std::vector<int> &jumps = code[table].Table;
+    const int defaultCase         = jumps[0];
+
+    // Value -> case
+    std::map<s32, int> cases;
+    if (instr.Op == OP_SWITCH_SPARSE) {
+        for (size_t c = 0; c + 1 < keys.size() && c / 2 + 1 < jumps.size(); c += 2) {
+            if ((s64)keys[c + 1] - keys[c] >= PROFILE_DENSE_SPAN) {
+                return false;
+            }
+            for (s64 value = keys[c]; value <= keys[c + 1]; ++value) {
+                cases[(s32)value] = jumps[c / 2 + 1];
+            }
+        }
+    } else {
+        const u32 multiplier = (u32)INT32_AT(instr.Operands, 2);
+        const u8 bits        = instr.Operands[6];
+        for (size_t slot = 0; slot < keys.size() && slot + 1 < jumps.size(); ++slot) {
+            // Empty slots jump to the default case.
+            if (SwitchTable::HashSlot(keys[slot], multiplier, bits) == slot && jumps[slot + 1] != defaultCase) {
+                cases[keys[slot]] = jumps[slot + 1];
+            }
+        }
+    }
+
+    if (cases.empty()) {
+        return false;
+    }
+
+    const s32 min = cases.begin()->first;
+    const s32 max = cases.rbegin()->first;
+    if ((s64)max - min >= PROFILE_DENSE_SPAN) {
+        return false;
+    }
+
+    std::vector<int> dense = { defaultCase };
+    for (s64 value = min; value <= max; ++value) {
+        auto found = cases.find((s32)value);
+        dense.push_back(found == cases.end() ? defaultCase : found->second);
+    }
+
+    code[table].Keys.clear();
+    code[table].Table = dense;
+
+    instr.Op           = OP_SWITCH;
+    instr.OperandCount = 10;
+    instr.Operands[2]  = mByte0(min);
+    instr.Operands[3]  = mByte1(min);
+    instr.Operands[4]  = mByte2(min);
+    instr.Operands[5]  = mByte3(min);
+    instr.Operands[6]  = mByte0(max);
+    instr.Operands[7]  = mByte1(max);
+    instr.Operands[8]  = mByte2(max);
+    instr.Operands[9]  = mByte3(max);
+    return true;
+}
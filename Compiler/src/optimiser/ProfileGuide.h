@@ -0,0 +1,74 @@
+#ifndef PROFILEGUIDE_H_
+#define PROFILEGUIDE_H_
+
+#include "Bytecode.h"
+#include "Function.h"
+#include "Profile.h"
+#include <map>
+#include <utility>
+#include <vector>
+
+/* An edge is hot if it was taken at least 1 / PROFILE_HOT_RATIO times as often as the most taken edge. */
+#ifndef PROFILE_HOT_RATIO
+#define PROFILE_HOT_RATIO 100
+#endif // PROFILE_HOT_RATIO
+
+/* Widest range of values a hot sparse or hashed switch is turned into a dense table for. */
+#ifndef PROFILE_DENSE_SPAN
+#define PROFILE_DENSE_SPAN 256
+#endif // PROFILE_DENSE_SPAN
+
+/*
+ * Uses an execution profile recorded by the VM to guide the optimiser.
+ * The profile is keyed by code offsets, so it has to be taken from a build with the optimiser off,
+ * and this has to run on each function before anything else changes its code.
+ *  - If/else arms are swapped so the one run most often falls through and the other pays for the jump over it.
+ *  - Hot loops are unrolled as if optimising for speed, and loops that never ran are left alone.
+ *  - Hot sparse and hashed switches are turned into dense tables, which don't need searching.
+ * The call counts are used by the inliner.
+ */
+class ProfileGuide
+{
+  public:
+    /* Reads a profile written by the VM. Returns false if it isn't one. */
+    bool Load(const std::vector<u8> &profile);
+
+    /* Checksum of the code the profile was taken from. */
+    u32 CodeChecksum() const;
+
+    /* Times control went from one code offset to another. */
+    u32 Count(u32 from, u32 to) const;
+
+    /* Times anything went to a code offset, including calls from the script or the host. */
+    u32 CallsTo(u32 start) const;
+
+    bool IsHot(u32 count) const;
+
+    /*
+     * Optimises a function in place. Start is the code offset of its first instruction. Returns true if the code was changed.
+     * Gets the number of times the function was called.
+     */
+    bool Run(std::vector<opCode_t> &code, u32 start, std::vector<LoopRange> &loops, u32 &outCalls);
+
+    /* Totals for every function run so far. */
+    u32 BranchesSwapped() const;
+    u32 LoopsHot() const;
+    u32 SwitchesWidened() const;
+
+  private:
+    u32 m_CodeChecksum = 0;
+    u32 m_Hottest      = 0;
+    std::map<std::pair<u32, u32>, u32> m_Edges;
+    std::map<u32, u32> m_Calls;
+    std::map<u32, u32> m_Leaving; // Total of the edges from each offset
+
+    u32 m_BranchesSwapped = 0;
+    u32 m_LoopsHot        = 0;
+    u32 m_SwitchesWidened = 0;
+
+    void MarkLoops(std::vector<LoopRange> &loops, u32 start);
+    bool SwapBranch(std::vector<Instruction> &code, std::vector<u32> &origins, int branch) const;
+    bool WidenSwitch(std::vector<Instruction> &code, int index) const;
+};
+
+#endif // PROFILEGUIDE_H_
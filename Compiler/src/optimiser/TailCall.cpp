@@ -0,0 +1,101 @@
+#include "TailCall.h"
+
+TailCall::TailCall(const std::vector<ConstantInfo> &constants) : m_Constants(constants)
+{
+}
+
+bool TailCall::Run(std::vector<opCode_t> &code)
+{
+    std::vector<Instruction> instructions;
+    if (!Bytecode::Decode(code, instructions)) {
+        return false;
+    }
+
+    const int count = (int)instructions.size();
+    std::vector<int> frames;
+    u32 replaced = 0;
+
+    for (int i = 0; i < count; ++i) {
+        const Instruction &instr = instructions[i];
+        if (instr.IsTable) {
+            continue;
+        }
+
+        if (instr.Op == OP_FRAME) {
+            frames.push_back(i);
+            continue;
+        }
+
+        if (instr.Op != OP_CALL) {
+            continue;
+        }
+
+        if (frames.empty()) {
+            return false;
+        }
+        const int frame = frames.back();
+        frames.pop_back();
+
+        const int next = Bytecode::Next(instructions, i);
+        if (next >= count || instructions[next].IsTable || instructions[next].Op != OP_RETURN) {
+            continue;
+        }
+
+        // The current frame is overwritten by the arguments, so they can't point into it.
+        if (PointsIntoFrame(instructions, frame + 1, i)) {
+            continue;
+        }
+
+        // Anything that jumped to the frame now lands on the function constant.
+        instructions[frame].Removed = true;
+        instructions[i].Op          = OP_TAIL_CALL;
+        replaced++;
+    }
+
+    if (replaced == 0) {
+        return false;
+    }
+
+    // The return after each tail call is left for dead code elimination, as other paths may still jump to it.
+    std::vector<opCode_t> optimised;
+    if (!Bytecode::Encode(instructions, optimised)) {
+        return false;
+    }
+
+    m_CallsReplaced += replaced;
+    code = optimised;
+    return true;
+}
+
+u32 TailCall::CallsReplaced() const
+{
+    return m_CallsReplaced;
+}
+
+/* True if an absolute pointer is taken between from and to that could be to one of the function's own slots. */
+bool TailCall::PointsIntoFrame(const std::vector<Instruction> &code, int from, int to) const
+{
+    for (int i = from; i < to; ++i) {
+        if (code[i].IsTable || code[i].Op != OP_ABSOLUTE_POINTER) {
+            continue;
+        }
+
+        const Instruction &prev = code[i - 1];
+        if (prev.IsTable || !Bytecode::IsConstant(prev.Op)) {
+            return true;
+        }
+
+        const u32 index = Bytecode::ConstantIndex(prev);
+        if (index >= m_Constants.size() || m_Constants[index].Type != dtPointer) {
+            return true;
+        }
+
+        // Globals are outside the stack frames. Fields belong to an instance further down the stack.
+        const VarScopeType scope = m_Constants[index].ConstValue.Pointer.Scope;
+        if (scope != scopeGlobal && scope != scopeField) {
+            return true;
+        }
+    }
+
+    return false;
+}
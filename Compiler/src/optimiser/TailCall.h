@@ -0,0 +1,32 @@
+#ifndef TAILCALL_H_
+#define TAILCALL_H_
+
+#include "Bytecode.h"
+#include "Variable.h"
+#include <vector>
+
+/*
+ * Turns calls in tail position into tail calls. Eg: return f(x);
+ * FRAME, CONSTANT f, args..., CALL n, RETURN -> CONSTANT f, args..., TAIL_CALL n
+ * The VM slides the function and its arguments down over the current ones and reuses the frame,
+ * so recursion through tail calls runs in constant stack space.
+ */
+class TailCall
+{
+  public:
+    explicit TailCall(const std::vector<ConstantInfo> &constants);
+
+    /* Optimises a function in place. Returns true if the code was changed. */
+    bool Run(std::vector<opCode_t> &code);
+
+    /* Total for every function run so far. */
+    u32 CallsReplaced() const;
+
+  private:
+    const std::vector<ConstantInfo> &m_Constants;
+    u32 m_CallsReplaced = 0;
+
+    bool PointsIntoFrame(const std::vector<Instruction> &code, int from, int to) const;
+};
+
+#endif // TAILCALL_H_
@@ -43,6 +43,9 @@ void Disassembler::SetCode(u8 *code, const size_t length)
     m_CodeStartPos = 0;
     m_ConstantsPos = 0;
     m_StringsPos   = 0;
+    m_TasksPos     = 0;
+    m_ExportsPos   = 0;
+    m_SymbolsPos   = 0;
     m_GlobalsSize  = 0;
 }
 
@@ -57,6 +60,12 @@ bool Disassembler::ReadHeader()
         return false;
 
     ScriptBinaryHeader *header = (ScriptBinaryHeader *)m_Code;
+    if (header->LangVersionMajor != LANG_VERSION_MAJOR || header->LangVersionMinor != LANG_VERSION_MINOR) {
+        OutputLine("Script was compiled for language version " + STRING(header->LangVersionMajor) + "." + STRING(header->LangVersionMinor) +
+                   ", expected " + STRING(LANG_VERSION_MAJOR) + "." + STRING(LANG_VERSION_MINOR) + ".");
+        return false;
+    }
+
     if (header->HeaderSize != sizeof(ScriptBinaryHeader)) {
         OutputLine("Script header invalid!");
         return false;
@@ -71,6 +80,9 @@ bool Disassembler::ReadHeader()
     m_CodeStartPos = header->CodePos;
     m_ConstantsPos = header->ConstantsPos;
     m_StringsPos   = header->StringsPos;
+    m_TasksPos     = header->TasksPos;
+    m_ExportsPos   = header->ExportsPos;
+    m_SymbolsPos   = header->SymbolsPos;
     m_GlobalsSize  = header->GlobalsSize;
 
     OutputLine("========== MecScript Disassembly ==========");
@@ -107,17 +119,26 @@ std::string Disassembler::ReadInstruction()
     opCode_t op = m_Code[m_Pos++];
 
     if (m_CurrentJumpTableEnd > 0 && m_Pos >= m_CurrentJumpTableStart) {
-        // Process Jump Table Address
+        // Process Jump Table Key or Address
         if (m_Pos >= m_CurrentJumpTableStart) {
             instr = std::format("{:6}", addr) + ":";
             ALIGN_STRING(instr, COL_OP);
-            instr += "JUMP_TBL_ADDR";
-            ALIGN_STRING(instr, COL_ARGS);
-            u16 jumpAddr = (u16)(op | ((u16)READ_BYTE() << 8));
-            instr += STRING(jumpAddr);
+            if (m_Pos <= m_CurrentJumpTableKeys) {
+                instr += "JUMP_TBL_KEY";
+                ALIGN_STRING(instr, COL_ARGS);
+                s32 key = INT32_AT(m_Pos - 1);
+                m_Pos += 3;
+                instr += STRING(key);
+            } else {
+                instr += "JUMP_TBL_ADDR";
+                ALIGN_STRING(instr, COL_ARGS);
+                u16 jumpAddr = (u16)(op | ((u16)READ_BYTE() << 8));
+                instr += STRING(jumpAddr);
+            }
         }
         if (m_Pos >= m_CurrentJumpTableEnd) {
             m_CurrentJumpTableStart = 0;
+            m_CurrentJumpTableKeys  = 0;
             m_CurrentJumpTableEnd   = 0;
         }
     } else {
@@ -134,7 +155,8 @@ std::string Disassembler::ReadInstruction()
                 break;
             }
             case OP_PUSH_N: {
-                instr = WriteInstruction(addr, "PUSH_N");
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "PUSH_N", STRING(count));
                 desc  = "Push N values onto the stack";
                 break;
             }
@@ -144,7 +166,8 @@ std::string Disassembler::ReadInstruction()
                 break;
             }
             case OP_POP_N: {
-                instr = WriteInstruction(addr, "POP_N");
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "POP_N", STRING(count));
                 desc  = "Pop N values off the top of the stack";
                 break;
             }
@@ -173,6 +196,23 @@ std::string Disassembler::ReadInstruction()
                 desc  = "Push 'true' onto stack";
                 break;
             }
+            case OP_INT_8: {
+                s8 value = (s8)READ_BYTE();
+                instr    = WriteInstruction(addr, "INT_8", STRING((int)value));
+                desc     = "Push the 8 bit value onto the stack, sign extended";
+                break;
+            }
+            case OP_INT_16: {
+                s16 value = (s16)READ_UINT16();
+                instr     = WriteInstruction(addr, "INT_16", STRING(value));
+                desc      = "Push the 16 bit value onto the stack, sign extended";
+                break;
+            }
+            case OP_FLOAT_ONE: {
+                instr = WriteInstruction(addr, "FLOAT_ONE");
+                desc  = "Push 1.0 onto stack";
+                break;
+            }
             case OP_CONSTANT: {
                 u8 index = READ_BYTE();
                 instr    = WriteInstruction(addr, "GET_CONST", STRING(index));
@@ -233,6 +273,13 @@ std::string Disassembler::ReadInstruction()
                 break;
             }
 
+            case OP_BOUNDS_CHECK: {
+                u16 length = READ_UINT16();
+                instr      = WriteInstruction(addr, "BOUNDS_CHECK", STRING(length));
+                desc       = "Stop if the index isn't less than the length of the array";
+                break;
+            }
+
             case OP_GET_INDEXED_S8: {
                 instr = WriteInstruction(addr, "GET_INDEXED_S8");
                 desc  = "Get indexed value from array of S8";
@@ -325,6 +372,46 @@ std::string Disassembler::ReadInstruction()
                 desc  = "Cast float at stack top -1 to int";
                 break;
             }
+            case OP_CAST_INT_TO_FIXED: {
+                instr = WriteInstruction(addr, "CAST_INT_TO_FIXED");
+                desc  = "Cast int to fixed";
+                break;
+            }
+            case OP_CAST_PREV_INT_TO_FIXED: {
+                instr = WriteInstruction(addr, "CAST_PREV_INT_TO_FIXED");
+                desc  = "Cast int at stack top -1 to fixed";
+                break;
+            }
+            case OP_CAST_FIXED_TO_INT: {
+                instr = WriteInstruction(addr, "CAST_FIXED_TO_INT");
+                desc  = "Cast fixed to int";
+                break;
+            }
+            case OP_CAST_PREV_FIXED_TO_INT: {
+                instr = WriteInstruction(addr, "CAST_PREV_FIXED_TO_INT");
+                desc  = "Cast fixed at stack top -1 to int";
+                break;
+            }
+            case OP_CAST_FLOAT_TO_FIXED: {
+                instr = WriteInstruction(addr, "CAST_FLOAT_TO_FIXED");
+                desc  = "Cast float to fixed";
+                break;
+            }
+            case OP_CAST_PREV_FLOAT_TO_FIXED: {
+                instr = WriteInstruction(addr, "CAST_PREV_FLOAT_TO_FIXED");
+                desc  = "Cast float at stack top -1 to fixed";
+                break;
+            }
+            case OP_CAST_FIXED_TO_FLOAT: {
+                instr = WriteInstruction(addr, "CAST_FIXED_TO_FLOAT");
+                desc  = "Cast fixed to float";
+                break;
+            }
+            case OP_CAST_PREV_FIXED_TO_FLOAT: {
+                instr = WriteInstruction(addr, "CAST_PREV_FIXED_TO_FLOAT");
+                desc  = "Cast fixed at stack top -1 to float";
+                break;
+            }
 
                 // Unary
             case OP_NEGATE_I: {
@@ -424,6 +511,36 @@ std::string Disassembler::ReadInstruction()
                 desc  = "Divide (Float)";
                 break;
             }
+            case OP_ADD_SAT_FIXED: {
+                instr = WriteInstruction(addr, "ADD_SAT_FIXED");
+                desc  = "Add (Fixed, Saturating)";
+                break;
+            }
+            case OP_SUB_SAT_FIXED: {
+                instr = WriteInstruction(addr, "SUB_SAT_FIXED");
+                desc  = "Subtract (Fixed, Saturating)";
+                break;
+            }
+            case OP_MULT_FIXED: {
+                instr = WriteInstruction(addr, "MULT_FIXED");
+                desc  = "Multiply (Fixed)";
+                break;
+            }
+            case OP_MULT_SAT_FIXED: {
+                instr = WriteInstruction(addr, "MULT_SAT_FIXED");
+                desc  = "Multiply (Fixed, Saturating)";
+                break;
+            }
+            case OP_DIV_FIXED: {
+                instr = WriteInstruction(addr, "DIV_FIXED");
+                desc  = "Divide (Fixed)";
+                break;
+            }
+            case OP_DIV_SAT_FIXED: {
+                instr = WriteInstruction(addr, "DIV_SAT_FIXED");
+                desc  = "Divide (Fixed, Saturating)";
+                break;
+            }
             case OP_MODULUS: {
                 instr = WriteInstruction(addr, "MODULUS");
                 desc  = "Modulus";
@@ -460,6 +577,168 @@ std::string Disassembler::ReadInstruction()
                 break;
             }
 
+                // Vectors
+            case OP_VEC_COPY: {
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "VEC_COPY", STRING(count));
+                desc     = "[Components] Copy a vector";
+                break;
+            }
+            case OP_VEC_ADD: {
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "VEC_ADD", STRING(count));
+                desc     = "[Components] Add vectors";
+                break;
+            }
+            case OP_VEC_SUB: {
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "VEC_SUB", STRING(count));
+                desc     = "[Components] Subtract vectors";
+                break;
+            }
+            case OP_VEC_MULT: {
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "VEC_MULT", STRING(count));
+                desc     = "[Components] Multiply vectors component-wise";
+                break;
+            }
+            case OP_VEC_SCALE: {
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "VEC_SCALE", STRING(count));
+                desc     = "[Components] Multiply a vector by a float";
+                break;
+            }
+            case OP_VEC_DOT: {
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "VEC_DOT", STRING(count));
+                desc     = "[Components] Dot product of vectors";
+                break;
+            }
+            case OP_VEC_LENGTH_SQ: {
+                u8 count = READ_BYTE();
+                instr    = WriteInstruction(addr, "VEC_LENGTH_SQ", STRING(count));
+                desc     = "[Components] Squared length of a vector";
+                break;
+            }
+
+                // Math Intrinsics
+            case OP_ABS_I: {
+                instr = WriteInstruction(addr, "ABS_I");
+                desc  = "Absolute value of the int at the top of the stack";
+                break;
+            }
+            case OP_ABS_F: {
+                instr = WriteInstruction(addr, "ABS_F");
+                desc  = "Absolute value of the float at the top of the stack";
+                break;
+            }
+            case OP_MIN_S: {
+                instr = WriteInstruction(addr, "MIN_S");
+                desc  = "Push the smaller of two signed ints";
+                break;
+            }
+            case OP_MIN_U: {
+                instr = WriteInstruction(addr, "MIN_U");
+                desc  = "Push the smaller of two unsigned ints";
+                break;
+            }
+            case OP_MIN_F: {
+                instr = WriteInstruction(addr, "MIN_F");
+                desc  = "Push the smaller of two floats";
+                break;
+            }
+            case OP_MAX_S: {
+                instr = WriteInstruction(addr, "MAX_S");
+                desc  = "Push the larger of two signed ints";
+                break;
+            }
+            case OP_MAX_U: {
+                instr = WriteInstruction(addr, "MAX_U");
+                desc  = "Push the larger of two unsigned ints";
+                break;
+            }
+            case OP_MAX_F: {
+                instr = WriteInstruction(addr, "MAX_F");
+                desc  = "Push the larger of two floats";
+                break;
+            }
+            case OP_CLAMP_S: {
+                instr = WriteInstruction(addr, "CLAMP_S");
+                desc  = "Clamp a signed int between the two values above it";
+                break;
+            }
+            case OP_CLAMP_U: {
+                instr = WriteInstruction(addr, "CLAMP_U");
+                desc  = "Clamp an unsigned int between the two values above it";
+                break;
+            }
+            case OP_CLAMP_F: {
+                instr = WriteInstruction(addr, "CLAMP_F");
+                desc  = "Clamp a float between the two values above it";
+                break;
+            }
+            case OP_SQRT: {
+                instr = WriteInstruction(addr, "SQRT");
+                desc  = "Square root of the float at the top of the stack";
+                break;
+            }
+            case OP_SIN: {
+                instr = WriteInstruction(addr, "SIN");
+                desc  = "Sine of the float at the top of the stack, in radians";
+                break;
+            }
+            case OP_COS: {
+                instr = WriteInstruction(addr, "COS");
+                desc  = "Cosine of the float at the top of the stack, in radians";
+                break;
+            }
+            case OP_FLOOR: {
+                instr = WriteInstruction(addr, "FLOOR");
+                desc  = "Round the float at the top of the stack down";
+                break;
+            }
+
+                // Bit Intrinsics
+            case OP_BIT_EXTRACT: {
+                u8 position = READ_BYTE();
+                u8 width    = READ_BYTE();
+                instr       = WriteInstruction(addr, "BIT_EXTRACT", STRING(position), STRING(width));
+                desc        = "[Position][Width] Get a bit field of the value at the top of the stack";
+                break;
+            }
+            case OP_BIT_INSERT: {
+                u8 position = READ_BYTE();
+                u8 width    = READ_BYTE();
+                instr       = WriteInstruction(addr, "BIT_INSERT", STRING(position), STRING(width));
+                desc        = "[Position][Width] Replace a bit field of a value with the value above it";
+                break;
+            }
+            case OP_POPCOUNT: {
+                instr = WriteInstruction(addr, "POPCOUNT");
+                desc  = "Count the bits set in the value at the top of the stack";
+                break;
+            }
+            case OP_CLZ: {
+                instr = WriteInstruction(addr, "CLZ");
+                desc  = "Count the leading zero bits of the value at the top of the stack";
+                break;
+            }
+            case OP_ROTATE_L: {
+                instr = WriteInstruction(addr, "ROTATE_L");
+                desc  = "Bitwise Rotate Left";
+                break;
+            }
+            case OP_ROTATE_R: {
+                instr = WriteInstruction(addr, "ROTATE_R");
+                desc  = "Bitwise Rotate Right";
+                break;
+            }
+            case OP_BYTE_SWAP: {
+                instr = WriteInstruction(addr, "BYTE_SWAP");
+                desc  = "Reverse the byte order of the value at the top of the stack";
+                break;
+            }
+
                 // Logic
             case OP_NOT: {
                 instr = WriteInstruction(addr, "NOT");
@@ -605,11 +884,33 @@ std::string Disassembler::ReadInstruction()
                 m_CurrentJumpTableEnd   = m_Pos - 1 + end;
                 s32 min                 = READ_INT32();
                 s32 max                 = READ_INT32();
-                m_CurrentJumpTableStart = m_CurrentJumpTableEnd - (((max - min) + 1) * 2);
+                m_CurrentJumpTableStart = m_CurrentJumpTableEnd - (((max - min) + 2) * 2);
+                m_CurrentJumpTableKeys  = 0;
                 instr                   = WriteInstruction(addr, "SWITCH", STRING(end), STRING(min), STRING(max));
                 desc                    = "[End][Min][Max] Set up a jump table and jump to the desired offset";
                 break;
             }
+            case OP_SWITCH_SPARSE: {
+                u16 end                 = READ_UINT16();
+                m_CurrentJumpTableEnd   = m_Pos + end;
+                u16 count               = READ_UINT16();
+                m_CurrentJumpTableKeys  = m_CurrentJumpTableEnd - ((count + 1) * 2);
+                m_CurrentJumpTableStart = m_CurrentJumpTableKeys - (count * 8);
+                instr                   = WriteInstruction(addr, "SWITCH_SPARSE", STRING(end), STRING(count));
+                desc                    = "[End][Count] Binary search a table of case ranges and jump to the matching offset";
+                break;
+            }
+            case OP_SWITCH_HASH: {
+                u16 end                 = READ_UINT16();
+                m_CurrentJumpTableEnd   = m_Pos + end;
+                u32 multiplier          = (u32)READ_INT32();
+                u8 bits                 = READ_BYTE();
+                m_CurrentJumpTableKeys  = m_CurrentJumpTableEnd - (((1 << bits) + 1) * 2);
+                m_CurrentJumpTableStart = m_CurrentJumpTableKeys - ((1 << bits) * 4);
+                instr                   = WriteInstruction(addr, "SWITCH_HASH", STRING(end), STRING(multiplier), STRING(bits));
+                desc                    = "[End][Multiplier][Bits] Hash the value into a table of cases and jump to the matching offset";
+                break;
+            }
             case OP_FRAME: {
                 instr = WriteInstruction(addr, "FRAME");
                 desc  = "Stores the current call frame on the stack";
@@ -627,12 +928,38 @@ std::string Disassembler::ReadInstruction()
                 desc    = "[Arg Count] Calls a native function";
                 break;
             }
+            case OP_TAIL_CALL: {
+                u8 args = READ_BYTE();
+                instr   = WriteInstruction(addr, "TAIL_CALL", STRING(args));
+                desc    = "[Arg Count] Calls a function in place of the current one";
+                break;
+            }
             case OP_RETURN: {
                 instr = WriteInstruction(addr, "RETURN");
                 desc  = "Return from called function";
                 break;
             }
 
+                // Channels
+            case OP_CHANNEL_SEND: {
+                u8 channel = READ_BYTE();
+                instr      = WriteInstruction(addr, "CHANNEL_SEND", STRING(channel));
+                desc       = "[Channel] Sends a value to a channel mailbox";
+                break;
+            }
+            case OP_CHANNEL_RECEIVE: {
+                u8 channel = READ_BYTE();
+                instr      = WriteInstruction(addr, "CHANNEL_RECEIVE", STRING(channel));
+                desc       = "[Channel] Receives a value from a channel mailbox, waiting if it is empty";
+                break;
+            }
+            case OP_CHANNEL_COUNT: {
+                u8 channel = READ_BYTE();
+                instr      = WriteInstruction(addr, "CHANNEL_COUNT", STRING(channel));
+                desc       = "[Channel] Gets the number of values waiting in a channel mailbox";
+                break;
+            }
+
             case OP_END: {
                 instr = WriteInstruction(addr, "END");
                 desc  = "<< END OF PROGRAM >>";
@@ -733,7 +1060,7 @@ std::string Disassembler::ReadString()
     str += "\"";
 
     // Strings are terminated and padded to 4 byte boundaries with null chars.
-    while (m_Code[m_Pos] == 0) {
+    while (m_Pos < m_TasksPos && m_Code[m_Pos] == 0) {
         m_Pos++;
     }
 
@@ -787,7 +1114,7 @@ void Disassembler::Disassemble()
     OutputLine("STRINGS");
     OutputLine(divider);
     int stringId = 0;
-    while (m_Pos < m_Length) {
+    while (m_Pos < m_TasksPos) {
         std::string str = std::format("{:4}", stringId++) + ":";
         ALIGN_STRING(str, 8);
         str += ReadString();
@@ -797,5 +1124,56 @@ void Disassembler::Disassemble()
     OutputLine(divider);
     OutputLine("    ");
 
+    // Periodic Tasks
+    OutputLine("TASKS");
+    OutputLine(divider);
+    int taskId = 0;
+    while (m_Pos + sizeof(TaskInfo) <= m_ExportsPos) {
+        std::string task = std::format("{:4}", taskId++) + ":";
+        ALIGN_STRING(task, 8);
+        u32 function = (u32)INT32_AT(m_Pos);
+        u32 period   = (u32)INT32_AT(m_Pos + 4);
+        m_Pos += sizeof(TaskInfo);
+        task += "Function [" + STRING(function) + "] every " + STRING(period) + " ms";
+        OutputLine(task);
+    }
+
+    OutputLine(divider);
+    OutputLine("    ");
+
+    // Exports
+    OutputLine("EXPORTS");
+    OutputLine(divider);
+    int exportId = 0;
+    while (m_Pos + sizeof(ExportInfo) <= m_SymbolsPos) {
+        auto *exportInfo = (ExportInfo *)&m_Code[m_Pos];
+        m_Pos += sizeof(ExportInfo);
+        std::string line = std::format("{:4}", exportId++) + ":";
+        ALIGN_STRING(line, 8);
+        line += "Function [" + STRING(exportInfo->Function) + "] (" + STRING(exportInfo->ArgCount) + ") : " + STRING(exportInfo->ReturnType);
+        line += " \"" + std::string((const char *)&m_Code[m_StringsPos + exportInfo->Name]) + "\"";
+        OutputLine(line);
+    }
+
+    OutputLine(divider);
+    OutputLine("    ");
+
+    // Symbols
+    OutputLine("SYMBOLS");
+    OutputLine(divider);
+    int symbolId = 0;
+    while (m_Pos + sizeof(SymbolInfo) <= m_Length) {
+        auto *symbol = (SymbolInfo *)&m_Code[m_Pos];
+        m_Pos += sizeof(SymbolInfo);
+        std::string line = std::format("{:4}", symbolId++) + ":";
+        ALIGN_STRING(line, 8);
+        line += "Global [" + STRING(symbol->Slot) + "] x" + STRING(symbol->Size) + " : " + STRING(symbol->Type);
+        line += " \"" + std::string((const char *)&m_Code[m_StringsPos + symbol->Name]) + "\"";
+        OutputLine(line);
+    }
+
+    OutputLine(divider);
+    OutputLine("    ");
+
     OutputLine("========== END ==========");
 }
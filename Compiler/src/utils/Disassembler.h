@@ -24,12 +24,16 @@ class Disassembler
     size_t m_CodeStartPos = 0;
     size_t m_ConstantsPos = 0;
     size_t m_StringsPos   = 0;
+    size_t m_TasksPos     = 0;
+    size_t m_ExportsPos   = 0;
+    size_t m_SymbolsPos   = 0;
     size_t m_GlobalsSize  = 0;
     u32 m_Checksum        = 0;
 
     bool m_ShowDescription = false;
 
     size_t m_CurrentJumpTableStart = 0;
+    size_t m_CurrentJumpTableKeys  = 0; // End of the keys of a sparse or hashed table, where its jumps start
     size_t m_CurrentJumpTableEnd   = 0;
 
     void OutputLine(const std::string &line);
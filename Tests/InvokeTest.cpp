@@ -0,0 +1,101 @@
+/*
+ * Host calls into a script that fail or wait on a channel.
+ * Usage: MecInvokeTest <Invoke.mbin>
+ */
+
+#include "MecVm.h"
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#define STACK_SIZE       0x1000
+#define CHANNEL_CAPACITY 4
+
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": Failed: " #condition << std::endl; \
+            ++Failures;                                                                    \
+        }                                                                                  \
+    } while (false)
+
+static int Failures = 0;
+
+static MailboxCell ChannelCells[CHANNEL_CAPACITY];
+static Mailbox Channel;
+
+static Value Invoke(MecVm &vm, const ScriptInfo &script, const char *name, const Value *args = nullptr, const int argCount = 0, bool *ok = nullptr)
+{
+    Value result = INT32_VAL(0);
+    const bool done = vm.Invoke(MecVm::FindExport(&script, name), args, argCount, &result);
+    if (ok != nullptr) {
+        *ok = done;
+    }
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::cerr << "Usage: MecInvokeTest <Invoke.mbin>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    std::vector<u8> image(std::istreambuf_iterator<char>(file), {});
+    if (image.empty()) {
+        std::cerr << "Can't read " << argv[1] << std::endl;
+        return 1;
+    }
+
+    Channel.Initialise(ChannelCells, CHANNEL_CAPACITY);
+    MecVm::SetChannelTable(&Channel, 1);
+
+    ScriptInfo script{};
+    u8 stack[STACK_SIZE];
+    MecVm vm;
+    MecVm::DecodeScript(image.data(), (u32)image.size(), stack, STACK_SIZE, &script);
+    vm.Run(&script);
+    CHECK(vm.GetStatus() == vmEnd);
+
+    const u32 idleSize = vm.SnapshotSize();
+    bool ok            = false;
+
+    // An error unwinds the call and leaves the script ready for the next one.
+    Value zero = INT32_VAL(0);
+    Invoke(vm, script, "Divide", &zero, 1, &ok);
+    CHECK(!ok);
+    CHECK(vm.GetInvokeStatus() == vmDivideByZero);
+    CHECK(vm.GetStatus() == vmEnd);
+    CHECK(vm.SnapshotSize() == idleSize);
+
+    Value four = INT32_VAL(4);
+    CHECK(Invoke(vm, script, "Divide", &four, 1, &ok).Int == 25);
+    CHECK(ok);
+    CHECK(vm.GetInvokeStatus() == vmEnd);
+
+    // A call waiting on a channel is finished by Resume(), and its result taken off the stack.
+    Invoke(vm, script, "Receive", nullptr, 0, &ok);
+    CHECK(!ok);
+    CHECK(vm.GetInvokeStatus() == vmWaiting);
+    CHECK(vm.Invoke(MecVm::FindExport(&script, "Bump")) == false);
+
+    Channel.Send(INT32_VAL(41));
+    vm.Resume();
+    CHECK(vm.GetInvokeStatus() == vmEnd);
+    CHECK(vm.GetStatus() == vmEnd);
+    CHECK(vm.GetInvokeResult().Int == 42);
+    CHECK(vm.SnapshotSize() == idleSize);
+
+    CHECK(Invoke(vm, script, "Bump", nullptr, 0, &ok).Int == 1);
+    CHECK(ok);
+    CHECK(vm.SnapshotSize() == idleSize);
+
+    if (Failures > 0) {
+        std::cerr << Failures << " check(s) failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Invoke tests passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Periodic tasks that fail or wait on a channel don't stop the others.
+ * Usage: MecTaskTest <Task.mbin>
+ */
+
+#include "MecVm.h"
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#define STACK_SIZE       0x1000
+#define CHANNEL_CAPACITY 4
+
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": Failed: " #condition << std::endl; \
+            ++Failures;                                                                    \
+        }                                                                                  \
+    } while (false)
+
+static int Failures = 0;
+
+static MailboxCell ChannelCells[CHANNEL_CAPACITY];
+static Mailbox Channel;
+
+static u32 Now = 0;
+
+static u32 ReadNow()
+{
+    return Now;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::cerr << "Usage: MecTaskTest <Task.mbin>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    std::vector<u8> image(std::istreambuf_iterator<char>(file), {});
+    if (image.empty()) {
+        std::cerr << "Can't read " << argv[1] << std::endl;
+        return 1;
+    }
+
+    Channel.Initialise(ChannelCells, CHANNEL_CAPACITY);
+    MecVm::SetChannelTable(&Channel, 1);
+    MecVm::SetClockFunction(ReadNow);
+
+    ScriptInfo script{};
+    u8 stack[STACK_SIZE];
+    MecVm vm;
+    MecVm::DecodeScript(image.data(), (u32)image.size(), stack, STACK_SIZE, &script);
+    vm.Run(&script);
+    CHECK(vm.GetStatus() == vmEnd);
+    CHECK(vm.GetTaskCount() == 3);
+
+    const u32 idleSize = vm.SnapshotSize();
+
+    // Every task is due on the first poll. Two of them don't finish.
+    CHECK(vm.PollTasks() == 3);
+    CHECK(vm.GetStatus() == vmEnd);
+    CHECK(vm.SnapshotSize() == idleSize);
+
+    const TaskStats *fail  = vm.GetTaskStats(0);
+    const TaskStats *block = vm.GetTaskStats(1);
+    const TaskStats *count = vm.GetTaskStats(2);
+    CHECK(fail->Runs == 0 && fail->Failures == 1 && fail->LastFailure == vmDivideByZero);
+    CHECK(block->Runs == 0 && block->Failures == 1 && block->LastFailure == vmWaiting);
+    CHECK(count->Runs == 1 && count->Failures == 0);
+
+    // Nothing is due until the next period, then the healthy task keeps running.
+    CHECK(vm.PollTasks() == 0);
+    Now += 10000;
+    CHECK(vm.PollTasks() == 3);
+    CHECK(count->Runs == 2);
+    CHECK(fail->Failures == 2);
+
+    Value ticks = INT32_VAL(0);
+    CHECK(vm.Invoke(MecVm::FindExport(&script, "Ticks"), nullptr, 0, &ticks));
+    CHECK(ticks.Int == 2);
+
+    // A channel with a value in it lets the blocking task finish.
+    Channel.Send(INT32_VAL(40));
+    Now += 10000;
+    CHECK(vm.PollTasks() == 3);
+    CHECK(block->Runs == 1);
+    CHECK(vm.Invoke(MecVm::FindExport(&script, "Ticks"), nullptr, 0, &ticks));
+    CHECK(ticks.Int == 43);
+    CHECK(vm.SnapshotSize() == idleSize);
+
+    if (Failures > 0) {
+        std::cerr << Failures << " check(s) failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Task tests passed." << std::endl;
+    return 0;
+}
@@ -7,5 +7,12 @@
 
 //#define DEBUG_TRACE_EXECUTION
 #define STACK_BOUNDS_CHECKING
+//#define VM_PROFILE // Lets the host record an execution profile with MecVm::SetProfileTable(). Costs a check on every branch and call.
+#define VM_SIMD // Vector instructions use SSE or NEON when the host has them
+//#define VM_FAST_MATH // sqrt, sin and cos use approximations instead of the C library
+
+// Periodic tasks
+#define MAX_PERIODIC_TASKS     8
+#define TASK_HISTOGRAM_BUCKETS 16 // Log2 buckets in microseconds. The last bucket holds everything above 2^14 us.
 
 #endif //VMCONFIG_H
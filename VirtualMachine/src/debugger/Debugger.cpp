@@ -63,6 +63,20 @@ void Debugger::DebugInstruction(const opCode_t *codeStart, const opCode_t *code)
             MSG("TRUE");
             break;
         }
+        case OP_INT_8: {
+            const s32 value = (s8)DBG_READ_UINT8(valPtr);
+            DBG_PRINT_VALUE_OP("PushInt8", value);
+            break;
+        }
+        case OP_INT_16: {
+            const s32 value = (s16)DBG_READ_UINT16(valPtr);
+            DBG_PRINT_VALUE_OP("PushInt16", value);
+            break;
+        }
+        case OP_FLOAT_ONE: {
+            MSG("FLOAT_ONE");
+            break;
+        }
         case OP_CONSTANT: {
             const u32 addr = DBG_READ_UINT8(valPtr);
             DBG_PRINT_VALUE_OP("PushConst", addr);
@@ -90,6 +104,11 @@ void Debugger::DebugInstruction(const opCode_t *codeStart, const opCode_t *code)
         }
 
         // Indexed values
+        case OP_BOUNDS_CHECK: {
+            const u32 length = DBG_READ_UINT16(valPtr);
+            DBG_PRINT_VALUE_OP("BoundsCheck", length);
+            break;
+        }
         case OP_GET_INDEXED_S8: {
             MSG("GetIndexedS8");
             break;
@@ -230,6 +249,128 @@ void Debugger::DebugInstruction(const opCode_t *codeStart, const opCode_t *code)
             break;
         }
 
+            // Vectors
+        case OP_VEC_COPY: {
+            MSG("VecCopy");
+            break;
+        }
+        case OP_VEC_ADD: {
+            MSG("VecAdd");
+            break;
+        }
+        case OP_VEC_SUB: {
+            MSG("VecSub");
+            break;
+        }
+        case OP_VEC_MULT: {
+            MSG("VecMult");
+            break;
+        }
+        case OP_VEC_SCALE: {
+            MSG("VecScale");
+            break;
+        }
+        case OP_VEC_DOT: {
+            MSG("VecDot");
+            break;
+        }
+        case OP_VEC_LENGTH_SQ: {
+            MSG("VecLengthSq");
+            break;
+        }
+
+            // Math Intrinsics
+        case OP_ABS_I: {
+            MSG("AbsInt");
+            break;
+        }
+        case OP_ABS_F: {
+            MSG("AbsFloat");
+            break;
+        }
+        case OP_MIN_S: {
+            MSG("MinSigned");
+            break;
+        }
+        case OP_MIN_U: {
+            MSG("MinUnsigned");
+            break;
+        }
+        case OP_MIN_F: {
+            MSG("MinFloat");
+            break;
+        }
+        case OP_MAX_S: {
+            MSG("MaxSigned");
+            break;
+        }
+        case OP_MAX_U: {
+            MSG("MaxUnsigned");
+            break;
+        }
+        case OP_MAX_F: {
+            MSG("MaxFloat");
+            break;
+        }
+        case OP_CLAMP_S: {
+            MSG("ClampSigned");
+            break;
+        }
+        case OP_CLAMP_U: {
+            MSG("ClampUnsigned");
+            break;
+        }
+        case OP_CLAMP_F: {
+            MSG("ClampFloat");
+            break;
+        }
+        case OP_SQRT: {
+            MSG("Sqrt");
+            break;
+        }
+        case OP_SIN: {
+            MSG("Sin");
+            break;
+        }
+        case OP_COS: {
+            MSG("Cos");
+            break;
+        }
+        case OP_FLOOR: {
+            MSG("Floor");
+            break;
+        }
+
+            // Bit Intrinsics
+        case OP_BIT_EXTRACT: {
+            MSG("BitExtract(" << DBG_READ_UINT8(valPtr) << ", " << DBG_READ_UINT8(valPtr + 1) << ")");
+            break;
+        }
+        case OP_BIT_INSERT: {
+            MSG("BitInsert(" << DBG_READ_UINT8(valPtr) << ", " << DBG_READ_UINT8(valPtr + 1) << ")");
+            break;
+        }
+        case OP_POPCOUNT: {
+            MSG("PopCount");
+            break;
+        }
+        case OP_CLZ: {
+            MSG("CountLeadingZeros");
+            break;
+        }
+        case OP_ROTATE_L: {
+            MSG("RotateLeft");
+            break;
+        }
+        case OP_ROTATE_R: {
+            MSG("RotateRight");
+            break;
+        }
+        case OP_BYTE_SWAP: {
+            MSG("ByteSwap");
+            break;
+        }
+
             // Assignment
         case OP_ASSIGN: {
             MSG("Assign = ");
@@ -277,6 +418,16 @@ void Debugger::DebugInstruction(const opCode_t *codeStart, const opCode_t *code)
             DBG_PRINT_VALUE_OP("Switch (Jump Table): ", offset);
             break;
         }
+        case OP_SWITCH_SPARSE: {
+            const u32 offset = DBG_READ_UINT16(valPtr);
+            DBG_PRINT_VALUE_OP("Switch (Sparse Jump Table): ", offset);
+            break;
+        }
+        case OP_SWITCH_HASH: {
+            const u32 offset = DBG_READ_UINT16(valPtr);
+            DBG_PRINT_VALUE_OP("Switch (Hashed Jump Table): ", offset);
+            break;
+        }
         case OP_FRAME: {
             MSG("FRAME");
             break;
@@ -289,10 +440,29 @@ void Debugger::DebugInstruction(const opCode_t *codeStart, const opCode_t *code)
             MSG("Call Native");
             break;
         }
+        case OP_TAIL_CALL: {
+            MSG("Tail Call");
+            break;
+        }
         case OP_RETURN: {
             MSG("Return");
             break;
         }
+        case OP_CHANNEL_SEND: {
+            const u32 channel = DBG_READ_UINT8(valPtr);
+            DBG_PRINT_VALUE_OP("Channel Send", channel);
+            break;
+        }
+        case OP_CHANNEL_RECEIVE: {
+            const u32 channel = DBG_READ_UINT8(valPtr);
+            DBG_PRINT_VALUE_OP("Channel Receive", channel);
+            break;
+        }
+        case OP_CHANNEL_COUNT: {
+            const u32 channel = DBG_READ_UINT8(valPtr);
+            DBG_PRINT_VALUE_OP("Channel Count", channel);
+            break;
+        }
         case OP_END: {
             MSG("END!");
             break;
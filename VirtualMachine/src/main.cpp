@@ -2,18 +2,27 @@
 // Created by Declan Walsh on 18/02/2024.
 //
 
+#include "Checksum.h"
 #include "Console.h"
 #include "MecVm.h"
 #include "Options.h"
 #include "VmConfig.h"
 #include <chrono>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
 #include <winerror.h>
 
-#define STACK_SIZE 0x1000
+#define STACK_SIZE       0x1000
+#define CHANNEL_COUNT    8
+#define CHANNEL_CAPACITY 64
+#define PROFILE_CAPACITY 0x4000 // Distinct branch and call edges recorded
+
+static MailboxCell ChannelCells[CHANNEL_COUNT][CHANNEL_CAPACITY];
+static Mailbox Channels[CHANNEL_COUNT];
 
 static Value NativePrint(const ScriptInfo *const script, void *sysParam, const int argCount, Value *args)
 {
@@ -98,6 +107,12 @@ static long long int Millis()
     return ms;
 }
 
+static u32 Micros()
+{
+    const auto now = Clock::now().time_since_epoch() - ClockStartTime;
+    return (u32)(now.count() / 1000);
+}
+
 static Value NativeClock(const ScriptInfo *const script, void *sysParam, int argCount, Value *args)
 {
     const auto ms = Millis();
@@ -193,34 +208,64 @@ static NativeFunc ResolveNativeFunction(const NativeFuncId funcId, const u8 argC
     return func;
 }
 
-int main(int argc, char *argv[])
-{
-    ClockStartTime = Clock::now().time_since_epoch();
-
-    std::string inputFilePath;
+struct HostOptions {
+    long long int TaskRunTime = 0;
+    std::string ExportName;
+    std::vector<std::string> Symbols;
+    std::string SaveSnapshotPath;
+    std::string LoadSnapshotPath;
+    bool Profile = false;
+};
 
-    // Read args
-    for (int i = 1; i < argc; i++) {
-        std::string arg = argv[i];
-        // Verbose
-        if (arg == "-v") {
-            MSG("Verbose Output = On");
-            Console::VerboseOutput = true;
+static void PrintTaskStats(MecVm &vm)
+{
+    for (u32 i = 0; i < vm.GetTaskCount(); ++i) {
+        const TaskStats *stats = vm.GetTaskStats(i);
+        MSG("Task " << i << ": Runs = " << stats->Runs << ", Overruns = " << stats->Overruns << ", Max Exec = " << stats->MaxExecutionTime
+                    << " us, Max Jitter = " << stats->MaxJitter << " us");
+        if (stats->Failures > 0) {
+            MSG("    Failures = " << stats->Failures << ", Last Status = " << stats->LastFailure);
         }
-        // Input path
-        else if (inputFilePath.empty()) {
-            inputFilePath = arg;
+
+        std::string execLine   = "    Exec (log2 us):   ";
+        std::string jitterLine = "    Jitter (log2 us): ";
+        for (int b = 0; b < TASK_HISTOGRAM_BUCKETS; ++b) {
+            execLine += std::to_string(stats->ExecutionTime[b]) + " ";
+            jitterLine += std::to_string(stats->Jitter[b]) + " ";
         }
+        MSG(execLine);
+        MSG(jitterLine);
     }
+}
 
-    if (inputFilePath.empty()) {
-        ERR("Incorrect usage!");
-        ERR("Correct usage is: " << VIRTUAL_MACHINE_NAME << " <file." << OUTPUT_EXTENSION << ">");
-        exit(ERROR_INVALID_FUNCTION);
+/* Writes the execution profile next to the script, for the compiler to read back with -p. */
+static void SaveProfile(const std::string &inputFilePath, const std::vector<u8> &scriptData, const std::vector<ProfileEntry> &table)
+{
+    const auto *image = (const ScriptBinaryHeader *)scriptData.data();
+
+    std::vector<ProfileEntry> entries;
+    for (auto &entry : table) {
+        if (entry.Count > 0) {
+            entries.push_back(entry);
+        }
     }
 
-    MSG_V("====== MecScript Virtual Machine ======");
+    ProfileHeader header{};
+    header.Magic        = PROFILE_MAGIC;
+    header.CodeChecksum = Checksum::Calculate(scriptData.data() + image->CodePos, image->ConstantsPos - image->CodePos);
+    header.EntryCount   = (u32)entries.size();
 
+    std::filesystem::path profilePath = inputFilePath;
+    profilePath.replace_extension(PROFILE_EXTENSION);
+
+    std::ofstream profileFile(profilePath, std::ios::out | std::ios::binary);
+    profileFile.write((const char *)&header, sizeof(ProfileHeader));
+    profileFile.write((const char *)entries.data(), (std::streamsize)(entries.size() * sizeof(ProfileEntry)));
+    MSG_V("Saved profile: " << entries.size() << " edges to \"" << profilePath.string() << "\"");
+}
+
+static void RunScript(const std::string &inputFilePath, const HostOptions &options)
+{
     std::ifstream scriptFile(inputFilePath, std::fstream::binary);
 
     if (!scriptFile.good()) {
@@ -238,26 +283,203 @@ int main(int argc, char *argv[])
 
     MSG_V("Program size: " << scriptData.size() << " bytes.");
 
-    // Give the VM a way to access native functions
-    MecVm::SetNativeFunctionResolver(ResolveNativeFunction);
-
     // Declare a script and give it a stack
     ScriptInfo script{};
     u8 stack[STACK_SIZE];
 
     // Create a VM and decode the script code into the script struct
     MecVm vm;
-    MecVm::DecodeScript(scriptData.data(), scriptData.size(), stack, STACK_SIZE, &script);
+    if (MecVm::DecodeScript(scriptData.data(), scriptData.size(), stack, STACK_SIZE, &script) == 0) {
+        u8 major, minor;
+        MecVm::GetLanguageVersion(major, minor);
+        ERR("Program binary is invalid, or wasn't compiled for language version " << (int)major << "." << (int)minor << ".");
+        exit(ERROR_INVALID_DATA);
+    }
+
+    // Record the branches taken and functions called
+    std::vector<ProfileEntry> profile;
+    if (options.Profile) {
+#ifdef VM_PROFILE
+        profile.resize(PROFILE_CAPACITY);
+        vm.SetProfileTable(profile.data(), PROFILE_CAPACITY);
+#else
+        ERR("Profiling needs the VM built with VM_PROFILE.");
+        exit(ERROR_INVALID_FUNCTION);
+#endif
+    }
     MSG_V("Stack size after globals: " << (script.Stack.Count * sizeof(Value)) << " bytes.");
 
     // Run the script
     MSG_V("======== Script Start ========");
 
-    vm.Run(&script);
+    if (options.LoadSnapshotPath.empty()) {
+        vm.Run(&script);
+    } else {
+        // Warm start from a previously saved state instead of running the top level code
+        std::ifstream snapshotFile(options.LoadSnapshotPath, std::ios::in | std::ios::binary);
+        std::vector<u8> snapshot(std::istreambuf_iterator<char>(snapshotFile), {});
+        if (!vm.Restore(&script, snapshot.data(), (u32)snapshot.size())) {
+            ERR("Snapshot \"" << options.LoadSnapshotPath << "\" does not match the script.");
+            return;
+        }
+        MSG_V("Restored snapshot: " << snapshot.size() << " bytes.");
+        vm.Resume();
+    }
+
+    // The script is suspended while it waits to receive from an empty channel.
+    while (vm.GetStatus() == vmWaiting) {
+        std::this_thread::yield();
+        vm.Resume();
+    }
+
+    // Save the initialised state for a later warm start
+    if (!options.SaveSnapshotPath.empty()) {
+        std::vector<u8> snapshot(vm.SnapshotSize());
+        const u32 size = vm.Snapshot(snapshot.data(), (u32)snapshot.size());
+        if (size == 0) {
+            ERR("Failed to take a snapshot. Status: " << vm.GetStatus());
+        } else {
+            std::ofstream snapshotFile(options.SaveSnapshotPath, std::ios::out | std::ios::binary);
+            snapshotFile.write((const char *)snapshot.data(), size);
+            MSG_V("Saved snapshot: " << size << " bytes.");
+        }
+    }
+
+    // Call an exported function on the initialised script
+    if (!options.ExportName.empty()) {
+        const ExportInfo *function = MecVm::FindExport(&script, options.ExportName.c_str());
+        if (function == nullptr) {
+            ERR("Exported function not found: \"" << options.ExportName << "\"");
+        } else {
+            vm.Invoke(function);
+
+            // The function is suspended while it waits to receive from an empty channel.
+            while (vm.GetInvokeStatus() == vmWaiting) {
+                std::this_thread::yield();
+                vm.Resume();
+            }
+
+            if (vm.GetInvokeStatus() != vmEnd) {
+                ERR("Failed to invoke \"" << options.ExportName << "\". Status: " << vm.GetInvokeStatus());
+            } else if (function->ReturnType != dtVoid) {
+                MSG(options.ExportName << "() returned " << vm.GetInvokeResult().Int);
+            }
+        }
+    }
+
+    // Read globals through the symbol table
+    for (auto &name : options.Symbols) {
+        SymbolHandle symbol;
+        if (!MecVm::ResolveSymbol(&script, name.c_str(), symbol)) {
+            ERR("Symbol not found: \"" << name << "\"");
+        } else if (symbol.Type == dtFloat || symbol.Type == dtFixed) {
+            MSG(name << " = " << symbol.ReadFloat());
+        } else {
+            MSG(name << " = " << symbol.ReadInt());
+        }
+    }
+
+    // Run any periodic tasks on the initialised script for the requested time
+    if (options.TaskRunTime > 0 && vm.GetTaskCount() > 0) {
+        MSG_V("======== Periodic Tasks ========");
+        const auto end = Millis() + options.TaskRunTime;
+        while (Millis() < end && vm.GetStatus() == vmEnd) {
+            if (vm.PollTasks() == 0) {
+                std::this_thread::yield();
+            }
+        }
+        PrintTaskStats(vm);
+    }
+
+    if (options.Profile) {
+        SaveProfile(inputFilePath, scriptData, profile);
+    }
 
     MSG_V("\n====== Script Finished =======");
 
     scriptFile.close();
+}
+
+int main(int argc, char *argv[])
+{
+    ClockStartTime = Clock::now().time_since_epoch();
+
+    std::vector<std::string> inputFilePaths;
+    HostOptions options;
+
+    // Read args
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        // Verbose
+        if (arg == "-v") {
+            MSG("Verbose Output = On");
+            Console::VerboseOutput = true;
+        }
+        // Periodic task run time
+        else if (arg == "-t" && (i + 1) < argc) {
+            options.TaskRunTime = std::stoll(argv[++i]);
+            MSG("Periodic task run time = " << options.TaskRunTime << " ms");
+        }
+        // Exported function to call
+        else if (arg == "-e" && (i + 1) < argc) {
+            options.ExportName = argv[++i];
+        }
+        // Global to print
+        else if (arg == "-g" && (i + 1) < argc) {
+            options.Symbols.push_back(argv[++i]);
+        }
+        // Snapshot to save after initialisation
+        else if (arg == "-ss" && (i + 1) < argc) {
+            options.SaveSnapshotPath = argv[++i];
+        }
+        // Snapshot to restore instead of running the top level code
+        else if (arg == "-ls" && (i + 1) < argc) {
+            options.LoadSnapshotPath = argv[++i];
+        }
+        // Execution profile for the compiler
+        else if (arg == "-p") {
+            options.Profile = true;
+        }
+        // Input paths
+        else {
+            inputFilePaths.push_back(arg);
+        }
+    }
+
+    if (inputFilePaths.empty()) {
+        ERR("Incorrect usage!");
+        ERR("Correct usage is: " << VIRTUAL_MACHINE_NAME << " <file." << OUTPUT_EXTENSION << "> [file." << OUTPUT_EXTENSION << " ...] [-t <task run time ms>] [-e <exported function>] [-g <global>] [-ss <snapshot out>] [-ls <snapshot in>] [-p]");
+        exit(ERROR_INVALID_FUNCTION);
+    }
+
+    MSG_V("====== MecScript Virtual Machine ======");
+
+    // Give the VM a way to access native functions
+    MecVm::SetNativeFunctionResolver(ResolveNativeFunction);
+
+    // Give the VM a clock to time periodic tasks
+    MecVm::SetClockFunction(Micros);
+
+    // Set up the channels shared between scripts
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        Channels[i].Initialise(ChannelCells[i], CHANNEL_CAPACITY);
+    }
+    MecVm::SetChannelTable(Channels, CHANNEL_COUNT);
+
+    if (inputFilePaths.size() == 1) {
+        RunScript(inputFilePaths.front(), options);
+        return 0;
+    }
+
+    // Multiple scripts each get their own thread and talk to each other through channels.
+    std::vector<std::thread> threads;
+    for (auto &path : inputFilePaths) {
+        threads.emplace_back(RunScript, path, std::cref(options));
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,89 @@
+#ifndef FASTMATH_H_
+#define FASTMATH_H_
+
+#include "BasicTypes.h"
+#include "VmConfig.h"
+#include <bit>
+#include <cmath>
+
+/*
+ * The float math intrinsics that don't have an exact answer.
+ * With VM_FAST_MATH they use short approximations for targets with a slow or missing C library, otherwise they are the C library functions.
+ * The approximations are within about 1e-5 of the C library for normal inputs.
+ * Sin and cos fall back to the C library for very large angles, where reducing the angle loses too much precision, and for inf and NaN.
+ */
+namespace FastMath
+{
+#if defined(VM_FAST_MATH)
+#define FAST_MATH_PI_HI     3.140625f // Pi split in two so reducing the angle doesn't lose the low bits
+#define FAST_MATH_PI_LO     9.67653589793e-4f
+#define FAST_MATH_INV_PI    0.318309886184f
+#define FAST_MATH_MAX_ANGLE 1.0e5f // Multiples of FAST_MATH_PI_HI are exact below this
+
+    /* Inverse square root estimate improved with two Newton-Raphson steps. */
+    inline float Sqrt(const float value)
+    {
+        if (value <= 0.0f) {
+            return value == 0.0f ? value : NAN;
+        }
+        if (std::isinf(value)) {
+            return value;
+        }
+
+        float inverse    = std::bit_cast<float>(0x5F3759DFu - (std::bit_cast<u32>(value) >> 1));
+        const float half = 0.5f * value;
+        inverse          = inverse * (1.5f - half * inverse * inverse);
+        inverse          = inverse * (1.5f - half * inverse * inverse);
+        return value * inverse;
+    }
+
+    /* Taylor series to x^9, for x in [-pi/2, pi/2]. */
+    inline float SinReduced(const float x)
+    {
+        const float x2 = x * x;
+        return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f)))));
+    }
+
+    /* Reduces the angle to x + k * pi. sin(x + k * pi) is sin(x) with the sign flipped when k is odd. */
+    inline float Sin(const float radians)
+    {
+        if (!(std::fabs(radians) < FAST_MATH_MAX_ANGLE)) {
+            return std::sin(radians);
+        }
+
+        const float turns = std::floor(radians * FAST_MATH_INV_PI + 0.5f);
+        const float sine  = SinReduced((radians - turns * FAST_MATH_PI_HI) - turns * FAST_MATH_PI_LO);
+        return ((s32)turns & 1) ? -sine : sine;
+    }
+
+    /* Reduces the angle to x + (k + 0.5) * pi. cos(x + (k + 0.5) * pi) is -sin(x) with the sign flipped when k is odd. */
+    inline float Cos(const float radians)
+    {
+        if (!(std::fabs(radians) < FAST_MATH_MAX_ANGLE)) {
+            return std::cos(radians);
+        }
+
+        const float turns = std::floor(radians * FAST_MATH_INV_PI);
+        const float half  = turns + 0.5f;
+        const float sine  = SinReduced((radians - half * FAST_MATH_PI_HI) - half * FAST_MATH_PI_LO);
+        return ((s32)turns & 1) ? sine : -sine;
+    }
+#else
+    inline float Sqrt(const float value)
+    {
+        return std::sqrt(value);
+    }
+
+    inline float Sin(const float radians)
+    {
+        return std::sin(radians);
+    }
+
+    inline float Cos(const float radians)
+    {
+        return std::cos(radians);
+    }
+#endif
+}
+
+#endif // FASTMATH_H_
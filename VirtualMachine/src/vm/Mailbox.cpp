@@ -0,0 +1,101 @@
+#include "Mailbox.h"
+
+bool Mailbox::Initialise(MailboxCell *cells, const u32 capacity)
+{
+    if (cells == nullptr || capacity < 2 || (capacity & (capacity - 1)) != 0) {
+        m_Cells = nullptr;
+        m_Mask  = 0;
+        return false;
+    }
+
+    m_Cells = cells;
+    m_Mask  = capacity - 1;
+
+    for (u32 i = 0; i < capacity; ++i) {
+        m_Cells[i].Sequence.store(i, std::memory_order_relaxed);
+    }
+
+    m_SendPos.store(0, std::memory_order_relaxed);
+    m_ReceivePos.store(0, std::memory_order_release);
+
+    return true;
+}
+
+bool Mailbox::Send(const Value &value)
+{
+    if (m_Cells == nullptr)
+        return false;
+
+    MailboxCell *cell;
+    u32 pos = m_SendPos.load(std::memory_order_relaxed);
+
+    while (true) {
+        cell           = &m_Cells[pos & m_Mask];
+        const u32 seq  = cell->Sequence.load(std::memory_order_acquire);
+        const s32 diff = (s32)(seq - pos);
+
+        if (diff == 0) {
+            // Cell is free, try to claim it.
+            if (m_SendPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Cell hasn't been received yet. Full.
+            return false;
+        } else {
+            // Another sender got here first.
+            pos = m_SendPos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->Data = value;
+    cell->Sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool Mailbox::Receive(Value &outValue)
+{
+    if (m_Cells == nullptr)
+        return false;
+
+    MailboxCell *cell;
+    u32 pos = m_ReceivePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        cell           = &m_Cells[pos & m_Mask];
+        const u32 seq  = cell->Sequence.load(std::memory_order_acquire);
+        const s32 diff = (s32)(seq - (pos + 1));
+
+        if (diff == 0) {
+            // Cell holds a value, try to claim it.
+            if (m_ReceivePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Nothing sent yet. Empty.
+            return false;
+        } else {
+            // Another receiver got here first.
+            pos = m_ReceivePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    outValue = cell->Data;
+    // Hand the cell back to the senders for the next lap of the ring.
+    cell->Sequence.store(pos + m_Mask + 1, std::memory_order_release);
+
+    return true;
+}
+
+u32 Mailbox::Count() const
+{
+    const u32 received = m_ReceivePos.load(std::memory_order_acquire);
+    const u32 sent     = m_SendPos.load(std::memory_order_acquire);
+    const u32 count    = sent - received;
+
+    return (count > m_Mask + 1) ? 0 : count;
+}
+
+u32 Mailbox::Capacity() const
+{
+    return (m_Cells == nullptr) ? 0 : m_Mask + 1;
+}
@@ -0,0 +1,50 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include "Value.h"
+#include <atomic>
+
+/* Keep the producer and consumer positions on separate cache lines so cores don't fight over them. */
+#ifndef MAILBOX_ALIGNMENT
+#define MAILBOX_ALIGNMENT 64
+#endif // MAILBOX_ALIGNMENT
+
+struct MailboxCell {
+    std::atomic<u32> Sequence;
+    Value Data = INT32_VAL(0);
+};
+
+/*
+ * Fixed capacity lock-free ring buffer used to pass values between scripts.
+ * Cell storage is provided by the host at setup so nothing is allocated at runtime.
+ * Each cell carries a sequence number, which makes the buffer safe for any number of
+ * senders and receivers (SPSC, MPSC and MPMC) without locks.
+ */
+class Mailbox
+{
+  public:
+    Mailbox() = default;
+
+    /* Capacity must be a power of two. */
+    bool Initialise(MailboxCell *cells, u32 capacity);
+
+    /* Returns false if the mailbox is full. */
+    bool Send(const Value &value);
+
+    /* Returns false if the mailbox is empty. */
+    bool Receive(Value &outValue);
+
+    /* Number of values waiting. Only a snapshot when other threads are active. */
+    u32 Count() const;
+
+    u32 Capacity() const;
+
+  private:
+    MailboxCell *m_Cells = nullptr;
+    u32 m_Mask           = 0;
+
+    alignas(MAILBOX_ALIGNMENT) std::atomic<u32> m_SendPos{ 0 };
+    alignas(MAILBOX_ALIGNMENT) std::atomic<u32> m_ReceivePos{ 0 };
+};
+
+#endif // MAILBOX_H
@@ -5,8 +5,13 @@
 #include "MecVm.h"
 
 #include <algorithm>
+#include <bit>
+#include <cstring>
 
+#include "BitOps.h"
 #include "Checksum.h"
+#include "FastMath.h"
+#include "VectorMath.h"
 
 #ifdef DEBUG_TRACE_EXECUTION
 #include "Checksum.h"
@@ -37,7 +42,14 @@
 #define THIS_ADDRESS            FRAME_LOCALS[0]
 #define STACK_ADDRESS_OF(ptr)   (u32)(ResolvePointer(ptr) - PGM_GLOBALS);
 
-#define FRAME_SIZE              ((sizeof(CallFrame) / sizeof(Value)) + (sizeof(CallFrame) % sizeof(Value) > 0 ? 1 : 0))
+#define FRAME_SIZE              (sizeof(StoredFrame) / sizeof(Value))
+
+// Return address of a function invoked by the host. Returning to it ends execution.
+#define HOST_RETURN_IP          nullptr
+#define HOST_RETURN_OFFSET      0xFFFFFFFF
+#define NO_FRAME_OFFSET         0xFFFFFFFF
+
+#define SNAPSHOT_MAGIC          0x5343454D // "MECS"
 
 /* Instruction Readers */
 #define READ_BYTE()             (*m_Frame.Ip++)
@@ -45,6 +57,10 @@
 #define READ_UINT24()           (m_Frame.Ip += 3, (uint32_t)(m_Frame.Ip[-3] | (m_Frame.Ip[-2] << 8) | (m_Frame.Ip[-1] << 16)))
 #define READ_INT32()            (m_Frame.Ip += 4, (int32_t)(m_Frame.Ip[-4] | (m_Frame.Ip[-3] << 8) | (m_Frame.Ip[-2] << 16) | (m_Frame.Ip[-1] << 24)))
 
+/* Switch Table Readers */
+#define UINT16_AT(ptr)          (uint16_t)((ptr)[0] | ((ptr)[1] << 8))
+#define INT32_AT(ptr)           (int32_t)((ptr)[0] | ((ptr)[1] << 8) | ((ptr)[2] << 16) | ((ptr)[3] << 24))
+
 /* Instruction Macros */
 #define OP_BINARY(op, resultType, valueType)                \
     do {                                                    \
@@ -53,10 +69,69 @@
         Push(resultType(valueType(lhs) op valueType(rhs))); \
     } while (false)
 
+// Stops the script instead of crashing the host on a divide by zero or INT32_MIN / -1.
+#define OP_INT_DIVIDE(op)                                               \
+    do {                                                                \
+        Value rhs = Pop();                                              \
+        Value lhs = Pop();                                              \
+        if (AS_INT32(rhs) == 0) {                                       \
+            SetStatus(vmDivideByZero);                                  \
+        } else if (AS_INT32(lhs) == INT32_MIN && AS_INT32(rhs) == -1) { \
+            SetStatus(vmDivideOverflow);                                \
+        } else {                                                        \
+            Push(INT32_VAL(AS_INT32(lhs) op AS_INT32(rhs)));            \
+        }                                                               \
+    } while (false)
+
+#define OP_FIXED(operation, saturate)                                                   \
+    do {                                                                                \
+        Value rhs = Pop();                                                              \
+        Value lhs = Pop();                                                              \
+        Push(INT32_VAL(FixedPoint::operation(AS_INT32(lhs), AS_INT32(rhs), saturate))); \
+    } while (false)
+
+#define OP_BINARY_FUNC(function, resultType, valueType)             \
+    do {                                                            \
+        Value rhs = Pop();                                          \
+        Value lhs = Pop();                                          \
+        Push(resultType(function(valueType(lhs), valueType(rhs)))); \
+    } while (false)
+
+// The max wins if the limits are the wrong way round.
+#define OP_CLAMP(resultType, valueType)                                                         \
+    do {                                                                                        \
+        Value max   = Pop();                                                                    \
+        Value min   = Pop();                                                                    \
+        Value value = Pop();                                                                    \
+        Push(resultType(std::min(std::max(valueType(value), valueType(min)), valueType(max)))); \
+    } while (false)
+
+// Operands are pointers to the vectors, the destination first. The count is clamped so a bad one can't overrun the lanes.
+#define OP_VECTOR(operation)                                                                          \
+    do {                                                                                              \
+        const int count             = std::min((int)READ_BYTE(), VECTOR_LANES);                       \
+        const VectorMath::Lanes rhs = VectorMath::Load(ResolvePointer(AS_POINTER(Pop())), count);     \
+        const VectorMath::Lanes lhs = VectorMath::Load(ResolvePointer(AS_POINTER(Pop())), count);     \
+        VectorMath::Store(ResolvePointer(AS_POINTER(Pop())), VectorMath::operation(lhs, rhs), count); \
+    } while (false)
+
 // Float 0 is the same as Int 0, so we only need to check the Int value.
 #define IS_FALSEY(value) (AS_INT32(value) == 0)
 
+#ifdef VM_PROFILE
+// Records where the instruction just run went. Uses the start of the instruction kept by Execute().
+#define PROFILE_EDGE()                                                                \
+    if (m_Profile != nullptr) {                                                       \
+        RecordEdge((u32)(instructionStart - PGM_CODE), (u32)(m_Frame.Ip - PGM_CODE)); \
+    }
+#else
+#define PROFILE_EDGE()
+#endif
+
 ResolverFunction MecVm::FunctionResolver = nullptr;
+ClockFunction MecVm::ClockSource          = nullptr;
+Mailbox *MecVm::ChannelTable              = nullptr;
+u32 MecVm::ChannelCount                   = 0;
 
 MecVm::MecVm()
 {
@@ -91,8 +166,34 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
 
     Reset();
 
+    Execute();
+}
+
+void MecVm::Resume()
+{
+    // Only a script waiting on a channel, or stopped by the host, can be resumed.
+    if (m_Status != vmWaiting && m_Status != vmStop)
+        return;
+
+    // A function invoked by the host may be what was waiting.
+    const bool invoking = FindHostFrame() != nullptr;
+
+    m_Status = vmOk;
+
+    Execute();
+
+    if (invoking) {
+        EndInvoke();
+    }
+}
+
+void MecVm::Execute()
+{
     while (m_Status == vmOk) {
         DISASSEMBLE_INSTRUCTION(m_Script->Code.Data, m_Frame.Ip);
+#ifdef VM_PROFILE
+        const opCode_t *instructionStart = m_Frame.Ip;
+#endif
         opCode_t instruction = READ_BYTE();
 
         switch (instruction) {
@@ -146,6 +247,21 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 break;
             }
 
+            case OP_INT_8: {
+                Push(INT32_VAL((int8_t)READ_BYTE()));
+                break;
+            }
+
+            case OP_INT_16: {
+                Push(INT32_VAL((int16_t)READ_UINT16()));
+                break;
+            }
+
+            case OP_FLOAT_ONE: {
+                Push(FLOAT_VAL(1.0f));
+                break;
+            }
+
             case OP_CONSTANT: {
                 u32 address = READ_BYTE();
                 Push(m_Script->Constants.Values[address]);
@@ -188,6 +304,15 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 break;
             }
 
+            case OP_BOUNDS_CHECK: {
+                // The index stays on the stack for the GET_INDEXED or SET_INDEXED that follows.
+                const u32 length = READ_UINT16();
+                if ((u32)AS_INT32(Peek()) >= length) {
+                    SetStatus(vmIndexOutOfBounds);
+                }
+                break;
+            }
+
             case OP_GET_INDEXED_S8: {
                 int i         = AS_INT32(Pop());
                 VmPointer ptr = AS_POINTER(Pop());
@@ -321,6 +446,42 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 prev->Int   = (int)prev->Float;
                 break;
             }
+            case OP_CAST_INT_TO_FIXED: {
+                Push(INT32_VAL(FixedPoint::FromInt(AS_INT32(Pop()))));
+                break;
+            }
+            case OP_CAST_PREV_INT_TO_FIXED: {
+                Value *prev = (m_StackPtr - 2);
+                prev->Int   = FixedPoint::FromInt(prev->Int);
+                break;
+            }
+            case OP_CAST_FIXED_TO_INT: {
+                Push(INT32_VAL(FixedPoint::ToInt(AS_INT32(Pop()))));
+                break;
+            }
+            case OP_CAST_PREV_FIXED_TO_INT: {
+                Value *prev = (m_StackPtr - 2);
+                prev->Int   = FixedPoint::ToInt(prev->Int);
+                break;
+            }
+            case OP_CAST_FLOAT_TO_FIXED: {
+                Push(INT32_VAL(FixedPoint::FromFloat(AS_FLOAT(Pop()))));
+                break;
+            }
+            case OP_CAST_PREV_FLOAT_TO_FIXED: {
+                Value *prev = (m_StackPtr - 2);
+                prev->Int   = FixedPoint::FromFloat(prev->Float);
+                break;
+            }
+            case OP_CAST_FIXED_TO_FLOAT: {
+                Push(FLOAT_VAL(FixedPoint::ToFloat(AS_INT32(Pop()))));
+                break;
+            }
+            case OP_CAST_PREV_FIXED_TO_FLOAT: {
+                Value *prev = (m_StackPtr - 2);
+                prev->Float = FixedPoint::ToFloat(prev->Int);
+                break;
+            }
 
                 // Unary
             case OP_NEGATE_I: {
@@ -393,16 +554,40 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 break;
             }
             case OP_DIV_S: {
-                OP_BINARY(/, INT32_VAL, AS_INT32);
+                OP_INT_DIVIDE(/);
                 break;
             }
             case OP_DIV_F: {
                 OP_BINARY(/, FLOAT_VAL, AS_FLOAT);
                 break;
             }
+            case OP_ADD_SAT_FIXED: {
+                OP_FIXED(Add, true);
+                break;
+            }
+            case OP_SUB_SAT_FIXED: {
+                OP_FIXED(Subtract, true);
+                break;
+            }
+            case OP_MULT_FIXED: {
+                OP_FIXED(Multiply, false);
+                break;
+            }
+            case OP_MULT_SAT_FIXED: {
+                OP_FIXED(Multiply, true);
+                break;
+            }
+            case OP_DIV_FIXED: {
+                OP_FIXED(Divide, false);
+                break;
+            }
+            case OP_DIV_SAT_FIXED: {
+                OP_FIXED(Divide, true);
+                break;
+            }
             case OP_MODULUS: {
                 // Must always be done as integers
-                OP_BINARY(%, INT32_VAL, AS_INT32);
+                OP_INT_DIVIDE(%);
                 break;
             }
 
@@ -413,6 +598,13 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 break;
             }
 
+            case OP_SET_VARIABLE: {
+                // Assign without leaving the value on the stack.
+                VmPointer ptr        = AS_POINTER(Pop());
+                *ResolvePointer(ptr) = Pop();
+                break;
+            }
+
                 // Bitwise
             case OP_BIT_AND: {
                 OP_BINARY(&, INT32_VAL, AS_INT32);
@@ -435,6 +627,150 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 break;
             }
 
+                // Vectors
+            case OP_VEC_COPY: {
+                const int count = std::min((int)READ_BYTE(), VECTOR_LANES);
+                const Value *in = ResolvePointer(AS_POINTER(Pop()));
+                Value *out      = ResolvePointer(AS_POINTER(Pop()));
+                std::memmove(out, in, count * sizeof(Value));
+                break;
+            }
+            case OP_VEC_ADD: {
+                OP_VECTOR(Add);
+                break;
+            }
+            case OP_VEC_SUB: {
+                OP_VECTOR(Subtract);
+                break;
+            }
+            case OP_VEC_MULT: {
+                OP_VECTOR(Multiply);
+                break;
+            }
+            case OP_VEC_SCALE: {
+                const int count            = std::min((int)READ_BYTE(), VECTOR_LANES);
+                const float scale          = AS_FLOAT(Pop());
+                const VectorMath::Lanes in = VectorMath::Load(ResolvePointer(AS_POINTER(Pop())), count);
+                VectorMath::Store(ResolvePointer(AS_POINTER(Pop())), VectorMath::Multiply(in, VectorMath::Splat(scale)), count);
+                break;
+            }
+            case OP_VEC_DOT: {
+                const int count  = std::min((int)READ_BYTE(), VECTOR_LANES);
+                const Value *rhs = ResolvePointer(AS_POINTER(Pop()));
+                const Value *lhs = ResolvePointer(AS_POINTER(Pop()));
+                Push(FLOAT_VAL(VectorMath::Dot(lhs, rhs, count)));
+                break;
+            }
+            case OP_VEC_LENGTH_SQ: {
+                const int count     = std::min((int)READ_BYTE(), VECTOR_LANES);
+                const Value *vector = ResolvePointer(AS_POINTER(Pop()));
+                Push(FLOAT_VAL(VectorMath::Dot(vector, vector, count)));
+                break;
+            }
+
+                // Math Intrinsics
+            case OP_ABS_I: {
+                const s32 value = AS_INT32(Pop());
+                Push(INT32_VAL((s32)(value < 0 ? 0u - (u32)value : (u32)value))); // abs(INT32_MIN) wraps instead of being undefined
+                break;
+            }
+            case OP_ABS_F: {
+                Push(FLOAT_VAL(std::fabs(AS_FLOAT(Pop()))));
+                break;
+            }
+            case OP_MIN_S: {
+                OP_BINARY_FUNC(std::min, INT32_VAL, AS_INT32);
+                break;
+            }
+            case OP_MIN_U: {
+                OP_BINARY_FUNC(std::min, UINT32_VAL, AS_UINT32);
+                break;
+            }
+            case OP_MIN_F: {
+                OP_BINARY_FUNC(std::min, FLOAT_VAL, AS_FLOAT);
+                break;
+            }
+            case OP_MAX_S: {
+                OP_BINARY_FUNC(std::max, INT32_VAL, AS_INT32);
+                break;
+            }
+            case OP_MAX_U: {
+                OP_BINARY_FUNC(std::max, UINT32_VAL, AS_UINT32);
+                break;
+            }
+            case OP_MAX_F: {
+                OP_BINARY_FUNC(std::max, FLOAT_VAL, AS_FLOAT);
+                break;
+            }
+            case OP_CLAMP_S: {
+                OP_CLAMP(INT32_VAL, AS_INT32);
+                break;
+            }
+            case OP_CLAMP_U: {
+                OP_CLAMP(UINT32_VAL, AS_UINT32);
+                break;
+            }
+            case OP_CLAMP_F: {
+                OP_CLAMP(FLOAT_VAL, AS_FLOAT);
+                break;
+            }
+            case OP_SQRT: {
+                Push(FLOAT_VAL(FastMath::Sqrt(AS_FLOAT(Pop()))));
+                break;
+            }
+            case OP_SIN: {
+                Push(FLOAT_VAL(FastMath::Sin(AS_FLOAT(Pop()))));
+                break;
+            }
+            case OP_COS: {
+                Push(FLOAT_VAL(FastMath::Cos(AS_FLOAT(Pop()))));
+                break;
+            }
+            case OP_FLOOR: {
+                Push(FLOAT_VAL(std::floor(AS_FLOAT(Pop()))));
+                break;
+            }
+
+                // Bit Intrinsics
+            case OP_BIT_EXTRACT: {
+                const u32 position = READ_BYTE();
+                const u32 width    = READ_BYTE();
+                Push(UINT32_VAL(BitOps::Extract(AS_UINT32(Pop()), position, width)));
+                break;
+            }
+            case OP_BIT_INSERT: {
+                const u32 position = READ_BYTE();
+                const u32 width    = READ_BYTE();
+                Value field        = Pop();
+                Value value        = Pop();
+                Push(UINT32_VAL(BitOps::Insert(AS_UINT32(value), AS_UINT32(field), position, width)));
+                break;
+            }
+            case OP_POPCOUNT: {
+                Push(UINT32_VAL(BitOps::PopCount(AS_UINT32(Pop()))));
+                break;
+            }
+            case OP_CLZ: {
+                Push(UINT32_VAL(BitOps::CountLeadingZeros(AS_UINT32(Pop()))));
+                break;
+            }
+            case OP_ROTATE_L: {
+                Value count = Pop();
+                Value value = Pop();
+                Push(UINT32_VAL(BitOps::RotateLeft(AS_UINT32(value), AS_INT32(count))));
+                break;
+            }
+            case OP_ROTATE_R: {
+                Value count = Pop();
+                Value value = Pop();
+                Push(UINT32_VAL(BitOps::RotateRight(AS_UINT32(value), AS_INT32(count))));
+                break;
+            }
+            case OP_BYTE_SWAP: {
+                Push(UINT32_VAL(BitOps::ByteSwap(AS_UINT32(Pop()))));
+                break;
+            }
+
                 // Logic
             case OP_NOT: {
                 Push(BOOL_VAL(IS_FALSEY(Pop())));
@@ -527,6 +863,7 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 if (IS_FALSEY(Peek())) {
                     m_Frame.Ip += offset;
                 }
+                PROFILE_EDGE();
                 break;
             }
 
@@ -535,6 +872,7 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 if (!IS_FALSEY(Peek())) {
                     m_Frame.Ip += offset;
                 }
+                PROFILE_EDGE();
                 break;
             }
 
@@ -544,6 +882,7 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 if (AS_INT32(Pop()) == AS_INT32(Pop())) {
                     m_Frame.Ip += offset;
                 }
+                PROFILE_EDGE();
                 break;
             }
 
@@ -551,6 +890,7 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
             case OP_LOOP: {
                 u16 offset = READ_UINT16();
                 m_Frame.Ip -= offset;
+                PROFILE_EDGE();
                 break;
             }
 
@@ -581,17 +921,85 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 u16 caseJump = READ_UINT16();
                 // Case jumps are stored as offsets. Jump is backwards.
                 m_Frame.Ip -= (caseJump + 2);
+                PROFILE_EDGE();
+                break;
+            }
+
+            case OP_SWITCH_SPARSE: {
+                const u16 tableEndOffset = READ_UINT16() - 2; // Skip the count to follow.
+                const int count          = READ_UINT16();
+                const int value          = AS_INT32(Pop());
+                /* JUMP TABLE
+                 * [low 0][high 0]  << keys
+                 * [...]
+                 * [low n][high n]
+                 * [default]
+                 * [case 0]         << jumps
+                 * [...]
+                 * [case n]
+                 * [JumpTableEnd]
+                 */
+                opCode_t *jumps = m_Frame.Ip + tableEndOffset - (count * 2);
+                opCode_t *keys  = jumps - 2 - (count * 8);
+                opCode_t *entry = jumps - 2; // Default
+
+                // The ranges are sorted, so binary search them.
+                int first = 0;
+                int last  = count - 1;
+                while (first <= last) {
+                    const int middle = (first + last) / 2;
+                    if (value < INT32_AT(keys + middle * 8)) {
+                        last = middle - 1;
+                    } else if (value > INT32_AT(keys + middle * 8 + 4)) {
+                        first = middle + 1;
+                    } else {
+                        entry = jumps + middle * 2;
+                        break;
+                    }
+                }
+
+                // Case jumps are stored as offsets. Jump is backwards.
+                m_Frame.Ip = entry - UINT16_AT(entry);
+                PROFILE_EDGE();
+                break;
+            }
 
+            case OP_SWITCH_HASH: {
+                const u16 tableEndOffset = READ_UINT16() - 5; // Skip the multiplier and bits to follow.
+                const u32 multiplier     = (u32)READ_INT32();
+                const u8 bits            = READ_BYTE();
+                const int value          = AS_INT32(Pop());
+                /* JUMP TABLE
+                 * [key 0]          << keys
+                 * [...]
+                 * [key n]
+                 * [default]
+                 * [slot 0]         << jumps
+                 * [...]
+                 * [slot n]
+                 * [JumpTableEnd]
+                 */
+                const int slots = 1 << bits;
+                opCode_t *jumps = m_Frame.Ip + tableEndOffset - (slots * 2);
+                opCode_t *keys  = jumps - 2 - (slots * 4);
+
+                // Each case has a slot of its own. Any other value that lands in it doesn't match the key.
+                const u32 slot  = ((u32)value * multiplier) >> (32 - bits);
+                opCode_t *entry = (INT32_AT(keys + slot * 4) == value) ? jumps + slot * 2 : jumps - 2;
+
+                // Case jumps are stored as offsets. Jump is backwards.
+                m_Frame.Ip = entry - UINT16_AT(entry);
+                PROFILE_EDGE();
                 break;
             }
 
             case OP_FRAME: {
                 // Push the stack to accommodate a call frame.
-                CallFrame *frame        = (CallFrame *)m_StackPtr;
+                StoredFrame *frame      = (StoredFrame *)m_StackPtr;
                 constexpr int frameSize = FRAME_SIZE;
                 m_StackPtr += frameSize;
                 // Store the current frame.
-                *frame            = m_Frame;
+                StoreFrame(frame);
                 m_Frame.Enclosing = frame;
                 break;
             }
@@ -603,6 +1011,21 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                     // A call error occurred.
                     return;
                 }
+                PROFILE_EDGE();
+                break;
+            }
+
+            case OP_TAIL_CALL: {
+                const int argCount = READ_BYTE();
+                // Slide the function and its arguments down over the current ones. The caller's stored frame is kept.
+                Value *func = m_Frame.Slots - 1;
+                memmove(func, m_StackPtr - argCount - 1, (argCount + 1) * sizeof(Value));
+                m_StackPtr = func + argCount + 1;
+                if (!Call(AS_FUNCTION(*func), argCount, true)) {
+                    // A call error occurred.
+                    return;
+                }
+                PROFILE_EDGE();
                 break;
             }
 
@@ -625,12 +1048,54 @@ void MecVm::Run(ScriptInfo *script, void *sysParam)
                 m_StackPtr = m_Frame.Slots - 1 - FRAME_SIZE;
 
                 // Roll back the stack frame
-                m_Frame = *m_Frame.Enclosing;
+                LoadFrame(m_Frame.Enclosing);
+
+                if (m_Frame.Ip == HOST_RETURN_IP) {
+                    // Function was invoked by the host, which takes the result off the stack.
+                    m_InvokeResult = result;
+                    SetStatus(vmEnd);
+                    return;
+                }
 
                 Push(result);
                 break;
             }
 
+            case OP_CHANNEL_SEND: {
+                Mailbox *channel = ResolveChannel(READ_BYTE());
+                if (channel == nullptr) {
+                    return;
+                }
+                Value value = Pop();
+                Push(BOOL_VAL(channel->Send(value)));
+                break;
+            }
+
+            case OP_CHANNEL_RECEIVE: {
+                Mailbox *channel = ResolveChannel(READ_BYTE());
+                if (channel == nullptr) {
+                    return;
+                }
+                Value value = INT32_VAL(0);
+                if (!channel->Receive(value)) {
+                    // Nothing to receive yet. Rewind to this instruction and suspend until the host resumes.
+                    m_Frame.Ip -= 2;
+                    SetStatus(vmWaiting);
+                    return;
+                }
+                Push(value);
+                break;
+            }
+
+            case OP_CHANNEL_COUNT: {
+                Mailbox *channel = ResolveChannel(READ_BYTE());
+                if (channel == nullptr) {
+                    return;
+                }
+                Push(UINT32_VAL(channel->Count()));
+                break;
+            }
+
             case OP_END: {
                 SetStatus(vmEnd);
                 return;
@@ -745,16 +1210,16 @@ void MecVm::Duplicate(const u32 count)
     }
 }
 
-bool MecVm::Call(const funcPtr_t functionId, const int argCount)
+bool MecVm::Call(const funcPtr_t functionId, const int argCount, const bool tailCall)
 {
     if (m_StackPtr >= STACK_END_PTR) {
         SetStatus(vmCallFrameOverflow);
         return false;
     }
 
-    // Store the return Ip to the previously stored frame
-    if (m_Frame.Enclosing != nullptr) {
-        m_Frame.Enclosing->Ip = m_Frame.Ip;
+    // Store the return Ip to the previously stored frame. A tail call returns to where the current function would have.
+    if (!tailCall && m_Frame.Enclosing != nullptr) {
+        m_Frame.Enclosing->Ip = (m_Frame.Ip == HOST_RETURN_IP) ? HOST_RETURN_OFFSET : (u32)(m_Frame.Ip - PGM_CODE);
     }
 
     // Update the new frame data
@@ -835,15 +1300,483 @@ void MecVm::Reset()
         m_Frame.Ip        = m_Script->Code.Data;
         m_Frame.Enclosing = nullptr;
     }
+
+    ResetTasks();
+}
+
+/*
+ * Call frames are stored on the stack as offsets so the stack can be moved. See Snapshot().
+ */
+void MecVm::StoreFrame(StoredFrame *frame) const
+{
+    frame->Enclosing = (m_Frame.Enclosing == nullptr) ? NO_FRAME_OFFSET : (u32)((Value *)m_Frame.Enclosing - PGM_GLOBALS);
+    frame->Ip        = (m_Frame.Ip == HOST_RETURN_IP) ? HOST_RETURN_OFFSET : (u32)(m_Frame.Ip - PGM_CODE);
+    frame->Slots     = (u32)(m_Frame.Slots - PGM_GLOBALS);
 }
 
+void MecVm::LoadFrame(const StoredFrame *frame)
+{
+    m_Frame.Enclosing = (frame->Enclosing == NO_FRAME_OFFSET) ? nullptr : (StoredFrame *)(PGM_GLOBALS + frame->Enclosing);
+    m_Frame.Ip        = (frame->Ip == HOST_RETURN_OFFSET) ? HOST_RETURN_IP : PGM_CODE + frame->Ip;
+    m_Frame.Slots     = PGM_GLOBALS + frame->Slots;
+}
+
+/*
+ * Calls a script function from the host on an initialised script.
+ * The script must have finished running its top level code.
+ */
+bool MecVm::InvokeFunction(const funcPtr_t function, const Value *args, const int argCount, Value *result)
+{
+    if (m_Script == nullptr || m_Status != vmEnd) {
+        return false;
+    }
+
+    m_Status       = vmOk;
+    m_InvokeStatus = vmOk;
+
+    // Store a frame that returns to the host.
+    Value *stackBase   = m_StackPtr;
+    StoredFrame *frame = (StoredFrame *)m_StackPtr;
+    m_Frame.Ip         = HOST_RETURN_IP;
+    PushN(FRAME_SIZE);
+    if (m_Status != vmOk) {
+        return false;
+    }
+    StoreFrame(frame);
+    m_Frame.Enclosing = frame;
+
+    // Function followed by its arguments, the same as a call from script.
+    Push(FUNCTION_VAL(function));
+    for (int i = 0; i < argCount; ++i) {
+        Push(args[i]);
+    }
+
+    if (m_Status != vmOk || !Call(function, argCount)) {
+        // Unwind so the script can still be used.
+        m_InvokeStatus = (m_Status == vmOk) ? vmError : m_Status;
+        LoadFrame(frame);
+        m_StackPtr = stackBase;
+        m_Status   = vmEnd;
+        return false;
+    }
+
+#ifdef VM_PROFILE
+    if (m_Profile != nullptr) {
+        RecordEdge(PROFILE_FROM_HOST, (u32)(m_Frame.Ip - PGM_CODE));
+    }
+#endif
+
+    Execute();
+    EndInvoke();
+
+    // Errors, or the function is waiting on a channel and has to be resumed.
+    if (m_InvokeStatus != vmEnd) {
+        return false;
+    }
+
+    if (result != nullptr) {
+        *result = m_InvokeResult;
+    }
+
+    return true;
+}
+
+/* Finds the frame stored by InvokeFunction() that returns to the host, if a function invoked by the host is still running. */
+MecVm::StoredFrame *MecVm::FindHostFrame() const
+{
+    StoredFrame *frame = m_Frame.Enclosing;
+    while (frame != nullptr) {
+        if (frame->Ip == HOST_RETURN_OFFSET) {
+            return frame;
+        }
+        frame = (frame->Enclosing == NO_FRAME_OFFSET) ? nullptr : (StoredFrame *)(PGM_GLOBALS + frame->Enclosing);
+    }
+
+    return nullptr;
+}
+
+/*
+ * Records how a function invoked by the host finished.
+ * On an error the stack is unwound back to where it was before the call, and the script is left ready to be called again.
+ */
+void MecVm::EndInvoke()
+{
+    m_InvokeStatus = m_Status;
+
+    if (m_Status != vmEnd && m_Status != vmWaiting && m_Status != vmStop) {
+        UnwindInvoke();
+    }
+}
+
+/* Abandons a function invoked by the host, putting the stack back to where it was before the call. */
+void MecVm::UnwindInvoke()
+{
+    StoredFrame *frame = FindHostFrame();
+    if (frame == nullptr) {
+        return;
+    }
+
+    LoadFrame(frame);
+    m_StackPtr = (Value *)frame;
+    m_Status   = vmEnd;
+}
+
+VmStatus MecVm::GetInvokeStatus() const
+{
+    return m_InvokeStatus;
+}
+
+/* Return value of the last invoked function to return. Used to read the result of a call finished by Resume(). */
+Value MecVm::GetInvokeResult() const
+{
+    return m_InvokeResult;
+}
+
+/*
+ * Finds an exported function by name. Resolve exports once and keep the result to avoid repeated lookups.
+ */
+const ExportInfo *MecVm::FindExport(const ScriptInfo *const script, const char *name)
+{
+    if (script == nullptr || name == nullptr || script->Exports.Entries == nullptr) {
+        return nullptr;
+    }
+
+    for (u32 i = 0; i < script->Exports.Count; ++i) {
+        const char *exportName = ResolveString(script, script->Exports.Entries[i].Name);
+        if (exportName != nullptr && strcmp(exportName, name) == 0) {
+            return &script->Exports.Entries[i];
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Calls an exported function with the given arguments on an initialised script.
+ * The return value, if any, is written to result.
+ */
+bool MecVm::Invoke(const ExportInfo *function, const Value *args, const int argCount, Value *result)
+{
+    if (function == nullptr || argCount != function->ArgCount || (argCount > 0 && args == nullptr)) {
+        return false;
+    }
+
+    return InvokeFunction(function->Function, args, argCount, result);
+}
+
+/*
+ * Resolves a global by name to a handle for direct access. Names of class instance members are "instance.member".
+ */
+bool MecVm::ResolveSymbol(const ScriptInfo *const script, const char *name, SymbolHandle &outHandle)
+{
+    outHandle = {};
+
+    if (script == nullptr || name == nullptr || script->Symbols.Entries == nullptr) {
+        return false;
+    }
+
+    for (u32 i = 0; i < script->Symbols.Count; ++i) {
+        const SymbolInfo &symbol = script->Symbols.Entries[i];
+        const char *symbolName   = ResolveString(script, symbol.Name);
+        if (symbolName == nullptr || strcmp(symbolName, name) != 0) {
+            continue;
+        }
+
+        if ((u32)(symbol.Slot + symbol.Size) > script->Globals.Count) {
+            return false;
+        }
+
+        outHandle.Slot = script->Globals.Values + symbol.Slot;
+        outHandle.Type = (DataType)symbol.Type;
+        outHandle.Size = symbol.Size;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Size in bytes of a snapshot of the current state.
+ */
+u32 MecVm::SnapshotSize() const
+{
+    if (m_Script == nullptr || m_StackPtr == nullptr) {
+        return 0;
+    }
+
+    return sizeof(SnapshotHeader) + (u32)((m_StackPtr - PGM_GLOBALS) * sizeof(Value));
+}
+
+/*
+ * Writes the globals, stack, call frames and instruction pointer of an idle or suspended script to a buffer.
+ * Returns the number of bytes written, or 0 if the VM is running or the buffer is too small.
+ */
+u32 MecVm::Snapshot(u8 *buffer, const u32 bufferSize) const
+{
+    if (buffer == nullptr || m_Script == nullptr) {
+        return 0;
+    }
+
+    if (m_Status != vmEnd && m_Status != vmWaiting && m_Status != vmStop) {
+        return 0;
+    }
+
+    const u32 size = SnapshotSize();
+    if (size == 0 || size > bufferSize) {
+        return 0;
+    }
+
+    SnapshotHeader header;
+    header.Magic         = SNAPSHOT_MAGIC;
+    header.ImageChecksum = m_Script->CheckSum;
+    header.GlobalsCount  = m_Script->Globals.Count;
+    header.StackOffset   = (u32)(m_StackPtr - PGM_GLOBALS);
+    header.Status        = (u32)m_Status;
+    StoreFrame(&header.Frame);
+
+    memcpy(buffer, &header, sizeof(SnapshotHeader));
+    memcpy(buffer + sizeof(SnapshotHeader), PGM_GLOBALS, size - sizeof(SnapshotHeader));
+
+    return size;
+}
+
+/*
+ * Restores a snapshot onto a script decoded from the same image.
+ * The script's stack can be anywhere, but must be large enough to hold the snapshot.
+ */
+bool MecVm::Restore(ScriptInfo *script, const u8 *snapshot, const u32 snapshotSize, void *sysParam)
+{
+    if (script == nullptr || snapshot == nullptr || snapshotSize < sizeof(SnapshotHeader)) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, snapshot, sizeof(SnapshotHeader));
+
+    if (header.Magic != SNAPSHOT_MAGIC || header.ImageChecksum != script->CheckSum || header.GlobalsCount != script->Globals.Count) {
+        return false;
+    }
+
+    const u32 memorySize = snapshotSize - sizeof(SnapshotHeader);
+    const u32 stackSize  = (u32)((script->Stack.Values + script->Stack.Count - script->Globals.Values) * sizeof(Value));
+    if (memorySize != header.StackOffset * sizeof(Value) || memorySize > stackSize) {
+        return false;
+    }
+
+    m_Script          = script;
+    m_SystemParameter = sysParam;
+
+    Reset();
+
+    memcpy(PGM_GLOBALS, snapshot + sizeof(SnapshotHeader), memorySize);
+
+    m_StackPtr = PGM_GLOBALS + header.StackOffset;
+    LoadFrame(&header.Frame);
+    m_Status = (VmStatus)header.Status;
+
+    return true;
+}
+
+void MecVm::SetClockFunction(ClockFunction clock)
+{
+    ClockSource = clock;
+}
+
+u32 MecVm::ReadClock()
+{
+    return ClockSource ? ClockSource() : 0;
+}
+
+void MecVm::ResetTasks()
+{
+    m_TaskCount = 0;
+    if (m_Script == nullptr || m_Script->Tasks.Entries == nullptr) {
+        return;
+    }
+
+    m_TaskCount = std::min(m_Script->Tasks.Count, (u32)MAX_PERIODIC_TASKS);
+    for (u32 i = 0; i < m_TaskCount; ++i) {
+        TaskState &task  = m_Tasks[i];
+        task.Function    = m_Script->Tasks.Entries[i].Function;
+        task.Period      = m_Script->Tasks.Entries[i].Period * 1000;
+        task.NextRelease = 0;
+        task.Stats       = {};
+    }
+    m_TasksReleased = false;
+}
+
+/*
+ * Releases every task for the first time, once the script has initialised.
+ * Done when the first task is run rather than on reset, so the script's start up time doesn't count as jitter.
+ */
+void MecVm::ReleaseTasks()
+{
+    if (m_TasksReleased) {
+        return;
+    }
+
+    const u32 now = ReadClock();
+    for (u32 i = 0; i < m_TaskCount; ++i) {
+        m_Tasks[i].NextRelease = now;
+    }
+    m_TasksReleased = true;
+}
+
+void MecVm::ResetTaskStats()
+{
+    for (u32 i = 0; i < m_TaskCount; ++i) {
+        m_Tasks[i].Stats = {};
+    }
+}
+
+u32 MecVm::GetTaskCount() const
+{
+    return m_TaskCount;
+}
+
+const TaskStats *MecVm::GetTaskStats(const u32 index) const
+{
+    return (index < m_TaskCount) ? &m_Tasks[index].Stats : nullptr;
+}
+
+void MecVm::RecordHistogram(u32 *histogram, const u32 value)
+{
+    const u32 bucket = std::min((u32)std::bit_width(value), (u32)(TASK_HISTOGRAM_BUCKETS - 1));
+    ++histogram[bucket];
+}
+
+/*
+ * Runs a periodic task now, regardless of its schedule.
+ * For hosts that call tasks from their own timer.
+ */
+/*
+ * Runs a task once. Tasks have to finish in one go: a task that stops on an error or waits on a channel is unwound and
+ * counted as a failure, leaving the script idle for the others. Returns false if the task didn't finish.
+ */
+bool MecVm::RunTask(const u32 index)
+{
+    // Tasks can only run while the script is idle.
+    if (index >= m_TaskCount || m_Status != vmEnd) {
+        return false;
+    }
+
+    ReleaseTasks();
+
+    TaskState &task = m_Tasks[index];
+
+    const u32 start  = ReadClock();
+    const u32 jitter = (s32)(start - task.NextRelease) > 0 ? start - task.NextRelease : 0;
+
+    const bool ok = InvokeFunction(task.Function, nullptr, 0, nullptr);
+
+    // Stopped by the host part way through. Resume() finishes the run, which isn't timed.
+    if (m_InvokeStatus == vmStop) {
+        return false;
+    }
+
+    const u32 end    = ReadClock();
+    TaskStats &stats = task.Stats;
+
+    if (ok) {
+        const u32 execTime = end - start;
+        ++stats.Runs;
+        stats.MaxExecutionTime = std::max(stats.MaxExecutionTime, execTime);
+        stats.MaxJitter        = std::max(stats.MaxJitter, jitter);
+        RecordHistogram(stats.ExecutionTime, execTime);
+        RecordHistogram(stats.Jitter, jitter);
+    } else {
+        if (m_InvokeStatus == vmWaiting) {
+            UnwindInvoke();
+        }
+        ++stats.Failures;
+        stats.LastFailure = m_InvokeStatus;
+    }
+
+    // Schedule the next release. Any periods missed while running are skipped and count as an overrun.
+    task.NextRelease += task.Period;
+    if ((s32)(end - task.NextRelease) > 0) {
+        if (ok) {
+            ++stats.Overruns;
+        }
+        while ((s32)(end - task.NextRelease) > 0) {
+            task.NextRelease += task.Period;
+        }
+    }
+
+    return ok;
+}
+
+/*
+ * Runs any periodic tasks that are due. Returns the number of tasks run.
+ */
+u32 MecVm::PollTasks()
+{
+    u32 count = 0;
+
+    if (m_Status == vmEnd) {
+        ReleaseTasks();
+    }
+
+    for (u32 i = 0; i < m_TaskCount; ++i) {
+        // Tasks can only run while the script is idle.
+        if (m_Status != vmEnd) {
+            break;
+        }
+
+        if ((s32)(ReadClock() - m_Tasks[i].NextRelease) >= 0) {
+            RunTask(i);
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+#ifdef VM_PROFILE
+void MecVm::SetProfileTable(ProfileEntry *table, const u32 capacity)
+{
+    m_Profile         = (capacity > 0) ? table : nullptr;
+    m_ProfileCapacity = capacity;
+
+    for (u32 i = 0; m_Profile != nullptr && i < capacity; ++i) {
+        m_Profile[i] = {};
+    }
+}
+
+void MecVm::RecordEdge(const u32 from, const u32 to)
+{
+    // Open addressing. Entries are never removed, so the first empty slot ends the search.
+    u32 slot = ((from * 0x9E3779B1u) ^ to) % m_ProfileCapacity;
+    for (u32 probe = 0; probe < m_ProfileCapacity; ++probe) {
+        ProfileEntry &entry = m_Profile[slot];
+        if (entry.Count == 0) {
+            entry.From  = from;
+            entry.To    = to;
+            entry.Count = 1;
+            return;
+        }
+        if (entry.From == from && entry.To == to) {
+            if (entry.Count < UINT32_MAX) {
+                ++entry.Count;
+            }
+            return;
+        }
+        slot = (slot + 1 == m_ProfileCapacity) ? 0 : slot + 1;
+    }
+}
+#endif
+
 u32 MecVm::DecodeScript(u8 *data, const u32 dataSize, u8 *stack, const u32 stackSize, ScriptInfo *script)
 {
-    if (data == nullptr || dataSize == 0 || stack == nullptr || stackSize == 0 || script == nullptr)
+    if (data == nullptr || dataSize < sizeof(ScriptBinaryHeader) || stack == nullptr || stackSize == 0 || script == nullptr)
         return 0;
 
     const ScriptBinaryHeader *header = (ScriptBinaryHeader *)data;
 
+    // The code would decode as different instructions.
+    if (header->LangVersionMajor != LANG_VERSION_MAJOR || header->LangVersionMinor != LANG_VERSION_MINOR)
+        return 0;
+
     // Validate the header
     if (header->HeaderSize != sizeof(ScriptBinaryHeader))
         return 0;
@@ -871,11 +1804,19 @@ u32 MecVm::DecodeScript(u8 *data, const u32 dataSize, u8 *stack, const u32 stack
     script->Constants.Values = (Value *)(data + header->ConstantsPos);
     script->Constants.Count  = ((header->StringsPos - header->ConstantsPos) / sizeof(Value));
     script->Strings.Values   = (Value *)(data + header->StringsPos);
-    script->Strings.Count    = ((header->TotalSize - header->StringsPos) / sizeof(Value));
+    script->Strings.Count    = ((header->TasksPos - header->StringsPos) / sizeof(Value));
     script->Globals.Values   = (Value *)stack;
     script->Globals.Count    = (header->GlobalsSize / sizeof(Value));
     script->Stack.Values     = (Value *)(stack + stackOffset);
     script->Stack.Count      = (stackSize - stackOffset) / sizeof(Value);
+    script->Tasks.Entries    = (TaskInfo *)(data + header->TasksPos);
+    script->Tasks.Count      = ((header->ExportsPos - header->TasksPos) / sizeof(TaskInfo));
+    script->Exports.Entries  = (ExportInfo *)(data + header->ExportsPos);
+    script->Exports.Count    = ((header->SymbolsPos - header->ExportsPos) / sizeof(ExportInfo));
+    script->Symbols.Entries  = (SymbolInfo *)(data + header->SymbolsPos);
+    script->Symbols.Count    = ((header->TotalSize - header->SymbolsPos) / sizeof(SymbolInfo));
+
+    script->CheckSum         = header->CheckSum;
 
     if ((header->Flags & CompileOptions::coEmbeddedFileName) && script->Strings.Count > 0) {
         script->FileName = (char *)&script->Strings.Values[0];
@@ -899,6 +1840,22 @@ NativeFunc MecVm::ResolveNativeFunction(const NativeFuncId funcId, const u8 argC
     return nullptr;
 }
 
+void MecVm::SetChannelTable(Mailbox *channels, const u32 count)
+{
+    ChannelTable = channels;
+    ChannelCount = (channels == nullptr) ? 0 : count;
+}
+
+Mailbox *MecVm::ResolveChannel(const u8 channelId)
+{
+    if (ChannelTable == nullptr || channelId >= ChannelCount) {
+        SetStatus(vmChannelNotResolved);
+        return nullptr;
+    }
+
+    return &ChannelTable[channelId];
+}
+
 Value *MecVm::ResolvePointer(const VmPointer &pointer)
 {
     switch (pointer.Scope) {
@@ -943,6 +1900,9 @@ void MecVm::IncrementValue(const VmPointer &pointer, bool push)
         case dtUint32:
             ++value->UInt;
             break;
+        case dtFixed:
+            value->Int = FixedPoint::Add(value->Int, FIXED_ONE, false);
+            break;
         case dtFloat:
             ++value->Float;
             break;
@@ -978,6 +1938,9 @@ void MecVm::DecrementValue(const VmPointer &pointer, bool push)
         case dtUint32:
             --value->UInt;
             break;
+        case dtFixed:
+            value->Int = FixedPoint::Subtract(value->Int, FIXED_ONE, false);
+            break;
         case dtFloat:
             --value->Float;
             break;
@@ -5,8 +5,11 @@
 #ifndef MECVM_H
 #define MECVM_H
 
+#include "FixedPoint.h"
 #include "Instructions.h"
+#include "Mailbox.h"
 #include "NativeFunctions.h"
+#include "Profile.h"
 #include "ScriptInfo.h"
 #include "Value.h"
 
@@ -20,6 +23,7 @@ enum VmStatus {
     vmOk = 0,
     vmStop,
     vmEnd,
+    vmWaiting,
 
     // Errors
     vmError,
@@ -33,6 +37,90 @@ enum VmStatus {
     vmCalledNonCallable,
     vmCallFrameOverflow,
     vmNativeFunctionNotResolved,
+    vmChannelNotResolved,
+    vmIndexOutOfBounds,
+    vmDivideByZero,
+    vmDivideOverflow, // INT32_MIN / -1
+};
+
+/* Host clock used to time periodic tasks. Returns microseconds. */
+typedef u32 (*ClockFunction)();
+
+/*
+ * Periodic task telemetry.
+ * Histogram bucket n counts times in the range [2^(n-1), 2^n) microseconds, bucket 0 counts 0.
+ */
+struct TaskStats {
+    u32 Runs;
+    u32 Overruns; // Finished after the start of the next period
+    u32 Failures; // Stopped on an error or waited on a channel, and was unwound without finishing
+    VmStatus LastFailure;
+    u32 MaxExecutionTime;
+    u32 MaxJitter;
+    u32 ExecutionTime[TASK_HISTOGRAM_BUCKETS];
+    u32 Jitter[TASK_HISTOGRAM_BUCKETS]; // Start time relative to the scheduled release
+};
+
+/*
+ * Direct access to a script global, resolved once by name with MecVm::ResolveSymbol().
+ * Reads and writes go straight to the global's stack slot with no lookup.
+ */
+struct SymbolHandle {
+    Value *Slot   = nullptr;
+    DataType Type = dtNone;
+    u16 Size      = 0; // Stack values
+
+    bool IsValid() const
+    {
+        return Slot != nullptr;
+    }
+
+    s32 ReadInt(const u32 index = 0) const
+    {
+        const Value &value = Slot[index];
+        switch (Type) {
+            case dtBool:
+                return value.Bool;
+            case dtInt8:
+                return value.Char;
+            case dtUint8:
+                return value.Byte;
+            case dtInt16:
+                return value.Short;
+            case dtUint16:
+                return value.UShort;
+            case dtFixed:
+                return FixedPoint::ToInt(value.Int);
+            case dtFloat:
+                return (s32)value.Float;
+            default:
+                return value.Int;
+        }
+    }
+
+    float ReadFloat(const u32 index = 0) const
+    {
+        if (Type == dtFixed)
+            return FixedPoint::ToFloat(Slot[index].Int);
+
+        return (Type == dtFloat) ? Slot[index].Float : (float)ReadInt(index);
+    }
+
+    void WriteInt(const s32 value, const u32 index = 0) const
+    {
+        if (Type == dtFixed)
+            Slot[index] = INT32_VAL(FixedPoint::FromInt(value));
+        else
+            Slot[index] = (Type == dtFloat) ? FLOAT_VAL(value) : INT32_VAL(value);
+    }
+
+    void WriteFloat(const float value, const u32 index = 0) const
+    {
+        if (Type == dtFixed)
+            Slot[index] = INT32_VAL(FixedPoint::FromFloat(value));
+        else
+            Slot[index] = (Type == dtFloat) ? FLOAT_VAL(value) : INT32_VAL(value);
+    }
 };
 
 /* Virtual Machine */
@@ -45,14 +133,52 @@ class MecVm
     static u32 DecodeScript(u8 *data, const u32 dataSize, u8 *stack, const u32 stackSize, ScriptInfo *script);
 
     void Run(ScriptInfo *script, void *sysParam = nullptr);
+    void Resume();
     void Stop();
 
     void Reset();
 
+    /* Snapshots - Capture an idle or suspended script and restore it onto a fresh context from the same image. */
+    u32 SnapshotSize() const;
+    u32 Snapshot(u8 *buffer, u32 bufferSize) const;
+    bool Restore(ScriptInfo *script, const u8 *snapshot, u32 snapshotSize, void *sysParam = nullptr);
+
+    /*
+     * Exported Functions - Run() the script once to initialise it, then resolve and invoke exports as needed.
+     * A call left waiting on a channel is finished by Resume(). A call that stops on an error is unwound so the script can be called again.
+     * GetInvokeStatus() is vmEnd once the last call has returned, vmWaiting or vmStop until it is resumed, otherwise the error it stopped on.
+     */
+    static const ExportInfo *FindExport(const ScriptInfo *const script, const char *name);
+    bool Invoke(const ExportInfo *function, const Value *args = nullptr, int argCount = 0, Value *result = nullptr);
+    VmStatus GetInvokeStatus() const;
+    Value GetInvokeResult() const;
+
+    /* Global Symbols - Requires the script to be compiled with a symbol table. */
+    static bool ResolveSymbol(const ScriptInfo *const script, const char *name, SymbolHandle &outHandle);
+
+    /* Periodic Tasks - Run() the script once to initialise it, then call PollTasks() regularly. */
+    u32 GetTaskCount() const;
+    bool RunTask(u32 index);
+    u32 PollTasks();
+    const TaskStats *GetTaskStats(u32 index) const;
+    void ResetTaskStats();
+
+#ifdef VM_PROFILE
+    /*
+     * Execution Profile - Records the branches taken and functions called into a table owned by the host.
+     * Edges that don't fit once the table is full are dropped. Pass nullptr to stop recording.
+     */
+    void SetProfileTable(ProfileEntry *table, u32 capacity);
+#endif
+
     VmStatus GetStatus();
 
     static void SetNativeFunctionResolver(ResolverFunction resolver);
 
+    static void SetChannelTable(Mailbox *channels, u32 count);
+
+    static void SetClockFunction(ClockFunction clock);
+
     static void GetLanguageVersion(u8 &major, u8 &minor);
 
     static const char *ResolveString(const ScriptInfo *const script, const u32 index);
@@ -60,12 +186,30 @@ class MecVm
   private:
     volatile VmStatus m_Status = vmOk;
 
+    /* Call frame stored on the stack by OP_FRAME. Uses offsets so the stack can be snapshotted and moved. */
+    struct StoredFrame {
+        u32 Enclosing; // Stack offset from the start of the globals
+        u32 Ip;        // Code offset
+        u32 Slots;     // Stack offset from the start of the globals
+    };
+
+    static_assert(sizeof(StoredFrame) % sizeof(Value) == 0, "Stored call frames must fill whole stack values.");
+
     struct CallFrame {
-        CallFrame *Enclosing;
+        StoredFrame *Enclosing;
         opCode_t *Ip;
         Value *Slots;
     };
 
+    struct SnapshotHeader {
+        u32 Magic;
+        u32 ImageChecksum;
+        u32 GlobalsCount;
+        u32 StackOffset; // Stack pointer offset from the start of the globals, in stack values.
+        StoredFrame Frame;
+        u32 Status;
+    };
+
     void *m_SystemParameter = nullptr;
     Value *m_StackPtr       = nullptr;
     Value *m_StackEnd       = nullptr;
@@ -74,6 +218,38 @@ class MecVm
 
     CallFrame m_Frame;
 
+    VmStatus m_InvokeStatus = vmEnd;
+    Value m_InvokeResult    = INT32_VAL(0);
+
+    struct TaskState {
+        funcPtr_t Function;
+        u32 Period; // Microseconds
+        u32 NextRelease;
+        TaskStats Stats;
+    };
+
+    TaskState m_Tasks[MAX_PERIODIC_TASKS];
+    u32 m_TaskCount      = 0;
+    bool m_TasksReleased = false;
+
+#ifdef VM_PROFILE
+    ProfileEntry *m_Profile = nullptr;
+    u32 m_ProfileCapacity   = 0;
+
+    void RecordEdge(u32 from, u32 to);
+#endif
+
+    void Execute();
+    void StoreFrame(StoredFrame *frame) const;
+    void LoadFrame(const StoredFrame *frame);
+    bool InvokeFunction(funcPtr_t function, const Value *args, int argCount, Value *result);
+    StoredFrame *FindHostFrame() const;
+    void EndInvoke();
+    void UnwindInvoke();
+    void ResetTasks();
+    void ReleaseTasks();
+    static void RecordHistogram(u32 *histogram, u32 value);
+
     void Push(const Value &data);
     void PushN(u32 num);
     Value Pop();
@@ -84,12 +260,19 @@ class MecVm
     Value *ResolvePointer(const VmPointer &pointer);
     void IncrementValue(const VmPointer &pointer, bool push);
     void DecrementValue(const VmPointer &pointer, bool push);
-    bool Call(funcPtr_t functionId, int argCount);
+    bool Call(funcPtr_t functionId, int argCount, bool tailCall = false);
     bool CallNative(NativeFuncId nativeId, int argCount);
 
     static ResolverFunction FunctionResolver;
     NativeFunc ResolveNativeFunction(NativeFuncId funcId, u8 argCount);
 
+    static ClockFunction ClockSource;
+    static u32 ReadClock();
+
+    static Mailbox *ChannelTable;
+    static u32 ChannelCount;
+    Mailbox *ResolveChannel(u8 channelId);
+
     VmStatus SetStatus(VmStatus status);
 };
 
@@ -0,0 +1,207 @@
+#ifndef VECTORMATH_H_
+#define VECTORMATH_H_
+
+#include "Value.h"
+#include "VmConfig.h"
+
+#if defined(VM_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define VECTOR_SSE
+#elif defined(VM_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define VECTOR_NEON
+#endif
+
+#define VECTOR_LANES 4
+
+/*
+ * Maths on the vector types. A vector is 2 to 4 consecutive stack values holding floats.
+ * Every vector is loaded into 4 lanes so the same instructions work for each size. Lanes past the last component are 0 and are never stored,
+ * so nothing past the end of a vector is read or written.
+ */
+namespace VectorMath
+{
+#if defined(VECTOR_SSE)
+    typedef __m128 Lanes;
+
+    inline Lanes Load(const Value *vector, const int count)
+    {
+        if (count == VECTOR_LANES) {
+            return _mm_loadu_ps(&vector[0].Float);
+        }
+
+        float padded[VECTOR_LANES] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < count; ++i) {
+            padded[i] = vector[i].Float;
+        }
+        return _mm_loadu_ps(padded);
+    }
+
+    inline void Store(Value *vector, const Lanes lanes, const int count)
+    {
+        if (count == VECTOR_LANES) {
+            _mm_storeu_ps(&vector[0].Float, lanes);
+            return;
+        }
+
+        float padded[VECTOR_LANES];
+        _mm_storeu_ps(padded, lanes);
+        for (int i = 0; i < count; ++i) {
+            vector[i].Float = padded[i];
+        }
+    }
+
+    inline Lanes Splat(const float value)
+    {
+        return _mm_set1_ps(value);
+    }
+
+    inline Lanes Add(const Lanes lhs, const Lanes rhs)
+    {
+        return _mm_add_ps(lhs, rhs);
+    }
+
+    inline Lanes Subtract(const Lanes lhs, const Lanes rhs)
+    {
+        return _mm_sub_ps(lhs, rhs);
+    }
+
+    inline Lanes Multiply(const Lanes lhs, const Lanes rhs)
+    {
+        return _mm_mul_ps(lhs, rhs);
+    }
+
+    inline float Sum(const Lanes lanes)
+    {
+        __m128 shuffled = _mm_shuffle_ps(lanes, lanes, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 sums     = _mm_add_ps(lanes, shuffled);
+        shuffled        = _mm_movehl_ps(shuffled, sums);
+        sums            = _mm_add_ss(sums, shuffled);
+        return _mm_cvtss_f32(sums);
+    }
+#elif defined(VECTOR_NEON)
+    typedef float32x4_t Lanes;
+
+    inline Lanes Load(const Value *vector, const int count)
+    {
+        if (count == VECTOR_LANES) {
+            return vld1q_f32(&vector[0].Float);
+        }
+
+        float padded[VECTOR_LANES] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < count; ++i) {
+            padded[i] = vector[i].Float;
+        }
+        return vld1q_f32(padded);
+    }
+
+    inline void Store(Value *vector, const Lanes lanes, const int count)
+    {
+        if (count == VECTOR_LANES) {
+            vst1q_f32(&vector[0].Float, lanes);
+            return;
+        }
+
+        float padded[VECTOR_LANES];
+        vst1q_f32(padded, lanes);
+        for (int i = 0; i < count; ++i) {
+            vector[i].Float = padded[i];
+        }
+    }
+
+    inline Lanes Splat(const float value)
+    {
+        return vdupq_n_f32(value);
+    }
+
+    inline Lanes Add(const Lanes lhs, const Lanes rhs)
+    {
+        return vaddq_f32(lhs, rhs);
+    }
+
+    inline Lanes Subtract(const Lanes lhs, const Lanes rhs)
+    {
+        return vsubq_f32(lhs, rhs);
+    }
+
+    inline Lanes Multiply(const Lanes lhs, const Lanes rhs)
+    {
+        return vmulq_f32(lhs, rhs);
+    }
+
+    inline float Sum(const Lanes lanes)
+    {
+#if defined(__aarch64__)
+        return vaddvq_f32(lanes);
+#else
+        float32x2_t sums = vadd_f32(vget_low_f32(lanes), vget_high_f32(lanes));
+        sums             = vpadd_f32(sums, sums);
+        return vget_lane_f32(sums, 0);
+#endif
+    }
+#else
+    struct Lanes {
+        float Values[VECTOR_LANES];
+    };
+
+    inline Lanes Load(const Value *vector, const int count)
+    {
+        Lanes lanes = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+        for (int i = 0; i < count; ++i) {
+            lanes.Values[i] = vector[i].Float;
+        }
+        return lanes;
+    }
+
+    inline void Store(Value *vector, const Lanes &lanes, const int count)
+    {
+        for (int i = 0; i < count; ++i) {
+            vector[i].Float = lanes.Values[i];
+        }
+    }
+
+    inline Lanes Splat(const float value)
+    {
+        return { { value, value, value, value } };
+    }
+
+    inline Lanes Add(const Lanes &lhs, const Lanes &rhs)
+    {
+        Lanes result;
+        for (int i = 0; i < VECTOR_LANES; ++i) {
+            result.Values[i] = lhs.Values[i] + rhs.Values[i];
+        }
+        return result;
+    }
+
+    inline Lanes Subtract(const Lanes &lhs, const Lanes &rhs)
+    {
+        Lanes result;
+        for (int i = 0; i < VECTOR_LANES; ++i) {
+            result.Values[i] = lhs.Values[i] - rhs.Values[i];
+        }
+        return result;
+    }
+
+    inline Lanes Multiply(const Lanes &lhs, const Lanes &rhs)
+    {
+        Lanes result;
+        for (int i = 0; i < VECTOR_LANES; ++i) {
+            result.Values[i] = lhs.Values[i] * rhs.Values[i];
+        }
+        return result;
+    }
+
+    inline float Sum(const Lanes &lanes)
+    {
+        return (lanes.Values[0] + lanes.Values[1]) + (lanes.Values[2] + lanes.Values[3]);
+    }
+#endif
+
+    inline float Dot(const Value *lhs, const Value *rhs, const int count)
+    {
+        return Sum(Multiply(Load(lhs, count), Load(rhs, count)));
+    }
+}
+
+#endif // VECTORMATH_H_